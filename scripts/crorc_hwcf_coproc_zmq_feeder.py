@@ -5,9 +5,54 @@ import sys
 import os
 import re
 import subprocess
+import struct
 import time
 import zmq
 
+# binary protocol, see src/crorc_hwcf_coproc_protocol.hpp
+HWCF_PROTOCOL_MAGIC = 0x46435748
+HWCF_PROTOCOL_VERSION = 1
+HWCF_ACK_PORT_OFFSET = 100
+HWCF_EVENT_PORT_OFFSET = 200
+HWCF_CMD_FILES = 1
+HWCF_CMD_STOP = 3
+HWCF_CMD_EVENTS = 4
+HWCF_ACK_STOP = 3
+HWCF_ACK_ERROR = 4
+
+def cmdHeader(cmdtype, seq, count):
+  return struct.pack('<IHHII', HWCF_PROTOCOL_MAGIC, HWCF_PROTOCOL_VERSION,
+                     cmdtype, seq, count)
+
+def sendBatch(skt, seq, batch):
+  body = ''.join(["%s\0%s\0%s\0" % entry for entry in batch])
+  skt.send_multipart([cmdHeader(HWCF_CMD_FILES, seq, len(batch)), body])
+
+# in-band mode: send the DDL data, remember where to store the clusters
+def sendEvents(skt, seq, batch, outnames):
+  frames = [cmdHeader(HWCF_CMD_EVENTS, seq, len(batch))]
+  for index in range(len(batch)):
+    (infilename, outfilename, reffilename) = batch[index]
+    with open(infilename, 'rb') as f:
+      frames.append(f.read())
+    outnames[(seq, index)] = outfilename
+  skt.send_multipart(frames)
+
+def receiveResults(poller, results, outnames, received, timeout):
+  for (sock, event) in poller.poll(timeout):
+    patch = results.index(sock)
+    (hdr, data) = sock.recv_multipart()
+    (magic, version, cmdtype, seq, index, flags, size) = \
+        struct.unpack('<IHHIIII', hdr)
+    outfilename = outnames[patch].pop((seq, index), "")
+    if flags:
+      sys.stderr.write("WARN: patch %d: HWCF flags 0x%x for %s\n"
+                       % (patch, flags, outfilename))
+    if outfilename:
+      with open(outfilename, 'wb') as f:
+        f.write(data)
+    received[patch] += 1
+
 def ddlid2patch( DDL_ID ):
   if DDL_ID >= 768 and DDL_ID < 840:
     patch = (DDL_ID % 2)
@@ -34,6 +79,9 @@ parser.add_argument('-i', '--indir', help='directory containing raw DDL source f
 parser.add_argument('-r', '--refdir', help='directory containing emulated HWCLUST1 reference files', type=str)
 parser.add_argument('-o', '--outdir', help='output directory', type=str)
 parser.add_argument('-p', '--patch', help='TPC patch', type=int, default=-1)
+parser.add_argument('-b', '--batch', help='send files in binary batches of this size instead of one text message per file', type=int, default=0)
+parser.add_argument('-e', '--inband', help='send the DDL data instead of file names and receive the clusters, written to --outdir if given (requires --batch)', action='store_true')
+parser.add_argument('-w', '--wait', help='wait for the STOP acknowledgement of each patch (requires --batch)', action='store_true')
 
 #parser.add_argument('-m', '--mapdir', help='directory containing emulated HWCLUST1 reference files', required=True, type=str)
 args = parser.parse_args()
@@ -66,7 +114,41 @@ else:
   skt[ch].connect("tcp://localhost:%d" % (5555 + ch))
 
 
+# connect before sending, acknowledgements without a peer are dropped
+acks = [None]*6
+if args.batch > 0 and args.wait:
+  for i in range(6):
+    if skt[i]:
+      acks[i] = ctx.socket(zmq.PULL)
+      acks[i].connect("tcp://localhost:%d" % (5555 + i + HWCF_ACK_PORT_OFFSET))
+
+# in-band results, connected before sending as well
+results = [None]*6
+outnames = [{} for i in range(6)]
+received = [0]*6
+poller = zmq.Poller()
+if args.batch > 0 and args.inband:
+  for i in range(6):
+    if skt[i]:
+      results[i] = ctx.socket(zmq.PULL)
+      results[i].connect("tcp://localhost:%d" % (5555 + i + HWCF_EVENT_PORT_OFFSET))
+      poller.register(results[i], zmq.POLLIN)
+
 pushcount = [0]*6
+batches = [[] for i in range(6)]
+seq = [0]*6
+
+def flushBatch(patch):
+  if args.inband:
+    # keep reading results while the coproc does not accept more events
+    while not skt[patch].poll(0, zmq.POLLOUT):
+      receiveResults(poller, results, outnames, received, 100)
+    sendEvents(skt[patch], seq[patch], batches[patch], outnames[patch])
+    receiveResults(poller, results, outnames, received, 0)
+  else:
+    sendBatch(skt[patch], seq[patch], batches[patch])
+  seq[patch] += 1
+  batches[patch] = []
 
 for root, dirnames, filenames in os.walk(args.indir):
   for filename in filenames:
@@ -94,13 +176,49 @@ for root, dirnames, filenames in os.walk(args.indir):
     #entry = { 'ddlid':ddlid, 'infile':infilename, 'reffile':reffilename, 'outfile':outfilename }
     #ddlfiles[patchid].append(entry)
     if (skt[patchid]):
-      skt[patchid].send("%s;%s;%s" % (infilename, outfilename, reffilename))
+      if args.batch > 0:
+        batches[patchid].append((infilename, outfilename, reffilename))
+        if len(batches[patchid]) >= args.batch:
+          flushBatch(patchid)
+      else:
+        skt[patchid].send("%s;%s;%s" % (infilename, outfilename, reffilename))
       pushcount[patchid] += 1
 
 for i in range(6):
   if (skt[i]):
-    skt[i].send(";;;");
+    if args.batch > 0:
+      if batches[i]:
+        flushBatch(i)
+      skt[i].send(cmdHeader(HWCF_CMD_STOP, seq[i], 0))
+    else:
+      skt[i].send(";;;");
   print "Patch %d: Pushed %d files." % (i, pushcount[i])
+
+if args.batch > 0 and args.inband:
+  while sum(received) < sum(pushcount):
+    before = sum(received)
+    receiveResults(poller, results, outnames, received, 10000)
+    if sum(received) == before:
+      sys.stderr.write("ERROR: no results for 10s, %d of %d received\n"
+                       % (before, sum(pushcount)))
+      break
+  for i in range(6):
+    if results[i]:
+      print "Patch %d: Received %d results." % (i, received[i])
+
+if args.batch > 0 and args.wait:
+  for i in range(6):
+    if not acks[i]:
+      continue
+    while True:
+      (magic, version, acktype, ackseq, count, nin, nout) = \
+          struct.unpack('<IHHIIQQ', acks[i].recv())
+      if acktype == HWCF_ACK_ERROR:
+        sys.stderr.write("ERROR: patch %d rejected batch %d after %d files\n"
+                         % (i, ackseq, count))
+      if acktype == HWCF_ACK_STOP:
+        print "Patch %d: done, %d inputs, %d outputs." % (i, nin, nout)
+        break
 exit(0)
 
 #procs = []
@@ -0,0 +1,261 @@
+/**
+ *  capture_file.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "capture_file.hh"
+
+#define CAPTURE_ALIGN 8
+#define CAPTURE_PAD(x)                                                         \
+  (((x) + CAPTURE_ALIGN - 1) & ~((uint64_t)CAPTURE_ALIGN - 1))
+
+static uint64_t now_us() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/****************** capture_writer *******************/
+capture_writer::capture_writer(std::string basename, uint32_t device,
+                               uint32_t channel, uint64_t segmentSizeLimit,
+                               dioEngine_t engine) {
+  m_basename = basename;
+  m_device = device;
+  m_channel = channel;
+  m_segment_size_limit = segmentSizeLimit;
+  m_segment = 0;
+  m_open = false;
+  m_offset = 0;
+  try {
+    m_out = new dio_writer(engine);
+  }
+  catch (int e) {
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+  if (openSegment() != 0) {
+    delete m_out;
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+}
+
+capture_writer::~capture_writer() {
+  close();
+  delete m_out;
+}
+
+int capture_writer::writeEvent(librorc::EventDescriptor *report,
+                               const void *event, uint64_t size,
+                               uint64_t eventNumber) {
+  if (!m_open) {
+    errno = EBADF;
+    return -1;
+  }
+  uint64_t recordSize = sizeof(captureRecordHeader_t) + CAPTURE_PAD(size);
+  uint64_t indexSize =
+      (m_index.size() + 1) * sizeof(uint64_t) + sizeof(captureIndexTrailer_t);
+  if (!m_index.empty() &&
+      m_offset + recordSize + indexSize > m_segment_size_limit) {
+    if (closeSegment() != 0) {
+      return -1;
+    }
+    m_segment++;
+    if (openSegment() != 0) {
+      return -1;
+    }
+  }
+
+  captureRecordHeader_t hdr;
+  hdr.magic = CAPTURE_RECORD_MAGIC;
+  hdr.headerSize = sizeof(captureRecordHeader_t);
+  hdr.eventNumber = eventNumber;
+  hdr.timestamp = now_us();
+  hdr.size = size;
+  memcpy(&hdr.report, report, sizeof(librorc::EventDescriptor));
+
+  static const uint8_t padding[CAPTURE_ALIGN] = { 0 };
+  struct iovec iov[3];
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = (void *)event;
+  iov[1].iov_len = size;
+  iov[2].iov_base = (void *)padding;
+  iov[2].iov_len = CAPTURE_PAD(size) - size;
+  if (m_out->append(iov, 3) != 0) {
+    return -1;
+  }
+  m_index.push_back(m_offset);
+  m_offset += recordSize;
+  return 0;
+}
+
+int capture_writer::close() {
+  if (!m_open) {
+    return 0;
+  }
+  return closeSegment();
+}
+
+int capture_writer::openSegment() {
+  char filename[4096];
+  snprintf(filename, sizeof(filename), "%s_%04u%s", m_basename.c_str(),
+           m_segment, CAPTURE_FILE_SUFFIX);
+  if (m_out->open(filename) != 0) {
+    return -1;
+  }
+  m_open = true;
+  captureFileHeader_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CAPTURE_FILE_MAGIC;
+  hdr.version = CAPTURE_VERSION;
+  hdr.headerSize = sizeof(captureFileHeader_t);
+  hdr.device = m_device;
+  hdr.channel = m_channel;
+  hdr.segment = m_segment;
+  hdr.createTime = now_us();
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  if (m_out->append(&iov, 1) != 0) {
+    m_out->close();
+    m_open = false;
+    return -1;
+  }
+  m_offset = sizeof(hdr);
+  m_index.clear();
+  return 0;
+}
+
+int capture_writer::closeSegment() {
+  captureIndexTrailer_t trailer;
+  trailer.magic = CAPTURE_INDEX_MAGIC;
+  trailer.reserved = 0;
+  trailer.nEntries = m_index.size();
+  trailer.indexOffset = m_offset;
+  struct iovec iov[2];
+  iov[0].iov_base = m_index.data();
+  iov[0].iov_len = m_index.size() * sizeof(uint64_t);
+  iov[1].iov_base = &trailer;
+  iov[1].iov_len = sizeof(trailer);
+  int ret = m_out->append(iov, 2);
+  if (m_out->close() != 0) {
+    ret = -1;
+  }
+  m_open = false;
+  m_index.clear();
+  return ret;
+}
+
+/****************** capture_reader *******************/
+capture_reader::capture_reader(const char *filename) {
+  m_map = NULL;
+  m_size = 0;
+  m_header = NULL;
+  m_has_index = false;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+  struct stat fd_stat;
+  if (fstat(fd, &fd_stat) == -1 ||
+      (uint64_t)fd_stat.st_size < sizeof(captureFileHeader_t)) {
+    ::close(fd);
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+  m_size = fd_stat.st_size;
+  void *map = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+  m_map = (uint8_t *)map;
+  m_header = (const captureFileHeader_t *)m_map;
+  if (m_header->magic != CAPTURE_FILE_MAGIC ||
+      m_header->version != CAPTURE_VERSION) {
+    munmap(m_map, m_size);
+    throw CAPTURE_CONSTRUCTOR_FAILED;
+  }
+
+  // use the trailing index if the segment was closed properly
+  if (m_size >= m_header->headerSize + sizeof(captureIndexTrailer_t)) {
+    const captureIndexTrailer_t *trailer =
+        (const captureIndexTrailer_t *)(m_map + m_size -
+                                        sizeof(captureIndexTrailer_t));
+    if (trailer->magic == CAPTURE_INDEX_MAGIC &&
+        trailer->indexOffset + trailer->nEntries * sizeof(uint64_t) +
+                sizeof(captureIndexTrailer_t) ==
+            m_size) {
+      const uint64_t *index = (const uint64_t *)(m_map + trailer->indexOffset);
+      m_index.assign(index, index + trailer->nEntries);
+      m_has_index = true;
+    }
+  }
+  if (!m_has_index) {
+    scanRecords();
+  }
+}
+
+capture_reader::~capture_reader() {
+  if (m_map) {
+    munmap(m_map, m_size);
+  }
+}
+
+int capture_reader::getEvent(uint64_t idx,
+                             const captureRecordHeader_t **record,
+                             const uint32_t **event) {
+  if (idx >= m_index.size()) {
+    errno = ERANGE;
+    return -1;
+  }
+  uint64_t offset = m_index[idx];
+  const captureRecordHeader_t *hdr =
+      (const captureRecordHeader_t *)(m_map + offset);
+  if (offset + sizeof(captureRecordHeader_t) > m_size ||
+      hdr->magic != CAPTURE_RECORD_MAGIC ||
+      offset + hdr->headerSize + hdr->size > m_size) {
+    errno = EILSEQ;
+    return -1;
+  }
+  *record = hdr;
+  *event = (const uint32_t *)(m_map + offset + hdr->headerSize);
+  return 0;
+}
+
+void capture_reader::scanRecords() {
+  // walk all complete records of an unterminated segment
+  uint64_t offset = m_header->headerSize;
+  while (offset + sizeof(captureRecordHeader_t) <= m_size) {
+    const captureRecordHeader_t *hdr =
+        (const captureRecordHeader_t *)(m_map + offset);
+    if (hdr->magic != CAPTURE_RECORD_MAGIC) {
+      break;
+    }
+    uint64_t next = offset + hdr->headerSize + CAPTURE_PAD(hdr->size);
+    if (next > m_size) {
+      break;
+    }
+    m_index.push_back(offset);
+    offset = next;
+  }
+}
@@ -0,0 +1,127 @@
+/**
+ *  capture_file.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef CAPTURE_FILE_HH
+#define CAPTURE_FILE_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <librorc.h>
+#include "dio_writer.hh"
+
+/**
+ * Capture segment layout:
+ *   captureFileHeader_t
+ *   N x { captureRecordHeader_t, event data padded to 8 bytes }
+ *   N x uint64_t file offset of each record header
+ *   captureIndexTrailer_t
+ * The index and trailer are written when a segment is closed. Segments
+ * without a valid trailer can still be read sequentially.
+ **/
+#define CAPTURE_FILE_MAGIC 0x50435243   // "CRCP"
+#define CAPTURE_RECORD_MAGIC 0x56455243 // "CREV"
+#define CAPTURE_INDEX_MAGIC 0x58495243  // "CRIX"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FILE_SUFFIX ".crc"
+
+#define CAPTURE_CONSTRUCTOR_FAILED 1
+
+struct captureFileHeader_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t device;
+  uint32_t channel;
+  uint32_t segment;
+  uint32_t reserved;
+  uint64_t createTime; // us since epoch
+};
+
+struct captureRecordHeader_t {
+  uint32_t magic;
+  uint32_t headerSize;
+  uint64_t eventNumber;
+  uint64_t timestamp; // us since epoch
+  uint64_t size;      // event data in bytes, without padding
+  librorc::EventDescriptor report;
+};
+
+struct captureIndexTrailer_t {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t nEntries;
+  uint64_t indexOffset;
+};
+
+class capture_writer {
+public:
+  /**
+   * Segments are written to <basename>_<segment>.crc. A new segment is
+   * started as soon as the next record would exceed segmentSizeLimit bytes.
+   * engine selects how the data is written to disk, see dio_writer.
+   **/
+  capture_writer(std::string basename, uint32_t device, uint32_t channel,
+                 uint64_t segmentSizeLimit,
+                 dioEngine_t engine = DIO_ENGINE_BUFFERED);
+  ~capture_writer();
+
+  int writeEvent(librorc::EventDescriptor *report, const void *event,
+                 uint64_t size, uint64_t eventNumber);
+  int close();
+  uint32_t segment() { return m_segment; }
+  dioEngine_t engine() { return m_out->engine(); }
+
+private:
+  int openSegment();
+  int closeSegment();
+
+  std::string m_basename;
+  uint32_t m_device;
+  uint32_t m_channel;
+  uint64_t m_segment_size_limit;
+  uint32_t m_segment;
+  dio_writer *m_out;
+  bool m_open;
+  uint64_t m_offset;
+  std::vector<uint64_t> m_index;
+};
+
+class capture_reader {
+public:
+  capture_reader(const char *filename);
+  ~capture_reader();
+
+  uint64_t numEvents() { return m_index.size(); }
+  const captureFileHeader_t *fileHeader() { return m_header; }
+  bool hasIndex() { return m_has_index; }
+  /** returns 0 on success or -1 with errno set **/
+  int getEvent(uint64_t idx, const captureRecordHeader_t **record,
+               const uint32_t **event);
+
+private:
+  void scanRecords();
+
+  uint8_t *m_map;
+  uint64_t m_size;
+  const captureFileHeader_t *m_header;
+  std::vector<uint64_t> m_index;
+  bool m_has_index;
+};
+
+#endif // CAPTURE_FILE_HH
@@ -0,0 +1,58 @@
+/**
+ *  cdh.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef CDH_HH
+#define CDH_HH
+
+#include <stdint.h>
+
+/**
+ * Common Data Header (v2) as found in the first 8 DWs of each DDL event:
+ * DW0: block length, 0xffffffff if unused
+ * DW1: [31:24] format version, [11:0] event ID 1 (bunch crossing)
+ * DW2: [23:0] event ID 2 (orbit)
+ * DW3: [23:0] participating sub-detectors
+ * DW4: [27:12] status & error bits, [11:0] mini event ID
+ * DW5-7: trigger classes and ROI
+ **/
+#define CDH_SIZE_DW 8
+#define CDH_EVENT_ID_BITS 36
+#define CDH_EVENT_ID_MASK ((((uint64_t)1) << CDH_EVENT_ID_BITS) - 1)
+
+struct cdhInfo_t {
+  uint32_t version;
+  uint32_t bunchCrossing;
+  uint32_t orbit;
+  uint32_t miniEventId;
+  uint32_t status;
+};
+
+inline void parseCdh(const uint32_t *event, cdhInfo_t *cdh) {
+  cdh->version = event[1] >> 24;
+  cdh->bunchCrossing = event[1] & 0xfff;
+  cdh->orbit = event[2] & 0xffffff;
+  cdh->miniEventId = event[4] & 0xfff;
+  cdh->status = (event[4] >> 12) & 0xffff;
+}
+
+/** 36 bit event ID composed of orbit and bunch crossing **/
+inline uint64_t cdhEventId(const uint32_t *event) {
+  return ((uint64_t)(event[2] & 0xffffff) << 12) | (event[1] & 0xfff);
+}
+
+#endif // CDH_HH
@@ -0,0 +1,121 @@
+/**
+ *  crorc_capture_convert.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "capture_file.hh"
+
+#define HELP_TEXT                                                              \
+  "crorc_capture_convert parameters: [options] file.crc [file.crc ...]\n"     \
+  " -o [dir]      write dev<N>_ch<M>_<count>.ddl/.report files to dir\n"      \
+  " -l            list the events of each capture segment\n"
+
+int writeFile(const char *filename, const void *data, size_t size) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t ret = write(fd, data, size);
+  close(fd);
+  if (ret != (ssize_t)size) {
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  char *outdir = NULL;
+  bool list = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:lh")) != -1) {
+    switch (opt) {
+    case 'o':
+      outdir = optarg;
+      break;
+    case 'l':
+      list = true;
+      break;
+    case 'h':
+      printf(HELP_TEXT);
+      return 0;
+    default:
+      printf(HELP_TEXT);
+      return -1;
+    }
+  }
+
+  if (optind >= argc) {
+    printf("ERROR: no capture file given!\n");
+    printf(HELP_TEXT);
+    return -1;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    capture_reader *reader = NULL;
+    try {
+      reader = new capture_reader(argv[i]);
+    }
+    catch (int e) {
+      printf("ERROR: failed to open capture file %s\n", argv[i]);
+      return -1;
+    }
+    const captureFileHeader_t *hdr = reader->fileHeader();
+    printf("%s: device %u, channel %u, segment %u, %lu events%s\n", argv[i],
+           hdr->device, hdr->channel, hdr->segment, reader->numEvents(),
+           reader->hasIndex() ? "" : " (no index, segment not closed)");
+
+    for (uint64_t idx = 0; idx < reader->numEvents(); idx++) {
+      const captureRecordHeader_t *rec;
+      const uint32_t *event;
+      if (reader->getEvent(idx, &rec, &event) != 0) {
+        printf("ERROR: corrupted record %lu in %s\n", idx, argv[i]);
+        delete reader;
+        return -1;
+      }
+      if (list) {
+        printf("  #%lu: size %lu bytes, timestamp %lu us, offset 0x%lx\n",
+               rec->eventNumber, rec->size, rec->timestamp,
+               (uint64_t)rec->report.offset);
+      }
+      if (outdir) {
+        char filename[4096];
+        snprintf(filename, sizeof(filename), "%s/dev%u_ch%u_%lu.ddl", outdir,
+                 hdr->device, hdr->channel, rec->eventNumber);
+        int ret = writeFile(filename, event, rec->size);
+        if (ret == 0) {
+          snprintf(filename, sizeof(filename), "%s/dev%u_ch%u_%lu.report",
+                   outdir, hdr->device, hdr->channel, rec->eventNumber);
+          ret = writeFile(filename, &rec->report,
+                          sizeof(librorc::EventDescriptor));
+        }
+        if (ret != 0) {
+          perror("Failed to write event");
+          delete reader;
+          return -1;
+        }
+      }
+    }
+    delete reader;
+  }
+  return 0;
+}
@@ -73,6 +73,8 @@ void ChannelReadout(int chId) { //, struct rdoInfo_t &rdoInfo) {
 
   librorc::event_stream *es = NULL;
   librorc::patterngenerator *pg = NULL;
+  struct timeval tStart, tInit;
+  gettimeofday(&tStart, NULL);
 
   try {
     es =
@@ -100,7 +102,10 @@ void ChannelReadout(int chId) { //, struct rdoInfo_t &rdoInfo) {
     es->m_link->setDataSourcePatternGenerator();
     es->m_link->setChannelActive(1);
     pg->enable();
-    cout << "Ch" << chId << " init done." << endl;
+    gettimeofday(&tInit, NULL);
+    cout << "Ch" << chId << " init done in "
+         << librorc::gettimeofdayDiff(tStart, tInit) * 1000.0 << " ms."
+         << endl;
   }
   catch (int e) {
     cout << "Channel " << chId
@@ -112,7 +117,7 @@ void ChannelReadout(int chId) { //, struct rdoInfo_t &rdoInfo) {
     }
   }
 
-  while (!done) {
+  while (!done && es) {
     librorc::EventDescriptor *report = NULL;
     const uint32_t *event = NULL;
     uint64_t librorcReference;
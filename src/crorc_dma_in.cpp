@@ -21,10 +21,16 @@
 #include <signal.h>
 #include <getopt.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include "event_checker.hh"
 #include "file_writer.hh"
 #include "fcf_mapping.hh"
+#include "thread_utils.hh"
 
 using namespace std;
 
@@ -35,7 +41,20 @@ using namespace std;
 #define EBUFSIZE (((uint64_t)1) << 19)
 #endif
 
-bool done = false;
+/** upper limit for the number of events drained per loop iteration **/
+#define MAX_BATCH_SIZE 4096
+
+/** maximum number of channels read out by a single process **/
+#define MAX_CHANNELS 12
+
+/** number of channels set up concurrently **/
+#define SETUP_THREADS 4
+
+/** status line interval and polling period of the main thread **/
+#define STATUS_INTERVAL_US 1000000
+#define STATUS_POLL_US 100000
+
+std::atomic<bool> done(false);
 enum t_dataSource {
   DS_PG,
   DS_DDR3,
@@ -44,21 +63,99 @@ enum t_dataSource {
   DS_RAW
 };
 
+/** readout settings shared by all channels **/
+struct rdoConfig_t {
+  t_dataSource dataSource;
+  uint32_t pgSize;
+  uint32_t pciPacketSize;
+  char *tpcRowMappingFile;
+  char *mappingCacheDir;
+  bool mappingOnlyChanged;
+  uint32_t tpcPatch;
+  uint32_t rcuVersion;
+  uint32_t batchSize;
+  ecPattern_t pattern;
+  uint32_t patternStart;
+};
+
+/**
+ * per-channel counters, written by the readout thread and read by the status
+ * printer. Each set occupies its own cache line.
+ **/
+struct alignas(CACHELINE_SIZE) rdoCounters_t {
+  std::atomic<uint64_t> n_events;
+  std::atomic<uint64_t> bytes_received;
+  std::atomic<uint64_t> error_count;
+  std::atomic<uint64_t> n_batches;
+  std::atomic<uint64_t> id_gaps;
+  std::atomic<uint64_t> id_duplicates;
+  std::atomic<uint64_t> id_out_of_order;
+  std::atomic<uint32_t> error_mask;
+  std::atomic<int64_t> pattern_mismatch;
+  std::atomic<int64_t> ref_mismatch_first;
+  std::atomic<int64_t> ref_mismatch_last;
+  std::atomic<uint64_t> ref_mismatch_count;
+};
+
+/** snapshot of the summed up counters **/
+struct rdoStatus_t {
+  uint64_t n_events;
+  uint64_t bytes_received;
+  uint64_t error_count;
+  uint64_t n_batches;
+  uint64_t id_gaps;
+  uint64_t id_duplicates;
+  uint64_t id_out_of_order;
+};
+
+struct rdoChannel_t {
+  uint32_t channelId;
+  librorc::event_stream *es;
+  event_checker *checker;
+  file_writer *dumper;
+  uint32_t checkMask;
+};
+
+rdoCounters_t rdoCounters[MAX_CHANNELS];
+
+/** arguments of the concurrent setupChannel() calls **/
+struct rdoSetup_t {
+  librorc::device *dev;
+  librorc::bar *bar;
+  rdoConfig_t *cfg;
+  rdoChannel_t *channels;
+  int64_t *setupTime_us;
+  /** per channel, printed in channel order after all setups returned **/
+  string *errors;
+};
+
 // Prototypes
 bool fileExists(char *filename);
-int configureDdl(librorc::event_stream *es, t_dataSource dataSource);
+librorc::event_stream *setupChannel(librorc::device *dev, librorc::bar *bar,
+                                    uint32_t channelId, rdoConfig_t *cfg,
+                                    ostream &err);
+void setupChannelAt(uint32_t index, void *arg);
+void teardownChannel(librorc::event_stream *es, rdoConfig_t *cfg);
+void channelReadout(rdoChannel_t *ch, rdoConfig_t *cfg, rdoCounters_t *cnt);
+int configureDdl(librorc::event_stream *es, t_dataSource dataSource,
+                 ostream &err);
 void unconfigureDdl(librorc::event_stream *es, t_dataSource dataSource);
 int configureFcf(librorc::event_stream *es, char *tpcRowMappingFile,
-                 uint32_t patch, uint32_t rcuVersion);
+                 uint32_t patch, uint32_t rcuVersion, char *mappingCacheDir,
+                 bool mappingOnlyChanged, ostream &err);
 void unconfigureFcf(librorc::event_stream *es);
-int configurePg(librorc::event_stream *es, uint32_t pgSize);
+int configurePg(librorc::event_stream *es, uint32_t pgSize,
+                ecPattern_t pattern);
 void unconfigurePg(librorc::event_stream *es);
 int configureRawReadout(librorc::event_stream *es);
 void unconfigureRawReadout(librorc::event_stream *es);
 int64_t timediff_us(struct timeval from, struct timeval to);
-void printStatusLine(librorc::ChannelStatus *cs_cur,
-                     librorc::ChannelStatus *cs_last, int64_t tdiff_us,
-                     int error_mask);
+void sumCounters(uint32_t nChannels, rdoStatus_t *sts);
+void printDumpStats(uint32_t channelId, file_writer *dumper);
+void printRecorderStats(uint32_t channelId, flight_recorder *recorder);
+void printStatusLine(const char *label, rdoStatus_t *sts_cur,
+                     rdoStatus_t *sts_last, int64_t tdiff_us, int error_mask,
+                     uint32_t batchSize);
 
 // Signal handler
 void abort_handler(int s) {
@@ -71,17 +168,40 @@ void abort_handler(int s) {
 }
 
 int main(int argc, char *argv[]) {
-  char logdir[] = "/tmp";
+  char defaultLogdir[] = "/tmp";
+  char *logdir = defaultLogdir;
+  uint32_t recorderContext = 0;
+  bool useRecorder = false;
+  uint32_t recorderEventKB = FR_DEFAULT_MAX_EVENT_SIZE >> 10;
+  uint64_t dumpLimit = 100;
   int deviceId = 0;
-  int channelId = 0;
-  t_dataSource dataSource = DS_DIU;
-  char *refFile = NULL;
-  char *tpcRowMappingFile = NULL;
-  uint32_t pgSize = 0x1000;
+  const char *channelList = "0";
+  char *cpuList = NULL;
+  uint32_t setupThreads = SETUP_THREADS;
+  vector<char *> refFiles;
+  ecRefMatch_t refMatchMode = EC_REF_ROUND_ROBIN;
+  bool idCheck = false;
+  bool eoeCheck = false;
+  uint32_t eoeMarker = 0;
   char *dumpDir = NULL;
-  uint32_t tpcPatch = 0;
-  uint32_t rcuVersion = 1;
-  uint32_t pciPacketSize = 0;
+  uint32_t dumpQueueDepth = 0;
+  fileWriterPolicy_t dumpPolicy = FW_POLICY_BLOCK;
+  uint64_t captureSegmentMB = 0;
+  dioEngine_t dumpEngine = DIO_ENGINE_BUFFERED;
+  rdoConfig_t cfg;
+  cfg.dataSource = DS_DIU;
+  cfg.pgSize = 0x1000;
+  cfg.pciPacketSize = 0;
+  cfg.tpcRowMappingFile = NULL;
+  cfg.mappingCacheDir = NULL;
+  cfg.mappingOnlyChanged = false;
+  cfg.tpcPatch = 0;
+  cfg.rcuVersion = 1;
+  cfg.batchSize = 1;
+  cfg.pattern = EC_PATTERN_INC;
+  cfg.patternStart = 0;
+  bool patternCheck = false;
+  bool patternCheckOff = false;
 
   static struct option long_options[] = {
     { "device", required_argument, 0, 'n' },
@@ -90,48 +210,145 @@ int main(int argc, char *argv[]) {
     { "size", required_argument, 0, 'S' },
     { "source", required_argument, 0, 's' },
     { "fcfmapping", required_argument, 0, 'm' },
+    { "mappingcache", required_argument, 0, 'k' },
+    { "mappingreadback", no_argument, 0, 'K' },
     { "tpcpatch", required_argument, 0, 'p' },
     { "dump", required_argument, 0, 'd' },
     { "reffile", required_argument, 0, 'f' },
     { "rcuversion", required_argument, 0, 'r' },
     { "packetsize", required_argument, 0, 'P' },
+    { "batch", required_argument, 0, 'b' },
+    { "cpus", required_argument, 0, 'a' },
+    { "setupthreads", required_argument, 0, 'j' },
+    { "dumpqueue", required_argument, 0, 'Q' },
+    { "dumpdrop", no_argument, 0, 'D' },
+    { "capture", required_argument, 0, 'C' },
+    { "dumpengine", required_argument, 0, 'E' },
+    { "pattern", required_argument, 0, 'T' },
+    { "refdigest", no_argument, 0, 'G' },
+    { "idcheck", no_argument, 0, 'I' },
+    { "eoe", required_argument, 0, 'e' },
+    { "logdir", required_argument, 0, 'L' },
+    { "recorder", required_argument, 0, 'R' },
+    { "recordersize", required_argument, 0, 'Z' },
+    { "dumplimit", required_argument, 0, 'l' },
     { "help", no_argument, 0, 'h' },
     { 0, 0, 0, 0 }
   };
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "n:c:f:S:s:m:p:hd:r:P:", long_options,
-                            NULL)) != -1) {
+  while ((opt = getopt_long(
+              argc, argv, "n:c:f:S:s:m:k:Kp:hd:r:P:b:a:j:Q:DC:E:T:GIe:L:R:Z:l:",
+              long_options, NULL)) != -1) {
     switch (opt) {
     case 'n':
       deviceId = strtoul(optarg, NULL, 0);
       break;
     case 'c':
-      channelId = strtoul(optarg, NULL, 0);
+      channelList = optarg;
       break;
     case 'f':
-      refFile = optarg;
+      refFiles.push_back(optarg);
+      break;
+    case 'G':
+      refMatchMode = EC_REF_DIGEST;
+      break;
+    case 'I':
+      idCheck = true;
+      break;
+    case 'e':
+      eoeCheck = true;
+      eoeMarker = strtoul(optarg, NULL, 0);
+      break;
+    case 'L':
+      logdir = optarg;
+      break;
+    case 'R':
+      useRecorder = true;
+      recorderContext = strtoul(optarg, NULL, 0);
+      break;
+    case 'Z':
+      recorderEventKB = strtoul(optarg, NULL, 0);
+      break;
+    case 'l':
+      dumpLimit = strtoull(optarg, NULL, 0);
       break;
     case 'p':
-      tpcPatch = strtoul(optarg, NULL, 0);
+      cfg.tpcPatch = strtoul(optarg, NULL, 0);
       break;
     case 'r':
-      rcuVersion = strtoul(optarg, NULL, 0);
+      cfg.rcuVersion = strtoul(optarg, NULL, 0);
       break;
     case 'P':
-      pciPacketSize = strtoul(optarg, NULL, 0);
+      cfg.pciPacketSize = strtoul(optarg, NULL, 0);
+      break;
+    case 'b':
+      cfg.batchSize = strtoul(optarg, NULL, 0);
+      break;
+    case 'a':
+      cpuList = optarg;
+      break;
+    case 'j':
+      setupThreads = strtoul(optarg, NULL, 0);
+      break;
+    case 'Q':
+      dumpQueueDepth = strtoul(optarg, NULL, 0);
+      break;
+    case 'D':
+      dumpPolicy = FW_POLICY_DROP;
+      break;
+    case 'C':
+      captureSegmentMB = strtoul(optarg, NULL, 0);
+      break;
+    case 'E':
+      if (dio_writer::parseEngine(optarg, &dumpEngine) != 0) {
+        cerr << "Invalid dump engine: " << optarg << endl
+             << "Supported values: buffered, direct, uring." << endl;
+        return -1;
+      }
+      break;
+    case 'T':
+      patternCheck = true;
+      if (strcmp(optarg, "none") == 0) {
+        patternCheckOff = true;
+      } else if (strcmp(optarg, "inc") == 0) {
+        cfg.pattern = EC_PATTERN_INC;
+      } else if (strcmp(optarg, "dec") == 0) {
+        cfg.pattern = EC_PATTERN_DEC;
+      } else if (strcmp(optarg, "const") == 0) {
+        cfg.pattern = EC_PATTERN_CONST;
+        cfg.patternStart = 0;
+      } else if (strncmp(optarg, "const:", 6) == 0) {
+        char *end = NULL;
+        errno = 0;
+        unsigned long value = strtoul(optarg + 6, &end, 0);
+        if (end == optarg + 6 || *end != '\0' || errno != 0 ||
+            value > UINT32_MAX) {
+          cerr << "Invalid constant pattern value: " << optarg + 6 << endl;
+          return -1;
+        }
+        cfg.pattern = EC_PATTERN_CONST;
+        cfg.patternStart = value;
+      } else if (strcmp(optarg, "prbs") == 0) {
+        cfg.pattern = EC_PATTERN_PRBS;
+      } else {
+        cerr << "Invalid pattern: " << optarg << endl
+             << "Supported values: inc, dec, const, const:<value>, prbs, "
+             << "none." << endl;
+        return -1;
+      }
       break;
     case 's':
       if (strcmp(optarg, "diu") == 0) {
-        dataSource = DS_DIU;
+        cfg.dataSource = DS_DIU;
       } else if (strcmp(optarg, "siu") == 0) {
-        dataSource = DS_SIU;
+        cfg.dataSource = DS_SIU;
       } else if (strcmp(optarg, "pg") == 0) {
-        dataSource = DS_PG;
+        cfg.dataSource = DS_PG;
       } else if (strcmp(optarg, "ddr3") == 0) {
-        dataSource = DS_DDR3;
+        cfg.dataSource = DS_DDR3;
       } else if (strcmp(optarg, "raw") == 0) {
-        dataSource = DS_RAW;
+        cfg.dataSource = DS_RAW;
       } else {
         cerr << "Invalid data source: " << optarg << endl
              << "Supported values: diu, pg, ddr3, raw." << endl;
@@ -139,10 +356,16 @@ int main(int argc, char *argv[]) {
       }
       break;
     case 'S':
-      pgSize = strtoul(optarg, NULL, 0);
+      cfg.pgSize = strtoul(optarg, NULL, 0);
       break;
     case 'm':
-      tpcRowMappingFile = optarg;
+      cfg.tpcRowMappingFile = optarg;
+      break;
+    case 'k':
+      cfg.mappingCacheDir = optarg;
+      break;
+    case 'K':
+      cfg.mappingOnlyChanged = true;
       break;
     case 'd':
       dumpDir = optarg;
@@ -164,6 +387,9 @@ int main(int argc, char *argv[]) {
         }
         cout << endl;
       }
+      cout << "With --source pg the payload is checked against --pattern "
+           << "(default: inc)," << endl
+           << "--pattern none skips the check." << endl;
     }
       return 0;
       break;
@@ -173,49 +399,305 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (refFile && !fileExists(refFile)) {
-    perror("Failed to access reference file: ");
+  vector<uint32_t> channelIds;
+  if (parseIdList(channelList, channelIds) != 0 || channelIds.empty() ||
+      channelIds.size() > MAX_CHANNELS) {
+    cerr << "Invalid channel list: " << channelList
+         << ", expected e.g. 0, 0-11 or 0,2,4" << endl;
+    return -1;
+  }
+
+  vector<uint32_t> cpuIds;
+  if (cpuList && parseIdList(cpuList, cpuIds) != 0) {
+    cerr << "Invalid CPU list: " << cpuList << endl;
     return -1;
   }
 
-  if (tpcRowMappingFile && !fileExists(tpcRowMappingFile)) {
+  for (size_t i = 0; i < refFiles.size(); i++) {
+    if (!fileExists(refFiles[i])) {
+      perror("Failed to access reference file: ");
+      return -1;
+    }
+  }
+
+  if (cfg.tpcRowMappingFile && !fileExists(cfg.tpcRowMappingFile)) {
     perror("Failed to access FCF mapping file: ");
     return -1;
   }
 
-  if (rcuVersion < 1 || rcuVersion > 2) {
-    cerr << "Invalid RCU version: " << rcuVersion << ", allowed values: 1, 2"
-         << endl;
+  if (cfg.rcuVersion < 1 || cfg.rcuVersion > 2) {
+    cerr << "Invalid RCU version: " << cfg.rcuVersion
+         << ", allowed values: 1, 2" << endl;
     return -1;
   }
 
-  file_writer *dumper = NULL;
-  if (dumpDir) {
-    try {
-      dumper = new file_writer(dumpDir, deviceId, channelId, 100);
+  if (cfg.batchSize < 1 || cfg.batchSize > MAX_BATCH_SIZE) {
+    cerr << "Invalid batch size: " << cfg.batchSize << ", allowed range: 1.."
+         << MAX_BATCH_SIZE << endl;
+    return -1;
+  }
+
+  // the pattern generator payload is verified unless disabled with -T none
+  if (cfg.dataSource == DS_PG) {
+    patternCheck = true;
+    if (cfg.pattern != EC_PATTERN_INC && cfg.pattern != EC_PATTERN_DEC) {
+      cerr << "Invalid pattern for the pattern generator, "
+           << "supported values: inc, dec." << endl;
+      return -1;
     }
-    catch (int e) {
-      cerr << "ERROR initializing file writer: " << e << endl;
+  }
+  if (patternCheckOff) {
+    patternCheck = false;
+  }
+
+  librorc::device *dev = NULL;
+  librorc::bar *bar = NULL;
+  try {
+    dev = new librorc::device(deviceId);
+    bar = new librorc::bar(dev, 1);
+  }
+  catch (int e) {
+    cerr << "ERROR: failed to initialize C-RORC: " << librorc::errMsg(e)
+         << endl;
+    if (dev) {
+      delete dev;
+    }
+    return -1;
+  }
+
+  // mapped and indexed once, shared read-only by the checkers of all channels
+  reference_set refs;
+  for (size_t i = 0; i < refFiles.size(); i++) {
+    if (refs.addPath(refFiles[i]) != 0) {
+      cerr << "ERROR: failed to load reference file(s) " << refFiles[i]
+           << endl;
+      delete bar;
+      delete dev;
       return -1;
     }
   }
+  if (!refFiles.empty() && refs.empty()) {
+    cerr << "ERROR: no reference files found" << endl;
+    delete bar;
+    delete dev;
+    return -1;
+  }
+
+  uint32_t nChannels = channelIds.size();
+  vector<rdoChannel_t> channels(nChannels);
+  int result = 0;
+  for (uint32_t i = 0; i < nChannels; i++) {
+    rdoChannel_t *ch = &channels[i];
+    ch->channelId = channelIds[i];
+    ch->checker = NULL;
+    ch->dumper = NULL;
+    ch->es = NULL;
+    if (result != 0) {
+      continue;
+    }
 
+    if (dumpDir) {
+      try {
+        ch->dumper = new file_writer(dumpDir, deviceId, ch->channelId,
+                                     dumpLimit);
+      }
+      catch (int e) {
+        cerr << "ERROR initializing file writer: " << e << endl;
+        result = -1;
+        continue;
+      }
+      if (captureSegmentMB &&
+          ch->dumper->useCaptureFormat(captureSegmentMB << 20, dumpEngine) !=
+              0) {
+        cerr << "ERROR creating capture file in " << dumpDir << endl;
+        result = -1;
+        continue;
+      }
+      if (dumpQueueDepth &&
+          ch->dumper->startAsync(dumpQueueDepth, dumpPolicy) != 0) {
+        cerr << "ERROR starting asynchronous file writer" << endl;
+        result = -1;
+        continue;
+      }
+    }
+
+    // set up event checker
+    ch->checker = new event_checker(deviceId, ch->channelId, logdir);
+    ch->checkMask = EC_CHK_SIZES | EC_CHK_DIU_ERR;
+    if (!refs.empty()) {
+      ch->checker->setReferenceSet(&refs);
+      ch->checker->setRefMatchMode(refMatchMode);
+      ch->checkMask |= EC_CHK_FILE;
+    }
+    if (patternCheck) {
+      ch->checker->setPattern(cfg.pattern, cfg.patternStart);
+      ch->checkMask |= EC_CHK_PATTERN;
+    }
+    if (useRecorder &&
+        ch->checker->enableFlightRecorder(recorderContext,
+                                          recorderEventKB << 10) != 0) {
+      cerr << "ERROR initializing flight recorder" << endl;
+      result = -1;
+      continue;
+    }
+    if (idCheck) {
+      // the PG generates consecutive event IDs
+      ch->checker->setStrictEventIds(cfg.dataSource == DS_PG);
+      ch->checkMask |= EC_CHK_ID;
+    }
+    if (eoeCheck) {
+      ch->checker->setEndOfEventMarker(eoeMarker);
+      ch->checkMask |= EC_CHK_EOE;
+    }
+    rdoCounters[i].pattern_mismatch = -1;
+    rdoCounters[i].ref_mismatch_first = -1;
+  }
+
+  // DMA buffers, link and FCF setup are independent per channel
+  if (result == 0) {
+    vector<int64_t> setupTime_us(nChannels, 0);
+    vector<string> setupErrors(nChannels);
+    rdoSetup_t setup = {dev, bar, &cfg, channels.data(), setupTime_us.data(),
+                        setupErrors.data()};
+    struct timeval tsetup, tsetupDone;
+    gettimeofday(&tsetup, NULL);
+    parallelFor(nChannels, setupThreads, setupChannelAt, &setup);
+    gettimeofday(&tsetupDone, NULL);
+    for (uint32_t i = 0; i < nChannels; i++) {
+      cerr << setupErrors[i];
+      if (!channels[i].es) {
+        result = -1;
+      } else {
+        cout << "Ch" << channels[i].channelId << " setup: "
+             << setupTime_us[i] / 1000 << " ms" << endl;
+      }
+    }
+    cout << "Setup of " << nChannels << " channels with " << setupThreads
+         << " threads: " << timediff_us(tsetup, tsetupDone) / 1000 << " ms"
+         << endl;
+  }
+
+  if (result == 0) {
+    // register signal handler for event loop
+    struct sigaction sigIntHandler;
+    sigIntHandler.sa_handler = abort_handler;
+    sigemptyset(&sigIntHandler.sa_mask);
+    sigIntHandler.sa_flags = 0;
+    sigaction(SIGINT, &sigIntHandler, NULL);
+
+    vector<thread> rdoThreads(nChannels);
+    for (uint32_t i = 0; i < nChannels; i++) {
+      rdoThreads[i] =
+          thread(channelReadout, &channels[i], &cfg, &rdoCounters[i]);
+      if (!cpuIds.empty()) {
+        uint32_t cpu = cpuIds[i % cpuIds.size()];
+        if (pinThreadToCpu(rdoThreads[i], cpu) != 0) {
+          cerr << "WARNING: failed to pin channel " << channels[i].channelId
+               << " to CPU " << cpu << endl;
+        }
+      }
+    }
+
+    // status output
+    struct timeval tcur, tlast, tstart;
+    gettimeofday(&tcur, NULL);
+    tlast = tcur;
+    tstart = tcur;
+    rdoStatus_t sts_cur, sts_last;
+    memset(&sts_last, 0, sizeof(rdoStatus_t));
+    while (!done) {
+      usleep(STATUS_POLL_US);
+      gettimeofday(&tcur, NULL);
+      int64_t tdiff_us = timediff_us(tlast, tcur);
+      if (tdiff_us > STATUS_INTERVAL_US) {
+        int error_mask = 0;
+        for (uint32_t i = 0; i < nChannels; i++) {
+          error_mask |= rdoCounters[i].error_mask.exchange(0);
+        }
+        sumCounters(nChannels, &sts_cur);
+        printStatusLine(channelList, &sts_cur, &sts_last, tdiff_us, error_mask,
+                        cfg.batchSize);
+        for (uint32_t i = 0; i < nChannels; i++) {
+          int64_t mismatch = rdoCounters[i].pattern_mismatch.exchange(-1);
+          if (mismatch >= 0) {
+            cout << "  Ch" << channels[i].channelId
+                 << " pattern mismatch at DW offset " << mismatch << endl;
+          }
+          int64_t refFirst = rdoCounters[i].ref_mismatch_first.exchange(-1);
+          if (refFirst >= 0) {
+            cout << "  Ch" << channels[i].channelId
+                 << " reference mismatch at DW offsets " << refFirst << ".."
+                 << rdoCounters[i].ref_mismatch_last.load() << ", "
+                 << rdoCounters[i].ref_mismatch_count.load()
+                 << " words differ" << endl;
+          }
+        }
+        sts_last = sts_cur;
+        tlast = tcur;
+      }
+    }
+
+    for (uint32_t i = 0; i < nChannels; i++) {
+      rdoThreads[i].join();
+    }
+
+    sumCounters(nChannels, &sts_cur);
+    int64_t truntime_us = timediff_us(tstart, tcur);
+    if (truntime_us > 0 && sts_cur.n_batches) {
+      cout.precision(2);
+      cout.setf(ios::fixed, ios::floatfield);
+      cout << "Batch size " << cfg.batchSize << ": "
+           << (sts_cur.n_events * 1000000.0 / truntime_us / 1000.0)
+           << " kHz average event rate, "
+           << ((float)sts_cur.n_events / sts_cur.n_batches)
+           << " events per batch" << endl;
+    }
+  }
+
+  for (uint32_t i = 0; i < nChannels; i++) {
+    if (channels[i].es) {
+      teardownChannel(channels[i].es, &cfg);
+      delete channels[i].es;
+    }
+    if (channels[i].dumper) {
+      // waits for all queued events to be written
+      channels[i].dumper->stopAsync();
+      printDumpStats(channels[i].channelId, channels[i].dumper);
+      delete channels[i].dumper;
+    }
+    if (channels[i].checker) {
+      flight_recorder *recorder = channels[i].checker->getFlightRecorder();
+      if (recorder) {
+        recorder->flush();
+        printRecorderStats(channels[i].channelId, recorder);
+      }
+      delete channels[i].checker;
+    }
+  }
+  delete bar;
+  delete dev;
+  return result;
+}
+
+librorc::event_stream *setupChannel(librorc::device *dev, librorc::bar *bar,
+                                    uint32_t channelId, rdoConfig_t *cfg,
+                                    ostream &err) {
   librorc::event_stream *es = NULL;
   try {
-    es = new librorc::event_stream(deviceId, channelId,
+    es = new librorc::event_stream(dev, bar, channelId,
                                    librorc::kEventStreamToHost);
   }
   catch (int e) {
-    cerr << "ERROR: Exception while setting up event stream: "
-         << librorc::errMsg(e) << endl;
-    return -1;
+    err << "ERROR: Exception while setting up event stream for channel "
+        << channelId << ": " << librorc::errMsg(e) << endl;
+    return NULL;
   }
   int result = es->initializeDma(2 * channelId, EBUFSIZE);
   if (result != 0) {
-    cerr << "ERROR: failed to initialize DMA: " << librorc::errMsg(result)
-         << endl;
+    err << "ERROR: failed to initialize DMA on channel " << channelId << ": "
+        << librorc::errMsg(result) << endl;
     delete es;
-    return -1;
+    return NULL;
   }
 
   // wait for DDL clock domain to be ready
@@ -227,27 +709,27 @@ int main(int argc, char *argv[]) {
   es->m_channel->clearEventCount();
   es->m_channel->clearStallCount();
   es->m_channel->readAndClearPtrStallFlags();
-  if (pciPacketSize) {
-    es->m_channel->setPciePacketSize(pciPacketSize);
+  if (cfg->pciPacketSize) {
+    es->m_channel->setPciePacketSize(cfg->pciPacketSize);
   }
   es->m_link->setFlowControlEnable(1);
   es->m_link->setChannelActive(1);
 
-  switch (dataSource) {
+  switch (cfg->dataSource) {
   case DS_DIU:
   case DS_SIU:
-    if (configureDdl(es, dataSource) != 0) {
+    if (configureDdl(es, cfg->dataSource, err) != 0) {
       es->m_link->setFlowControlEnable(0);
       es->m_link->setChannelActive(0);
       delete es;
-      return -1;
+      return NULL;
     }
     break;
   case DS_RAW:
     configureRawReadout(es);
     break;
   case DS_PG:
-    configurePg(es, pgSize);
+    configurePg(es, cfg->pgSize, cfg->pattern);
     break;
   case DS_DDR3:
     es->m_link->setDataSourceDdr3DataReplay();
@@ -255,70 +737,35 @@ int main(int argc, char *argv[]) {
   }
 
   // check if FCF exists and configure it
-  if (configureFcf(es, tpcRowMappingFile, tpcPatch, rcuVersion) < 0) {
+  if (configureFcf(es, cfg->tpcRowMappingFile, cfg->tpcPatch,
+                   cfg->rcuVersion, cfg->mappingCacheDir,
+                   cfg->mappingOnlyChanged, err) < 0) {
     delete es;
-    return -1;
+    return NULL;
   }
+  return es;
+}
 
-  // register signal handler for event loop
-  struct sigaction sigIntHandler;
-  sigIntHandler.sa_handler = abort_handler;
-  sigemptyset(&sigIntHandler.sa_mask);
-  sigIntHandler.sa_flags = 0;
-  sigaction(SIGINT, &sigIntHandler, NULL);
-
-  struct timeval tcur, tlast;
-  gettimeofday(&tcur, NULL);
-  tlast = tcur;
-  librorc::ChannelStatus cs_last;
-  memset(&cs_last, 0, sizeof(librorc::ChannelStatus));
-
-  // set up event checker
-  event_checker *checker = new event_checker(deviceId, channelId, logdir);
-  uint32_t check_mask = EC_CHK_SIZES | EC_CHK_DIU_ERR;
-  if (refFile) {
-    checker->addRefFile(refFile);
-    check_mask |= EC_CHK_FILE;
-  }
-  int error_mask = 0;
-
-  // Main event loop
-  while (!done) {
-    gettimeofday(&tcur, NULL);
-    librorc::EventDescriptor *report;
-    const uint32_t *event;
-    uint64_t reference;
-
-    if (es->getNextEvent(&report, &event, &reference)) {
-      es->updateChannelStatus(report);
-      int ret = checker->check(report, event, check_mask);
-      if (ret != 0) {
-        es->m_channel_status->error_count++;
-        error_mask |= ret;
-      }
-      if (dumper) {
-        dumper->dump(report, event);
-      }
-      es->releaseEvent(reference);
-    }
-
-    int64_t tdiff_us = timediff_us(tlast, tcur);
-    if (tdiff_us > 1000000) {
-      printStatusLine(es->m_channel_status, &cs_last, tdiff_us, error_mask);
-      memcpy(&cs_last, es->m_channel_status, sizeof(librorc::ChannelStatus));
-      tlast = tcur;
-      if (error_mask) {
-        error_mask = 0;
-      }
-    }
-  }
+void setupChannelAt(uint32_t index, void *arg) {
+  rdoSetup_t *setup = (rdoSetup_t *)arg;
+  rdoChannel_t *ch = &setup->channels[index];
+  struct timeval tstart, tdone;
+  gettimeofday(&tstart, NULL);
+  ostringstream err;
+  ch->es =
+      setupChannel(setup->dev, setup->bar, ch->channelId, setup->cfg, err);
+  gettimeofday(&tdone, NULL);
+  setup->setupTime_us[index] = timediff_us(tstart, tdone);
+  setup->errors[index] = err.str();
+}
 
+void teardownChannel(librorc::event_stream *es, rdoConfig_t *cfg) {
   es->m_link->setFlowControlEnable(0);
   es->m_link->setChannelActive(0);
-  switch (dataSource) {
+  switch (cfg->dataSource) {
   case DS_DIU:
   case DS_SIU:
-    unconfigureDdl(es, dataSource);
+    unconfigureDdl(es, cfg->dataSource);
     break;
   case DS_RAW:
     unconfigureRawReadout(es);
@@ -331,31 +778,99 @@ int main(int argc, char *argv[]) {
   }
   unconfigureFcf(es);
   es->m_link->setDefaultDataSource();
+}
+
+void channelReadout(rdoChannel_t *ch, rdoConfig_t *cfg, rdoCounters_t *cnt) {
+  librorc::event_stream *es = ch->es;
+  uint32_t batchSize = cfg->batchSize;
+  std::vector<librorc::EventDescriptor *> reports(batchSize);
+  std::vector<const uint32_t *> events(batchSize);
+  std::vector<uint64_t> references(batchSize);
+  uint64_t nBatches = 0;
+
+  while (!done) {
+    // drain up to batchSize reports
+    uint32_t nEvents = 0;
+    while (nEvents < batchSize &&
+           es->getNextEvent(&reports[nEvents], &events[nEvents],
+                            &references[nEvents])) {
+      nEvents++;
+    }
+    if (!nEvents) {
+      continue;
+    }
+
+    int error_mask = 0;
+    for (uint32_t i = 0; i < nEvents; i++) {
+      es->updateChannelStatus(reports[i]);
+      int ret = ch->checker->check(reports[i], events[i], ch->checkMask);
+      if (ret != 0) {
+        es->m_channel_status->error_count++;
+        error_mask |= ret;
+      }
+      if (ch->dumper) {
+        ch->dumper->dump(reports[i], events[i]);
+      }
+    }
+
+    // librorc only advances the read pointers on the device once the oldest
+    // outstanding event is released. Releasing the batch newest-first
+    // therefore results in a single pointer update for all drained events.
+    for (uint32_t i = nEvents; i > 0; i--) {
+      es->releaseEvent(references[i - 1]);
+    }
+    nBatches++;
 
-  if (dumper) {
-    delete dumper;
+    cnt->n_events.store(es->m_channel_status->n_events,
+                        std::memory_order_relaxed);
+    cnt->bytes_received.store(es->m_channel_status->bytes_received,
+                              std::memory_order_relaxed);
+    cnt->error_count.store(es->m_channel_status->error_count,
+                           std::memory_order_relaxed);
+    cnt->n_batches.store(nBatches, std::memory_order_relaxed);
+    if (error_mask) {
+      cnt->error_mask.fetch_or(error_mask, std::memory_order_relaxed);
+    }
+    if (ch->checkMask & EC_CHK_ID) {
+      ecIdStats_t idStats = ch->checker->getIdStats();
+      cnt->id_gaps.store(idStats.gaps, std::memory_order_relaxed);
+      cnt->id_duplicates.store(idStats.duplicates, std::memory_order_relaxed);
+      cnt->id_out_of_order.store(idStats.outOfOrder,
+                                 std::memory_order_relaxed);
+    }
+    if (error_mask & EC_CHK_PATTERN) {
+      cnt->pattern_mismatch.store(ch->checker->lastPatternMismatch(),
+                                  std::memory_order_relaxed);
+    }
+    if (error_mask & EC_CHK_FILE) {
+      wordMismatch_t refMismatch = ch->checker->lastRefMismatch();
+      cnt->ref_mismatch_count.store(refMismatch.count,
+                                    std::memory_order_relaxed);
+      cnt->ref_mismatch_last.store(refMismatch.last,
+                                   std::memory_order_relaxed);
+      cnt->ref_mismatch_first.store(refMismatch.first,
+                                    std::memory_order_release);
+    }
   }
-  delete checker;
-  delete es;
-  return 0;
 }
 
-int configureDdl(librorc::event_stream *es, t_dataSource dataSource) {
+int configureDdl(librorc::event_stream *es, t_dataSource dataSource,
+                 ostream &err) {
   librorc::diu *diu = es->getDiu();
   if (!diu) {
-    cerr << "ERROR: DIU not available for this channel!" << endl;
+    err << "ERROR: DIU not available for this channel!" << endl;
     return -1;
   }
   diu->useAsDataSource();
   if (dataSource == DS_DIU) {
     if (diu->prepareForDiuData() < 0) {
-      cerr << "ERROR: prepareForDiuData failed!" << endl;
+      err << "ERROR: prepareForDiuData failed!" << endl;
       delete diu;
       return -1;
     }
   } else {
     if (diu->prepareForSiuData() < 0) {
-      cerr << "ERROR: prepareForSiuData failed!" << endl;
+      err << "ERROR: prepareForSiuData failed!" << endl;
       delete diu;
       return -1;
     }
@@ -363,7 +878,7 @@ int configureDdl(librorc::event_stream *es, t_dataSource dataSource) {
   diu->setEnable(1);
   if (dataSource == DS_SIU) {
     if (diu->sendFeeReadyToReceiveCmd() < 0) {
-      cerr << "ERROR: failed to send RDYRX to FEE!" << endl;
+      err << "ERROR: failed to send RDYRX to FEE!" << endl;
       delete diu;
       return -1;
     }
@@ -385,7 +900,8 @@ void unconfigureDdl(librorc::event_stream *es, t_dataSource dataSource) {
 }
 
 int configureFcf(librorc::event_stream *es, char *tpcRowMappingFile,
-                 uint32_t patch, uint32_t rcuVersion) {
+                 uint32_t patch, uint32_t rcuVersion, char *mappingCacheDir,
+                 bool mappingOnlyChanged, ostream &err) {
   librorc::fastclusterfinder *fcf = es->getFastClusterFinder();
   if (!fcf) {
     // FCF doesn't exist on this channel, so nothing to configure
@@ -397,20 +913,28 @@ int configureFcf(librorc::event_stream *es, char *tpcRowMappingFile,
   fcf->clearErrors();
   if (tpcRowMappingFile) {
     if (patch > 5) {
-      cerr << "ERROR: invalid TPC patch: " << patch << endl;
+      err << "ERROR: invalid TPC patch: " << patch << endl;
       delete fcf;
       return -1;
     }
     fcf_mapping map = fcf_mapping(patch);
-    if (map.readMappingFile(tpcRowMappingFile, rcuVersion) < 0) {
-      cerr << "ERROR: Invalid TPC row mapping file: " << tpcRowMappingFile
-           << endl;
+    int result =
+        mappingCacheDir
+            ? map.readMappingFileCached(tpcRowMappingFile, rcuVersion,
+                                        mappingCacheDir)
+            : map.readMappingFile(tpcRowMappingFile, rcuVersion);
+    if (result < 0) {
+      fcfMappingError_t error = map.parseError();
+      err << "ERROR: Invalid TPC row mapping file: " << tpcRowMappingFile;
+      if (error.line) {
+        err << ":" << error.line << ":" << error.column << ": "
+            << error.reason;
+      }
+      err << endl;
       delete fcf;
       return -1;
     }
-    for (uint32_t i = 0; i < gkConfigWordCnt; i++) {
-      fcf->writeMappingRamEntry(i, map[i]);
-    }
+    writeMappingRam(fcf, &map, mappingOnlyChanged);
     fcf->setBypass(0);
   } else {
     fcf->setBypass(1);
@@ -449,14 +973,16 @@ void unconfigureFcf(librorc::event_stream *es) {
   delete fcf;
 }
 
-int configurePg(librorc::event_stream *es, uint32_t pgSize) {
+int configurePg(librorc::event_stream *es, uint32_t pgSize,
+                ecPattern_t pattern) {
   librorc::patterngenerator *pg = es->getPatternGenerator();
   if (!pg) {
     return 0;
   }
   pg->disable();
   pg->useAsDataSource();
-  pg->configureMode(PG_PATTERN_INC, 0 /*pattern*/, 0 /*#events*/);
+  uint32_t mode = (pattern == EC_PATTERN_DEC) ? PG_PATTERN_DEC : PG_PATTERN_INC;
+  pg->configureMode(mode, 0 /*pattern*/, 0 /*#events*/);
   pg->setStaticEventSize(pgSize);
   pg->enable();
   delete pg;
@@ -496,17 +1022,35 @@ int64_t timediff_us(struct timeval from, struct timeval to) {
           (int64_t)(to.tv_usec - from.tv_usec));
 }
 
-void printStatusLine(librorc::ChannelStatus *cs_cur,
-                     librorc::ChannelStatus *cs_last, int64_t tdiff_us,
-                     int error_mask) {
-  uint64_t events_diff = cs_cur->n_events - cs_last->n_events;
+void sumCounters(uint32_t nChannels, rdoStatus_t *sts) {
+  memset(sts, 0, sizeof(rdoStatus_t));
+  for (uint32_t i = 0; i < nChannels; i++) {
+    sts->n_events += rdoCounters[i].n_events.load(std::memory_order_relaxed);
+    sts->bytes_received +=
+        rdoCounters[i].bytes_received.load(std::memory_order_relaxed);
+    sts->error_count +=
+        rdoCounters[i].error_count.load(std::memory_order_relaxed);
+    sts->n_batches += rdoCounters[i].n_batches.load(std::memory_order_relaxed);
+    sts->id_gaps += rdoCounters[i].id_gaps.load(std::memory_order_relaxed);
+    sts->id_duplicates +=
+        rdoCounters[i].id_duplicates.load(std::memory_order_relaxed);
+    sts->id_out_of_order +=
+        rdoCounters[i].id_out_of_order.load(std::memory_order_relaxed);
+  }
+}
+
+void printStatusLine(const char *label, rdoStatus_t *sts_cur,
+                     rdoStatus_t *sts_last, int64_t tdiff_us, int error_mask,
+                     uint32_t batchSize) {
+  uint64_t events_diff = sts_cur->n_events - sts_last->n_events;
   float event_rate_khz = (events_diff * 1000000.0) / tdiff_us / 1000.0;
-  uint64_t bytes_diff = cs_cur->bytes_received - cs_last->bytes_received;
+  uint64_t bytes_diff = sts_cur->bytes_received - sts_last->bytes_received;
   float mbytes_rate = (bytes_diff * 1000000.0) / tdiff_us / (float)(1 << 20);
-  float total_receiced_GB = (cs_cur->bytes_received / (float)(1 << 30));
+  float total_receiced_GB = (sts_cur->bytes_received / (float)(1 << 30));
+  uint64_t batches_diff = sts_cur->n_batches - sts_last->n_batches;
   cout.precision(2);
   cout.setf(ios::fixed, ios::floatfield);
-  cout << "Ch" << cs_cur->channel << " -  #Events: " << cs_cur->n_events
+  cout << "Ch" << label << " -  #Events: " << sts_cur->n_events
        << ", Size: " << total_receiced_GB << " GB, ";
   if (events_diff) {
     cout << "Data Rate: " << mbytes_rate
@@ -514,13 +1058,37 @@ void printStatusLine(librorc::ChannelStatus *cs_cur,
   } else {
     cout << "Data Rate: - , Event Rate: - ";
   }
-  cout << ", Errors: " << cs_cur->error_count;
+  if (batchSize > 1) {
+    float batchFill = batches_diff ? (float)events_diff / batches_diff : 0.0;
+    cout << ", Batch: " << batchFill << "/" << batchSize;
+  }
+  if (sts_cur->id_gaps || sts_cur->id_duplicates || sts_cur->id_out_of_order) {
+    cout << ", ID gaps/dups/ooo: " << (sts_cur->id_gaps - sts_last->id_gaps)
+         << "/" << (sts_cur->id_duplicates - sts_last->id_duplicates) << "/"
+         << (sts_cur->id_out_of_order - sts_last->id_out_of_order);
+  }
+  cout << ", Errors: " << sts_cur->error_count;
   if (error_mask) {
     cout << " mask: 0x" << hex << error_mask << dec;
   }
   cout << endl;
 }
 
+void printDumpStats(uint32_t channelId, file_writer *dumper) {
+  struct fileWriterStats_t stats = dumper->getStats();
+  cout.precision(2);
+  cout.setf(ios::fixed, ios::floatfield);
+  cout << "Ch" << channelId << " dump - Written: " << stats.eventsWritten
+       << " events, " << (stats.bytesWritten / (float)(1 << 20)) << " MB";
+  if (stats.eventsQueued) {
+    cout << ", Queued: " << stats.eventsQueued << " events, "
+         << (stats.bytesQueued / (float)(1 << 20)) << " MB"
+         << ", Dropped: " << stats.eventsDropped << " events, "
+         << (stats.bytesDropped / (float)(1 << 20)) << " MB";
+  }
+  cout << ", Errors: " << stats.writeErrors << endl;
+}
+
 bool fileExists(char *filename) {
   int fd = open(filename, O_RDONLY);
   if (fd == -1) {
@@ -529,3 +1097,12 @@ bool fileExists(char *filename) {
   close(fd);
   return true;
 }
+
+void printRecorderStats(uint32_t channelId, flight_recorder *recorder) {
+  struct flightRecorderStats_t stats = recorder->getStats();
+  cout << "Ch" << channelId << " flight recorder - Triggers: "
+       << stats.triggers << ", Dumps written: " << stats.dumpsWritten
+       << ", dropped: " << stats.dumpsDropped
+       << ", Truncated events: " << stats.eventsTruncated
+       << ", Errors: " << stats.writeErrors << endl;
+}
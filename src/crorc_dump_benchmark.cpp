@@ -0,0 +1,160 @@
+/**
+ *  crorc_dump_benchmark.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+#include "capture_file.hh"
+
+#define HELP_TEXT                                                              \
+  "crorc_dump_benchmark parameters:\n"                                         \
+  " -d [dir]      target directory, default: /tmp\n"                           \
+  " -s [bytes]    event size, default: 4096\n"                                 \
+  " -t [MB]       amount of data written per engine, default: 1024\n"          \
+  " -S [MB]       capture segment size, default: 1024\n"                       \
+  " -e [engine]   buffered, direct or uring, default: all\n"
+
+inline double timediff_s(struct timeval from, struct timeval to) {
+  return (to.tv_sec - from.tv_sec) + (to.tv_usec - from.tv_usec) / 1000000.0;
+}
+
+int runBenchmark(const char *dir, dioEngine_t engine, uint32_t eventSize,
+                 uint64_t totalBytes, uint64_t segmentSize) {
+  char basename[4096];
+  snprintf(basename, sizeof(basename), "%s/crorc_dump_benchmark_%s", dir,
+           dio_writer::engineName(engine));
+
+  std::vector<uint32_t> event((eventSize + 3) / 4);
+  for (size_t i = 0; i < event.size(); i++) {
+    event[i] = i;
+  }
+  librorc::EventDescriptor report;
+  memset(&report, 0, sizeof(report));
+  report.calc_event_size = event.size();
+  report.reported_event_size = event.size();
+
+  struct timeval tstart, twritten, tsynced;
+  gettimeofday(&tstart, NULL);
+  capture_writer *writer = NULL;
+  try {
+    writer = new capture_writer(basename, 0, 0, segmentSize, engine);
+  }
+  catch (int e) {
+    perror("Failed to create capture file");
+    return -1;
+  }
+  dioEngine_t usedEngine = writer->engine();
+  uint64_t nEvents = totalBytes / eventSize;
+  for (uint64_t i = 0; i < nEvents; i++) {
+    if (writer->writeEvent(&report, event.data(), eventSize, i) != 0) {
+      perror("Failed to write event");
+      delete writer;
+      return -1;
+    }
+  }
+  uint32_t nSegments = writer->segment() + 1;
+  if (writer->close() != 0) {
+    perror("Failed to close capture file");
+    delete writer;
+    return -1;
+  }
+  delete writer;
+  gettimeofday(&twritten, NULL);
+  // include the write-back of page cache based engines
+  sync();
+  gettimeofday(&tsynced, NULL);
+
+  double twrite = timediff_s(tstart, twritten);
+  double tsync = timediff_s(tstart, tsynced);
+  double mbytes = nEvents * (double)eventSize / (1 << 20);
+  printf("%s, %s, %u, %lu, %.2f, %.2f, %.2f\n",
+         dio_writer::engineName(engine), dio_writer::engineName(usedEngine),
+         eventSize, nEvents, mbytes / twrite, mbytes / tsync,
+         nEvents / twrite / 1000.0);
+
+  for (uint32_t seg = 0; seg < nSegments; seg++) {
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s_%04u%s", basename, seg,
+             CAPTURE_FILE_SUFFIX);
+    unlink(filename);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *dir = "/tmp";
+  uint32_t eventSize = 4096;
+  uint64_t totalMB = 1024;
+  uint64_t segmentMB = 1024;
+  std::vector<dioEngine_t> engines;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:t:S:e:h")) != -1) {
+    switch (opt) {
+    case 'd':
+      dir = optarg;
+      break;
+    case 's':
+      eventSize = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      totalMB = strtoull(optarg, NULL, 0);
+      break;
+    case 'S':
+      segmentMB = strtoull(optarg, NULL, 0);
+      break;
+    case 'e': {
+      dioEngine_t engine;
+      if (dio_writer::parseEngine(optarg, &engine) != 0) {
+        printf("ERROR: invalid engine %s\n", optarg);
+        return -1;
+      }
+      engines.push_back(engine);
+    } break;
+    case 'h':
+      printf(HELP_TEXT);
+      return 0;
+    default:
+      printf(HELP_TEXT);
+      return -1;
+    }
+  }
+
+  if (eventSize == 0 || totalMB == 0 || segmentMB == 0) {
+    printf("ERROR: event size, total size and segment size must be > 0\n");
+    return -1;
+  }
+  if (engines.empty()) {
+    engines.push_back(DIO_ENGINE_BUFFERED);
+    engines.push_back(DIO_ENGINE_DIRECT);
+    engines.push_back(DIO_ENGINE_URING);
+  }
+
+  printf("# engine, usedEngine, eventSize, nEvents, writeMBps, "
+         "writeSyncMBps, eventRateKHz\n");
+  for (size_t i = 0; i < engines.size(); i++) {
+    if (runBenchmark(dir, engines[i], eventSize, totalMB << 20,
+                     segmentMB << 20) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+/**
+ *  crorc_fcf_emulate.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fcf_emulator.hh"
+#include "thread_utils.hh"
+
+#define HELP_TEXT                                                              \
+  "usage: crorc_fcf_emulate [parameters] [DDL file(s)]\n"                      \
+  "    -m [mappingfile] Path to AliRoot TPC Row Mapping File\n"                \
+  "    -p [patch]       TPC patch, default:0\n"                                \
+  "    -r [rcuVersion]  TPC RCU version, default:1\n"                          \
+  "    -o [dir]         write the output of TPC_*.ddl as FCF_*.ddl to dir,\n"  \
+  "                     default: no output\n"                                  \
+  "    -j [threads]     number of worker threads, default: all CPUs\n"        \
+  "    -a [cpus]        pin the worker threads to a CPU list like 0-5\n"      \
+  "    FCF parameters as for crorc_hwcf_coproc_zmq, e.g. "                     \
+  "--merger-distance\n"
+
+struct workerResult_t {
+  uint64_t inputBytes;
+  uint64_t failed;
+  fcfEmulatorStats_t stats;
+};
+
+inline double timediff_s(struct timeval from, struct timeval to) {
+  return (to.tv_sec - from.tv_sec) + (to.tv_usec - from.tv_usec) / 1000000.0;
+}
+
+int readFile(const char *filename, std::vector<uint32_t> *data) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  data->resize((st.st_size + 3) / 4);
+  ssize_t nbytes = read(fd, data->data(), st.st_size);
+  close(fd);
+  if (nbytes != st.st_size) {
+    if (nbytes >= 0) {
+      errno = EIO;
+    }
+    return -1;
+  }
+  data->resize(st.st_size / 4);
+  return 0;
+}
+
+int writeFile(const char *filename, const std::vector<uint32_t> &data) {
+  int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t size = data.size() * sizeof(uint32_t);
+  ssize_t nbytes = write(fd, data.data(), size);
+  close(fd);
+  if (nbytes != size) {
+    if (nbytes >= 0) {
+      errno = EIO;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/** TPC_768.ddl -> outdir/FCF_768.ddl **/
+std::string outputFilename(const char *outdir, const char *input) {
+  const char *base = strrchr(input, '/');
+  std::string name = base ? base + 1 : input;
+  size_t pos = name.find("TPC_");
+  if (pos != std::string::npos) {
+    name.replace(pos, 4, "FCF_");
+  }
+  return std::string(outdir) + "/" + name;
+}
+
+void worker(fcf_emulator *emu, char **files, uint32_t nFiles,
+            std::atomic<uint32_t> *nextFile, const char *outdir,
+            workerResult_t *result) {
+  std::vector<uint32_t> input;
+  std::vector<uint32_t> output;
+  result->inputBytes = 0;
+  result->failed = 0;
+  uint32_t i;
+  while ((i = nextFile->fetch_add(1)) < nFiles) {
+    if (readFile(files[i], &input) != 0) {
+      fprintf(stderr, "ERROR: Failed to read %s: %s\n", files[i],
+              strerror(errno));
+      result->failed++;
+      continue;
+    }
+    result->inputBytes += input.size() * sizeof(uint32_t);
+    if (emu->processEvent(input.data(), input.size(), &output) != 0) {
+      fprintf(stderr, "ERROR: Failed to process %s: %s\n", files[i],
+              strerror(errno));
+      result->failed++;
+      continue;
+    }
+    if (outdir) {
+      std::string outfile = outputFilename(outdir, files[i]);
+      if (writeFile(outfile.c_str(), output) != 0) {
+        fprintf(stderr, "ERROR: Failed to write %s: %s\n", outfile.c_str(),
+                strerror(errno));
+        result->failed++;
+      }
+    }
+  }
+  result->stats = emu->getStats();
+}
+
+int main(int argc, char *argv[]) {
+  char *mappingfile = NULL;
+  uint32_t tpcPatch = 0;
+  uint32_t rcuVersion = 1;
+  const char *outdir = NULL;
+  uint32_t nThreads = std::thread::hardware_concurrency();
+  char *cpuList = NULL;
+  fcfConfig_t fcfcfg = fcfDefaultConfig;
+
+  static struct option long_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"mapping", required_argument, 0, 'm'},
+      {"patch", required_argument, 0, 'p'},
+      {"rcu2-data", required_argument, 0, 'r'},
+      {"outdir", required_argument, 0, 'o'},
+      {"threads", required_argument, 0, 'j'},
+      {"cpus", required_argument, 0, 'a'},
+      FCF_CONFIG_LONG_OPTIONS,
+      {0, 0, 0, 0}};
+
+  int arg;
+  while ((arg = getopt_long(argc, argv, "hm:p:r:o:j:a:" FCF_CONFIG_OPTSTRING,
+                            long_options, NULL)) != -1) {
+    switch (arg) {
+    case 'h':
+      printf(HELP_TEXT);
+      return 0;
+    case 'm':
+      mappingfile = optarg;
+      break;
+    case 'p':
+      tpcPatch = strtoul(optarg, NULL, 0);
+      break;
+    case 'r':
+      rcuVersion = (strtoul(optarg, NULL, 0) > 0) ? 2 : 1;
+      break;
+    case 'o':
+      outdir = optarg;
+      break;
+    case 'j':
+      nThreads = strtoul(optarg, NULL, 0);
+      break;
+    case 'a':
+      cpuList = optarg;
+      break;
+    default:
+      if (parseFcfConfigOption(arg, optarg, &fcfcfg) != 0) {
+        printf(HELP_TEXT);
+        return -1;
+      }
+      break;
+    }
+  }
+
+  if (!mappingfile) {
+    printf("ERROR: no FCF mapping file provided!\n");
+    return -1;
+  }
+  if (tpcPatch > 5) {
+    printf("ERROR: invalid TPC patch %u\n", tpcPatch);
+    return -1;
+  }
+  uint32_t nFiles = argc - optind;
+  if (nFiles == 0) {
+    printf("ERROR: no input files\n");
+    return -1;
+  }
+  if (nThreads == 0) {
+    nThreads = 1;
+  }
+  if (nThreads > nFiles) {
+    nThreads = nFiles;
+  }
+  std::vector<uint32_t> cpuIds;
+  if (cpuList && parseIdList(cpuList, cpuIds) != 0) {
+    printf("ERROR: invalid CPU list %s\n", cpuList);
+    return -1;
+  }
+
+  fcf_mapping map = fcf_mapping(tpcPatch);
+  if (map.readMappingFile(mappingfile, rcuVersion) != 0) {
+    fcfMappingError_t error = map.parseError();
+    if (error.line) {
+      printf("ERROR: %s:%lu:%lu: %s\n", mappingfile, error.line, error.column,
+             error.reason);
+    } else {
+      perror("Failed to read mapping file");
+    }
+    return -1;
+  }
+
+  std::vector<fcf_emulator *> emulators(nThreads);
+  std::vector<workerResult_t> results(nThreads);
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> nextFile(0);
+  struct timeval tstart, tend;
+  gettimeofday(&tstart, NULL);
+  for (uint32_t i = 0; i < nThreads; i++) {
+    emulators[i] = new fcf_emulator(&map, fcfcfg);
+    threads.push_back(std::thread(worker, emulators[i], argv + optind, nFiles,
+                                  &nextFile, outdir, &results[i]));
+    if (!cpuIds.empty()) {
+      pinThreadToCpu(threads[i], cpuIds[i % cpuIds.size()]);
+    }
+  }
+
+  uint64_t inputBytes = 0, failed = 0, events = 0, clusters = 0, errors = 0;
+  for (uint32_t i = 0; i < nThreads; i++) {
+    threads[i].join();
+    inputBytes += results[i].inputBytes;
+    failed += results[i].failed;
+    events += results[i].stats.events;
+    clusters += results[i].stats.clusters;
+    errors += results[i].stats.decodeErrors;
+    delete emulators[i];
+  }
+  gettimeofday(&tend, NULL);
+  double t = timediff_s(tstart, tend);
+
+  printf("%" PRIu64 " events, %" PRIu64 " clusters, %" PRIu64 " failed, "
+         "%" PRIu64 " decode errors\n",
+         events, clusters, failed, errors);
+  printf("%u threads, %.3f s, %.1f events/s, %.1f MB/s input\n", nThreads, t,
+         events / t, inputBytes / t / (1 << 20));
+  return failed ? -1 : 0;
+}
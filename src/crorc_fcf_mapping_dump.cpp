@@ -26,15 +26,17 @@
   "crorc_fcf_mapping_dump paramters:\n"                                        \
   " -f [file]     TPC AliRoot RowMapping.txt file\n"                           \
   " -p [patch]    TPC Patch Number, default: 0\n"                              \
+  " -a            all patches, one column per patch\n"                         \
   " -r [version]  RCU Version, default: 0\n"
 
 int main(int argc, char *argv[]) {
   uint32_t tpcPatch = 0;
   uint32_t rcuVersion = 1;
   char *filename = NULL;
+  bool allPatches = false;
 
   int opt;
-  while ((opt = getopt(argc, argv, "p:r:f:h")) != -1) {
+  while ((opt = getopt(argc, argv, "p:r:f:ah")) != -1) {
     switch (opt) {
     case 'p':
       tpcPatch = strtoul(optarg, NULL, 0);
@@ -45,6 +47,9 @@ int main(int argc, char *argv[]) {
     case 'f':
       filename = optarg;
       break;
+    case 'a':
+      allPatches = true;
+      break;
     case 'h':
       printf(HELP_TEXT);
       return 0;
@@ -56,14 +61,28 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  fcf_mapping map = fcf_mapping(tpcPatch);
-  if (map.readMappingFile(filename, rcuVersion) != 0) {
+  fcf_mapping *maps[gkPatchCnt];
+  unsigned nMaps = allPatches ? gkPatchCnt : 1;
+  for (unsigned p = 0; p < nMaps; p++) {
+    maps[p] = new fcf_mapping(allPatches ? p : tpcPatch);
+  }
+  fcfMappingError_t error;
+  int result =
+      fcf_mapping::readMappingFiles(filename, rcuVersion, maps, nMaps, &error);
+  if (result != 0 && error.line) {
+    fprintf(stderr, "%s:%lu:%lu: %s\n", filename, error.line, error.column,
+            error.reason);
+  } else if (result != 0) {
     perror("Failed to read mapping file");
-    return -1;
+  } else {
+    for (unsigned i = 0; i < gkConfigWordCnt; i++) {
+      for (unsigned p = 0; p < nMaps; p++) {
+        printf((p + 1 < nMaps) ? "%08x " : "%08x\n", (*maps[p])[i]);
+      }
+    }
   }
-  for (unsigned i = 0; i < gkConfigWordCnt; i++) {
-    printf("%08x\n", map[i]);
+  for (unsigned p = 0; p < nMaps; p++) {
+    delete maps[p];
   }
-
-  return 0;
+  return (result != 0) ? -1 : 0;
 }
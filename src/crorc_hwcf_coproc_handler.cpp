@@ -17,15 +17,16 @@
  **/
 
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include "crorc_hwcf_coproc_handler.hpp"
 #include "fcf_mapping.hh"
 
-#define ZMQ_BUF_SIZE (3 * 4096)
-
 crorc_hwcf_coproc_handler::crorc_hwcf_coproc_handler(librorc::device *dev,
                                                      librorc::bar *bar,
                                                      int channelId,
@@ -33,12 +34,26 @@ crorc_hwcf_coproc_handler::crorc_hwcf_coproc_handler(librorc::device *dev,
   m_es2host = NULL;
   m_es2dev = NULL;
   m_fcf = NULL;
-  m_eb2dev_writeptr = 0;
-  m_eb2dev_readptr = 0;
+  m_mapping_only_changed = false;
+  m_mapping_words_written = 0;
+  m_eb2dev_ring = NULL;
   m_es2dev_id = channelId;
   m_zmq_skt = NULL;
   m_zmq_ctx = NULL;
+  m_zmq_ack_skt = NULL;
+  m_flush_ack_pending = false;
+  m_flush_seq = 0;
+  m_stop_ack_pending = false;
+  m_stop_seq = 0;
+  m_zmq_event_skt = NULL;
+  m_host_tag.inBand = false;
+  m_host_tag.seq = 0;
+  m_host_tag.index = 0;
+  m_shipped_outstanding = 0;
+  m_inband_cmd_active = false;
+  m_inband_cmd_accepted = 0;
   m_eventsInChain = 0;
+  memset(&m_compare_result, 0, sizeof(m_compare_result));
   m_status.nInputsQueued = 0;
   m_status.nInputsDone = 0;
   m_status.nOutputsQueued = 0;
@@ -49,6 +64,16 @@ crorc_hwcf_coproc_handler::crorc_hwcf_coproc_handler(librorc::device *dev,
   m_input_file_list.clear();
   m_input_iter = m_input_file_list.begin();
   m_input_end = m_input_file_list.end();
+  m_prefetch_stop = false;
+  m_prefetch_stalls = 0;
+  m_fcf_stats = NULL;
+  m_stats_events = 0;
+  m_xoff_total_cc = 0;
+  m_xoff_sampled_cc = 0;
+  m_prefetch_stalled = false;
+  m_pf_requested = 0;
+  m_pf_consumed = 0;
+  m_pf_loaded = 0;
 
   m_es2dev = new librorc::event_stream(dev, bar, m_es2dev_id,
                                        librorc::kEventStreamToDevice);
@@ -72,16 +97,37 @@ crorc_hwcf_coproc_handler::crorc_hwcf_coproc_handler(librorc::device *dev,
   if (result) {
     throw result;
   }
-  m_eb2dev_readptr = m_es2dev->m_eventBuffer->size();
+  m_eb2dev_ring = new ring_allocator(m_es2dev->m_eventBuffer->size());
 }
 
 crorc_hwcf_coproc_handler::~crorc_hwcf_coproc_handler() {
+  if (m_prefetch_thread.joinable()) {
+    m_prefetch_stop = true;
+    m_prefetch_thread.join();
+  }
+  for (size_t i = 0; i < m_prefetch.size(); i++) {
+    free(m_prefetch[i].data);
+  }
   if (m_zmq_skt) {
     zmq_close(m_zmq_skt);
   }
+  if (m_zmq_ack_skt) {
+    zmq_close(m_zmq_ack_skt);
+  }
+  for (size_t i = 0; i < m_inband_inputs.size(); i++) {
+    zmq_msg_close(&m_inband_inputs[i].msg);
+  }
+  // waits up to INBAND_LINGER_MS for shipped events, the DMA buffer has to
+  // be valid until then
+  if (m_zmq_event_skt) {
+    zmq_close(m_zmq_event_skt);
+  }
   if (m_zmq_ctx) {
     zmq_term(m_zmq_ctx);
   }
+  if (m_fcf_stats) {
+    delete m_fcf_stats;
+  }
   if (m_fcf) {
     delete m_fcf;
   }
@@ -91,6 +137,21 @@ crorc_hwcf_coproc_handler::~crorc_hwcf_coproc_handler() {
   if (m_es2dev) {
     delete m_es2dev;
   }
+  if (m_eb2dev_ring) {
+    delete m_eb2dev_ring;
+  }
+}
+
+void crorc_hwcf_coproc_handler::setToDeviceRingMode(ringMode_t mode) {
+  ring_allocator *ring =
+      new ring_allocator(m_es2dev->m_eventBuffer->size(), mode);
+  // only possible while the buffer is empty
+  if (m_eb2dev_ring->allocations()) {
+    delete ring;
+    return;
+  }
+  delete m_eb2dev_ring;
+  m_eb2dev_ring = ring;
 }
 
 int crorc_hwcf_coproc_handler::initializeClusterFinder(
@@ -126,13 +187,46 @@ int crorc_hwcf_coproc_handler::initializeClusterFinder(
   m_fcf->clearErrors();
 
   fcf_mapping map = fcf_mapping(tpcPatch);
-  if (map.readMappingFile(tpcRowMappingFile, rcuVersion)) {
+  int result;
+  if (m_mapping_cache_dir.empty()) {
+    result = map.readMappingFile(tpcRowMappingFile, rcuVersion);
+  } else {
+    result = map.readMappingFileCached(tpcRowMappingFile, rcuVersion,
+                                       m_mapping_cache_dir.c_str());
+  }
+  if (result) {
+    fcfMappingError_t error = map.parseError();
+    if (error.line) {
+      printf("initializeClusterFinder: %s:%lu:%lu: %s\n", tpcRowMappingFile,
+             error.line, error.column, error.reason);
+    }
     return -1;
   }
-  for (uint32_t i = 0; i < gkConfigWordCnt; i++) {
-    m_fcf->writeMappingRamEntry(i, map[i]);
+  m_mapping_words_written =
+      writeMappingRam(m_fcf, &map, m_mapping_only_changed);
+
+  if (rcuVersion == 2) {
+    m_fcf->setBranchOverride(1);
+  } else {
+    m_fcf->setBranchOverride(0);
   }
 
+  configureClusterFinder(fcfcfg);
+  m_es2host->m_link->setDdlReg(RORC_REG_DDL_DEADTIME, 0);
+  return 0;
+}
+
+void crorc_hwcf_coproc_handler::setMappingCache(const char *cacheDir,
+                                                bool onlyChanged) {
+  m_mapping_cache_dir = cacheDir ? cacheDir : "";
+  m_mapping_only_changed = onlyChanged;
+}
+
+void crorc_hwcf_coproc_handler::configureClusterFinder(
+    struct fcfConfig_t fcfcfg) {
+  m_fcf->setReset(1);
+  m_fcf->setEnable(0);
+
   m_fcf->setSinglePadSuppression(fcfcfg.single_pad_suppression);
   m_fcf->setBypassMerger(fcfcfg.bypass_merger);
   m_fcf->setDeconvPad(fcfcfg.deconvolute_pad);
@@ -149,16 +243,8 @@ int crorc_hwcf_coproc_handler::initializeClusterFinder(
   m_fcf->setCorrectEdgeClusters(fcfcfg.correct_edge_clusters);
   m_fcf->setTagDeconvolutedClusters(fcfcfg.tag_deconvoluted_clusters);
 
-  if (rcuVersion == 2) {
-    m_fcf->setBranchOverride(1);
-  } else {
-    m_fcf->setBranchOverride(0);
-  }
-
   m_fcf->setReset(0);
   m_fcf->setEnable(1);
-  m_es2host->m_link->setDdlReg(RORC_REG_DDL_DEADTIME, 0);
-  return 0;
 }
 
 int crorc_hwcf_coproc_handler::enqueueEventToDevice(const char *filename) {
@@ -170,43 +256,40 @@ int crorc_hwcf_coproc_handler::enqueueEventToDevice(const char *filename) {
 
   // map event data
   struct stat fd_stat;
-  fstat(fd, &fd_stat);
+  if (fstat(fd, &fd_stat) != 0) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
   void *event_in = mmap(NULL, fd_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
   close(fd);
   if (event_in == MAP_FAILED) {
     return errno;
   }
-  if (fd_stat.st_size < 0) {
-    return EIO;
-  }
-
-  uint64_t buffersize = m_es2dev->m_eventBuffer->size();
-  // check if file fits into buffer at all
-  if ((uint64_t)fd_stat.st_size > buffersize) {
-    return EFBIG;
-  }
+  int result = enqueueEventToDevice(event_in, fd_stat.st_size);
+  munmap(event_in, fd_stat.st_size);
+  return result;
+}
 
-  // check if file fits into free buffer
-  uint64_t free_buffer =
-      (m_eb2dev_writeptr > m_eb2dev_readptr)
-          ? (buffersize - m_eb2dev_writeptr + m_eb2dev_readptr)
-          : (m_eb2dev_readptr - m_eb2dev_writeptr);
-  if ((uint64_t)fd_stat.st_size > free_buffer) {
-    munmap(event_in, fd_stat.st_size);
-    return EAGAIN;
+int crorc_hwcf_coproc_handler::enqueueEventToDevice(const void *data,
+                                                    uint64_t size) {
+  // find space in the buffer, EFBIG if the file does not fit at all
+  ringSegment_t seg[2];
+  uint32_t nSegments = 0;
+  int result = m_eb2dev_ring->reserve(size, seg, &nSegments);
+  if (result) {
+    return result;
   }
 
-  // copy event to buffer
-  char *event_dst =
-      (char *)m_es2dev->m_eventBuffer->getMem() + m_eb2dev_writeptr;
-  memcpy(event_dst, event_in, fd_stat.st_size);
-  munmap(event_in, fd_stat.st_size);
-
-  // create scatter-gather-list
+  // create scatter-gather-list, one part per segment
   std::vector<librorc::ScatterGatherEntry> sglist;
-  if (m_es2dev->m_eventBuffer->composeSglistFromBufferSegment(
-          m_eb2dev_writeptr, fd_stat.st_size, &sglist) == false) {
-    return EINVAL;
+  for (uint32_t i = 0; i < nSegments; i++) {
+    std::vector<librorc::ScatterGatherEntry> part;
+    if (m_es2dev->m_eventBuffer->composeSglistFromBufferSegment(
+            seg[i].offset, seg[i].size, &part) == false) {
+      return EINVAL;
+    }
+    sglist.insert(sglist.end(), part.begin(), part.end());
   }
 
   // check if scatter-gather-list fits into DMA channel FIFO at all
@@ -222,25 +305,100 @@ int crorc_hwcf_coproc_handler::enqueueEventToDevice(const char *filename) {
     return EAGAIN;
   }
 
+  // copy event to buffer
+  const char *src = (const char *)data;
+  for (uint32_t i = 0; i < nSegments; i++) {
+    char *event_dst =
+        (char *)m_es2dev->m_eventBuffer->getMem() + seg[i].offset;
+    memcpy(event_dst, src, seg[i].size);
+    src += seg[i].size;
+  }
+
   // announce event to C-RORC
   m_es2dev->m_channel->announceEvent(sglist);
+  m_eb2dev_ring->commit();
+  return 0;
+}
 
-  // adjust write pointer
-  m_eb2dev_writeptr += fd_stat.st_size;
-  if (m_eb2dev_writeptr >= buffersize) {
-    m_eb2dev_writeptr -= buffersize;
+int crorc_hwcf_coproc_handler::enqueueEventFromMemory(const void *data,
+                                                      uint64_t size) {
+  int result = enqueueEventToDevice(data, size);
+  if (result) {
+    return result;
   }
-
+  chainTag_t tag;
+  tag.inBand = false;
+  tag.seq = 0;
+  tag.index = 0;
+  m_chain_tags.push_back(tag);
+  m_last_input = "memory";
+  m_eventsInChain++;
   return 0;
 }
 
 int crorc_hwcf_coproc_handler::enqueueNextEventToDevice() {
+  chainTag_t tag;
+  tag.inBand = false;
+  tag.seq = 0;
+  tag.index = 0;
+  if (!m_inband_inputs.empty()) {
+    inBandInput_t *in = &m_inband_inputs.front();
+    int result =
+        enqueueEventToDevice(zmq_msg_data(&in->msg), zmq_msg_size(&in->msg));
+    if (result) {
+      return result;
+    }
+    tag.inBand = true;
+    tag.seq = in->seq;
+    tag.index = in->index;
+    m_chain_tags.push_back(tag);
+    zmq_msg_close(&in->msg);
+    m_inband_inputs.pop_front();
+    m_last_input = "in-band";
+    m_status.nInputsDone++;
+    m_eventsInChain++;
+    return 0;
+  }
+
+  if (!m_prefetch.empty()) {
+    submitPrefetch();
+    uint64_t consumed = m_pf_consumed.load(std::memory_order_relaxed);
+    if (consumed == m_pf_requested.load(std::memory_order_relaxed)) {
+      return EAGAIN;
+    }
+    if (consumed == m_pf_loaded.load(std::memory_order_acquire)) {
+      // count each input file only once, this is polled continuously
+      if (!m_prefetch_stalled) {
+        m_prefetch_stalls++;
+        m_prefetch_stalled = true;
+      }
+      return EAGAIN;
+    }
+    prefetchSlot_t *slot = &m_prefetch[consumed % m_prefetch.size()];
+    if (slot->error) {
+      return slot->error;
+    }
+    int result = enqueueEventToDevice(slot->data, slot->size);
+    if (result) {
+      return result;
+    }
+    m_last_input = slot->filename;
+    m_prefetch_stalled = false;
+    m_pf_consumed.store(consumed + 1, std::memory_order_release);
+    m_chain_tags.push_back(tag);
+    m_status.nInputsDone++;
+    m_eventsInChain++;
+    submitPrefetch();
+    return 0;
+  }
+
   int result = enqueueEventToDevice(m_input_iter->c_str());
   if (result) {
     return result;
   }
   m_last_input = *m_input_iter;
   m_input_iter = m_input_file_list.erase(m_input_iter);
+  m_chain_tags.push_back(tag);
   m_status.nInputsDone++;
   m_eventsInChain++;
   return 0;
@@ -254,26 +412,42 @@ int crorc_hwcf_coproc_handler::pollForEventToDeviceCompletion() {
     return EAGAIN;
   }
   m_es2dev->updateChannelStatus(report);
-  m_eb2dev_readptr =
-      report->offset + ((report->calc_event_size & 0x3fffffff) << 2);
+  // events complete in the order they were announced
+  int64_t offset = m_eb2dev_ring->release();
+  if (offset != (int64_t)report->offset) {
+    printf("pollForEventToDeviceCompletion: unexpected completion at offset "
+           "0x%lx, expected 0x%lx\n",
+           report->offset, offset);
+  }
   if (m_es2dev->releaseEvent(librorcEventReference) != 0) {
     printf("pollForEventToDeviceCompletion: failed to release reference %ld\n",
            librorcEventReference);
   }
-  uint64_t buffersize = m_es2dev->m_eventBuffer->size();
-  if (m_eb2dev_readptr >= buffersize) {
-    m_eb2dev_readptr -= buffersize;
-  }
   return 0;
 }
 
 bool crorc_hwcf_coproc_handler::pollForEventToHost(
     librorc::EventDescriptor **report, const uint32_t **event,
     uint64_t *reference) {
+  if (m_shipped_outstanding) {
+    releaseShippedEvents();
+  }
+  if (!m_inband_outputs.empty()) {
+    sendInBandResults();
+  }
   bool result = m_es2host->getNextEvent(report, event, reference);
   if (result) {
     m_es2host->updateChannelStatus(*report);
     m_eventsInChain--;
+    if (!m_chain_tags.empty()) {
+      m_host_tag = m_chain_tags.front();
+      m_chain_tags.pop_front();
+    } else {
+      m_host_tag.inBand = false;
+    }
+    if (m_fcf_stats) {
+      sampleFcfStats();
+    }
   }
   return result;
 }
@@ -289,6 +463,9 @@ void crorc_hwcf_coproc_handler::addInputFile(std::string filename) {
   m_input_iter = m_input_file_list.begin();
   m_input_end = m_input_file_list.end();
   m_status.nInputsQueued++;
+  if (!m_prefetch.empty()) {
+    submitPrefetch();
+  }
 }
 
 void crorc_hwcf_coproc_handler::addOutputFile(std::string filename) {
@@ -305,8 +482,110 @@ void crorc_hwcf_coproc_handler::addRefFile(std::string filename) {
   m_status.nRefsQueued++;
 }
 
+int crorc_hwcf_coproc_handler::startPrefetch(uint32_t depth) {
+  if (!m_prefetch.empty() || depth == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  m_prefetch.resize(depth);
+  for (size_t i = 0; i < m_prefetch.size(); i++) {
+    m_prefetch[i].data = NULL;
+    m_prefetch[i].size = 0;
+    m_prefetch[i].capacity = 0;
+    m_prefetch[i].error = 0;
+  }
+  m_prefetch_stop = false;
+  m_prefetch_thread =
+      std::thread(&crorc_hwcf_coproc_handler::prefetchThread, this);
+  return 0;
+}
+
+uint32_t crorc_hwcf_coproc_handler::prefetchFill() {
+  return m_pf_loaded.load(std::memory_order_acquire) -
+         m_pf_consumed.load(std::memory_order_relaxed);
+}
+
+const char *crorc_hwcf_coproc_handler::nextInputFile() {
+  if (!m_inband_inputs.empty()) {
+    return "in-band event";
+  }
+  uint64_t consumed = m_pf_consumed.load(std::memory_order_relaxed);
+  if (consumed != m_pf_requested.load(std::memory_order_relaxed)) {
+    return m_prefetch[consumed % m_prefetch.size()].filename.c_str();
+  }
+  return m_input_iter->c_str();
+}
+
+/** hand queued input files to the prefetch thread while slots are free **/
+void crorc_hwcf_coproc_handler::submitPrefetch() {
+  uint64_t requested = m_pf_requested.load(std::memory_order_relaxed);
+  uint64_t consumed = m_pf_consumed.load(std::memory_order_relaxed);
+  while (m_input_iter != m_input_end &&
+         requested - consumed < m_prefetch.size()) {
+    m_prefetch[requested % m_prefetch.size()].filename = *m_input_iter;
+    m_input_iter = m_input_file_list.erase(m_input_iter);
+    requested++;
+    m_pf_requested.store(requested, std::memory_order_release);
+  }
+}
+
+int crorc_hwcf_coproc_handler::readInputFile(prefetchSlot_t *slot) {
+  int fd = open(slot->filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return errno;
+  }
+  struct stat fd_stat;
+  if (fstat(fd, &fd_stat) != 0) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+  uint64_t size = fd_stat.st_size;
+  if (size > slot->capacity) {
+    uint8_t *data = (uint8_t *)realloc(slot->data, size);
+    if (!data) {
+      close(fd);
+      return ENOMEM;
+    }
+    slot->data = data;
+    slot->capacity = size;
+  }
+  posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+  uint64_t done = 0;
+  while (done < size) {
+    ssize_t ret = read(fd, slot->data + done, size - done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      int err = (ret < 0) ? errno : EIO;
+      close(fd);
+      return err;
+    }
+    done += ret;
+  }
+  close(fd);
+  slot->size = size;
+  return 0;
+}
+
+void crorc_hwcf_coproc_handler::prefetchThread() {
+  uint64_t loaded = m_pf_loaded.load(std::memory_order_relaxed);
+  while (!m_prefetch_stop) {
+    if (loaded == m_pf_requested.load(std::memory_order_acquire)) {
+      usleep(PREFETCH_IDLE_USLEEP);
+      continue;
+    }
+    prefetchSlot_t *slot = &m_prefetch[loaded % m_prefetch.size()];
+    slot->error = readInputFile(slot);
+    loaded++;
+    m_pf_loaded.store(loaded, std::memory_order_release);
+  }
+}
+
 bool crorc_hwcf_coproc_handler::inputFilesPending() {
-  return (m_input_iter != m_input_end);
+  return (m_input_iter != m_input_end) ||
+         (m_pf_consumed.load(std::memory_order_relaxed) !=
+          m_pf_requested.load(std::memory_order_relaxed));
 }
 
 bool crorc_hwcf_coproc_handler::outputFilesPending() {
@@ -364,15 +643,22 @@ int crorc_hwcf_coproc_handler::compareEventWithNextRefFile(
   uint32_t dmaWords = (report->calc_event_size & 0x3fffffff);
   ssize_t eventSize = (dmaWords << 2);
 
-  if (fd_stat.st_size != eventSize) {
+  // identical events are the common case, only decode on a difference
+  if (fd_stat.st_size == eventSize &&
+      memcmp(event, event_ref, eventSize) == 0) {
     munmap(event_ref, fd_stat.st_size);
-    errno = EFBIG;
-    return -1;
+    markRefFileDone();
+    return 0;
   }
 
-  int result = memcmp(event, event_ref, eventSize);
+  int result = m_cluster_compare.compare(event, dmaWords,
+                                         (const uint32_t *)event_ref,
+                                         fd_stat.st_size >> 2,
+                                         &m_compare_result);
   munmap(event_ref, fd_stat.st_size);
-  if (result != 0) {
+  if (result < 0) {
+    return -1;
+  } else if (result > 0) {
     errno = EILSEQ;
     return -1;
   }
@@ -391,8 +677,30 @@ int crorc_hwcf_coproc_handler::initializeZmq(int port) {
   if (zmq_bind(m_zmq_skt, zmq_bind_addr)) {
     return -1;
   }
-  m_zmq_pi.socket = m_zmq_skt;
-  m_zmq_pi.events = ZMQ_POLLIN;
+  m_zmq_event_skt = zmq_socket(m_zmq_ctx, ZMQ_PUSH);
+  if (!m_zmq_event_skt) {
+    return -1;
+  }
+  int eventLinger = INBAND_LINGER_MS;
+  zmq_setsockopt(m_zmq_event_skt, ZMQ_LINGER, &eventLinger,
+                 sizeof(eventLinger));
+  snprintf(zmq_bind_addr, 1024, "tcp://*:%d", port + HWCF_EVENT_PORT_OFFSET);
+  if (zmq_bind(m_zmq_event_skt, zmq_bind_addr)) {
+    return -1;
+  }
+
+  m_zmq_ack_skt = zmq_socket(m_zmq_ctx, ZMQ_PUSH);
+  if (!m_zmq_ack_skt) {
+    return -1;
+  }
+  // a STOP ack queued right before the handler is deleted still has to
+  // reach a feeder waiting for it
+  int ackLinger = INBAND_LINGER_MS;
+  zmq_setsockopt(m_zmq_ack_skt, ZMQ_LINGER, &ackLinger, sizeof(ackLinger));
+  snprintf(zmq_bind_addr, 1024, "tcp://*:%d", port + HWCF_ACK_PORT_OFFSET);
+  if (zmq_bind(m_zmq_ack_skt, zmq_bind_addr)) {
+    return -1;
+  }
   return 0;
 }
 
@@ -400,43 +708,305 @@ int crorc_hwcf_coproc_handler::pollZmq() {
   if (!m_zmq_ctx || !m_zmq_skt) {
     return -1;
   }
-  int zmq_ret = zmq_poll(&m_zmq_pi, 1, 0);
-  if (zmq_ret < 0) {
+  sendPendingAcks();
+  if (m_inband_inputs.size() >= INBAND_MAX_QUEUED_EVENTS) {
+    // leave further commands or events in the socket to throttle the feeder
+    return 0;
+  }
+  if (m_inband_cmd_active) {
+    // the remaining frames of the command are already in the socket
+    return receiveInBandEvents();
+  }
+  if (!zmqCommandPending()) {
+    return 0;
+  }
+  zmq_msg_t msg;
+  zmq_msg_init(&msg);
+  if (zmq_msg_recv(&msg, m_zmq_skt, 0) == -1) {
+    zmq_msg_close(&msg);
+    return -1;
+  }
+  const char *data = (const char *)zmq_msg_data(&msg);
+  size_t size = zmq_msg_size(&msg);
+  int result;
+  hwcfCmdHeader_t hdr;
+  if (size == sizeof(hwcfCmdHeader_t)) {
+    memcpy(&hdr, data, sizeof(hdr));
+  }
+  if (size == sizeof(hwcfCmdHeader_t) && hdr.magic == HWCF_PROTOCOL_MAGIC) {
+    result = handleBinaryCommand(&hdr);
+  } else {
+    result = handleTextCommand(data, size);
+  }
+  zmq_msg_close(&msg);
+  // drop anything left of unexpected multipart messages
+  if (!m_inband_cmd_active) {
+    discardMessageFrames();
+  }
+  return result;
+}
+
+void crorc_hwcf_coproc_handler::sendPendingAcks() {
+  if (!m_flush_ack_pending && !m_stop_ack_pending) {
+    return;
+  }
+  if (inputFilesPending() || outputFilesPending() || refFilesPending() ||
+      inBandInputsPending() || inBandOutputsPending() || m_eventsInChain) {
+    return;
+  }
+  if (m_flush_ack_pending) {
+    sendAck(HWCF_ACK_FLUSH, m_flush_seq, 0);
+    m_flush_ack_pending = false;
+  }
+  if (m_stop_ack_pending) {
+    sendAck(HWCF_ACK_STOP, m_stop_seq, 0);
+    m_stop_ack_pending = false;
+  }
+}
+
+/** "input;output;reference" or ";;;" **/
+int crorc_hwcf_coproc_handler::handleTextCommand(const char *data,
+                                                 size_t size) {
+  // ignore a terminating NUL sent by C clients
+  size = strnlen(data, size);
+  if (size == 3 && memcmp(data, ";;;", 3) == 0) {
+    m_status.stopReceived = true;
+    m_stop_ack_pending = true;
+    m_stop_seq = 0;
+    return 0;
+  }
+  const char *end = data + size;
+  const char *sep1 = (const char *)memchr(data, ';', size);
+  if (!sep1) {
+    return -1;
+  }
+  const char *sep2 = (const char *)memchr(sep1 + 1, ';', end - sep1 - 1);
+  if (!sep2) {
     return -1;
-  } else if (zmq_ret > 0) {
-    char zmq_buffer[ZMQ_BUF_SIZE];
-    memset(zmq_buffer, 0, ZMQ_BUF_SIZE);
-    int ret = zmq_recv(m_zmq_skt, zmq_buffer, ZMQ_BUF_SIZE, 0);
-    if (ret == -1) {
-      return -1;
+  }
+  addInputFile(std::string(data, sep1 - data));
+  if (sep2 > sep1 + 1) {
+    addOutputFile(std::string(sep1 + 1, sep2 - sep1 - 1));
+  }
+  if (end > sep2 + 1) {
+    addRefFile(std::string(sep2 + 1, end - sep2 - 1));
+  }
+  return 0;
+}
+
+int crorc_hwcf_coproc_handler::handleBinaryCommand(const hwcfCmdHeader_t *hdr) {
+  if (hdr->version != HWCF_PROTOCOL_VERSION) {
+    sendAck(HWCF_ACK_ERROR, hdr->seq, 0);
+    return -1;
+  }
+  switch (hdr->type) {
+  case HWCF_CMD_FLUSH:
+    m_flush_ack_pending = true;
+    m_flush_seq = hdr->seq;
+    return 0;
+  case HWCF_CMD_STOP:
+    m_status.stopReceived = true;
+    m_stop_ack_pending = true;
+    m_stop_seq = hdr->seq;
+    return 0;
+  case HWCF_CMD_EVENTS:
+    m_inband_cmd = *hdr;
+    m_inband_cmd_accepted = 0;
+    m_inband_cmd_active = true;
+    return receiveInBandEvents();
+  case HWCF_CMD_FILES:
+    break;
+  default:
+    sendAck(HWCF_ACK_ERROR, hdr->seq, 0);
+    return -1;
+  }
+
+  int more = 0;
+  size_t moreSize = sizeof(more);
+  zmq_getsockopt(m_zmq_skt, ZMQ_RCVMORE, &more, &moreSize);
+  if (!more) {
+    sendAck(HWCF_ACK_ERROR, hdr->seq, 0);
+    return -1;
+  }
+  zmq_msg_t body;
+  zmq_msg_init(&body);
+  if (zmq_msg_recv(&body, m_zmq_skt, 0) == -1) {
+    zmq_msg_close(&body);
+    return -1;
+  }
+  const char *p = (const char *)zmq_msg_data(&body);
+  const char *end = p + zmq_msg_size(&body);
+  uint32_t accepted = 0;
+  while (accepted < hdr->count) {
+    // three NUL-terminated strings per event
+    const char *str[3];
+    size_t len[3];
+    int i;
+    for (i = 0; i < 3 && p < end; i++) {
+      str[i] = p;
+      len[i] = strnlen(p, end - p);
+      if (str[i] + len[i] == end) {
+        break;
+      }
+      p += len[i] + 1;
+    }
+    if (i < 3 || len[0] == 0) {
+      break;
+    }
+    addInputFile(std::string(str[0], len[0]));
+    if (len[1]) {
+      addOutputFile(std::string(str[1], len[1]));
+    }
+    if (len[2]) {
+      addRefFile(std::string(str[2], len[2]));
     }
-    std::string rcvd = std::string(zmq_buffer);
-    if (rcvd.compare(";;;") == 0) {
-      m_status.stopReceived = true;
+    accepted++;
+  }
+  zmq_msg_close(&body);
+  sendAck(accepted == hdr->count ? HWCF_ACK_FILES : HWCF_ACK_ERROR, hdr->seq,
+          accepted);
+  return (accepted == hdr->count) ? 0 : -1;
+}
+
+/**
+ * receive the events of m_inband_cmd until the queue is full. The rest of
+ * the command stays in the socket and is received by later calls. An
+ * invalid event ends the command, the events before it stay queued.
+ **/
+int crorc_hwcf_coproc_handler::receiveInBandEvents() {
+  int more = 0;
+  size_t moreSize = sizeof(more);
+  zmq_getsockopt(m_zmq_skt, ZMQ_RCVMORE, &more, &moreSize);
+  while (more && m_inband_cmd_accepted < m_inband_cmd.count) {
+    if (m_inband_inputs.size() >= INBAND_MAX_QUEUED_EVENTS) {
       return 0;
     }
-    size_t found = rcvd.find_first_of(";");
-    if (found == std::string::npos) {
-      return -1;
+    // received in place, deque elements do not move when appending
+    m_inband_inputs.push_back(inBandInput_t());
+    inBandInput_t *in = &m_inband_inputs.back();
+    zmq_msg_init(&in->msg);
+    if (zmq_msg_recv(&in->msg, m_zmq_skt, 0) == -1) {
+      zmq_msg_close(&in->msg);
+      m_inband_inputs.pop_back();
+      break;
     }
-    std::string inputfile = rcvd.substr(0, found);
-    rcvd = rcvd.substr(found + 1, -1);
-    found = rcvd.find_first_of(";");
-    if (found == std::string::npos) {
-      return -1;
+    // an event the DMA engine cannot take must not stop the channel later
+    size_t size = zmq_msg_size(&in->msg);
+    if (size == 0 || size > m_eb2dev_ring->size() || (size & 3)) {
+      zmq_msg_close(&in->msg);
+      m_inband_inputs.pop_back();
+      break;
     }
-    std::string outputfile = rcvd.substr(0, found);
-    std::string reffile = rcvd.substr(found + 1, -1);
+    in->seq = m_inband_cmd.seq;
+    in->index = m_inband_cmd_accepted;
+    more = zmq_msg_more(&in->msg);
+    m_inband_cmd_accepted++;
+    m_status.nInputsQueued++;
+  }
+  m_inband_cmd_active = false;
+  discardMessageFrames();
+  uint32_t accepted = m_inband_cmd_accepted;
+  bool complete = (accepted == m_inband_cmd.count);
+  sendAck(complete ? HWCF_ACK_EVENTS : HWCF_ACK_ERROR, m_inband_cmd.seq,
+          accepted);
+  return complete ? 0 : -1;
+}
+
+void crorc_hwcf_coproc_handler::shipEventToZmq(
+    librorc::EventDescriptor *report, const uint32_t *event,
+    uint64_t reference) {
+  inBandOutput_t out;
+  out.hdr.magic = HWCF_PROTOCOL_MAGIC;
+  out.hdr.version = HWCF_PROTOCOL_VERSION;
+  out.hdr.type = HWCF_CMD_EVENTS;
+  out.hdr.seq = m_host_tag.seq;
+  out.hdr.index = m_host_tag.index;
+  out.hdr.flags = (report->calc_event_size >> 30) & 0x3;
+  out.hdr.size = (report->calc_event_size & 0x3fffffff) << 2;
+  out.event = event;
+  out.reference = reference;
+  m_inband_outputs.push_back(out);
+  m_shipped_outstanding++;
+  sendInBandResults();
+}
 
-    addInputFile(inputfile);
-    if (!outputfile.empty()) {
-      addOutputFile(outputfile);
+/** hand results to ZMQ in order, keep them in the DMA buffer if it is busy **/
+void crorc_hwcf_coproc_handler::sendInBandResults() {
+  while (!m_inband_outputs.empty()) {
+    inBandOutput_t *out = &m_inband_outputs.front();
+    // the remaining frames of a message are always accepted if the first
+    // one was, so only the header can fail with EAGAIN
+    if (zmq_send(m_zmq_event_skt, &out->hdr, sizeof(out->hdr),
+                 ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1) {
+      return;
     }
-    if (!reffile.empty()) {
-      addRefFile(reffile);
+    shippedEvent_t *shipped = new shippedEvent_t;
+    shipped->handler = this;
+    shipped->reference = out->reference;
+    zmq_msg_t msg;
+    zmq_msg_init_data(&msg, (void *)out->event, out->hdr.size,
+                      freeShippedEvent, shipped);
+    if (zmq_msg_send(&msg, m_zmq_event_skt, ZMQ_DONTWAIT) == -1) {
+      // releases the event through freeShippedEvent()
+      zmq_msg_close(&msg);
     }
+    m_status.nOutputsDone++;
+    m_inband_outputs.pop_front();
   }
-  return 0;
+}
+
+/** called by ZMQ, possibly from its I/O thread, once an event is sent **/
+void crorc_hwcf_coproc_handler::freeShippedEvent(void *data, void *hint) {
+  shippedEvent_t *shipped = (shippedEvent_t *)hint;
+  crorc_hwcf_coproc_handler *handler = shipped->handler;
+  {
+    std::lock_guard<std::mutex> lock(handler->m_shipped_lock);
+    handler->m_shipped_done.push_back(shipped->reference);
+  }
+  delete shipped;
+}
+
+/** release shipped events in the handler thread, librorc is not thread safe **/
+void crorc_hwcf_coproc_handler::releaseShippedEvents() {
+  {
+    std::lock_guard<std::mutex> lock(m_shipped_lock);
+    m_shipped_release.swap(m_shipped_done);
+  }
+  for (size_t i = 0; i < m_shipped_release.size(); i++) {
+    releaseEventToHost(m_shipped_release[i]);
+  }
+  m_shipped_outstanding -= m_shipped_release.size();
+  m_shipped_release.clear();
+}
+
+void crorc_hwcf_coproc_handler::discardMessageFrames() {
+  int more = 0;
+  size_t moreSize = sizeof(more);
+  zmq_getsockopt(m_zmq_skt, ZMQ_RCVMORE, &more, &moreSize);
+  while (more) {
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    zmq_msg_recv(&msg, m_zmq_skt, 0);
+    more = zmq_msg_more(&msg);
+    zmq_msg_close(&msg);
+  }
+}
+
+void crorc_hwcf_coproc_handler::sendAck(uint16_t type, uint32_t seq,
+                                        uint32_t count) {
+  if (!m_zmq_ack_skt) {
+    return;
+  }
+  hwcfAck_t ack;
+  ack.magic = HWCF_PROTOCOL_MAGIC;
+  ack.version = HWCF_PROTOCOL_VERSION;
+  ack.type = type;
+  ack.seq = seq;
+  ack.count = count;
+  ack.nInputsDone = m_status.nInputsDone;
+  ack.nOutputsDone = m_status.nOutputsDone;
+  // never block the event loop, acknowledgements are dropped without feeder
+  zmq_send(m_zmq_ack_skt, &ack, sizeof(ack), ZMQ_DONTWAIT);
 }
 
 struct streamStatus_t crorc_hwcf_coproc_handler::getStatus() {
@@ -445,9 +1015,39 @@ struct streamStatus_t crorc_hwcf_coproc_handler::getStatus() {
   return statuscopy;
 }
 
+int crorc_hwcf_coproc_handler::zmqFd() {
+  int fd = -1;
+  size_t len = sizeof(fd);
+  if (!m_zmq_skt || zmq_getsockopt(m_zmq_skt, ZMQ_FD, &fd, &len)) {
+    return -1;
+  }
+  return fd;
+}
+
+bool crorc_hwcf_coproc_handler::zmqCommandPending() {
+  // ZMQ_EVENTS also processes the socket's internal commands and rearms
+  // the ZMQ_FD notification, no system call if nothing changed
+  int events = 0;
+  size_t len = sizeof(events);
+  if (zmq_getsockopt(m_zmq_skt, ZMQ_EVENTS, &events, &len)) {
+    return false;
+  }
+  return events & ZMQ_POLLIN;
+}
+
+bool crorc_hwcf_coproc_handler::isIdle() {
+  // shipped events pin DMA buffer space until they are released here
+  return m_eventsInChain == 0 && !inputFilesPending() &&
+         !inBandInputsPending() && !inBandOutputsPending() &&
+         m_shipped_outstanding == 0 && !m_inband_cmd_active &&
+         !m_flush_ack_pending && !m_stop_ack_pending &&
+         !(m_zmq_skt && zmqCommandPending());
+}
+
 bool crorc_hwcf_coproc_handler::isDone() {
   return m_status.stopReceived && !inputFilesPending() &&
-         !outputFilesPending() && !refFilesPending();
+         !outputFilesPending() && !refFilesPending() &&
+         !inBandInputsPending() && !inBandOutputsPending();
 }
 
 uint32_t crorc_hwcf_coproc_handler::fcfProcTimeCC() {
@@ -477,9 +1077,15 @@ uint32_t crorc_hwcf_coproc_handler::fcfXoffTimeCC() {
   if (deadtime > 0) {
     m_es2host->m_link->setDdlReg(RORC_REG_DDL_DEADTIME, 0);
   }
+  m_xoff_total_cc += deadtime;
   return deadtime;
 }
 
+uint64_t crorc_hwcf_coproc_handler::fcfXoffTotalCC() {
+  fcfXoffTimeCC();
+  return m_xoff_total_cc;
+}
+
 uint32_t crorc_hwcf_coproc_handler::fcfMergerInputFifoMax() {
   uint32_t max =  m_es2host->m_link->ddlReg(RORC_REG_FCF_STS_CFD);
   return max;
@@ -493,3 +1099,50 @@ uint32_t crorc_hwcf_coproc_handler::fcfDividerInputFifoMax() {
 void crorc_hwcf_coproc_handler::fcfClearStats() {
   m_fcf->clearErrors();
 }
+
+int crorc_hwcf_coproc_handler::enableStatsSampling(uint32_t interval,
+                                                   const char *traceFile) {
+  fcf_stats *stats = NULL;
+  try {
+    stats = new fcf_stats(m_es2dev_id, interval, traceFile);
+  }
+  catch (int) {
+    // errno is still set by fopen()
+    return -1;
+  }
+  delete m_fcf_stats;
+  m_fcf_stats = stats;
+  m_stats_events = 0;
+  fcfClearStats();
+  m_xoff_sampled_cc = fcfXoffTotalCC();
+  return 0;
+}
+
+void crorc_hwcf_coproc_handler::sampleFcfStats() {
+  uint32_t interval = m_fcf_stats->interval();
+  uint64_t n = m_stats_events++;
+  if (n % interval == 0) {
+    fcfStatsSample_t sample;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    sample.event = n;
+    sample.timestamp_us = now.tv_sec * 1000000ULL + now.tv_usec;
+    sample.value[FCF_STAT_PROC_TIME] = fcfProcTimeCC();
+    sample.value[FCF_STAT_INPUT_IDLE_TIME] = fcfInputIdleTimeCC();
+    // other reads of the counter are accumulated in the total as well
+    sample.value[FCF_STAT_XOFF_TIME] =
+        (uint32_t)(fcfXoffTotalCC() - m_xoff_sampled_cc);
+    // NaN if the merger did not run at all
+    float idle = fcfMergerIdlePercent();
+    sample.value[FCF_STAT_MERGER_IDLE] =
+        (idle >= 0 && idle <= 100) ? (uint32_t)(idle * 100 + 0.5) : 0;
+    sample.value[FCF_STAT_MERGER_FIFO_MAX] = fcfMergerInputFifoMax();
+    sample.value[FCF_STAT_DIVIDER_FIFO_MAX] = fcfDividerInputFifoMax();
+    m_fcf_stats->record(&sample);
+  }
+  // only the next sampled event is accumulated in the counters
+  if ((n + 1) % interval == 0) {
+    fcfClearStats();
+    m_xoff_sampled_cc = fcfXoffTotalCC();
+  }
+}
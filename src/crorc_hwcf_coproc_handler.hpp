@@ -19,11 +19,30 @@
 #define CRORC_HWCF_COPROC_HANDLER_HPP
 
 #include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 #include <stdlib.h>
 #include <stdint.h>
 #include <zmq.h>
 #define LIBRORC_INTERNAL
 #include <librorc.h>
+#include "thread_utils.hh"
+#include "ring_allocator.hh"
+#include "fcf_config.hh"
+#include "fcf_cluster_compare.hh"
+#include "fcf_stats.hh"
+#include "crorc_hwcf_coproc_protocol.hpp"
+
+/** sleep time of the idle prefetch thread **/
+#define PREFETCH_IDLE_USLEEP 100
+/** stop receiving commands and events while this many events are queued **/
+#define INBAND_MAX_QUEUED_EVENTS 256
+/** time to send remaining in-band results and acks on deletion **/
+#define INBAND_LINGER_MS 1000
 
 struct streamStatus_t {
   uint64_t nInputsQueued;
@@ -35,42 +54,6 @@ struct streamStatus_t {
   bool stopReceived;
 };
 
-struct fcfConfig_t {
-  uint16_t bypass_merger;
-  uint16_t charge_fluctuation;
-  uint16_t cluster_lower_limit;
-  uint16_t cluster_qmax_lower_limit;
-  uint16_t deconvolute_pad;
-  uint16_t merger_distance;
-  uint16_t noise_suppression;
-  uint16_t noise_suppression_minimum;
-  uint16_t noise_suppression_neighbor;
-  uint16_t single_pad_suppression;
-  uint16_t single_seq_limit;
-  uint16_t tag_deconvoluted_clusters;
-  uint16_t tag_border_clusters;
-  uint16_t correct_edge_clusters;
-  uint16_t use_time_follow;
-};
-
-const struct fcfConfig_t fcfDefaultConfig = {
-  bypass_merger : 0,
-  charge_fluctuation : 0,
-  cluster_lower_limit : 10,
-  cluster_qmax_lower_limit : 0,
-  deconvolute_pad : 0,
-  merger_distance : 4,
-  noise_suppression : 0,
-  noise_suppression_minimum : 0,
-  noise_suppression_neighbor : 0,
-  single_pad_suppression : 0,
-  single_seq_limit : 0,
-  tag_deconvoluted_clusters : 0,
-  tag_border_clusters : 0,
-  correct_edge_clusters : 0,
-  use_time_follow : 1
-};
-
 class crorc_hwcf_coproc_handler {
 public:
   crorc_hwcf_coproc_handler(librorc::device *dev, librorc::bar *bar,
@@ -80,11 +63,78 @@ public:
   // int initializeDmaToDevice(ssize_t bufferSize);
   int initializeClusterFinder(const char *tpcMappingFile, uint32_t tpcPatch,
                               uint32_t rcuVersion, struct fcfConfig_t fcfcfg);
+  /**
+   * reprogram the FCF parameters, keeping the mapping of
+   * initializeClusterFinder(). No events may be in the chain.
+   **/
+  void configureClusterFinder(struct fcfConfig_t fcfcfg);
+  /**
+   * let initializeClusterFinder() reuse a binary image of the parsed
+   * mapping in cacheDir, see fcf_mapping::readMappingFileCached(). With
+   * onlyChanged, the mapping RAM is read back and only differing entries
+   * are written. Call before initializeClusterFinder().
+   **/
+  void setMappingCache(const char *cacheDir, bool onlyChanged);
+  /** mapping RAM entries written by initializeClusterFinder() **/
+  uint32_t mappingWordsWritten() { return m_mapping_words_written; }
+  /**
+   * receive commands on a PULL socket at port and send acknowledgements on
+   * a PUSH socket at port + HWCF_ACK_PORT_OFFSET, see
+   * crorc_hwcf_coproc_protocol.hpp
+   **/
   int initializeZmq(int port);
   int pollZmq();
+  /** acknowledge FLUSH and STOP commands once all events are processed **/
+  void sendPendingAcks();
+  /**
+   * file descriptor signalling activity on the command socket, see
+   * ZMQ_FD. It only becomes readable again after zmqCommandPending() or
+   * pollZmq() has seen the socket without pending commands.
+   **/
+  int zmqFd();
+  bool zmqCommandPending();
+
+  /** in-band events received with HWCF_CMD_EVENTS and not yet enqueued **/
+  bool inBandInputsPending() { return !m_inband_inputs.empty(); }
+  /** in-band results not yet handed to ZMQ **/
+  bool inBandOutputsPending() { return !m_inband_outputs.empty(); }
+  /** true if the last event from pollForEventToHost() was an in-band event **/
+  bool hostEventInBand() { return m_host_tag.inBand; }
+  /**
+   * send the clusters of the last in-band event from pollForEventToHost()
+   * without copying. The event is released once ZMQ is done with it, do not
+   * call releaseEventToHost() for it.
+   **/
+  void shipEventToZmq(librorc::EventDescriptor *report, const uint32_t *event,
+                      uint64_t reference);
 
   int enqueueEventToDevice(const char *filename);
+  int enqueueEventToDevice(const void *data, uint64_t size);
   int enqueueNextEventToDevice();
+  /**
+   * enqueue an event held by the caller, tracked in eventsInChain() like
+   * the input files. Returns 0 or an error number, EAGAIN if the buffer or
+   * the DMA FIFO is full.
+   **/
+  int enqueueEventFromMemory(const void *data, uint64_t size);
+
+  /**
+   * Read the next depth input files in a background thread into staging
+   * buffers. enqueueNextEventToDevice() then only copies the prefetched
+   * data into the event buffer and announces it. Must be called before the
+   * first input file is added.
+   **/
+  int startPrefetch(uint32_t depth);
+
+  /** how events crossing the end of the to-device buffer are placed **/
+  void setToDeviceRingMode(ringMode_t mode);
+  /** to-device buffer occupancy, see ring_allocator **/
+  ring_allocator *toDeviceRing() { return m_eb2dev_ring; }
+  uint32_t prefetchDepth() { return m_prefetch.size(); }
+  /** number of prefetched input files ready to be enqueued **/
+  uint32_t prefetchFill();
+  /** number of times the next input file was not prefetched in time **/
+  uint64_t prefetchStalls() { return m_prefetch_stalls; }
   int pollForEventToDeviceCompletion();
   bool pollForEventToHost(librorc::EventDescriptor **report,
                           const uint32_t **event, uint64_t *reference);
@@ -97,38 +147,117 @@ public:
   bool outputFilesPending();
   bool refFilesPending();
   const char *lastInputFile() { return m_last_input.c_str(); };
-  const char *nextInputFile() { return m_input_iter->c_str(); };
+  const char *nextInputFile();
   const char *nextRefFile() { return m_ref_iter->c_str(); };
   const char *nextOutputFile() { return m_output_iter->c_str(); };
 
   int writeEventToNextOutputFile(librorc::EventDescriptor *report,
                                  const uint32_t *event);
+  /**
+   * compare the clusters of event with the next reference file regardless of
+   * their order. Returns 0 on a match, -1 with errno EILSEQ if clusters or
+   * headers differ, see lastCompareResult(), or EBADMSG if an event cannot
+   * be decoded.
+   **/
   int compareEventWithNextRefFile(librorc::EventDescriptor *report,
                                   const uint32_t *event);
+  void setCompareTolerance(fcfTolerance_t tolerance) {
+    m_cluster_compare.setTolerance(tolerance);
+  }
+  fcfCompareResult_t lastCompareResult() { return m_compare_result; }
   uint64_t eventsInChain() { return m_eventsInChain; };
   uint32_t fcfProcTimeCC();
   uint32_t fcfInputIdleTimeCC();
   uint32_t fcfXoffTimeCC();
+  /**
+   * FCF xoff time accumulated over all reads of the counter. Reads it on
+   * each call, so it is current in any mode, also with stats sampling.
+   **/
+  uint64_t fcfXoffTotalCC();
   uint32_t fcfNumCandidates();
   float fcfMergerIdlePercent();
   uint32_t fcfMergerInputFifoMax();
   uint32_t fcfDividerInputFifoMax();
   void fcfClearStats();
+  /**
+   * read the FCF counters after every interval-th event received with
+   * pollForEventToHost() into fcfStats() and clear them before the next
+   * sampled event. The counters must not be read or cleared elsewhere
+   * while sampling is enabled, except the xoff time, which is sampled as
+   * the difference of fcfXoffTotalCC(). Returns 0 or -1 with errno set if
+   * the trace file cannot be created.
+   **/
+  int enableStatsSampling(uint32_t interval, const char *traceFile = NULL);
+  fcf_stats *fcfStats() { return m_fcf_stats; }
   struct streamStatus_t getStatus();
   bool isDone();
+  /**
+   * nothing to do until the next command arrives: no events in the chain,
+   * no pending inputs, in-band results, unreleased shipped events or acks
+   * and no command in the socket
+   **/
+  bool isIdle();
 
   void markRefFileDone();
 
 protected:
+  struct prefetchSlot_t {
+    std::string filename;
+    uint8_t *data;
+    uint64_t size;
+    uint64_t capacity;
+    int error;
+  };
+
+  struct inBandInput_t {
+    zmq_msg_t msg;
+    uint32_t seq;
+    uint32_t index;
+  };
+
+  struct inBandOutput_t {
+    hwcfEventHeader_t hdr;
+    const uint32_t *event;
+    uint64_t reference;
+  };
+
+  /** origin of an event in the chain, events complete in order **/
+  struct chainTag_t {
+    bool inBand;
+    uint32_t seq;
+    uint32_t index;
+  };
+
+  /** free callback argument of a shipped event **/
+  struct shippedEvent_t {
+    crorc_hwcf_coproc_handler *handler;
+    uint64_t reference;
+  };
+
+  int handleTextCommand(const char *data, size_t size);
+  int receiveInBandEvents();
+  void sendInBandResults();
+  void releaseShippedEvents();
+  static void freeShippedEvent(void *data, void *hint);
+  int handleBinaryCommand(const hwcfCmdHeader_t *hdr);
+  void discardMessageFrames();
+  void sendAck(uint16_t type, uint32_t seq, uint32_t count);
+
+  int readInputFile(prefetchSlot_t *slot);
+  void submitPrefetch();
+  void prefetchThread();
+
   std::string m_last_input;
   int64_t m_es2host_id;
   int64_t m_es2dev_id;
-  uint64_t m_eb2dev_writeptr;
-  uint64_t m_eb2dev_readptr;
+  ring_allocator *m_eb2dev_ring;
   uint64_t m_eventsInChain;
   librorc::event_stream *m_es2host;
   librorc::event_stream *m_es2dev;
   librorc::fastclusterfinder *m_fcf;
+  std::string m_mapping_cache_dir;
+  bool m_mapping_only_changed;
+  uint32_t m_mapping_words_written;
 
   std::list<std::string> m_input_file_list;
   std::list<std::string>::iterator m_input_end;
@@ -141,12 +270,54 @@ protected:
   std::list<std::string> m_ref_file_list;
   std::list<std::string>::iterator m_ref_end;
   std::list<std::string>::iterator m_ref_iter;
+  fcf_cluster_compare m_cluster_compare;
+  fcfCompareResult_t m_compare_result;
 
   void *m_zmq_ctx;
   void *m_zmq_skt;
-  zmq_pollitem_t m_zmq_pi;
+  void *m_zmq_ack_skt;
+  bool m_flush_ack_pending;
+  uint32_t m_flush_seq;
+  bool m_stop_ack_pending;
+  uint32_t m_stop_seq;
+
+  // in-band events
+  void *m_zmq_event_skt;
+  std::deque<inBandInput_t> m_inband_inputs;
+  std::deque<inBandOutput_t> m_inband_outputs;
+  std::deque<chainTag_t> m_chain_tags;
+  chainTag_t m_host_tag;
+  // references of shipped events, filled from the ZMQ I/O thread
+  std::mutex m_shipped_lock;
+  std::vector<uint64_t> m_shipped_done;
+  std::vector<uint64_t> m_shipped_release;
+  uint64_t m_shipped_outstanding;
+  // HWCF_CMD_EVENTS command whose events are still partly in the socket
+  bool m_inband_cmd_active;
+  hwcfCmdHeader_t m_inband_cmd;
+  uint32_t m_inband_cmd_accepted;
 
   struct streamStatus_t m_status;
+
+  // input prefetching: slots are requested, loaded and consumed in order
+  std::vector<prefetchSlot_t> m_prefetch;
+  std::thread m_prefetch_thread;
+  std::atomic<bool> m_prefetch_stop;
+  uint64_t m_prefetch_stalls;
+  bool m_prefetch_stalled;
+
+  void sampleFcfStats();
+  fcf_stats *m_fcf_stats;
+  uint64_t m_stats_events;
+  uint64_t m_xoff_total_cc;
+  uint64_t m_xoff_sampled_cc; // total at the start of the sampled event
+
+  char m_pad0[CACHELINE_SIZE];
+  std::atomic<uint64_t> m_pf_requested; // written by the main thread
+  std::atomic<uint64_t> m_pf_consumed;  // written by the main thread
+  char m_pad1[CACHELINE_SIZE];
+  std::atomic<uint64_t> m_pf_loaded; // written by the prefetch thread
+  char m_pad2[CACHELINE_SIZE];
 };
 
 #endif
@@ -0,0 +1,103 @@
+/**
+ *  crorc_hwcf_coproc_protocol.hpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+#ifndef CRORC_HWCF_COPROC_PROTOCOL_HPP
+#define CRORC_HWCF_COPROC_PROTOCOL_HPP
+
+#include <stdint.h>
+
+/**
+ * Binary command protocol of crorc_hwcf_coproc_zmq, received on the PULL
+ * socket at ZMQ_BASE_PORT + channel next to the "in;out;ref" and ";;;"
+ * text messages. All integers are little endian.
+ *
+ * Command: multipart message
+ *   frame 0: hwcfCmdHeader_t
+ *   frame 1: HWCF_CMD_FILES only: count triples of NUL-terminated strings
+ *            "input\0output\0reference\0", output and reference may be
+ *            empty
+ *   frames 1..count: HWCF_CMD_EVENTS only: one raw DDL event per frame
+ *
+ * HWCF_CMD_FILES:  queue count events
+ * HWCF_CMD_EVENTS: queue count in-band events. They are copied from the
+ *                  message directly into the DMA buffer, no file is read.
+ *                  An empty event, one that is not a multiple of 4 bytes
+ *                  or larger than the to-device buffer is dropped with the
+ *                  rest of the command and answered with HWCF_ACK_ERROR,
+ *                  count is the number of events queued before it.
+ * HWCF_CMD_FLUSH:  acknowledge once all events queued so far are processed
+ * HWCF_CMD_STOP:   no more events follow, acknowledged once all events are
+ *                  processed. Same as the ";;;" text message.
+ *
+ * Acknowledgements (hwcfAck_t) are sent without blocking on a PUSH socket
+ * at ZMQ_BASE_PORT + HWCF_ACK_PORT_OFFSET + channel. They are dropped if
+ * no feeder is connected.
+ *
+ * The clusters of in-band events are sent on a PUSH socket at
+ * ZMQ_BASE_PORT + HWCF_EVENT_PORT_OFFSET + channel as two frames,
+ * hwcfEventHeader_t and the cluster data, in the order the events were
+ * received. The cluster data frame is sent directly from the DMA buffer.
+ **/
+#define HWCF_PROTOCOL_MAGIC 0x46435748 // "HWCF"
+#define HWCF_PROTOCOL_VERSION 1
+#define HWCF_ACK_PORT_OFFSET 100
+#define HWCF_EVENT_PORT_OFFSET 200
+
+enum hwcfCmdType_t {
+  HWCF_CMD_FILES = 1,
+  HWCF_CMD_FLUSH = 2,
+  HWCF_CMD_STOP = 3,
+  HWCF_CMD_EVENTS = 4
+};
+
+enum hwcfAckType_t {
+  HWCF_ACK_FILES = 1,
+  HWCF_ACK_FLUSH = 2,
+  HWCF_ACK_STOP = 3,
+  HWCF_ACK_ERROR = 4,
+  HWCF_ACK_EVENTS = 5
+};
+
+struct hwcfCmdHeader_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+  uint32_t seq; // chosen by the sender, returned in the acknowledgement
+  uint32_t count;
+};
+
+struct hwcfAck_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+  uint32_t seq;
+  uint32_t count; // HWCF_ACK_FILES/EVENTS: number of accepted events
+  uint64_t nInputsDone;
+  uint64_t nOutputsDone;
+};
+
+struct hwcfEventHeader_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;  // HWCF_CMD_EVENTS
+  uint32_t seq;   // of the command that carried the event
+  uint32_t index; // of the event within that command
+  uint32_t flags; // bit 0: RCU protocol error, bit 1: ALTRO channel error
+  uint32_t size;  // of the cluster data in bytes
+};
+
+#endif
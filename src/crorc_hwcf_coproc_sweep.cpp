@@ -0,0 +1,432 @@
+/**
+ *  crorc_hwcf_coproc_sweep.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/signal.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include "crorc_hwcf_coproc_handler.hpp"
+#include "fcf_cluster_decoder.hh"
+
+#define HELP_TEXT                                                              \
+  "usage: crorc_hwcf_coproc_sweep [parameters] [DDL file(s)]\n"                \
+  "    -n [Id]          Device ID, default:0\n"                                \
+  "    -c [Id]          channel ID, default:0\n"                               \
+  "    -r [rcuVersion]  TPC RCU version, default:1\n"                          \
+  "    -m [mappingfile] Path to AliRoot TPC Row Mapping File\n"                \
+  "    -z [MB]          DMA buffer size per direction, default:1024\n"        \
+  "    -R [passes]      process the corpus passes times per configuration, " \
+  "default:1\n"                                                                \
+  "    -q [depth]       maximum number of events in flight, default:0 "       \
+  "(unlimited)\n"                                                              \
+  "    FCF parameters as for crorc_hwcf_coproc_zmq, each taking a list of\n"  \
+  "    values like 0,2,4-6. All combinations are measured, one output row\n"  \
+  "    per configuration.\n"
+
+#define EB_SIZE 0x40000000 // 1GB
+
+/** time to wait for the next event before giving up on a configuration **/
+#define EVENT_TIMEOUT_US 5000000
+
+using namespace std;
+
+/** one swept FCF parameter **/
+struct sweepAxis_t {
+  int opt;
+  const char *name;
+  vector<uint32_t> values;
+};
+
+struct sweepResult_t {
+  uint64_t events;
+  uint64_t inputBytes;
+  uint64_t outputBytes;
+  uint64_t clusters;
+  uint64_t flaggedEvents;
+  uint64_t xoffTimeCC;
+  double mergerIdlePercent;
+  double seconds;
+  vector<uint32_t> latencyUs;
+  vector<uint32_t> procTimeCC;
+};
+
+std::atomic<bool> done(false);
+// Signal handler
+void abort_handler(int s) {
+  fprintf(stderr, "Caught signal %d\n", s);
+  if (done == true) {
+    exit(-1);
+  } else {
+    done = true;
+  }
+}
+
+inline long long timediff_us(struct timeval from, struct timeval to) {
+  return ((long long)(to.tv_sec - from.tv_sec) * 1000000LL +
+          (long long)(to.tv_usec - from.tv_usec));
+}
+
+int readFile(const char *filename, vector<uint32_t> *data) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  data->resize(st.st_size / 4);
+  ssize_t nbytes = read(fd, data->data(), data->size() * 4);
+  close(fd);
+  if (nbytes != (ssize_t)(data->size() * 4)) {
+    if (nbytes >= 0) {
+      errno = EIO;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/** value at fraction p of the sorted list, 0 if empty **/
+uint32_t percentile(vector<uint32_t> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t i = (size_t)(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+/**
+ * send all events of the corpus passes times through the FCF and collect
+ * throughput, cluster counts and per-event timing. Events complete in the
+ * order they were enqueued. The FCF counters are read after each event,
+ * with more than one event in flight they are attributed to the event
+ * leaving the chain. Returns 0 or -1 on a DMA error or timeout.
+ **/
+int runConfiguration(crorc_hwcf_coproc_handler *stream,
+                     const vector<vector<uint32_t> > &corpus, uint32_t passes,
+                     uint32_t maxInFlight, sweepResult_t *res) {
+  uint64_t total = (uint64_t)corpus.size() * passes;
+  uint64_t next = 0;
+  deque<struct timeval> enqueueTime;
+  res->events = 0;
+  res->inputBytes = 0;
+  res->outputBytes = 0;
+  res->clusters = 0;
+  res->flaggedEvents = 0;
+  res->xoffTimeCC = 0;
+  res->mergerIdlePercent = 0;
+  res->latencyUs.clear();
+  res->procTimeCC.clear();
+  res->latencyUs.reserve(total);
+  res->procTimeCC.reserve(total);
+
+  stream->fcfClearStats();
+  struct timeval tstart, tnow, tlast;
+  gettimeofday(&tstart, NULL);
+  tlast = tstart;
+  while (res->events < total && !done) {
+    while (next < total &&
+           (!maxInFlight || enqueueTime.size() < maxInFlight)) {
+      const vector<uint32_t> &ev = corpus[next % corpus.size()];
+      int result = stream->enqueueEventFromMemory(ev.data(), ev.size() * 4);
+      if (result == EAGAIN) {
+        break;
+      } else if (result) {
+        fprintf(stderr, "ERROR: failed to enqueue event: %s\n",
+                strerror(result));
+        return -1;
+      }
+      gettimeofday(&tnow, NULL);
+      enqueueTime.push_back(tnow);
+      res->inputBytes += ev.size() * 4;
+      next++;
+    }
+
+    stream->pollForEventToDeviceCompletion();
+
+    librorc::EventDescriptor *report = NULL;
+    uint64_t reference = 0;
+    const uint32_t *event = NULL;
+    gettimeofday(&tnow, NULL);
+    if (!stream->pollForEventToHost(&report, &event, &reference)) {
+      if (timediff_us(tlast, tnow) > EVENT_TIMEOUT_US) {
+        fprintf(stderr, "ERROR: no event for %d s, %lu events in chain\n",
+                EVENT_TIMEOUT_US / 1000000, stream->eventsInChain());
+        return -1;
+      }
+      continue;
+    }
+    tlast = tnow;
+    uint32_t dmaWords = (report->calc_event_size & 0x3fffffff);
+    if ((report->calc_event_size >> 30) & 0x3) {
+      res->flaggedEvents++;
+    }
+    int64_t nClusters = fcfParseTrailer(event, dmaWords, NULL);
+    if (nClusters > 0) {
+      res->clusters += nClusters;
+    }
+    res->outputBytes += dmaWords << 2;
+    res->procTimeCC.push_back(stream->fcfProcTimeCC());
+    res->xoffTimeCC += stream->fcfXoffTimeCC();
+    res->mergerIdlePercent += stream->fcfMergerIdlePercent();
+    stream->fcfClearStats();
+    stream->releaseEventToHost(reference);
+    if (!enqueueTime.empty()) {
+      res->latencyUs.push_back(timediff_us(enqueueTime.front(), tnow));
+      enqueueTime.pop_front();
+    }
+    res->events++;
+  }
+  gettimeofday(&tnow, NULL);
+  res->seconds = timediff_us(tstart, tnow) / 1000000.0;
+  if (res->events) {
+    res->mergerIdlePercent /= res->events;
+  }
+  return done ? -1 : 0;
+}
+
+void printResultHeader(const vector<sweepAxis_t> &axes) {
+  printf("# ");
+  for (size_t i = 0; i < axes.size(); i++) {
+    printf("%s, ", axes[i].name);
+  }
+  printf("events, seconds, eventsPerSec, inputMBps, outputMBps, "
+         "clustersPerEvent, latencyP50Us, latencyP90Us, latencyP99Us, "
+         "latencyMaxUs, procTimeCCP50, procTimeCCP99, xoffTimeCC, "
+         "mergerIdlePercent, flaggedEvents\n");
+}
+
+void printResultRow(const vector<sweepAxis_t> &axes,
+                    const vector<size_t> &index, sweepResult_t *res) {
+  for (size_t i = 0; i < axes.size(); i++) {
+    printf("%u, ", axes[i].values[index[i]]);
+  }
+  double t = (res->seconds > 0) ? res->seconds : 1;
+  printf("%lu, %.3f, %.1f, %.1f, %.1f, %.1f, %u, %u, %u, %u, %u, %u, %lu, "
+         "%f, %lu\n",
+         res->events, res->seconds, res->events / t,
+         res->inputBytes / t / (1 << 20), res->outputBytes / t / (1 << 20),
+         res->events ? (double)res->clusters / res->events : 0.0,
+         percentile(res->latencyUs, 0.5), percentile(res->latencyUs, 0.9),
+         percentile(res->latencyUs, 0.99), percentile(res->latencyUs, 1.0),
+         percentile(res->procTimeCC, 0.5), percentile(res->procTimeCC, 0.99),
+         res->xoffTimeCC, res->mergerIdlePercent, res->flaggedEvents);
+  fflush(stdout);
+}
+
+/**
+ * main
+ **/
+int main(int argc, char *argv[]) {
+  int deviceId = 0;
+  int channelId = 0;
+  char *mappingfile = NULL;
+  uint32_t rcuVersion = 1;
+  uint64_t ebSize = EB_SIZE;
+  uint32_t passes = 1;
+  uint32_t maxInFlight = 0;
+  vector<sweepAxis_t> axes;
+
+  static struct option long_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"channel", required_argument, 0, 'c'},
+      {"device", required_argument, 0, 'n'},
+      {"mapping", required_argument, 0, 'm'},
+      {"ebsize", required_argument, 0, 'z'},
+      {"passes", required_argument, 0, 'R'},
+      {"depth", required_argument, 0, 'q'},
+      {"rcu2-data", required_argument, 0, 'r'},
+      FCF_CONFIG_LONG_OPTIONS,
+      {0, 0, 0, 0}};
+
+  int arg;
+  while ((arg = getopt_long(argc, argv, "hn:c:m:r:z:R:q:" FCF_CONFIG_OPTSTRING,
+                            long_options, NULL)) != -1) {
+    switch (arg) {
+    case 'h':
+      printf(HELP_TEXT);
+      return 0;
+    case 'n':
+      deviceId = strtoul(optarg, NULL, 0);
+      break;
+    case 'c':
+      channelId = strtoul(optarg, NULL, 0);
+      break;
+    case 'r':
+      rcuVersion = (strtoul(optarg, NULL, 0) > 0) ? 2 : 1;
+      break;
+    case 'm':
+      mappingfile = optarg;
+      break;
+    case 'z':
+      ebSize = strtoull(optarg, NULL, 0) << 20;
+      break;
+    case 'R':
+      passes = strtoul(optarg, NULL, 0);
+      break;
+    case 'q':
+      maxInFlight = strtoul(optarg, NULL, 0);
+      break;
+    default: {
+      fcfConfig_t probe = fcfDefaultConfig;
+      sweepAxis_t axis;
+      axis.opt = arg;
+      axis.name = NULL;
+      for (int i = 0; long_options[i].name; i++) {
+        if (long_options[i].val == arg) {
+          axis.name = long_options[i].name;
+        }
+      }
+      if (!axis.name || parseFcfConfigOption(arg, "0", &probe) != 0 ||
+          parseIdList(optarg, axis.values) != 0) {
+        printf(HELP_TEXT);
+        return -1;
+      }
+      // a repeated option replaces the earlier list
+      for (size_t i = 0; i < axes.size(); i++) {
+        if (axes[i].opt == arg) {
+          axes.erase(axes.begin() + i);
+          break;
+        }
+      }
+      axes.push_back(axis);
+    } break;
+    }
+  }
+
+  if (!mappingfile) {
+    fprintf(stderr, "ERROR: no FCF mapping file provided!\n");
+    printf(HELP_TEXT);
+    return -1;
+  }
+  if (optind == argc) {
+    fprintf(stderr, "ERROR: no input files\n");
+    return -1;
+  }
+  if (passes == 0) {
+    passes = 1;
+  }
+
+  // load the corpus once, all configurations see the same events
+  vector<vector<uint32_t> > corpus(argc - optind);
+  uint64_t corpusBytes = 0;
+  for (int i = optind; i < argc; i++) {
+    if (readFile(argv[i], &corpus[i - optind]) != 0) {
+      fprintf(stderr, "ERROR: Failed to read %s: %s\n", argv[i],
+              strerror(errno));
+      return -1;
+    }
+    corpusBytes += corpus[i - optind].size() * 4;
+  }
+
+  librorc::device *dev = NULL;
+  librorc::bar *bar = NULL;
+  librorc::sysmon *sm = NULL;
+  crorc_hwcf_coproc_handler *stream = NULL;
+  try {
+    dev = new librorc::device(deviceId);
+    bar = new librorc::bar(dev, 1);
+    sm = new librorc::sysmon(bar);
+    stream = new crorc_hwcf_coproc_handler(dev, bar, channelId, ebSize);
+  }
+  catch (int e) {
+    cerr << "ERROR: failed to initialize C-RORC: " << librorc::errMsg(e)
+         << endl;
+    delete stream;
+    delete sm;
+    delete bar;
+    delete dev;
+    return -1;
+  }
+
+  time_t rawtime;
+  time(&rawtime);
+  printf("# Date: %s# Firmware Rev.: %07x, Firmware Date: %08x, RCU%d\n",
+         ctime(&rawtime), sm->FwRevision(), sm->FwBuildDate(), rcuVersion);
+  delete sm;
+  printf("# Corpus: %lu events, %lu bytes, %u passes, depth %u\n",
+         corpus.size(), corpusBytes, passes, maxInFlight);
+  printHwcfConfig(fcfDefaultConfig);
+
+  int ret = 0;
+  if (stream->initializeClusterFinder(mappingfile, channelId, rcuVersion,
+                                      fcfDefaultConfig)) {
+    fprintf(stderr, "ERROR: Failed to intialize Clusterfinder with "
+                    "mappingfile %s\n",
+            mappingfile);
+    ret = -1;
+  }
+
+  struct sigaction sigIntHandler;
+  sigIntHandler.sa_handler = abort_handler;
+  sigemptyset(&sigIntHandler.sa_mask);
+  sigIntHandler.sa_flags = 0;
+  sigaction(SIGINT, &sigIntHandler, NULL);
+
+  if (ret == 0) {
+    printResultHeader(axes);
+  }
+  vector<size_t> index(axes.size(), 0);
+  sweepResult_t res;
+  while (ret == 0 && !done) {
+    fcfConfig_t cfg = fcfDefaultConfig;
+    char value[16];
+    for (size_t i = 0; i < axes.size(); i++) {
+      snprintf(value, sizeof(value), "%u", axes[i].values[index[i]]);
+      parseFcfConfigOption(axes[i].opt, value, &cfg);
+    }
+    stream->configureClusterFinder(cfg);
+    if (runConfiguration(stream, corpus, passes, maxInFlight, &res) != 0) {
+      ret = -1;
+      break;
+    }
+    printResultRow(axes, index, &res);
+
+    // advance the grid, the last axis varies fastest
+    size_t i = axes.size();
+    while (i > 0) {
+      i--;
+      if (++index[i] < axes[i].values.size()) {
+        break;
+      }
+      index[i] = 0;
+    }
+    if (axes.empty() || (i == 0 && index[0] == 0)) {
+      break;
+    }
+  }
+
+  delete stream;
+  delete bar;
+  delete dev;
+  return ret;
+}
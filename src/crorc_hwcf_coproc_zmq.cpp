@@ -16,15 +16,29 @@
  *  along with this program. If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/signal.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <errno.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "crorc_hwcf_coproc_handler.hpp"
+#include "thread_utils.hh"
+#include "idle_waiter.hh"
+#include "inflight_controller.hh"
+#include "fcf_cluster_decoder.hh"
 
 #define HELP_TEXT                                                              \
   "usage: crorc_hwcf_coproc [parameters]\n"                                    \
@@ -32,8 +46,36 @@
   "    -c [Id]          optional channel ID, default:all\n"                    \
   "    -r [rcuVersion]  TPC RCU version, default:1\n"                          \
   "    -m [mappingfile] Path to AliRoot TPC Row Mapping File\n"                \
+  "    -k [dir]         keep parsed mappings as binary images in dir and "     \
+  "reuse them\n"                                                               \
+  "    -K               only write mapping RAM entries that differ from the "  \
+  "readback\n"                                                                 \
   "    -b               batch mode, queue multiple events at onece and "       \
-  "                     don't print stats after each event.\n"
+  "                     don't print stats after each event.\n"               \
+  "    -p [depth]       prefetch up to depth input files per channel in a\n"   \
+  "                     background thread, default:0 (off)\n"                  \
+  "    -a [cpus]        pin the channel threads to a CPU list like 0-5\n"    \
+  "    -Q [depth]       batch mode with an adaptive number of events in "      \
+  "flight,\n"                                                                  \
+  "                     at most depth, see -L\n"                               \
+  "    -L [us]          with -Q, keep the completion latency at us, "          \
+  "default:0\n"                                                                \
+  "                     (maximize the throughput)\n"                           \
+  "    -j [threads]     initialize up to this many channels concurrently, "    \
+  "default:4\n"                                                                \
+  "    -z [MB]          DMA buffer size per direction, default:1024\n"        \
+  "    -w [split|pad]   place events crossing the end of the to-device\n"      \
+  "                     buffer in two segments or at offset 0, "               \
+  "default:split\n"                                                            \
+  "    -T [tolerances]  match reference clusters within "                     \
+  "pad,time[,charge[,qmax[,sigma]]],\n"                                       \
+  "                     default: exact match in any order\n"                \
+  "    -H [N]           collect histograms of the FCF counters of every "     \
+  "N-th event\n"                                                              \
+  "                     instead of printing them per event, "               \
+  "default:0 (off)\n"                                                          \
+  "    -x [prefix]      with -H, also write the samples to "                  \
+  "prefix_ch<N>.fcfstats\n"
 
 #define ES2HOST_EB_ID 0
 #define ES2DEV_EB_ID 2
@@ -42,31 +84,129 @@
 
 #define ZMQ_BASE_PORT 5555
 
+/** maximum number of channels handled by a single process **/
+#define MAX_CHANNELS 12
+
+/** number of channels initialized concurrently **/
+#define INIT_THREADS 4
+
+/** status line interval **/
+#define STATUS_INTERVAL_US 1000000
+
+/**
+ * limits of the adaptive spin window of an idle channel thread before it
+ * sleeps until the next command, see idle_waiter
+ **/
+#define IDLE_SPIN_MIN_US 10
+#define IDLE_SPIN_MAX_US 2000
+
+/** time to wait for events still in the chain after a stop request **/
+#define DRAIN_TIMEOUT_US 5000000
+
 using namespace std;
 
+/**
+ * per-channel status, published by the channel thread and read by the
+ * status printer. Each set occupies its own cache line.
+ **/
+struct alignas(CACHELINE_SIZE) chStatus_t {
+  std::atomic<uint64_t> nInputsQueued;
+  std::atomic<uint64_t> nInputsDone;
+  std::atomic<uint64_t> nOutputsDone;
+  std::atomic<uint64_t> eventsInChain;
+  std::atomic<uint64_t> prefetchStalls;
+  std::atomic<uint32_t> prefetchFill;
+  std::atomic<uint64_t> ebUsed;
+  std::atomic<uint64_t> ebHighWater;
+  std::atomic<uint64_t> ebPadding;
+  std::atomic<uint64_t> sleeps;
+  std::atomic<uint32_t> depth;
+  std::atomic<uint32_t> latencyUs;
+  std::atomic<bool> finished;
+};
+
+chStatus_t chStatus[MAX_CHANNELS];
+
+/** outcome of the initialization of one channel, see initializeChannel() **/
+struct chInit_t {
+  string error;
+  double buffersMs;
+  double fcfMs;
+  double totalMs;
+};
+
+/** settings shared by the channel initialization threads **/
+struct chSetup_t {
+  librorc::device *dev;
+  librorc::bar *bar;
+  int chStart;
+  uint64_t ebSize;
+  const char *mappingfile;
+  const char *mappingCacheDir;
+  bool mappingOnlyChanged;
+  uint32_t rcuVersion;
+  fcfConfig_t fcfcfg;
+  ringMode_t ringMode;
+  fcfTolerance_t tolerance;
+  uint32_t histInterval;
+  const char *tracePrefix;
+  uint32_t prefetchDepth;
+  crorc_hwcf_coproc_handler **stream;
+  chInit_t *init;
+};
+
+/** serializes the per-event output of the channel threads **/
+std::mutex printLock;
+
 /**
  * Prototypes
  **/
+void initializeChannel(uint32_t index, void *arg);
+void channelWorker(uint32_t channelId, crorc_hwcf_coproc_handler *stream,
+                   bool batchMode, uint32_t maxDepth, uint32_t targetLatencyUs,
+                   chStatus_t *sts);
+void publishStatus(crorc_hwcf_coproc_handler *stream, chStatus_t *sts);
 void checkHwcfFlags(librorc::EventDescriptor *report, string outputFileName);
 void printEventStatsHeader();
 void printEventStats(crorc_hwcf_coproc_handler *stream,
                      librorc::EventDescriptor *report, const uint32_t *event);
-void printStatusLine(uint32_t channelId, crorc_hwcf_coproc_handler *stream);
-void printHwcfConfig(struct fcfConfig_t cfg);
+void printStatusLine(uint32_t channelId, uint32_t prefetchDepth,
+                     chStatus_t *sts);
+void printTotalStatusLine(uint32_t nCh, uint64_t *lastInputsDone,
+                          long long tdiff_us);
+void printFcfStats(uint32_t chStart, uint32_t nCh,
+                   crorc_hwcf_coproc_handler **stream, bool final);
 
 inline long long timediff_us(struct timeval from, struct timeval to) {
   return ((long long)(to.tv_sec - from.tv_sec) * 1000000LL +
           (long long)(to.tv_usec - from.tv_usec));
 }
 
-bool done = false;
+std::atomic<bool> done(false);
+/** readable once done is set, wakes up sleeping channel threads **/
+int stopFd = -1;
+/** signalled by each channel thread when it finishes **/
+int finishedFd = -1;
+
+void signalFd(int fd) {
+  uint64_t one = 1;
+  if (fd >= 0 && write(fd, &one, sizeof(one)) != sizeof(one)) {
+    // the counter is already non-zero, the waiter wakes up anyway
+  }
+}
+
+void requestStop() {
+  done = true;
+  signalFd(stopFd);
+}
+
 // Signal handler
 void abort_handler(int s) {
   cerr << "Caught signal " << s << endl;
   if (done == true) {
     exit(-1);
   } else {
-    done = true;
+    requestStop();
   }
 }
 
@@ -77,35 +217,48 @@ int main(int argc, char *argv[]) {
   int deviceId = 0;
   int channelId = -1;
   char *mappingfile = NULL;
+  char *mappingCacheDir = NULL;
+  bool mappingOnlyChanged = false;
   uint32_t rcuVersion = 1;
   bool batchMode = false;
+  uint32_t prefetchDepth = 0;
+  char *cpuList = NULL;
+  uint32_t initThreads = INIT_THREADS;
+  uint32_t maxDepth = 0;
+  uint32_t targetLatencyUs = 0;
+  uint64_t ebSize = EB_SIZE;
+  ringMode_t ringMode = RING_SPLIT;
   int arg;
   fcfConfig_t fcfcfg = fcfDefaultConfig;
+  fcfTolerance_t tolerance = fcfExactTolerance;
+  uint32_t histInterval = 0;
+  char *tracePrefix = NULL;
 
   static struct option long_options[] = {
       {"help", no_argument, 0, 'h'},
       {"channel", required_argument, 0, 'c'},
       {"device", required_argument, 0, 'n'},
       {"mapping", required_argument, 0, 'm'},
+      {"mapping-cache", required_argument, 0, 'k'},
+      {"mapping-readback", no_argument, 0, 'K'},
       {"batch", no_argument, 0, 'b'},
+      {"prefetch", required_argument, 0, 'p'},
+      {"cpus", required_argument, 0, 'a'},
+      {"init-threads", required_argument, 0, 'j'},
+      {"adaptive-depth", required_argument, 0, 'Q'},
+      {"target-latency", required_argument, 0, 'L'},
+      {"ebsize", required_argument, 0, 'z'},
+      {"wrap", required_argument, 0, 'w'},
       {"rcu2-data", required_argument, 0, 'r'},
-      {"deconvolute-pad", required_argument, 0, 'd'},
-      {"single-pad-suppression", required_argument, 0, 's'},
-      {"bypass-merger", required_argument, 0, 'B'},
-      {"cluster-lower-limit", required_argument, 0, 'l'},
-      {"cluster-qmax-lower-limit", required_argument, 0, 'q'},
-      {"single-sequence-limit", required_argument, 0, 'S'},
-      {"merger-distance", required_argument, 0, 'M'},
-      {"use-time-follow", required_argument, 0, 't'},
-      {"noise-suppression", required_argument, 0, 'N'},
-      {"noise-suppression-for-minima", required_argument, 0, 'i'},
-      {"noise-suppression-neighbor", required_argument, 0, 'u'},
-      {"tag-deconvoluted-clusters", required_argument, 0, 'D'},
-      {"tag-border-clusters", required_argument, 0, 'e'},
-      {"correct-edge-clusters", required_argument, 0, 'E'},
+      {"tolerance", required_argument, 0, 'T'},
+      {"histogram", required_argument, 0, 'H'},
+      {"stats-trace", required_argument, 0, 'x'},
+      FCF_CONFIG_LONG_OPTIONS,
       {0, 0, 0, 0}};
 
-  while ((arg = getopt_long(argc, argv, "hn:c:m:r:bd:s:B:l:q:S:M:t:N:i:u:D:e:E:",
+  while ((arg = getopt_long(argc, argv,
+                            "hn:c:m:k:Kr:bp:a:j:Q:L:z:w:T:H:x:"
+                            FCF_CONFIG_OPTSTRING,
                             long_options, NULL)) != -1) {
     switch (arg) {
     case 'h':
@@ -127,50 +280,62 @@ int main(int argc, char *argv[]) {
     case 'b':
       batchMode = true;
       break;
-    case 'm':
-      mappingfile = optarg;
-      break;
-    case 'd':
-      fcfcfg.deconvolute_pad = (strtoul(optarg, NULL, 0)) & 1;
+    case 'p':
+      prefetchDepth = strtoul(optarg, NULL, 0);
       break;
-    case 's':
-      fcfcfg.single_pad_suppression = (strtoul(optarg, NULL, 0)) & 1;
+    case 'a':
+      cpuList = optarg;
       break;
-    case 'B':
-      fcfcfg.bypass_merger = (strtoul(optarg, NULL, 0)) & 1;
+    case 'j':
+      initThreads = strtoul(optarg, NULL, 0);
       break;
-    case 'l':
-      fcfcfg.cluster_lower_limit = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'Q':
+      maxDepth = strtoul(optarg, NULL, 0);
+      batchMode = (maxDepth > 0) || batchMode;
       break;
-    case 'q':
-      fcfcfg.cluster_qmax_lower_limit = (strtoul(optarg, NULL, 0)) & 0x7ff;
+    case 'L':
+      targetLatencyUs = strtoul(optarg, NULL, 0);
       break;
-    case 'S':
-      fcfcfg.single_seq_limit = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'z':
+      ebSize = strtoull(optarg, NULL, 0) << 20;
       break;
-    case 'M':
-      fcfcfg.merger_distance = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'w':
+      if (strcmp(optarg, "split") == 0) {
+        ringMode = RING_SPLIT;
+      } else if (strcmp(optarg, "pad") == 0) {
+        ringMode = RING_PAD;
+      } else {
+        cerr << "ERROR: invalid wrap mode " << optarg << endl;
+        return -1;
+      }
       break;
-    case 't':
-      fcfcfg.use_time_follow = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'T':
+      if (sscanf(optarg, "%f,%f,%u,%u,%f", &tolerance.pad, &tolerance.time,
+                 &tolerance.charge, &tolerance.qmax, &tolerance.sigma) < 2) {
+        cerr << "ERROR: invalid tolerances " << optarg << endl;
+        return -1;
+      }
       break;
-    case 'N':
-      fcfcfg.noise_suppression = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'H':
+      histInterval = strtoul(optarg, NULL, 0);
       break;
-    case 'i':
-      fcfcfg.noise_suppression_minimum = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'x':
+      tracePrefix = optarg;
       break;
-    case 'u':
-      fcfcfg.noise_suppression_neighbor = (strtoul(optarg, NULL, 0)) & 0xffff;
+    case 'm':
+      mappingfile = optarg;
       break;
-    case 'D':
-      fcfcfg.tag_deconvoluted_clusters = (strtoul(optarg, NULL, 0)) & 0x3;
+    case 'k':
+      mappingCacheDir = optarg;
       break;
-    case 'e':
-      fcfcfg.tag_border_clusters = (strtoul(optarg, NULL, 0)) & 1;
+    case 'K':
+      mappingOnlyChanged = true;
       break;
-    case 'E':
-      fcfcfg.correct_edge_clusters = (strtoul(optarg, NULL, 0)) & 1;
+    default:
+      if (parseFcfConfigOption(arg, optarg, &fcfcfg) != 0) {
+        cout << HELP_TEXT;
+        return -1;
+      }
       break;
     }
   }
@@ -181,6 +346,18 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  if (targetLatencyUs && !maxDepth) {
+    cerr << "ERROR: -L requires an adaptive depth, see -Q" << endl;
+    cout << HELP_TEXT;
+    return -1;
+  }
+
+  vector<uint32_t> cpuIds;
+  if (cpuList && parseIdList(cpuList, cpuIds) != 0) {
+    cerr << "ERROR: invalid CPU list " << cpuList << endl;
+    return -1;
+  }
+
   librorc::device *dev = NULL;
   librorc::bar *bar = NULL;
   librorc::sysmon *sm = NULL;
@@ -223,43 +400,56 @@ int main(int argc, char *argv[]) {
     nCh = 1;
   }
   delete sm;
+  if (nCh > MAX_CHANNELS) {
+    cerr << "ERROR: firmware provides " << nCh << " channels, at most "
+         << MAX_CHANNELS << " are supported. Select a single channel with -c."
+         << endl;
+    delete bar;
+    delete dev;
+    return -1;
+  }
 
   crorc_hwcf_coproc_handler *stream[nCh];
   for (int i = 0; i < nCh; i++) {
     stream[i] = NULL;
   }
+  vector<chInit_t> chInit(nCh);
+  chSetup_t setup;
+  setup.dev = dev;
+  setup.bar = bar;
+  setup.chStart = chStart;
+  setup.ebSize = ebSize;
+  setup.mappingfile = mappingfile;
+  setup.mappingCacheDir = mappingCacheDir;
+  setup.mappingOnlyChanged = mappingOnlyChanged;
+  setup.rcuVersion = rcuVersion;
+  setup.fcfcfg = fcfcfg;
+  setup.ringMode = ringMode;
+  setup.tolerance = tolerance;
+  setup.histInterval = histInterval;
+  setup.tracePrefix = tracePrefix;
+  setup.prefetchDepth = prefetchDepth;
+  setup.stream = stream;
+  setup.init = chInit.data();
+
+  // buffer allocation, SG list and FCF programming dominate the startup
+  // time and are independent per channel
+  struct timeval initStart, initEnd;
+  gettimeofday(&initStart, NULL);
+  parallelFor(nCh, initThreads, initializeChannel, &setup);
+  gettimeofday(&initEnd, NULL);
   for (int i = 0; i < nCh; i++) {
-    // cout << "INFO: initializing channel " << (chStart + i) << "..." << endl;
-    try {
-      stream[i] = new crorc_hwcf_coproc_handler(dev, bar, chStart + i, EB_SIZE);
-    }
-    catch (int e) {
-      cerr << "ERROR: failed to initialize channel " << (chStart + i) << ": "
-           << librorc::errMsg(e) << endl;
-      done = true;
-    }
-
-    if (done) {
-      break;
-    }
-
-    if (stream[i]->initializeClusterFinder(mappingfile, chStart + i, rcuVersion,
-                                           fcfcfg)) {
-      cerr << "ERROR: Failed to intialize Clusterfinder on channel "
-           << (chStart + i) << " with mappingfile " << mappingfile << endl;
-      done = true;
-    }
-
-    if (done) {
-      break;
-    }
-
-    if (stream[i]->initializeZmq(ZMQ_BASE_PORT + chStart + i)) {
-      cerr << "ERROR: Failed to initialize ZMQ for channel " << (chStart + i)
-           << "." << endl;
+    if (!chInit[i].error.empty()) {
+      cerr << "ERROR: " << chInit[i].error << endl;
       done = true;
+    } else {
+      printf("# Ch%d initialized in %.1f ms: buffers %.1f ms, FCF %.1f ms\n",
+             chStart + i, chInit[i].totalMs, chInit[i].buffersMs,
+             chInit[i].fcfMs);
     }
   }
+  printf("# Initialization of %d channels with %u threads: %.1f ms\n", nCh,
+         initThreads, timediff_us(initStart, initEnd) / 1000.0);
 
   // cout << "INFO: initialization done, waiting for data..." << endl;
 
@@ -269,124 +459,433 @@ int main(int argc, char *argv[]) {
   sigIntHandler.sa_flags = 0;
   sigaction(SIGINT, &sigIntHandler, NULL);
 
+  if (!batchMode && !histInterval) {
+    printEventStatsHeader();
+  }
+
+  // main thread event loop: status timer and finished channels
+  stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  finishedFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int statusFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec statusInterval;
+  statusInterval.it_interval.tv_sec = STATUS_INTERVAL_US / 1000000;
+  statusInterval.it_interval.tv_nsec = (STATUS_INTERVAL_US % 1000000) * 1000;
+  statusInterval.it_value = statusInterval.it_interval;
+  idle_waiter *statusWaiter = NULL;
+  try {
+    statusWaiter = new idle_waiter(0, 0);
+  }
+  catch (int) {
+    // errno is still set by epoll_create1()
+  }
+  if (stopFd < 0 || finishedFd < 0 || statusFd < 0 || !statusWaiter ||
+      timerfd_settime(statusFd, 0, &statusInterval, NULL) ||
+      statusWaiter->addFd(statusFd) || statusWaiter->addFd(finishedFd)) {
+    cerr << "ERROR: Failed to set up the event loop: " << strerror(errno)
+         << endl;
+    done = true;
+  }
+
+  vector<thread> workers;
+  if (!done) {
+    for (int i = 0; i < nCh; i++) {
+      chStatus[i].finished = false;
+      chStatus[i].sleeps = 0;
+      chStatus[i].depth = 0;
+      chStatus[i].latencyUs = 0;
+      publishStatus(stream[i], &chStatus[i]);
+      workers.push_back(
+          thread(channelWorker, chStart + i, stream[i], batchMode, maxDepth,
+                 targetLatencyUs, &chStatus[i]));
+      if (!cpuIds.empty()) {
+        uint32_t cpu = cpuIds[i % cpuIds.size()];
+        if (pinThreadToCpu(workers[i], cpu) != 0) {
+          cerr << "WARNING: failed to pin channel " << (chStart + i)
+               << " to CPU " << cpu << endl;
+        }
+      }
+    }
+  }
+
+  // the channel threads finish on their own once all data is processed or
+  // after draining the chain on a stop request
   struct timeval now, last;
   gettimeofday(&now, NULL);
   last = now;
+  uint64_t lastInputsDone = 0;
+  bool all_finished = workers.empty();
+  while (!all_finished) {
+    statusWaiter->wait(-1);
+    uint64_t expirations = 0;
+    bool statusDue = (read(statusFd, &expirations, sizeof(expirations)) ==
+                      sizeof(expirations));
+    uint64_t finishedCount;
+    if (read(finishedFd, &finishedCount, sizeof(finishedCount)) < 0) {
+      // EAGAIN: woken by the status timer only
+    }
+    all_finished = true;
+    for (int i = 0; i < nCh; i++) {
+      all_finished &= chStatus[i].finished.load();
+    }
+    gettimeofday(&now, NULL);
+    long long tdiff_us = timediff_us(last, now);
+    if ((batchMode || histInterval) && (all_finished || statusDue)) {
+      if (all_finished) {
+        cout << "=========== stopping ==========" << endl;
+      }
+      if (batchMode) {
+        for (int i = 0; i < nCh; i++) {
+          printStatusLine(chStart + i, prefetchDepth, &chStatus[i]);
+        }
+        printTotalStatusLine(nCh, &lastInputsDone, tdiff_us);
+      }
+      if (histInterval) {
+        printFcfStats(chStart, nCh, stream, all_finished);
+      }
+      last = now;
+    }
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  if (statusFd >= 0) {
+    close(statusFd);
+  }
+  delete statusWaiter;
+
+  // buffer occupancy, to size -z for the next run
+  for (size_t i = 0; i < workers.size(); i++) {
+    cout.precision(2);
+    cout.setf(ios::fixed, ios::floatfield);
+    cout << "Ch: " << (chStart + i) << " to-device buffer high water: "
+         << (chStatus[i].ebHighWater.load() / (float)(1 << 20)) << " of "
+         << (ebSize >> 20) << " MB";
+    if (ringMode == RING_PAD) {
+      cout << ", padding: "
+           << (chStatus[i].ebPadding.load() / (float)(1 << 20)) << " MB";
+    }
+    cout << endl;
+  }
 
-  if (!batchMode) {
-    printEventStatsHeader();
+  for (int i = 0; i < nCh; i++) {
+    if (stream[i]) {
+      delete stream[i];
+    }
+  }
+  if (bar) {
+    delete bar;
+  }
+  if (dev) {
+    delete dev;
+  }
+  if (stopFd >= 0) {
+    close(stopFd);
   }
+  if (finishedFd >= 0) {
+    close(finishedFd);
+  }
+  return 0;
+}
 
-  while (!done) {
-    for (int i = 0; i < nCh; i++) {
+/**
+ * bring up a single channel, called concurrently for all channels by
+ * parallelFor(). Errors are stored in the chInit_t of the channel.
+ **/
+void initializeChannel(uint32_t index, void *arg) {
+  chSetup_t *setup = (chSetup_t *)arg;
+  chInit_t *init = &setup->init[index];
+  int channelId = setup->chStart + index;
+  struct timeval t0, t1, t2, t3;
+  gettimeofday(&t0, NULL);
+  crorc_hwcf_coproc_handler *stream = NULL;
+  try {
+    stream = new crorc_hwcf_coproc_handler(setup->dev, setup->bar, channelId,
+                                           setup->ebSize);
+  }
+  catch (int e) {
+    init->error = "failed to initialize channel " + to_string(channelId) +
+                  ": " + librorc::errMsg(e);
+    return;
+  }
+  setup->stream[index] = stream;
+  gettimeofday(&t1, NULL);
+
+  stream->setMappingCache(setup->mappingCacheDir, setup->mappingOnlyChanged);
+  if (stream->initializeClusterFinder(setup->mappingfile, channelId,
+                                      setup->rcuVersion, setup->fcfcfg)) {
+    init->error = "Failed to intialize Clusterfinder on channel " +
+                  to_string(channelId) + " with mappingfile " +
+                  setup->mappingfile;
+    return;
+  }
+  gettimeofday(&t2, NULL);
 
+  if (stream->initializeZmq(ZMQ_BASE_PORT + channelId)) {
+    init->error =
+        "Failed to initialize ZMQ for channel " + to_string(channelId) + ".";
+    return;
+  }
+
+  stream->setToDeviceRingMode(setup->ringMode);
+  stream->setCompareTolerance(setup->tolerance);
+
+  if (setup->histInterval) {
+    string traceFile;
+    if (setup->tracePrefix) {
+      traceFile = string(setup->tracePrefix) + "_ch" + to_string(channelId) +
+                  ".fcfstats";
+    }
+    if (stream->enableStatsSampling(
+            setup->histInterval,
+            setup->tracePrefix ? traceFile.c_str() : NULL)) {
+      init->error = "Failed to create FCF stats trace " + traceFile + ": " +
+                    strerror(errno);
+      return;
+    }
+  }
+
+  if (setup->prefetchDepth && stream->startPrefetch(setup->prefetchDepth)) {
+    init->error = "Failed to start input prefetching for channel " +
+                  to_string(channelId) + ".";
+    return;
+  }
+  gettimeofday(&t3, NULL);
+  init->buffersMs = timediff_us(t0, t1) / 1000.0;
+  init->fcfMs = timediff_us(t1, t2) / 1000.0;
+  init->totalMs = timediff_us(t0, t3) / 1000.0;
+}
+
+/**
+ * channel thread: receives commands, pushes events to the device and
+ * handles the processed events of a single channel
+ **/
+void channelWorker(uint32_t channelId, crorc_hwcf_coproc_handler *stream,
+                   bool batchMode, uint32_t maxDepth, uint32_t targetLatencyUs,
+                   chStatus_t *sts) {
+  bool draining = false;
+  // number of events in flight, unlimited in batch mode without -Q
+  inflight_controller *depthCtl = NULL;
+  if (maxDepth) {
+    depthCtl = new inflight_controller(1, maxDepth, targetLatencyUs);
+    sts->depth.store(depthCtl->depth(), std::memory_order_relaxed);
+  }
+  struct timeval tdrain, now;
+  // sleep until the next command or stop request once idle
+  idle_waiter *waiter = NULL;
+  try {
+    waiter = new idle_waiter(IDLE_SPIN_MIN_US, IDLE_SPIN_MAX_US);
+  }
+  catch (int) {
+  }
+  if (!waiter || waiter->addFd(stopFd) ||
+      (stream->zmqFd() >= 0 && waiter->addFd(stream->zmqFd()))) {
+    cerr << "WARNING: Ch" << channelId << " failed to set up sleeping when "
+         << "idle: " << strerror(errno) << endl;
+    delete waiter;
+    waiter = NULL;
+  }
+  while (true) {
+    if (!done) {
       // check for new commands via ZMQ
-      stream[i]->pollZmq();
+      stream->pollZmq();
 
       // push events to device
-      if (stream[i]->inputFilesPending() &&
-          (batchMode || stream[i]->eventsInChain() == 0)) {
-        int result = stream[i]->enqueueNextEventToDevice();
+      if ((stream->inputFilesPending() || stream->inBandInputsPending()) &&
+          (batchMode || stream->eventsInChain() == 0) &&
+          (!depthCtl || depthCtl->mayEnqueue(stream->eventsInChain()))) {
+        uint64_t inChain = stream->eventsInChain();
+        int result = stream->enqueueNextEventToDevice();
+        if (depthCtl && stream->eventsInChain() > inChain) {
+          depthCtl->enqueued();
+        }
         if (result && result != EAGAIN) {
-          cerr << "ERROR: Failed to enqueue event "
-               << stream[i]->nextInputFile()
+          cerr << "ERROR: Failed to enqueue event " << stream->nextInputFile()
                << ", failed with: " << strerror(result) << "(" << result << ")"
                << endl;
-          done = true;
-          break;
+          // stop all channels
+          requestStop();
         }
       }
-      if (done) {
-        break;
-      }
+    }
 
-      stream[i]->pollForEventToDeviceCompletion();
-
-      // check for events from device
-      librorc::EventDescriptor *report = NULL;
-      uint64_t librorcEventReference = 0;
-      const uint32_t *event = NULL;
-      if (stream[i]
-              ->pollForEventToHost(&report, &event, &librorcEventReference)) {
-        if (stream[i]->outputFilesPending()) {
-          string nextOutputFile = stream[i]->nextOutputFile();
-          checkHwcfFlags(report, nextOutputFile);
-          if (stream[i]->writeEventToNextOutputFile(report, event)) {
-            cerr << "ERROR: Failed to write event to file " << nextOutputFile
-                 << ": " << strerror(errno) << endl;
-          } else {
-          }
+    stream->pollForEventToDeviceCompletion();
+
+    // check for events from device
+    librorc::EventDescriptor *report = NULL;
+    uint64_t librorcEventReference = 0;
+    const uint32_t *event = NULL;
+    if (stream->pollForEventToHost(&report, &event, &librorcEventReference)) {
+      if (depthCtl && depthCtl->completed()) {
+        depthCtl->adjust(stream->fcfXoffTotalCC());
+        sts->depth.store(depthCtl->depth(), std::memory_order_relaxed);
+        sts->latencyUs.store(depthCtl->latencyUs(), std::memory_order_relaxed);
+      }
+      bool inBand = stream->hostEventInBand();
+      if (!inBand && stream->outputFilesPending()) {
+        string nextOutputFile = stream->nextOutputFile();
+        checkHwcfFlags(report, nextOutputFile);
+        if (stream->writeEventToNextOutputFile(report, event)) {
+          cerr << "ERROR: Failed to write event to file " << nextOutputFile
+               << ": " << strerror(errno) << endl;
         }
+      }
 
-        if (stream[i]->refFilesPending()) {
-          string nextRefFile = stream[i]->nextRefFile();
-          if (stream[i]->compareEventWithNextRefFile(report, event)) {
-            cerr << nextRefFile << " : ";
-            switch (errno) {
-            case EFBIG:
-              cerr << " Size mismatch";
-              break;
-            case EILSEQ:
-              cerr << " Pattern mismatch";
-              break;
-            default:
-              cerr << strerror(errno);
-              break;
+      if (!inBand && stream->refFilesPending()) {
+        string nextRefFile = stream->nextRefFile();
+        if (stream->compareEventWithNextRefFile(report, event)) {
+          cerr << nextRefFile << " : ";
+          fcfCompareResult_t cmp = stream->lastCompareResult();
+          switch (errno) {
+          case EILSEQ:
+            cerr << " Cluster mismatch: " << cmp.nOutput << " output, "
+                 << cmp.nReference << " reference, " << cmp.missing
+                 << " missing, " << cmp.extra << " extra, " << cmp.differing
+                 << " differing";
+            if (cmp.headerDiffers) {
+              cerr << ", header/trailer differ";
             }
-            cerr << endl;
-            stream[i]->markRefFileDone();
+            break;
+          case EBADMSG:
+            cerr << " Invalid FCF output format";
+            break;
+          default:
+            cerr << strerror(errno);
+            break;
           }
+          cerr << endl;
+          stream->markRefFileDone();
         }
-        if (!batchMode) {
-          printEventStats(stream[i], report, event);
-          stream[i]->fcfClearStats();
-        }
-        stream[i]->releaseEventToHost(librorcEventReference);
       }
-
-    } // for
-
-    bool all_done = true;
-    for (int i = 0; i < nCh; i++) {
-      if (!stream[i]->isDone() || stream[i]->eventsInChain() > 0) {
-        all_done = false;
+      if (!batchMode && !stream->fcfStats()) {
+        std::lock_guard<std::mutex> lock(printLock);
+        printEventStats(stream, report, event);
+        stream->fcfClearStats();
+      }
+      if (inBand) {
+        // released once ZMQ has sent the clusters
+        stream->shipEventToZmq(report, event, librorcEventReference);
+      } else {
+        stream->releaseEventToHost(librorcEventReference);
       }
     }
-    done |= all_done;
+    publishStatus(stream, sts);
 
-    if (batchMode) {
+    if (stream->eventsInChain() == 0 && (done || stream->isDone())) {
+      break;
+    }
+    if (done) {
+      // stop requested: wait for the events still in the chain
       gettimeofday(&now, NULL);
-      if (done || timediff_us(last, now) > 1000000) {
-        if (done) {
-          cout << "=========== stopping ==========" << endl;
-        }
-        for (int i = 0; i < nCh; i++) {
-          printStatusLine(chStart + i, stream[i]);
-        }
-        last = now;
+      if (!draining) {
+        draining = true;
+        tdrain = now;
+      } else if (timediff_us(tdrain, now) > DRAIN_TIMEOUT_US) {
+        cerr << "WARNING: Ch" << channelId << " stopping with "
+             << stream->eventsInChain() << " event(s) still in the chain"
+             << endl;
+        break;
       }
     }
-  } // while(!done)
-
-  for (int i = 0; i < nCh; i++) {
-    if (stream[i]) {
-      delete stream[i];
+    if (waiter) {
+      waiter->pass(!done && stream->isIdle());
+      sts->sleeps.store(waiter->sleeps(), std::memory_order_relaxed);
     }
   }
-  if (bar) {
-    delete bar;
+  // acknowledge a STOP received while events were still in the chain
+  stream->sendPendingAcks();
+  delete waiter;
+  delete depthCtl;
+  sts->finished = true;
+  signalFd(finishedFd);
+}
+
+void publishStatus(crorc_hwcf_coproc_handler *stream, chStatus_t *sts) {
+  struct streamStatus_t status = stream->getStatus();
+  sts->nInputsQueued.store(status.nInputsQueued, std::memory_order_relaxed);
+  sts->nInputsDone.store(status.nInputsDone, std::memory_order_relaxed);
+  sts->nOutputsDone.store(status.nOutputsDone, std::memory_order_relaxed);
+  sts->eventsInChain.store(stream->eventsInChain(), std::memory_order_relaxed);
+  sts->prefetchStalls.store(stream->prefetchStalls(),
+                            std::memory_order_relaxed);
+  sts->prefetchFill.store(stream->prefetchFill(), std::memory_order_relaxed);
+  ring_allocator *ring = stream->toDeviceRing();
+  sts->ebUsed.store(ring->used(), std::memory_order_relaxed);
+  sts->ebHighWater.store(ring->highWater(), std::memory_order_relaxed);
+  sts->ebPadding.store(ring->paddingBytes(), std::memory_order_relaxed);
+}
+
+void printStatusLine(uint32_t channelId, uint32_t prefetchDepth,
+                     chStatus_t *sts) {
+  cout << "Ch: " << channelId << " InQueued: " << sts->nInputsQueued.load()
+       << ", InDone: " << sts->nInputsDone.load()
+       << ", OutDone: " << sts->nOutputsDone.load()
+       << ", InChain: " << sts->eventsInChain.load() << ", EB: "
+       << (sts->ebUsed.load() >> 20) << "/"
+       << (sts->ebHighWater.load() >> 20) << " MB used/max"
+       << ", Sleeps: " << sts->sleeps.load();
+  if (sts->depth.load()) {
+    cout << ", Depth: " << sts->depth.load()
+         << ", Latency: " << sts->latencyUs.load() << " us";
   }
-  if (dev) {
-    delete dev;
+  if (prefetchDepth) {
+    cout << ", Prefetched: " << sts->prefetchFill.load() << "/"
+         << prefetchDepth
+         << ", PrefetchStalls: " << sts->prefetchStalls.load();
   }
-  return 0;
+  cout << endl;
 }
 
-void printStatusLine(uint32_t channelId, crorc_hwcf_coproc_handler *stream) {
-  struct streamStatus_t sts = stream->getStatus();
-  cout << "Ch: " << channelId << " InQueued: " << sts.nInputsQueued
-       << ", InDone: " << sts.nInputsDone << ", OutDone: " << sts.nOutputsDone
-       << ", InChain: " << stream->eventsInChain() << endl;
+void printTotalStatusLine(uint32_t nCh, uint64_t *lastInputsDone,
+                          long long tdiff_us) {
+  uint64_t inputsQueued = 0, inputsDone = 0, outputsDone = 0, inChain = 0;
+  for (uint32_t i = 0; i < nCh; i++) {
+    inputsQueued += chStatus[i].nInputsQueued.load();
+    inputsDone += chStatus[i].nInputsDone.load();
+    outputsDone += chStatus[i].nOutputsDone.load();
+    inChain += chStatus[i].eventsInChain.load();
+  }
+  float rate_khz =
+      tdiff_us ? (inputsDone - *lastInputsDone) * 1000.0 / tdiff_us : 0.0;
+  cout.precision(2);
+  cout.setf(ios::fixed, ios::floatfield);
+  cout << "All: InQueued: " << inputsQueued << ", InDone: " << inputsDone
+       << ", OutDone: " << outputsDone << ", InChain: " << inChain
+       << ", InRate: " << rate_khz << " kHz" << endl;
+  *lastInputsDone = inputsDone;
+}
+
+/**
+ * cumulative FCF counter histograms per channel, and over all channels for
+ * the final dump
+ **/
+void printFcfStats(uint32_t chStart, uint32_t nCh,
+                   crorc_hwcf_coproc_handler **stream, bool final) {
+  fcf_stats *total = NULL;
+  char label[32];
+  for (uint32_t i = 0; i < nCh; i++) {
+    fcf_stats *stats = stream[i] ? stream[i]->fcfStats() : NULL;
+    if (!stats) {
+      continue;
+    }
+    snprintf(label, sizeof(label), "Ch%u FCF stats", chStart + i);
+    stats->print(label);
+    if (stats->traceErrors()) {
+      cerr << "WARNING: Ch" << (chStart + i) << " failed to write "
+           << stats->traceErrors() << " trace record(s)" << endl;
+    }
+    if (final && nCh > 1) {
+      if (!total) {
+        total = new fcf_stats(0, stats->interval());
+      }
+      for (uint32_t j = 0; j < FCF_STAT_COUNT; j++) {
+        total->histogram(j)->merge(*stats->histogram(j));
+      }
+    }
+  }
+  if (total) {
+    total->print("All FCF stats");
+    delete total;
+  }
 }
 
 #if 0
@@ -425,30 +924,23 @@ void printEventStats(crorc_hwcf_coproc_handler *stream,
   uint32_t procTimeCC = stream->fcfProcTimeCC();
   uint32_t inputIdleTimeCC = stream->fcfInputIdleTimeCC();
   uint32_t xoffTimeCC = stream->fcfXoffTimeCC();
-  uint32_t hdrTrlSize = (10 + 9) * sizeof(uint32_t);
-  uint32_t nClusters = (outputSize - hdrTrlSize) / (6 * sizeof(uint32_t));
-  uint32_t inputSize =
-      (dmaWords > 9) ? (event[dmaWords - 9] * 4 + hdrTrlSize) : 0;
+  fcfTrailer_t trailer;
+  int64_t nClusters = fcfParseTrailer(event, dmaWords, &trailer);
+  uint32_t inputSize = 0;
+  if (nClusters < 0) {
+    cerr << "WARNING: Invalid RCU trailer in output of "
+         << stream->lastInputFile() << endl;
+    nClusters = 0;
+  } else {
+    inputSize =
+        (trailer.payloadWords + FCF_HEADER_DW + trailer.trailerWords) << 2;
+  }
   float mergerIdlePercent = stream->fcfMergerIdlePercent();
   uint32_t numCandidates = stream->fcfNumCandidates();
   uint32_t fifoMergerMax = stream->fcfMergerInputFifoMax();
   uint32_t fifoDividerMax = stream->fcfDividerInputFifoMax();
-  printf("%u, %u, %u, %u, %u, %u, %u, %f, %d, %d, %s\n", inputSize, outputSize,
-         nClusters, procTimeCC, inputIdleTimeCC, xoffTimeCC, numCandidates,
-         mergerIdlePercent, fifoMergerMax, fifoDividerMax,
+  printf("%u, %u, %" PRId64 ", %u, %u, %u, %u, %f, %d, %d, %s\n", inputSize,
+         outputSize, nClusters, procTimeCC, inputIdleTimeCC, xoffTimeCC,
+         numCandidates, mergerIdlePercent, fifoMergerMax, fifoDividerMax,
          stream->lastInputFile());
 }
-
-void printHwcfConfig(struct fcfConfig_t cfg) {
-  printf("# BypassMerger: %d, ChargeFluctiation: %d, ClusterLowerLimit: %d, "
-         "ClusterQmaxLowerLimit: %d, DeconvPad: %d, MergerDistance: %d, "
-         "NoiseSuppr: %d, NoiseSupprMin: %d, NoiseSupprNeighbor: %d, "
-         "SinglePadSuppr: %d, SingleSeqLimit: %d, TagDeconvClusters: %d, "
-         "TagBorderClusters: %d, UseTimeFollow: %d\n",
-         cfg.bypass_merger, cfg.charge_fluctuation, cfg.cluster_lower_limit,
-         cfg.cluster_qmax_lower_limit, cfg.deconvolute_pad, cfg.merger_distance,
-         cfg.noise_suppression, cfg.noise_suppression_minimum,
-         cfg.noise_suppression_neighbor, cfg.single_pad_suppression,
-         cfg.single_seq_limit, cfg.tag_deconvoluted_clusters,
-         cfg.tag_border_clusters, cfg.use_time_follow);
-}
@@ -0,0 +1,270 @@
+/**
+ *  crorc_init_benchmark.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <sys/time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "crorc_hwcf_coproc_handler.hpp"
+#include "thread_utils.hh"
+
+#define HELP_TEXT                                                              \
+  "usage: crorc_init_benchmark [parameters]\n"                                 \
+  "Measures the startup time of crorc_hwcf_coproc_zmq: DMA buffers in both\n"  \
+  "directions and FCF programming for a set of channels.\n"                    \
+  "    -n [Id]          Device ID, default:0\n"                                \
+  "    -c [Ids]         channel list like 0-5, default:all\n"                  \
+  "    -r [rcuVersion]  TPC RCU version, default:1\n"                          \
+  "    -m [mappingfile] Path to AliRoot TPC Row Mapping File, default: "       \
+  "skip the FCF\n"                                                             \
+  "    -k [dir]         mapping cache directory, see crorc_hwcf_coproc_zmq\n"  \
+  "    -z [MB]          DMA buffer size per direction, default:1024\n"         \
+  "    -j [threads]     list of thread counts to measure, default:1,4\n"       \
+  "    -R [runs]        runs per thread count, default:3\n"                    \
+  "The first run allocates the DMA buffers, later runs reuse them.\n"
+
+#define EB_SIZE 0x40000000 // 1GB
+
+using namespace std;
+
+struct initSetup_t {
+  librorc::device *dev;
+  librorc::bar *bar;
+  uint64_t ebSize;
+  const char *mappingfile;
+  const char *mappingCacheDir;
+  uint32_t rcuVersion;
+  vector<uint32_t> channels;
+  vector<crorc_hwcf_coproc_handler *> stream;
+  vector<int64_t> buffers_us;
+  vector<int64_t> fcf_us;
+  vector<int> error;
+};
+
+inline int64_t timediff_us(struct timeval from, struct timeval to) {
+  return ((int64_t)(to.tv_sec - from.tv_sec) * 1000000LL +
+          (int64_t)(to.tv_usec - from.tv_usec));
+}
+
+void initializeChannel(uint32_t index, void *arg) {
+  initSetup_t *setup = (initSetup_t *)arg;
+  uint32_t channelId = setup->channels[index];
+  struct timeval t0, t1, t2;
+  gettimeofday(&t0, NULL);
+  try {
+    setup->stream[index] = new crorc_hwcf_coproc_handler(
+        setup->dev, setup->bar, channelId, setup->ebSize);
+  }
+  catch (int e) {
+    setup->error[index] = e;
+    return;
+  }
+  gettimeofday(&t1, NULL);
+  if (setup->mappingfile) {
+    setup->stream[index]->setMappingCache(setup->mappingCacheDir, false);
+    if (setup->stream[index]->initializeClusterFinder(
+            setup->mappingfile, channelId, setup->rcuVersion,
+            fcfDefaultConfig)) {
+      setup->error[index] = errno;
+    }
+  }
+  gettimeofday(&t2, NULL);
+  setup->buffers_us[index] = timediff_us(t0, t1);
+  setup->fcf_us[index] = timediff_us(t1, t2);
+}
+
+void teardownChannel(uint32_t index, void *arg) {
+  initSetup_t *setup = (initSetup_t *)arg;
+  delete setup->stream[index];
+  setup->stream[index] = NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int deviceId = 0;
+  char *channelList = NULL;
+  char *mappingfile = NULL;
+  char *mappingCacheDir = NULL;
+  uint32_t rcuVersion = 1;
+  uint64_t ebSize = EB_SIZE;
+  const char *threadList = "1,4";
+  uint32_t runs = 3;
+
+  static struct option long_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"channel", required_argument, 0, 'c'},
+      {"device", required_argument, 0, 'n'},
+      {"mapping", required_argument, 0, 'm'},
+      {"mapping-cache", required_argument, 0, 'k'},
+      {"ebsize", required_argument, 0, 'z'},
+      {"threads", required_argument, 0, 'j'},
+      {"runs", required_argument, 0, 'R'},
+      {"rcu2-data", required_argument, 0, 'r'},
+      {0, 0, 0, 0}};
+
+  int arg;
+  while ((arg = getopt_long(argc, argv, "hn:c:m:k:r:z:j:R:", long_options,
+                            NULL)) != -1) {
+    switch (arg) {
+    case 'h':
+      printf(HELP_TEXT);
+      return 0;
+    case 'n':
+      deviceId = strtoul(optarg, NULL, 0);
+      break;
+    case 'c':
+      channelList = optarg;
+      break;
+    case 'r':
+      rcuVersion = (strtoul(optarg, NULL, 0) > 0) ? 2 : 1;
+      break;
+    case 'm':
+      mappingfile = optarg;
+      break;
+    case 'k':
+      mappingCacheDir = optarg;
+      break;
+    case 'z':
+      ebSize = strtoull(optarg, NULL, 0) << 20;
+      break;
+    case 'j':
+      threadList = optarg;
+      break;
+    case 'R':
+      runs = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      printf(HELP_TEXT);
+      return -1;
+    }
+  }
+
+  vector<uint32_t> threadCounts;
+  if (parseIdList(threadList, threadCounts) != 0) {
+    fprintf(stderr, "ERROR: invalid thread list %s\n", threadList);
+    return -1;
+  }
+
+  initSetup_t setup;
+  setup.dev = NULL;
+  setup.bar = NULL;
+  librorc::sysmon *sm = NULL;
+  try {
+    setup.dev = new librorc::device(deviceId);
+    setup.bar = new librorc::bar(setup.dev, 1);
+    sm = new librorc::sysmon(setup.bar);
+  }
+  catch (int e) {
+    cerr << "ERROR: failed to initialize C-RORC: " << librorc::errMsg(e)
+         << endl;
+    delete sm;
+    delete setup.bar;
+    delete setup.dev;
+    return -1;
+  }
+
+  uint32_t nChannels = sm->numberOfChannels() / 2;
+  if (channelList) {
+    if (parseIdList(channelList, setup.channels) != 0) {
+      fprintf(stderr, "ERROR: invalid channel list %s\n", channelList);
+      delete setup.bar;
+      delete setup.dev;
+      return -1;
+    }
+  } else {
+    for (uint32_t i = 0; i < nChannels; i++) {
+      setup.channels.push_back(i);
+    }
+  }
+  time_t rawtime;
+  time(&rawtime);
+  printf("# Date: %s# Firmware Rev.: %07x, Firmware Date: %08x, RCU%d\n",
+         ctime(&rawtime), sm->FwRevision(), sm->FwBuildDate(), rcuVersion);
+  delete sm;
+  printf("# %lu channels, %lu MB per direction, mapping: %s\n",
+         setup.channels.size(), ebSize >> 20,
+         mappingfile ? mappingfile : "none");
+  setup.ebSize = ebSize;
+  setup.mappingfile = mappingfile;
+  setup.mappingCacheDir = mappingCacheDir;
+  setup.rcuVersion = rcuVersion;
+
+  uint32_t n = setup.channels.size();
+  if (n == 0 || threadCounts.empty()) {
+    fprintf(stderr, "ERROR: nothing to measure\n");
+    delete setup.bar;
+    delete setup.dev;
+    return -1;
+  }
+  printf("# threads, run, initMs, buffersMsMean, buffersMsMax, fcfMsMean, "
+         "fcfMsMax, teardownMs\n");
+  int ret = 0;
+  for (size_t t = 0; t < threadCounts.size() && ret == 0; t++) {
+    for (uint32_t run = 0; run < runs && ret == 0; run++) {
+      setup.stream.assign(n, NULL);
+      setup.buffers_us.assign(n, 0);
+      setup.fcf_us.assign(n, 0);
+      setup.error.assign(n, 0);
+
+      struct timeval tstart, tinit, tdone;
+      gettimeofday(&tstart, NULL);
+      parallelFor(n, threadCounts[t], initializeChannel, &setup);
+      gettimeofday(&tinit, NULL);
+      for (uint32_t i = 0; i < n; i++) {
+        if (setup.error[i] && !setup.stream[i]) {
+          cerr << "ERROR: failed to initialize channel " << setup.channels[i]
+               << ": " << librorc::errMsg(setup.error[i]) << endl;
+          ret = -1;
+        } else if (setup.error[i]) {
+          fprintf(stderr, "ERROR: failed to initialize the FCF of channel "
+                          "%u: %s\n",
+                  setup.channels[i], strerror(setup.error[i]));
+          ret = -1;
+        }
+      }
+      parallelFor(n, threadCounts[t], teardownChannel, &setup);
+      gettimeofday(&tdone, NULL);
+      if (ret != 0) {
+        break;
+      }
+
+      int64_t buffersSum = 0, fcfSum = 0;
+      for (uint32_t i = 0; i < n; i++) {
+        buffersSum += setup.buffers_us[i];
+        fcfSum += setup.fcf_us[i];
+      }
+      printf("%u, %u, %.1f, %.1f, %.1f, %.1f, %.1f, %.1f\n", threadCounts[t],
+             run, timediff_us(tstart, tinit) / 1000.0,
+             buffersSum / 1000.0 / n,
+             *max_element(setup.buffers_us.begin(), setup.buffers_us.end()) /
+                 1000.0,
+             fcfSum / 1000.0 / n,
+             *max_element(setup.fcf_us.begin(), setup.fcf_us.end()) / 1000.0,
+             timediff_us(tinit, tdone) / 1000.0);
+      fflush(stdout);
+    }
+  }
+
+  delete setup.bar;
+  delete setup.dev;
+  return ret;
+}
@@ -0,0 +1,32 @@
+/**
+ *  digest.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef DIGEST_HH
+#define DIGEST_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fast non-cryptographic 64 bit digest of a buffer, computed in a single
+ * pass. The algorithm follows xxHash64, so results can be cross-checked
+ * with the xxhsum tool.
+ **/
+uint64_t digest64(const void *data, size_t size, uint64_t seed = 0);
+
+#endif // DIGEST_HH
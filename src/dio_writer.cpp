@@ -0,0 +1,286 @@
+/**
+ *  dio_writer.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dio_writer.hh"
+
+dio_writer::dio_writer(dioEngine_t engine, uint64_t bufferSize,
+                       uint32_t nBuffers) {
+  m_requested_engine = engine;
+  m_engine = engine;
+  m_fd = -1;
+  m_file_offset = 0;
+  m_cur = 0;
+  // buffer sizes have to be a multiple of the O_DIRECT alignment
+  m_buffer_size = (bufferSize + DIO_ALIGN - 1) & ~((uint64_t)DIO_ALIGN - 1);
+  if (m_buffer_size == 0 || nBuffers == 0) {
+    throw DIO_CONSTRUCTOR_FAILED;
+  }
+#ifdef HAVE_LIBURING
+  m_ring_initialized = false;
+#endif
+  if (engine == DIO_ENGINE_BUFFERED) {
+    return;
+  }
+
+  m_buffers.resize(nBuffers);
+  for (uint32_t i = 0; i < nBuffers; i++) {
+    void *mem = NULL;
+    if (posix_memalign(&mem, DIO_ALIGN, m_buffer_size) != 0) {
+      m_buffers.resize(i);
+      for (uint32_t j = 0; j < i; j++) {
+        free(m_buffers[j].data);
+      }
+      throw DIO_CONSTRUCTOR_FAILED;
+    }
+    m_buffers[i].data = (uint8_t *)mem;
+    m_buffers[i].fill = 0;
+    m_buffers[i].submitted = 0;
+    m_buffers[i].inFlight = false;
+  }
+
+#ifdef HAVE_LIBURING
+  if (engine == DIO_ENGINE_URING) {
+    m_ring_initialized = (io_uring_queue_init(nBuffers, &m_ring, 0) == 0);
+  }
+#endif
+}
+
+dio_writer::~dio_writer() {
+  close();
+#ifdef HAVE_LIBURING
+  if (m_ring_initialized) {
+    io_uring_queue_exit(&m_ring);
+  }
+#endif
+  for (size_t i = 0; i < m_buffers.size(); i++) {
+    free(m_buffers[i].data);
+  }
+}
+
+const char *dio_writer::engineName(dioEngine_t engine) {
+  switch (engine) {
+  case DIO_ENGINE_BUFFERED:
+    return "buffered";
+  case DIO_ENGINE_DIRECT:
+    return "direct";
+  case DIO_ENGINE_URING:
+    return "uring";
+  }
+  return "unknown";
+}
+
+int dio_writer::parseEngine(const char *name, dioEngine_t *engine) {
+  if (strcmp(name, "buffered") == 0) {
+    *engine = DIO_ENGINE_BUFFERED;
+  } else if (strcmp(name, "direct") == 0) {
+    *engine = DIO_ENGINE_DIRECT;
+  } else if (strcmp(name, "uring") == 0) {
+    *engine = DIO_ENGINE_URING;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+int dio_writer::open(const char *filename) {
+  if (m_fd >= 0) {
+    errno = EBUSY;
+    return -1;
+  }
+  m_engine = m_requested_engine;
+#ifdef HAVE_LIBURING
+  if (m_engine == DIO_ENGINE_URING && !m_ring_initialized) {
+    m_engine = DIO_ENGINE_DIRECT;
+  }
+#else
+  if (m_engine == DIO_ENGINE_URING) {
+    m_engine = DIO_ENGINE_DIRECT;
+  }
+#endif
+  if (m_engine != DIO_ENGINE_BUFFERED) {
+    m_fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (m_fd < 0 && errno == EINVAL) {
+      // file system without O_DIRECT support, e.g. tmpfs
+      m_engine = DIO_ENGINE_BUFFERED;
+    } else if (m_fd < 0) {
+      return -1;
+    }
+  }
+  if (m_engine == DIO_ENGINE_BUFFERED) {
+    m_fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+      return -1;
+    }
+  }
+  m_file_offset = 0;
+  m_cur = 0;
+  for (size_t i = 0; i < m_buffers.size(); i++) {
+    m_buffers[i].fill = 0;
+  }
+  return 0;
+}
+
+int dio_writer::append(const struct iovec *iov, int iovcnt) {
+  if (m_fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (m_engine == DIO_ENGINE_BUFFERED) {
+    ssize_t size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      size += iov[i].iov_len;
+    }
+    ssize_t ret = writev(m_fd, iov, iovcnt);
+    if (ret != size) {
+      if (ret >= 0) {
+        errno = EIO;
+      }
+      return -1;
+    }
+    m_file_offset += size;
+    return 0;
+  }
+
+  // copy into the staging buffers, submit every buffer once it is full
+  for (int i = 0; i < iovcnt; i++) {
+    const uint8_t *src = (const uint8_t *)iov[i].iov_base;
+    uint64_t remaining = iov[i].iov_len;
+    while (remaining) {
+      dioBuffer_t *buf = &m_buffers[m_cur];
+      uint64_t chunk = m_buffer_size - buf->fill;
+      if (chunk > remaining) {
+        chunk = remaining;
+      }
+      memcpy(buf->data + buf->fill, src, chunk);
+      buf->fill += chunk;
+      src += chunk;
+      remaining -= chunk;
+      if (buf->fill == m_buffer_size && submitBuffer(m_buffer_size) != 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+int dio_writer::close() {
+  if (m_fd < 0) {
+    return 0;
+  }
+  int ret = 0;
+  if (m_engine != DIO_ENGINE_BUFFERED) {
+    // the last block is written padded and the file truncated afterwards
+    uint64_t fill = m_buffers[m_cur].fill;
+    uint64_t logicalSize = m_file_offset + fill;
+    if (fill) {
+      uint64_t padded = (fill + DIO_ALIGN - 1) & ~((uint64_t)DIO_ALIGN - 1);
+      memset(m_buffers[m_cur].data + fill, 0, padded - fill);
+      ret = submitBuffer(padded);
+    }
+    if (waitAll() != 0) {
+      ret = -1;
+    }
+    if (ret == 0 && ftruncate(m_fd, logicalSize) != 0) {
+      ret = -1;
+    }
+  }
+  if (::close(m_fd) != 0) {
+    ret = -1;
+  }
+  m_fd = -1;
+  return ret;
+}
+
+int dio_writer::submitBuffer(uint64_t length) {
+  dioBuffer_t *buf = &m_buffers[m_cur];
+  if (m_engine == DIO_ENGINE_DIRECT) {
+    ssize_t ret = pwrite(m_fd, buf->data, length, m_file_offset);
+    if (ret != (ssize_t)length) {
+      if (ret >= 0) {
+        errno = EIO;
+      }
+      return -1;
+    }
+  }
+#ifdef HAVE_LIBURING
+  else if (m_engine == DIO_ENGINE_URING) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+    if (!sqe) {
+      errno = EBUSY;
+      return -1;
+    }
+    io_uring_prep_write(sqe, m_fd, buf->data, length, m_file_offset);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)m_cur);
+    int ret = io_uring_submit(&m_ring);
+    if (ret < 0) {
+      errno = -ret;
+      return -1;
+    }
+    buf->submitted = length;
+    buf->inFlight = true;
+  }
+#endif
+  m_file_offset += length;
+  m_cur = (m_cur + 1) % m_buffers.size();
+  m_buffers[m_cur].fill = 0;
+  return waitBuffer(m_cur);
+}
+
+int dio_writer::waitBuffer(uint32_t idx) {
+#ifdef HAVE_LIBURING
+  int result = 0;
+  while (m_buffers[idx].inFlight) {
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(&m_ring, &cqe);
+    if (ret < 0) {
+      errno = -ret;
+      return -1;
+    }
+    dioBuffer_t *done = &m_buffers[(uintptr_t)io_uring_cqe_get_data(cqe)];
+    if (cqe->res < 0) {
+      errno = -cqe->res;
+      result = -1;
+    } else if ((uint64_t)cqe->res != done->submitted) {
+      errno = EIO;
+      result = -1;
+    }
+    done->inFlight = false;
+    io_uring_cqe_seen(&m_ring, cqe);
+  }
+  return result;
+#else
+  return 0;
+#endif
+}
+
+int dio_writer::waitAll() {
+  int ret = 0;
+  for (uint32_t i = 0; i < m_buffers.size(); i++) {
+    if (waitBuffer(i) != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,87 @@
+/**
+ *  dio_writer.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef DIO_WRITER_HH
+#define DIO_WRITER_HH
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/** alignment of buffers, offsets and sizes for O_DIRECT **/
+#define DIO_ALIGN 4096
+#define DIO_DEFAULT_BUFFER_SIZE (4 << 20)
+#define DIO_DEFAULT_NBUFFERS 4
+
+#define DIO_CONSTRUCTOR_FAILED 1
+
+/**
+ * DIO_ENGINE_BUFFERED: plain writev() through the page cache
+ * DIO_ENGINE_DIRECT:   O_DIRECT, synchronous pwrite() of aligned buffers
+ * DIO_ENGINE_URING:    O_DIRECT, buffers submitted through io_uring and
+ *                      reaped when they are needed again
+ * Engines fall back to the next simpler one if the file system or the
+ * build does not support them, see engine().
+ **/
+enum dioEngine_t { DIO_ENGINE_BUFFERED, DIO_ENGINE_DIRECT, DIO_ENGINE_URING };
+
+class dio_writer {
+public:
+  dio_writer(dioEngine_t engine, uint64_t bufferSize = DIO_DEFAULT_BUFFER_SIZE,
+             uint32_t nBuffers = DIO_DEFAULT_NBUFFERS);
+  ~dio_writer();
+
+  /** all calls return 0 on success or -1 with errno set **/
+  int open(const char *filename);
+  int append(const struct iovec *iov, int iovcnt);
+  int close();
+
+  /** engine actually used for the currently open file **/
+  dioEngine_t engine() { return m_engine; }
+  static const char *engineName(dioEngine_t engine);
+  static int parseEngine(const char *name, dioEngine_t *engine);
+
+private:
+  struct dioBuffer_t {
+    uint8_t *data;
+    uint64_t fill;
+    uint64_t submitted;
+    bool inFlight;
+  };
+
+  int submitBuffer(uint64_t length);
+  int waitBuffer(uint32_t idx);
+  int waitAll();
+
+  dioEngine_t m_requested_engine;
+  dioEngine_t m_engine;
+  int m_fd;
+  uint64_t m_file_offset;
+  uint64_t m_buffer_size;
+  std::vector<dioBuffer_t> m_buffers;
+  uint32_t m_cur;
+#ifdef HAVE_LIBURING
+  struct io_uring m_ring;
+  bool m_ring_initialized;
+#endif
+};
+
+#endif // DIO_WRITER_HH
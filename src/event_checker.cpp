@@ -16,14 +16,9 @@
  *  along with this program. If not, see <http://www.gnu.org/licenses/>.
  **/
 
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <string.h>
 #include "event_checker.hh"
-
-/** limit the number of corrupted events to be written to disk **/
-#define MAX_FILES_TO_DISK 100
+#include "digest.hh"
 
 event_checker::event_checker(uint32_t deviceId, uint32_t channelId,
                              char *logDir) {
@@ -31,45 +26,56 @@ event_checker::event_checker(uint32_t deviceId, uint32_t channelId,
   m_channelId = channelId;
   m_logDir = logDir;
   m_errorCount = 0;
-  m_refListIter = m_refList.begin();
+  m_pattern = EC_PATTERN_INC;
+  m_patternStart = 0;
+  m_patternMismatch = -1;
+  m_refMismatch.first = -1;
+  m_refMismatch.last = -1;
+  m_refMismatch.count = 0;
+  m_refMatchMode = EC_REF_ROUND_ROBIN;
+  m_strictIds = false;
+  m_lastIdValid = false;
+  m_lastId = 0;
+  memset(&m_idStats, 0, sizeof(m_idStats));
+  m_eoeMarker = 0;
+  m_recorder = NULL;
+  m_refs = NULL;
+  m_refPos = 0;
 }
 
 event_checker::~event_checker() {
-  std::vector<refFileEntry>::iterator iter, end;
-  iter = m_refList.begin();
-  end = m_refList.end();
-  while (iter != end) {
-    munmap(iter->map, iter->size);
-    ++iter;
+  if (m_recorder) {
+    delete m_recorder;
   }
-  m_refList.clear();
 }
 
-int event_checker::addRefFile(char *filename) {
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) {
-    return -1;
+int event_checker::enableFlightRecorder(uint32_t contextEvents,
+                                        uint32_t maxEventSize,
+                                        uint32_t maxDumps) {
+  if (m_recorder) {
+    return 0;
   }
-  struct stat refstat;
-  if (fstat(fd, &refstat) == -1) {
-    close(fd);
-    return -1;
+  try {
+    m_recorder = new flight_recorder(m_logDir, m_deviceId, m_channelId,
+                                     contextEvents, maxEventSize, maxDumps);
   }
-  uint32_t *map =
-      (uint32_t *)mmap(0, refstat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-  if (map == MAP_FAILED) {
-    close(fd);
+  catch (int e) {
+    m_recorder = NULL;
     return -1;
   }
-  close(fd);
-  struct refFileEntry entry;
-  entry.map = map;
-  entry.size = refstat.st_size;
-  m_refList.push_back(entry);
-  m_refListIter = m_refList.begin();
   return 0;
 }
 
+void event_checker::setReferenceSet(const reference_set *refs) {
+  m_refs = refs;
+  m_refPos = 0;
+}
+
+void event_checker::setPattern(ecPattern_t pattern, uint32_t startValue) {
+  m_pattern = pattern;
+  m_patternStart = startValue;
+}
+
 int event_checker::check(librorc::EventDescriptor *report,
                          const uint32_t *event, uint32_t checkMask) {
   int result = 0;
@@ -82,15 +88,32 @@ int event_checker::check(librorc::EventDescriptor *report,
   if (checkMask & EC_CHK_CMPL) {
     result |= checkCompletionStatus(report);
   }
-  if (checkMask & EC_CHK_FILE) {
+  if ((checkMask & EC_CHK_FILE) && m_refMatchMode == EC_REF_DIGEST) {
+    result |= checkReferenceDigest(report, event);
+  } else if (checkMask & EC_CHK_FILE) {
     result |= checkReferenceFile(report, event);
   }
   if (checkMask & EC_CHK_SOE) {
     result |= checkStartOfEvent(report, event);
   }
-  if (checkMask & EC_CHK_FILE) {
+  if (checkMask & EC_CHK_PATTERN) {
+    result |= checkPattern(report, event);
+  }
+  if (checkMask & EC_CHK_ID) {
+    result |= checkEventId(report, event);
+  }
+  if (checkMask & EC_CHK_EOE) {
+    result |= checkEndOfEvent(report, event);
+  }
+  if ((checkMask & EC_CHK_FILE) && m_refMatchMode == EC_REF_ROUND_ROBIN) {
     selectNextRefFile();
   }
+  if (result) {
+    m_errorCount++;
+  }
+  if (m_recorder) {
+    dumpToFile(report, event, result);
+  }
   return result;
 }
 
@@ -127,25 +150,127 @@ uint32_t event_checker::checkStartOfEvent(librorc::EventDescriptor *report,
   return 0;
 }
 
+uint32_t event_checker::checkEventId(librorc::EventDescriptor *report,
+                                     const uint32_t *event) {
+  if ((report->calc_event_size & 0x3fffffff) < CDH_SIZE_DW) {
+    return 0;
+  }
+  // classify without branches, IDs wrap around after 36 bits
+  uint64_t id = cdhEventId(event);
+  uint64_t delta = (id - m_lastId) & CDH_EVENT_ID_MASK;
+  uint64_t valid = m_lastIdValid;
+  uint64_t duplicate = (delta == 0);
+  uint64_t outOfOrder = (delta > (CDH_EVENT_ID_MASK >> 1));
+  uint64_t gap = (delta > 1) & !outOfOrder;
+  m_idStats.duplicates += duplicate & valid;
+  m_idStats.outOfOrder += outOfOrder & valid;
+  m_idStats.gaps += gap & valid;
+  m_idStats.missingIds += (delta - 1) * (gap & valid);
+  // keep the highest ID seen so a single late event is reported only once
+  m_lastId = (outOfOrder & valid) ? m_lastId : id;
+  m_lastIdValid = true;
+  uint64_t error = (duplicate | outOfOrder | (gap & m_strictIds)) & valid;
+  return error ? EC_CHK_ID : 0;
+}
+
+uint32_t event_checker::checkEndOfEvent(librorc::EventDescriptor *report,
+                                        const uint32_t *event) {
+  size_t eventSizeDws = (report->calc_event_size & 0x3fffffff);
+  if (eventSizeDws == 0 || event[eventSizeDws - 1] != m_eoeMarker) {
+    return EC_CHK_EOE;
+  }
+  return 0;
+}
+
+uint32_t event_checker::checkPattern(librorc::EventDescriptor *report,
+                                     const uint32_t *event) {
+  size_t eventSizeDws = (report->calc_event_size & 0x3fffffff);
+  if (eventSizeDws <= EC_PATTERN_OFFSET) {
+    return 0;
+  }
+  const uint32_t *payload = event + EC_PATTERN_OFFSET;
+  size_t payloadDws = eventSizeDws - EC_PATTERN_OFFSET;
+  int64_t mismatch;
+  switch (m_pattern) {
+  case EC_PATTERN_INC:
+    mismatch = findLinearMismatch(payload, payloadDws, m_patternStart, 1);
+    break;
+  case EC_PATTERN_DEC:
+    mismatch =
+        findLinearMismatch(payload, payloadDws, m_patternStart, 0xffffffff);
+    break;
+  case EC_PATTERN_CONST:
+    mismatch = findLinearMismatch(payload, payloadDws, m_patternStart, 0);
+    break;
+  default:
+    mismatch = findPrbsMismatch(payload, payloadDws);
+    break;
+  }
+  if (mismatch < 0) {
+    return 0;
+  }
+  m_patternMismatch = mismatch + EC_PATTERN_OFFSET;
+  return EC_CHK_PATTERN;
+}
+
 uint32_t event_checker::checkReferenceFile(librorc::EventDescriptor *report,
                                            const uint32_t *event) {
-  uint32_t *refMap = m_refListIter->map;
-  size_t refSizeDws = (m_refListIter->size) >> 2;
+  const refFileEntry &ref = m_refs->entry(m_refPos);
+  const uint32_t *refMap = ref.map;
+  size_t refSizeDws = ref.size >> 2;
   size_t eventSizeDws = (report->calc_event_size & 0x3fffffff);
+  size_t commonDws = (refSizeDws < eventSizeDws) ? refSizeDws : eventSizeDws;
+  wordMismatch_t mismatch;
+  compareWords(refMap, event, commonDws, &mismatch);
   if (refSizeDws != eventSizeDws) {
-    return EC_CHK_FILE;
+    size_t maxDws = (refSizeDws > eventSizeDws) ? refSizeDws : eventSizeDws;
+    if (mismatch.first < 0) {
+      mismatch.first = commonDws;
+    }
+    mismatch.last = maxDws - 1;
+    mismatch.count += maxDws - commonDws;
+  }
+  if (mismatch.count == 0) {
+    return 0;
   }
-  for (size_t idx = 0; idx > refSizeDws; idx++) {
-    if (refMap[idx] != event[idx]) {
-      return EC_CHK_FILE;
+  m_refMismatch = mismatch;
+  return EC_CHK_FILE;
+}
+
+uint32_t event_checker::checkReferenceDigest(librorc::EventDescriptor *report,
+                                             const uint32_t *event) {
+  size_t eventSize = (report->calc_event_size & 0x3fffffff) << 2;
+  uint64_t digest = digest64(event, eventSize);
+  std::pair<reference_set::indexIter_t, reference_set::indexIter_t> range =
+      m_refs->find(digest);
+  // no localization possible without a matching digest
+  m_refMismatch.first = -1;
+  m_refMismatch.last = -1;
+  m_refMismatch.count = 0;
+  for (; range.first != range.second; ++range.first) {
+    const refFileEntry *ref = &m_refs->entry(range.first->second);
+    if (ref->size != eventSize) {
+      continue;
     }
+    // rule out digest collisions
+    wordMismatch_t mismatch;
+    if (compareWords(ref->map, event, eventSize >> 2, &mismatch) == 0) {
+      return 0;
+    }
+    m_refMismatch = mismatch;
   }
-  return 0;
+  return EC_CHK_FILE;
+}
+
+void event_checker::dumpToFile(librorc::EventDescriptor *report,
+                               const uint32_t *event, uint32_t checkResult) {
+  // only copies the event, the recorder writes from its own thread
+  m_recorder->record(report, event, checkResult);
 }
 
 void event_checker::selectNextRefFile() {
-  ++m_refListIter;
-  if (m_refListIter == m_refList.end()) {
-    m_refListIter = m_refList.begin();
+  m_refPos++;
+  if (m_refPos == m_refs->size()) {
+    m_refPos = 0;
   }
 }
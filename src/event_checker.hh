@@ -19,9 +19,12 @@
 #ifndef _EVENT_CHECKER_H
 #define _EVENT_CHECKER_H
 
-#include <vector>
 #include <stdint.h>
 #include <librorc.h>
+#include "word_compare.hh"
+#include "reference_set.hh"
+#include "cdh.hh"
+#include "flight_recorder.hh"
 
 /** sanity checks **/
 #define EC_CHK_SIZES (1 << 0)
@@ -33,9 +36,34 @@
 #define EC_CHK_FILE (1 << 8)
 #define EC_CHK_CMPL (1 << 9)
 
-struct refFileEntry {
-  uint32_t *map;
-  size_t size;
+/** limit the number of corrupted events to be written to disk **/
+#define MAX_FILES_TO_DISK 100
+
+/** payload patterns verified by EC_CHK_PATTERN **/
+enum ecPattern_t {
+  EC_PATTERN_INC,
+  EC_PATTERN_DEC,
+  EC_PATTERN_CONST,
+  EC_PATTERN_PRBS
+};
+
+/** the payload starts after the 8-word CDH **/
+#define EC_PATTERN_OFFSET 8
+
+/**
+ * how EC_CHK_FILE selects the reference for an event:
+ * EC_REF_ROUND_ROBIN: events arrive in the order of the reference files
+ * EC_REF_DIGEST:      the event is looked up by its digest in all reference
+ *                     files, the order of arrival does not matter
+ **/
+enum ecRefMatch_t { EC_REF_ROUND_ROBIN, EC_REF_DIGEST };
+
+/** event ID continuity counters of EC_CHK_ID **/
+struct ecIdStats_t {
+  uint64_t gaps;
+  uint64_t missingIds;
+  uint64_t duplicates;
+  uint64_t outOfOrder;
 };
 
 class event_checker {
@@ -43,10 +71,56 @@ public:
   event_checker(uint32_t deviceId, uint32_t channelId, char *logDir);
   ~event_checker();
 
-  int addRefFile(char *filename);
+  /**
+   * reference events for EC_CHK_FILE. The set is not copied and has to
+   * outlive the checker, it may be shared by several checkers.
+   **/
+  void setReferenceSet(const reference_set *refs);
+  void setRefMatchMode(ecRefMatch_t mode) { m_refMatchMode = mode; }
   int check(librorc::EventDescriptor *report, const uint32_t *event,
             uint32_t checkMask);
 
+  /**
+   * select the payload pattern for EC_CHK_PATTERN. INC, DEC and CONST start
+   * with startValue in every event, PRBS is checked word-to-word and does
+   * not depend on startValue.
+   **/
+  void setPattern(ecPattern_t pattern, uint32_t startValue);
+
+  /**
+   * DW offset of the first mismatching word of the most recent event that
+   * failed EC_CHK_PATTERN, -1 if no pattern error occurred so far
+   **/
+  int64_t lastPatternMismatch() { return m_patternMismatch; }
+
+  /**
+   * differing DWs of the most recent event that failed EC_CHK_FILE. Words
+   * beyond the end of the shorter of event and reference count as
+   * differences.
+   **/
+  wordMismatch_t lastRefMismatch() { return m_refMismatch; }
+
+  /**
+   * EC_CHK_ID compares the CDH event ID against the previous event of the
+   * channel. Duplicates and out-of-order IDs are always errors, gaps only in
+   * strict mode, i.e. for sources with consecutive IDs like the PG.
+   **/
+  void setStrictEventIds(bool strict) { m_strictIds = strict; }
+  ecIdStats_t getIdStats() { return m_idStats; }
+
+  /** EC_CHK_EOE: expected value of the last DW of each event **/
+  void setEndOfEventMarker(uint32_t marker) { m_eoeMarker = marker; }
+
+  /**
+   * record all checked events in a flight_recorder writing to logDir. Each
+   * failed check dumps the faulting event with contextEvents events before
+   * and after it. Returns 0 on success or -1.
+   **/
+  int enableFlightRecorder(uint32_t contextEvents,
+                           uint32_t maxEventSize = FR_DEFAULT_MAX_EVENT_SIZE,
+                           uint32_t maxDumps = MAX_FILES_TO_DISK);
+  flight_recorder *getFlightRecorder() { return m_recorder; }
+
 private:
   uint32_t checkDiuError(librorc::EventDescriptor *report);
   uint32_t checkReportSizes(librorc::EventDescriptor *report);
@@ -55,7 +129,15 @@ private:
                               const uint32_t *event);
   uint32_t checkStartOfEvent(librorc::EventDescriptor *report,
                              const uint32_t *event);
+  uint32_t checkPattern(librorc::EventDescriptor *report,
+                        const uint32_t *event);
+  uint32_t checkEventId(librorc::EventDescriptor *report,
+                        const uint32_t *event);
+  uint32_t checkEndOfEvent(librorc::EventDescriptor *report,
+                           const uint32_t *event);
 
+  uint32_t checkReferenceDigest(librorc::EventDescriptor *report,
+                                const uint32_t *event);
   void selectNextRefFile();
   void dumpToFile(librorc::EventDescriptor *report, const uint32_t *event,
                   uint32_t checkResult);
@@ -64,7 +146,19 @@ private:
   uint32_t m_channelId;
   char *m_logDir;
   uint64_t m_errorCount;
-  std::vector<refFileEntry> m_refList;
-  std::vector<refFileEntry>::iterator m_refListIter;
+  ecPattern_t m_pattern;
+  uint32_t m_patternStart;
+  int64_t m_patternMismatch;
+  wordMismatch_t m_refMismatch;
+  bool m_strictIds;
+  bool m_lastIdValid;
+  uint64_t m_lastId;
+  ecIdStats_t m_idStats;
+  uint32_t m_eoeMarker;
+  flight_recorder *m_recorder;
+  const reference_set *m_refs;
+  /** index of the expected reference in round-robin mode **/
+  size_t m_refPos;
+  ecRefMatch_t m_refMatchMode;
 };
 #endif
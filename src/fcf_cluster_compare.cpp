@@ -0,0 +1,217 @@
+/**
+ *  fcf_cluster_compare.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include "fcf_cluster_compare.hh"
+
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES 3
+
+/** sort key resolution: 1/32 pad and 1/8 time bin **/
+#define KEY_PAD_SCALE 32
+#define KEY_TIME_SCALE 8
+
+void radixSortKeys(uint64_t *keys, uint64_t *tmp, size_t n) {
+  uint32_t hist[RADIX_PASSES][RADIX_SIZE];
+  memset(hist, 0, sizeof(hist));
+  for (size_t i = 0; i < n; i++) {
+    uint32_t key = keys[i] >> 32;
+    for (int p = 0; p < RADIX_PASSES; p++) {
+      hist[p][(key >> (p * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+    }
+  }
+  uint64_t *src = keys;
+  uint64_t *dst = tmp;
+  for (int p = 0; p < RADIX_PASSES; p++) {
+    uint32_t shift = 32 + p * RADIX_BITS;
+    // skip digits that are the same for all keys
+    if (n == 0 || hist[p][(src[0] >> shift) & (RADIX_SIZE - 1)] == n) {
+      continue;
+    }
+    uint32_t offset = 0;
+    for (uint32_t d = 0; d < RADIX_SIZE; d++) {
+      uint32_t count = hist[p][d];
+      hist[p][d] = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      dst[hist[p][(src[i] >> shift) & (RADIX_SIZE - 1)]++] = src[i];
+    }
+    uint64_t *swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != keys) {
+    memcpy(keys, src, n * sizeof(uint64_t));
+  }
+}
+
+/** row [31:26], pad [25:13], time [12:0], clamped to the field widths **/
+static inline uint32_t clusterKey(uint32_t row, float pad, float time) {
+  float p = pad * KEY_PAD_SCALE;
+  float t = time * KEY_TIME_SCALE;
+  uint32_t pk = (p > 0) ? ((p < 0x1fff) ? (uint32_t)p : 0x1fff) : 0;
+  uint32_t tk = (t > 0) ? ((t < 0x1fff) ? (uint32_t)t : 0x1fff) : 0;
+  return (row << 26) | (pk << 13) | tk;
+}
+
+fcf_cluster_compare::fcf_cluster_compare(fcfTolerance_t tolerance) {
+  m_tolerance = tolerance;
+  m_out = NULL;
+  m_ref = NULL;
+  m_out_event = NULL;
+  m_ref_event = NULL;
+}
+
+fcf_cluster_compare::~fcf_cluster_compare() {
+  delete m_out;
+  delete m_ref;
+}
+
+int fcf_cluster_compare::decode(const uint32_t *event, uint32_t nWords,
+                                fcf_cluster_buffer **buffer,
+                                std::vector<uint64_t> *keys) {
+  int64_t n = fcfParseTrailer(event, nWords, NULL);
+  if (n < 0) {
+    return -1;
+  }
+  if (!*buffer || (*buffer)->clusters()->capacity < n) {
+    delete *buffer;
+    *buffer = NULL;
+    *buffer = new fcf_cluster_buffer(n + n / 2);
+  }
+  fcfClusters_t *c = (*buffer)->clusters();
+  if (fcfDecodeClusters(event, nWords, c) < 0) {
+    return -1;
+  }
+  keys->resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    (*keys)[i] =
+        ((uint64_t)clusterKey(c->row[i], c->pad[i], c->time[i]) << 32) | i;
+  }
+  if (m_sort_tmp.size() < keys->size()) {
+    m_sort_tmp.resize(keys->size());
+  }
+  radixSortKeys(keys->data(), m_sort_tmp.data(), n);
+  return 0;
+}
+
+static inline uint32_t absdiff(uint32_t a, uint32_t b) {
+  return (a > b) ? a - b : b - a;
+}
+
+bool fcf_cluster_compare::fieldsMatch(uint32_t o, uint32_t r) {
+  // charges are compared on the raw fixed point words, the decoded values
+  // lack the fractional bits
+  const uint32_t *wo = m_out_event + FCF_HEADER_DW + o * FCF_CLUSTER_DW;
+  const uint32_t *wr = m_ref_event + FCF_HEADER_DW + r * FCF_CLUSTER_DW;
+  fcfClusters_t *a = m_out->clusters();
+  fcfClusters_t *b = m_ref->clusters();
+  return (wo[1] >> 30) == (wr[1] >> 30) &&
+         absdiff(wo[1] & 0x3fffffff, wr[1] & 0x3fffffff) <=
+             (m_tolerance.charge << FCF_CHARGE_FRAC_BITS) &&
+         absdiff(wo[0] & 0xffffff, wr[0] & 0xffffff) <=
+             (m_tolerance.qmax << FCF_CHARGE_FRAC_BITS) &&
+         fabsf(a->sigmaPad2[o] - b->sigmaPad2[r]) <= m_tolerance.sigma &&
+         fabsf(a->sigmaTime2[o] - b->sigmaTime2[r]) <= m_tolerance.sigma;
+}
+
+int fcf_cluster_compare::compare(const uint32_t *output, uint32_t outputWords,
+                                 const uint32_t *reference,
+                                 uint32_t referenceWords,
+                                 fcfCompareResult_t *result) {
+  memset(result, 0, sizeof(*result));
+  m_out_event = output;
+  m_ref_event = reference;
+  if (decode(output, outputWords, &m_out, &m_out_keys) ||
+      decode(reference, referenceWords, &m_ref, &m_ref_keys)) {
+    return -1;
+  }
+  fcfClusters_t *a = m_out->clusters();
+  fcfClusters_t *b = m_ref->clusters();
+  uint32_t nOut = m_out_keys.size();
+  uint32_t nRef = m_ref_keys.size();
+  result->nOutput = nOut;
+  result->nReference = nRef;
+
+  // everything but the clusters has to be identical
+  uint32_t outTrailer = outputWords - FCF_HEADER_DW - nOut * FCF_CLUSTER_DW;
+  uint32_t refTrailer = referenceWords - FCF_HEADER_DW - nRef * FCF_CLUSTER_DW;
+  result->headerDiffers =
+      memcmp(output, reference, FCF_HEADER_DW * sizeof(uint32_t)) != 0 ||
+      outTrailer != refTrailer ||
+      memcmp(output + outputWords - outTrailer,
+             reference + referenceWords - refTrailer,
+             outTrailer * sizeof(uint32_t)) != 0;
+
+  // merge pass: the output window [lo, hi) holds all clusters of the same
+  // row within the pad tolerance of the current reference cluster
+  m_out_used.assign(nOut, 0);
+  uint32_t padTol = (uint32_t)ceilf(m_tolerance.pad * KEY_PAD_SCALE);
+  uint32_t lo = 0;
+  for (uint32_t k = 0; k < nRef; k++) {
+    uint32_t r = m_ref_keys[k] & 0xffffffff;
+    uint32_t refKey = m_ref_keys[k] >> 32;
+    uint32_t row = refKey >> 26;
+    uint32_t padKey = (refKey >> 13) & 0x1fff;
+    uint32_t loKey = (row << 26) | ((padKey > padTol ? padKey - padTol : 0)
+                                    << 13);
+    while (lo < nOut && (m_out_keys[lo] >> 32) < loKey) {
+      lo++;
+    }
+    int best = -1;
+    float bestDist = 0;
+    for (uint32_t j = lo; j < nOut; j++) {
+      uint32_t outKey = m_out_keys[j] >> 32;
+      if ((outKey >> 26) != row ||
+          ((outKey >> 13) & 0x1fff) > padKey + padTol) {
+        break;
+      }
+      uint32_t o = m_out_keys[j] & 0xffffffff;
+      if (m_out_used[j]) {
+        continue;
+      }
+      float dp = fabsf(a->pad[o] - b->pad[r]);
+      float dt = fabsf(a->time[o] - b->time[r]);
+      if (dp <= m_tolerance.pad && dt <= m_tolerance.time &&
+          (best < 0 || dp + dt < bestDist)) {
+        best = j;
+        bestDist = dp + dt;
+      }
+    }
+    if (best < 0) {
+      result->missing++;
+      continue;
+    }
+    m_out_used[best] = 1;
+    if (fieldsMatch(m_out_keys[best] & 0xffffffff, r)) {
+      result->matched++;
+    } else {
+      result->differing++;
+    }
+  }
+  result->extra = nOut - result->matched - result->differing;
+
+  return (result->missing || result->extra || result->differing ||
+          result->headerDiffers)
+             ? 1
+             : 0;
+}
@@ -0,0 +1,96 @@
+/**
+ *  fcf_cluster_compare.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_CLUSTER_COMPARE_HH
+#define FCF_CLUSTER_COMPARE_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "fcf_cluster_decoder.hh"
+
+/**
+ * maximum absolute differences for two clusters to match. Pad and time
+ * select the partner cluster, the others decide if it differs. Charges are
+ * in ADC counts, sigmas are the pad and time variances.
+ **/
+struct fcfTolerance_t {
+  float pad;
+  float time;
+  float sigma;
+  uint32_t charge;
+  uint32_t qmax;
+};
+
+const struct fcfTolerance_t fcfExactTolerance = {0, 0, 0, 0, 0};
+
+struct fcfCompareResult_t {
+  uint32_t nOutput;
+  uint32_t nReference;
+  uint32_t matched;   // partner found, all fields within tolerance
+  uint32_t differing; // partner found, charge, qmax, sigma or flags differ
+  uint32_t missing;   // reference clusters without partner in the output
+  uint32_t extra;     // output clusters without partner in the reference
+  bool headerDiffers; // header or RCU trailer words differ
+};
+
+/**
+ * Order-insensitive comparison of two FCF output events. Both cluster lists
+ * are sorted by (row, pad, time) with an LSD radix sort and matched in a
+ * single merge pass, so the runtime is linear in the number of clusters.
+ * Buffers are kept between calls, use one instance per thread.
+ **/
+class fcf_cluster_compare {
+public:
+  fcf_cluster_compare(fcfTolerance_t tolerance = fcfExactTolerance);
+  ~fcf_cluster_compare();
+
+  void setTolerance(fcfTolerance_t tolerance) { m_tolerance = tolerance; }
+
+  /**
+   * compare output against reference. Returns 0 if all clusters match, 1 if
+   * there are missing, extra or differing clusters or the headers differ,
+   * -1 with errno set to EBADMSG if one of the events cannot be decoded.
+   **/
+  int compare(const uint32_t *output, uint32_t outputWords,
+              const uint32_t *reference, uint32_t referenceWords,
+              fcfCompareResult_t *result);
+
+private:
+  int decode(const uint32_t *event, uint32_t nWords,
+             fcf_cluster_buffer **buffer, std::vector<uint64_t> *keys);
+  bool fieldsMatch(uint32_t o, uint32_t r);
+
+  fcfTolerance_t m_tolerance;
+  const uint32_t *m_out_event;
+  const uint32_t *m_ref_event;
+  fcf_cluster_buffer *m_out;
+  fcf_cluster_buffer *m_ref;
+  std::vector<uint64_t> m_out_keys;
+  std::vector<uint64_t> m_ref_keys;
+  std::vector<uint64_t> m_sort_tmp;
+  std::vector<uint8_t> m_out_used;
+};
+
+/**
+ * sort keys by their upper 32 bits with an LSD radix sort of 11 bit digits,
+ * the lower 32 bits are carried along. tmp has to hold n entries.
+ **/
+void radixSortKeys(uint64_t *keys, uint64_t *tmp, size_t n);
+
+#endif // FCF_CLUSTER_COMPARE_HH
@@ -0,0 +1,213 @@
+/**
+ *  fcf_cluster_decoder.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fcf_cluster_decoder.hh"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#define FCF_SSE2 1
+#endif
+
+#define FCF_ARRAY_ALIGN 64
+
+int64_t fcfParseTrailer(const uint32_t *event, uint32_t nWords,
+                        fcfTrailer_t *trailer) {
+  if (nWords < FCF_HEADER_DW + 2) {
+    errno = EBADMSG;
+    return -1;
+  }
+  uint32_t last = event[nWords - 1];
+  uint32_t trailerWords = last & 0x7f;
+  if ((last >> 30) != 0x3 || trailerWords < 2 ||
+      trailerWords > nWords - FCF_HEADER_DW) {
+    errno = EBADMSG;
+    return -1;
+  }
+  const uint32_t *trl = event + nWords - trailerWords;
+  for (uint32_t i = 1; i < trailerWords - 1; i++) {
+    if ((trl[i] >> 30) != 0x2) {
+      errno = EBADMSG;
+      return -1;
+    }
+  }
+  uint32_t clusterWords = nWords - FCF_HEADER_DW - trailerWords;
+  if (clusterWords % FCF_CLUSTER_DW) {
+    errno = EBADMSG;
+    return -1;
+  }
+  if (trailer) {
+    trailer->payloadWords = trl[0] & 0x3ffffff;
+    trailer->trailerWords = trailerWords;
+    trailer->rcuId = (last >> 7) & 0x1ff;
+    trailer->formatVersion = (last >> 24) & 0x3f;
+  }
+  return clusterWords / FCF_CLUSTER_DW;
+}
+
+/** decode clusters [first, n), returns the index of a bad marker or n **/
+static uint32_t decodeScalar(const uint32_t *cl, uint32_t first, uint32_t n,
+                             fcfClusters_t *c) {
+  for (uint32_t i = first; i < n; i++) {
+    const uint32_t *w = cl + i * FCF_CLUSTER_DW;
+    if ((w[0] >> 30) != FCF_CLUSTER_MARKER) {
+      return i;
+    }
+    float pad, time, pad2, time2;
+    memcpy(&pad, &w[2], sizeof(float));
+    memcpy(&time, &w[3], sizeof(float));
+    memcpy(&pad2, &w[4], sizeof(float));
+    memcpy(&time2, &w[5], sizeof(float));
+    c->row[i] = (w[0] >> 24) & 0x3f;
+    c->qmax[i] = (w[0] & 0xffffff) >> FCF_CHARGE_FRAC_BITS;
+    c->flags[i] = w[1] >> 30;
+    c->charge[i] = (w[1] & 0x3fffffff) >> FCF_CHARGE_FRAC_BITS;
+    c->pad[i] = pad;
+    c->time[i] = time;
+    c->sigmaPad2[i] = pad2 - pad * pad;
+    c->sigmaTime2[i] = time2 - time * time;
+  }
+  return n;
+}
+
+#ifdef FCF_SSE2
+/** store the low byte of each 32 bit lane **/
+static inline void storeBytes(uint8_t *dst, __m128i v) {
+  __m128i v16 = _mm_packs_epi32(v, v);
+  int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v16, v16));
+  memcpy(dst, &bytes, sizeof(bytes));
+}
+
+/**
+ * four clusters per iteration: the 24 words are transposed into one vector
+ * per cluster word, then all fields are extracted in parallel
+ **/
+static uint32_t decodeSse2(const uint32_t *cl, uint32_t n, fcfClusters_t *c) {
+  const __m128i marker = _mm_set1_epi32(FCF_CLUSTER_MARKER);
+  const __m128i rowMask = _mm_set1_epi32(0x3f);
+  const __m128i qmaxMask = _mm_set1_epi32(0xffffff);
+  const __m128i chargeMask = _mm_set1_epi32(0x3fffffff);
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float *src = (const float *)(cl + i * FCF_CLUSTER_DW);
+    __m128 v0 = _mm_loadu_ps(src);
+    __m128 v1 = _mm_loadu_ps(src + 4);
+    __m128 v2 = _mm_loadu_ps(src + 8);
+    __m128 v3 = _mm_loadu_ps(src + 12);
+    __m128 v4 = _mm_loadu_ps(src + 16);
+    __m128 v5 = _mm_loadu_ps(src + 20);
+    // words 0/1, 2/3 and 4/5 of clusters 0 and 1 ...
+    __m128 a01 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 2, 1, 0));
+    __m128 a23 = _mm_shuffle_ps(v0, v2, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128 a45 = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(3, 2, 1, 0));
+    // ... and of clusters 2 and 3
+    __m128 b01 = _mm_shuffle_ps(v3, v4, _MM_SHUFFLE(3, 2, 1, 0));
+    __m128 b23 = _mm_shuffle_ps(v3, v5, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128 b45 = _mm_shuffle_ps(v4, v5, _MM_SHUFFLE(3, 2, 1, 0));
+    __m128i w0 = _mm_castps_si128(
+        _mm_shuffle_ps(a01, b01, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i w1 = _mm_castps_si128(
+        _mm_shuffle_ps(a01, b01, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128 pad = _mm_shuffle_ps(a23, b23, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 time = _mm_shuffle_ps(a23, b23, _MM_SHUFFLE(3, 1, 3, 1));
+    __m128 pad2 = _mm_shuffle_ps(a45, b45, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 time2 = _mm_shuffle_ps(a45, b45, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m128i ok = _mm_cmpeq_epi32(_mm_srli_epi32(w0, 30), marker);
+    if (_mm_movemask_epi8(ok) != 0xffff) {
+      // let the scalar loop find the bad cluster
+      return decodeScalar(cl, i, n, c);
+    }
+    storeBytes(c->row + i, _mm_and_si128(_mm_srli_epi32(w0, 24), rowMask));
+    storeBytes(c->flags + i, _mm_srli_epi32(w1, 30));
+    _mm_storeu_si128((__m128i *)(c->qmax + i),
+                     _mm_srli_epi32(_mm_and_si128(w0, qmaxMask),
+                                    FCF_CHARGE_FRAC_BITS));
+    _mm_storeu_si128((__m128i *)(c->charge + i),
+                     _mm_srli_epi32(_mm_and_si128(w1, chargeMask),
+                                    FCF_CHARGE_FRAC_BITS));
+    _mm_storeu_ps(c->pad + i, pad);
+    _mm_storeu_ps(c->time + i, time);
+    _mm_storeu_ps(c->sigmaPad2 + i, _mm_sub_ps(pad2, _mm_mul_ps(pad, pad)));
+    _mm_storeu_ps(c->sigmaTime2 + i,
+                  _mm_sub_ps(time2, _mm_mul_ps(time, time)));
+  }
+  return decodeScalar(cl, i, n, c);
+}
+#endif
+
+int64_t fcfDecodeClusters(const uint32_t *event, uint32_t nWords,
+                          fcfClusters_t *clusters, fcfTrailer_t *trailer) {
+  clusters->count = 0;
+  int64_t n = fcfParseTrailer(event, nWords, trailer);
+  if (n < 0) {
+    return -1;
+  }
+  if (n > clusters->capacity) {
+    errno = ENOSPC;
+    return -1;
+  }
+  const uint32_t *cl = event + FCF_HEADER_DW;
+#ifdef FCF_SSE2
+  uint32_t decoded = decodeSse2(cl, n, clusters);
+#else
+  uint32_t decoded = decodeScalar(cl, 0, n, clusters);
+#endif
+  clusters->count = decoded;
+  if (decoded != n) {
+    errno = EBADMSG;
+    return -1;
+  }
+  return n;
+}
+
+static inline size_t alignedSize(size_t size) {
+  return (size + FCF_ARRAY_ALIGN - 1) & ~((size_t)FCF_ARRAY_ALIGN - 1);
+}
+
+fcf_cluster_buffer::fcf_cluster_buffer(uint32_t capacity) {
+  // one allocation, each array starting on its own cache line
+  size_t bytes8 = alignedSize(capacity);
+  size_t bytes32 = alignedSize(capacity * sizeof(uint32_t));
+  m_mem = NULL;
+  if (posix_memalign(&m_mem, FCF_ARRAY_ALIGN, 2 * bytes8 + 6 * bytes32) != 0) {
+    throw FCF_BUFFER_CONSTRUCTOR_FAILED;
+  }
+  uint8_t *p = (uint8_t *)m_mem;
+  m_clusters.capacity = capacity;
+  m_clusters.count = 0;
+  m_clusters.row = p;
+  p += bytes8;
+  m_clusters.flags = p;
+  p += bytes8;
+  m_clusters.charge = (uint32_t *)p;
+  p += bytes32;
+  m_clusters.qmax = (uint32_t *)p;
+  p += bytes32;
+  m_clusters.pad = (float *)p;
+  p += bytes32;
+  m_clusters.time = (float *)p;
+  p += bytes32;
+  m_clusters.sigmaPad2 = (float *)p;
+  p += bytes32;
+  m_clusters.sigmaTime2 = (float *)p;
+}
+
+fcf_cluster_buffer::~fcf_cluster_buffer() { free(m_mem); }
@@ -0,0 +1,114 @@
+/**
+ *  fcf_cluster_decoder.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_CLUSTER_DECODER_HH
+#define FCF_CLUSTER_DECODER_HH
+
+#include <stdint.h>
+
+/**
+ * FastClusterFinder output event:
+ *   FCF_HEADER_DW words header, starting with the CDH
+ *   n * FCF_CLUSTER_DW words clusters
+ *   RCU trailer as received with the raw data, FCF_TRAILER_DW words
+ *
+ * Cluster words:
+ *   0: [31:30] 0b11 cluster marker, [29:24] pad row, [23:0] Qmax
+ *   1: [31:30] flags, [29:0] total charge
+ *   2: pad (float)
+ *   3: time (float)
+ *   4: pad^2 (float), mean of the squared pad
+ *   5: time^2 (float), mean of the squared time
+ * Qmax and the total charge are fixed point with FCF_CHARGE_FRAC_BITS
+ * fractional bits.
+ *
+ * RCU trailer words:
+ *   first: [25:0] payload size of the raw data in words
+ *   middle: [31:30] 0b10, [29:26] parameter code, [25:0] value
+ *   last: [31:30] 0b11, [29:24] format version, [15:7] RCU ID,
+ *         [6:0] trailer size in words
+ **/
+#define FCF_HEADER_DW 10
+#define FCF_TRAILER_DW 9
+#define FCF_CLUSTER_DW 6
+#define FCF_CLUSTER_MARKER 0x3
+#define FCF_CHARGE_FRAC_BITS 6
+
+#define FCF_FLAG_SPLIT_PAD 0x1
+#define FCF_FLAG_SPLIT_TIME 0x2
+
+#define FCF_BUFFER_CONSTRUCTOR_FAILED 1
+
+struct fcfTrailer_t {
+  uint32_t payloadWords;
+  uint32_t trailerWords;
+  uint32_t rcuId;
+  uint32_t formatVersion;
+};
+
+/**
+ * Struct-of-arrays cluster buffers, provided by the caller. Each array has
+ * to hold capacity entries. Use fcf_cluster_buffer to allocate them.
+ **/
+struct fcfClusters_t {
+  uint32_t capacity;
+  uint32_t count;
+  uint8_t *row;
+  uint8_t *flags;
+  uint32_t *charge;
+  uint32_t *qmax;
+  float *pad;
+  float *time;
+  float *sigmaPad2;
+  float *sigmaTime2;
+};
+
+/**
+ * Validate the RCU trailer at the end of an FCF output event of nWords
+ * words and fill trailer if not NULL. Returns the number of clusters or -1
+ * with errno set to EBADMSG if the event is malformed.
+ **/
+int64_t fcfParseTrailer(const uint32_t *event, uint32_t nWords,
+                        fcfTrailer_t *trailer);
+
+/**
+ * Decode all clusters of an FCF output event, e.g. directly from the DMA
+ * buffer. Does not allocate. Returns the number of clusters or -1 with
+ * errno set:
+ *   EBADMSG: invalid trailer or cluster marker, clusters->count holds the
+ *            number of clusters decoded before the bad one
+ *   ENOSPC:  more clusters than clusters->capacity
+ **/
+int64_t fcfDecodeClusters(const uint32_t *event, uint32_t nWords,
+                          fcfClusters_t *clusters,
+                          fcfTrailer_t *trailer = 0);
+
+/** owner of 64 byte aligned cluster arrays **/
+class fcf_cluster_buffer {
+public:
+  fcf_cluster_buffer(uint32_t capacity);
+  ~fcf_cluster_buffer();
+
+  fcfClusters_t *clusters() { return &m_clusters; }
+
+private:
+  void *m_mem;
+  fcfClusters_t m_clusters;
+};
+
+#endif // FCF_CLUSTER_DECODER_HH
@@ -0,0 +1,155 @@
+/**
+ *  fcf_config.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_CONFIG_HH
+#define FCF_CONFIG_HH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** FastClusterFinder parameters, see librorc::fastclusterfinder **/
+struct fcfConfig_t {
+  uint16_t bypass_merger;
+  uint16_t charge_fluctuation;
+  uint16_t cluster_lower_limit;
+  uint16_t cluster_qmax_lower_limit;
+  uint16_t deconvolute_pad;
+  uint16_t merger_distance;
+  uint16_t noise_suppression;
+  uint16_t noise_suppression_minimum;
+  uint16_t noise_suppression_neighbor;
+  uint16_t single_pad_suppression;
+  uint16_t single_seq_limit;
+  uint16_t tag_deconvoluted_clusters;
+  uint16_t tag_border_clusters;
+  uint16_t correct_edge_clusters;
+  uint16_t use_time_follow;
+};
+
+const struct fcfConfig_t fcfDefaultConfig = {
+  bypass_merger : 0,
+  charge_fluctuation : 0,
+  cluster_lower_limit : 10,
+  cluster_qmax_lower_limit : 0,
+  deconvolute_pad : 0,
+  merger_distance : 4,
+  noise_suppression : 0,
+  noise_suppression_minimum : 0,
+  noise_suppression_neighbor : 0,
+  single_pad_suppression : 0,
+  single_seq_limit : 0,
+  tag_deconvoluted_clusters : 0,
+  tag_border_clusters : 0,
+  correct_edge_clusters : 0,
+  use_time_follow : 1
+};
+
+/** getopt_long options shared by all tools taking an FCF configuration **/
+#define FCF_CONFIG_OPTSTRING "d:s:B:l:q:S:M:t:N:i:u:D:e:E:"
+#define FCF_CONFIG_LONG_OPTIONS                                                \
+  {"deconvolute-pad", required_argument, 0, 'd'},                              \
+      {"single-pad-suppression", required_argument, 0, 's'},                   \
+      {"bypass-merger", required_argument, 0, 'B'},                            \
+      {"cluster-lower-limit", required_argument, 0, 'l'},                      \
+      {"cluster-qmax-lower-limit", required_argument, 0, 'q'},                 \
+      {"single-sequence-limit", required_argument, 0, 'S'},                    \
+      {"merger-distance", required_argument, 0, 'M'},                          \
+      {"use-time-follow", required_argument, 0, 't'},                          \
+      {"noise-suppression", required_argument, 0, 'N'},                        \
+      {"noise-suppression-for-minima", required_argument, 0, 'i'},             \
+      {"noise-suppression-neighbor", required_argument, 0, 'u'},               \
+      {"tag-deconvoluted-clusters", required_argument, 0, 'D'},                \
+      {"tag-border-clusters", required_argument, 0, 'e'},                      \
+      {"correct-edge-clusters", required_argument, 0, 'E'}
+
+/**
+ * apply one of the FCF_CONFIG_LONG_OPTIONS to cfg. Returns 0 or -1 if arg
+ * is not an FCF option.
+ **/
+inline int parseFcfConfigOption(int arg, const char *optarg,
+                                fcfConfig_t *cfg) {
+  if (!optarg) {
+    return -1;
+  }
+  unsigned long value = strtoul(optarg, NULL, 0);
+  switch (arg) {
+  case 'd':
+    cfg->deconvolute_pad = value & 1;
+    break;
+  case 's':
+    cfg->single_pad_suppression = value & 1;
+    break;
+  case 'B':
+    cfg->bypass_merger = value & 1;
+    break;
+  case 'l':
+    cfg->cluster_lower_limit = value & 0xffff;
+    break;
+  case 'q':
+    cfg->cluster_qmax_lower_limit = value & 0x7ff;
+    break;
+  case 'S':
+    cfg->single_seq_limit = value & 0xffff;
+    break;
+  case 'M':
+    cfg->merger_distance = value & 0xffff;
+    break;
+  case 't':
+    cfg->use_time_follow = value & 0xffff;
+    break;
+  case 'N':
+    cfg->noise_suppression = value & 0xffff;
+    break;
+  case 'i':
+    cfg->noise_suppression_minimum = value & 0xffff;
+    break;
+  case 'u':
+    cfg->noise_suppression_neighbor = value & 0xffff;
+    break;
+  case 'D':
+    cfg->tag_deconvoluted_clusters = value & 0x3;
+    break;
+  case 'e':
+    cfg->tag_border_clusters = value & 1;
+    break;
+  case 'E':
+    cfg->correct_edge_clusters = value & 1;
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+/** print cfg as a comment line of the stats output **/
+inline void printHwcfConfig(struct fcfConfig_t cfg) {
+  printf("# BypassMerger: %d, ChargeFluctiation: %d, ClusterLowerLimit: %d, "
+         "ClusterQmaxLowerLimit: %d, DeconvPad: %d, MergerDistance: %d, "
+         "NoiseSuppr: %d, NoiseSupprMin: %d, NoiseSupprNeighbor: %d, "
+         "SinglePadSuppr: %d, SingleSeqLimit: %d, TagDeconvClusters: %d, "
+         "TagBorderClusters: %d, UseTimeFollow: %d\n",
+         cfg.bypass_merger, cfg.charge_fluctuation, cfg.cluster_lower_limit,
+         cfg.cluster_qmax_lower_limit, cfg.deconvolute_pad, cfg.merger_distance,
+         cfg.noise_suppression, cfg.noise_suppression_minimum,
+         cfg.noise_suppression_neighbor, cfg.single_pad_suppression,
+         cfg.single_seq_limit, cfg.tag_deconvoluted_clusters,
+         cfg.tag_border_clusters, cfg.use_time_follow);
+}
+
+#endif // FCF_CONFIG_HH
@@ -0,0 +1,426 @@
+/**
+ *  fcf_emulator.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include "fcf_emulator.hh"
+#include "fcf_cluster_decoder.hh"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FCF_X86 1
+#endif
+
+/** RCU payload: channel header [31:30] = 0b01, [29] bad channel,
+ *  [25:16] number of 10 bit words, [11:0] hardware address **/
+#define ALTRO_CHANNEL_HEADER 0x1
+#define ALTRO_BAD_CHANNEL (1 << 29)
+#define ALTRO_N10(w) (((w) >> 16) & 0x3ff)
+#define ALTRO_HWADDR(w) ((w)&0xfff)
+
+/****************** 10 bit unpacking *******************/
+/** each payload word holds three 10 bit words in [29:20], [19:10], [9:0] **/
+static void unpack10Scalar(const uint32_t *src, uint32_t nWords,
+                           uint16_t *dst) {
+  for (uint32_t i = 0; i < nWords; i++) {
+    dst[3 * i] = (src[i] >> 20) & 0x3ff;
+    dst[3 * i + 1] = (src[i] >> 10) & 0x3ff;
+    dst[3 * i + 2] = src[i] & 0x3ff;
+  }
+}
+
+#ifdef FCF_X86
+/** four payload words to twelve samples per iteration **/
+__attribute__((target("ssse3"))) static void
+unpack10Ssse3(const uint32_t *src, uint32_t nWords, uint16_t *dst) {
+  const __m128i mask = _mm_set1_epi32(0x3ff);
+  // 16 bit lanes of ab = a0..a3 b0..b3, of cc = c0..c3 c0..c3
+  const __m128i abLo =
+      _mm_setr_epi8(0, 1, 8, 9, -1, -1, 2, 3, 10, 11, -1, -1, 4, 5, 12, 13);
+  const __m128i ccLo =
+      _mm_setr_epi8(-1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1);
+  const __m128i abHi =
+      _mm_setr_epi8(-1, -1, 6, 7, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1);
+  const __m128i ccHi =
+      _mm_setr_epi8(4, 5, -1, -1, -1, -1, 6, 7, -1, -1, -1, -1, -1, -1, -1,
+                    -1);
+  uint32_t i = 0;
+  for (; i + 4 <= nWords; i += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i a = _mm_and_si128(_mm_srli_epi32(w, 20), mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(w, 10), mask);
+    __m128i c = _mm_and_si128(w, mask);
+    __m128i ab = _mm_packs_epi32(a, b);
+    __m128i cc = _mm_packs_epi32(c, c);
+    __m128i lo = _mm_or_si128(_mm_shuffle_epi8(ab, abLo),
+                              _mm_shuffle_epi8(cc, ccLo));
+    __m128i hi = _mm_or_si128(_mm_shuffle_epi8(ab, abHi),
+                              _mm_shuffle_epi8(cc, ccHi));
+    _mm_storeu_si128((__m128i *)(dst + 3 * i), lo);
+    _mm_storel_epi64((__m128i *)(dst + 3 * i + 8), hi);
+  }
+  unpack10Scalar(src + i, nWords - i, dst + 3 * i);
+}
+
+static bool cpuHasSsse3() {
+  static const bool hasSsse3 = __builtin_cpu_supports("ssse3");
+  return hasSsse3;
+}
+#endif
+
+static void unpack10(const uint32_t *src, uint32_t nWords, uint16_t *dst) {
+#ifdef FCF_X86
+  if (cpuHasSsse3()) {
+    unpack10Ssse3(src, nWords, dst);
+    return;
+  }
+#endif
+  unpack10Scalar(src, nWords, dst);
+}
+
+/****************** emulator *******************/
+fcf_emulator::fcf_emulator(fcf_mapping *mapping, fcfConfig_t cfg) {
+  for (uint32_t i = 0; i < gkConfigWordCnt; i++) {
+    m_config_words[i] = (*mapping)[i];
+  }
+  m_cfg = cfg;
+  memset(&m_stats, 0, sizeof(m_stats));
+  m_out = NULL;
+}
+
+fcf_emulator::~fcf_emulator() {}
+
+int fcf_emulator::processEvent(const uint32_t *event, uint32_t nWords,
+                               std::vector<uint32_t> *out) {
+  if (nWords < FCF_HEADER_DW + 2) {
+    errno = EBADMSG;
+    return -1;
+  }
+  uint32_t last = event[nWords - 1];
+  uint32_t trailerWords = last & 0x7f;
+  if ((last >> 30) != 0x3 || trailerWords < 2 ||
+      trailerWords > nWords - FCF_HEADER_DW) {
+    errno = EBADMSG;
+    return -1;
+  }
+
+  m_sequences.clear();
+  const uint32_t *payload = event + FCF_HEADER_DW;
+  uint32_t payloadWords = nWords - FCF_HEADER_DW - trailerWords;
+  uint32_t i = 0;
+  while (i < payloadWords) {
+    uint32_t hdr = payload[i];
+    if ((hdr >> 30) != ALTRO_CHANNEL_HEADER) {
+      // resynchronize on the next channel header
+      m_stats.decodeErrors++;
+      i++;
+      continue;
+    }
+    uint32_t n10 = ALTRO_N10(hdr);
+    uint32_t n32 = (n10 + 2) / 3;
+    if (i + 1 + n32 > payloadWords) {
+      m_stats.decodeErrors++;
+      break;
+    }
+    uint32_t configWord = m_config_words[ALTRO_HWADDR(hdr)];
+    if (!(hdr & ALTRO_BAD_CHANNEL) && (configWord & FCF_CW_ACTIVE)) {
+      if (m_samples.size() < 3 * n32) {
+        m_samples.resize(3 * n32);
+      }
+      unpack10(payload + i + 1, n32, m_samples.data());
+      processChannel(configWord, m_samples.data(), n10);
+      m_stats.channels++;
+    }
+    i += 1 + n32;
+  }
+  m_stats.sequences += m_sequences.size();
+
+  out->clear();
+  out->insert(out->end(), event, event + FCF_HEADER_DW);
+  m_out = out;
+  mergeSequences();
+  out->insert(out->end(), event + nWords - trailerWords, event + nWords);
+  m_stats.events++;
+  return 0;
+}
+
+/**
+ * bunches: length including the two header words, time of the first
+ * sample, samples in decreasing time
+ **/
+void fcf_emulator::processChannel(uint32_t configWord, const uint16_t *data,
+                                  uint32_t nWords10) {
+  uint32_t idx = 0;
+  while (idx + 2 <= nWords10) {
+    uint32_t len = data[idx];
+    uint32_t time0 = data[idx + 1];
+    if (len < 3 || idx + len > nWords10 || time0 + 3 < len) {
+      m_stats.decodeErrors++;
+      return;
+    }
+    const uint16_t *s = data + idx + 2;
+    int n = len - 2;
+
+    // walk in increasing time, split at significant minima
+    int start = n - 1;
+    uint32_t peak = 0;
+    uint32_t minimum = 0;
+    int minIdx = 0;
+    bool falling = false;
+    uint8_t flags = 0;
+    for (int k = n - 1; k >= 0; k--) {
+      uint32_t adc = s[k];
+      if (!falling) {
+        if (adc >= peak) {
+          peak = adc;
+        } else {
+          falling = true;
+          minimum = adc;
+          minIdx = k;
+        }
+      } else if (adc < minimum) {
+        minimum = adc;
+        minIdx = k;
+      } else if (adc > minimum + m_cfg.noise_suppression &&
+                 peak > minimum + m_cfg.noise_suppression_minimum) {
+        // the minimum stays with the earlier sequence
+        addSequence(configWord, s, start, minIdx, time0,
+                    flags | FCF_FLAG_SPLIT_TIME);
+        start = minIdx - 1;
+        flags = FCF_FLAG_SPLIT_TIME;
+        peak = adc;
+        falling = false;
+      }
+    }
+    addSequence(configWord, s, start, 0, time0, flags);
+    idx += len;
+  }
+}
+
+/** samples s[hi] down to s[lo], sample k has time time0 - k **/
+void fcf_emulator::addSequence(uint32_t configWord, const uint16_t *s, int hi,
+                               int lo, uint32_t time0, uint8_t flags) {
+  uint32_t gain = FCF_CW_GAIN(configWord);
+  sequence_t seq;
+  seq.q = 0;
+  seq.qmax = 0;
+  seq.qt = 0;
+  seq.qt2 = 0;
+  seq.peakTime = 0;
+  uint32_t adcMax = 0;
+  for (int k = hi; k >= lo; k--) {
+    // gain is 1.12 fixed point, charges keep FCF_CHARGE_FRAC_BITS
+    uint32_t q = (s[k] * gain) >> (12 - FCF_CHARGE_FRAC_BITS);
+    uint64_t t = time0 - k;
+    seq.q += q;
+    seq.qt += q * t;
+    seq.qt2 += q * t * t;
+    if (q > seq.qmax) {
+      seq.qmax = q;
+      seq.peakTime = t;
+    }
+    if (s[k] > adcMax) {
+      adcMax = s[k];
+    }
+  }
+  if (seq.q == 0 || adcMax < m_cfg.single_seq_limit) {
+    return;
+  }
+  seq.row = FCF_CW_ROW(configWord);
+  seq.pad = FCF_CW_PAD(configWord);
+  seq.flags = flags;
+  seq.edge = (configWord & FCF_CW_EDGE) ? 1 : 0;
+  seq.border = (configWord & FCF_CW_BORDER) ? 1 : 0;
+  m_sequences.push_back(seq);
+}
+
+void fcf_emulator::mergeSequences() {
+  // order by row, pad and peak time, the index in the low 40 bits
+  m_order.resize(m_sequences.size());
+  for (size_t i = 0; i < m_sequences.size(); i++) {
+    const sequence_t *seq = &m_sequences[i];
+    m_order[i] = ((uint64_t)seq->row << 58) | ((uint64_t)seq->pad << 50) |
+                 ((uint64_t)(seq->peakTime & 0x3ff) << 40) | i;
+  }
+  std::sort(m_order.begin(), m_order.end());
+
+  m_open.clear();
+  m_next.clear();
+  int curRow = -1;
+  int curPad = -1;
+  // with time follow, m_open is ordered by lastPeakTime and candidates
+  // before firstCandidate are too early for all remaining sequences
+  size_t firstCandidate = 0;
+  for (size_t i = 0; i < m_order.size(); i++) {
+    const sequence_t *seq = &m_sequences[m_order[i] & 0xffffffffffULL];
+    cluster_t cl;
+    if (m_cfg.bypass_merger) {
+      openCluster(seq, seq->flags, &cl);
+      closeCluster(&cl);
+      continue;
+    }
+
+    if (seq->row != curRow || seq->pad != curPad) {
+      // clusters not continued on the previous pad are complete
+      closeOpenClusters();
+      if (seq->row == curRow && seq->pad == curPad + 1) {
+        m_open.swap(m_next);
+      } else {
+        for (size_t j = 0; j < m_next.size(); j++) {
+          closeCluster(&m_next[j]);
+        }
+      }
+      m_next.clear();
+      firstCandidate = 0;
+      curRow = seq->row;
+      curPad = seq->pad;
+    }
+
+    // closest candidate on the previous pad
+    int best = -1;
+    uint32_t bestDist = 0;
+    for (size_t j = firstCandidate; j < m_open.size(); j++) {
+      uint32_t ref = m_cfg.use_time_follow ? m_open[j].lastPeakTime
+                                           : m_open[j].firstPeakTime;
+      if (m_cfg.use_time_follow) {
+        if (ref + m_cfg.merger_distance < seq->peakTime) {
+          if (j == firstCandidate) {
+            firstCandidate++;
+          }
+          continue;
+        }
+        if (ref > seq->peakTime + m_cfg.merger_distance) {
+          break;
+        }
+      }
+      if (m_open[j].continued) {
+        continue;
+      }
+      uint32_t dist = (seq->peakTime > ref) ? seq->peakTime - ref
+                                            : ref - seq->peakTime;
+      if (dist <= m_cfg.merger_distance && (best < 0 || dist < bestDist)) {
+        best = j;
+        bestDist = dist;
+      }
+    }
+
+    if (best < 0) {
+      openCluster(seq, seq->flags, &cl);
+      m_next.push_back(cl);
+      continue;
+    }
+    m_open[best].continued = true;
+    cl = m_open[best];
+    cl.continued = false;
+    uint32_t rise = (uint32_t)m_cfg.noise_suppression_neighbor
+                    << FCF_CHARGE_FRAC_BITS;
+    if (m_cfg.deconvolute_pad && cl.falling && seq->qmax > cl.lastQmax + rise) {
+      // charge rises again in pad direction: split
+      cl.flags |= FCF_FLAG_SPLIT_PAD;
+      closeCluster(&cl);
+      openCluster(seq, seq->flags | FCF_FLAG_SPLIT_PAD, &cl);
+    } else {
+      addPad(&cl, seq);
+    }
+    m_next.push_back(cl);
+  }
+  closeOpenClusters();
+  for (size_t j = 0; j < m_next.size(); j++) {
+    closeCluster(&m_next[j]);
+  }
+  m_next.clear();
+}
+
+void fcf_emulator::closeOpenClusters() {
+  for (size_t j = 0; j < m_open.size(); j++) {
+    if (!m_open[j].continued) {
+      closeCluster(&m_open[j]);
+    }
+  }
+  m_open.clear();
+}
+
+void fcf_emulator::openCluster(const sequence_t *seq, uint8_t flags,
+                               cluster_t *cl) {
+  memset(cl, 0, sizeof(*cl));
+  cl->row = seq->row;
+  cl->firstPeakTime = seq->peakTime;
+  cl->flags = flags;
+  addPad(cl, seq);
+}
+
+void fcf_emulator::addPad(cluster_t *cl, const sequence_t *seq) {
+  uint32_t fall = (uint32_t)m_cfg.charge_fluctuation << FCF_CHARGE_FRAC_BITS;
+  if (cl->nPads && seq->qmax + fall < cl->lastQmax) {
+    cl->falling = true;
+  }
+  int64_t pad = seq->pad;
+  cl->q += seq->q;
+  cl->qpNorm += seq->q;
+  cl->qp += seq->q * pad;
+  cl->qp2 += seq->q * pad * pad;
+  if (m_cfg.correct_edge_clusters && seq->edge) {
+    // mirror the edge pad into the virtual pad beyond the row
+    int64_t virt = (seq->pad == 0) ? -1 : pad + 1;
+    cl->qpNorm += seq->q;
+    cl->qp += seq->q * virt;
+    cl->qp2 += seq->q * virt * virt;
+  }
+  cl->qt += seq->qt;
+  cl->qt2 += seq->qt2;
+  if (seq->qmax > cl->qmax) {
+    cl->qmax = seq->qmax;
+  }
+  cl->flags |= seq->flags;
+  cl->border |= seq->border;
+  cl->lastPeakTime = seq->peakTime;
+  cl->lastQmax = seq->qmax;
+  cl->lastPad = seq->pad;
+  cl->nPads++;
+}
+
+void fcf_emulator::closeCluster(const cluster_t *cl) {
+  if (m_cfg.single_pad_suppression && cl->nPads == 1) {
+    return;
+  }
+  if ((cl->q >> FCF_CHARGE_FRAC_BITS) < m_cfg.cluster_lower_limit ||
+      (cl->qmax >> FCF_CHARGE_FRAC_BITS) < m_cfg.cluster_qmax_lower_limit) {
+    return;
+  }
+  float pad = (double)cl->qp / cl->qpNorm;
+  float pad2 = (double)cl->qp2 / cl->qpNorm;
+  float time = (double)cl->qt / cl->q;
+  float time2 = (double)cl->qt2 / cl->q;
+  uint32_t flags = m_cfg.tag_deconvoluted_clusters ? cl->flags : 0;
+  if (m_cfg.tag_border_clusters && cl->border) {
+    flags = FCF_FLAG_SPLIT_PAD | FCF_FLAG_SPLIT_TIME;
+  }
+
+  uint32_t words[FCF_CLUSTER_DW];
+  words[0] = (FCF_CLUSTER_MARKER << 30) | ((uint32_t)cl->row << 24) |
+             (cl->qmax & 0xffffff);
+  words[1] = (flags << 30) | (cl->q & 0x3fffffff);
+  memcpy(&words[2], &pad, sizeof(float));
+  memcpy(&words[3], &time, sizeof(float));
+  memcpy(&words[4], &pad2, sizeof(float));
+  memcpy(&words[5], &time2, sizeof(float));
+  m_out->insert(m_out->end(), words, words + FCF_CLUSTER_DW);
+  m_stats.clusters++;
+}
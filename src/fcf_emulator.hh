@@ -0,0 +1,146 @@
+/**
+ *  fcf_emulator.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_EMULATOR_HH
+#define FCF_EMULATOR_HH
+
+#include <stdint.h>
+#include <vector>
+#include "fcf_config.hh"
+#include "fcf_mapping.hh"
+
+/**
+ * Software model of the FastClusterFinder. Takes a raw TPC DDL event with
+ * RCU data and produces the FCF output format described in
+ * fcf_cluster_decoder.hh. An instance keeps its scratch buffers between
+ * events and is not thread safe, use one instance per thread.
+ *
+ * Processing steps:
+ *  - decode the ALTRO channels, look up row, pad, gain and flags in the
+ *    mapping config words, skip inactive channels
+ *  - split bunches into sequences at minima. A minimum splits if the charge
+ *    fell by more than noise_suppression_minimum from the previous peak and
+ *    rises by more than noise_suppression after it.
+ *  - drop sequences with a Qmax below single_seq_limit
+ *  - merge sequences of neighboring pads in a row whose peak times differ
+ *    by at most merger_distance, compared to the last merged sequence with
+ *    use_time_follow, to the first otherwise. With deconvolute_pad, a
+ *    cluster falling by more than charge_fluctuation in pad direction is
+ *    split when the charge rises again by more than
+ *    noise_suppression_neighbor.
+ *  - drop single pad clusters with single_pad_suppression and clusters
+ *    below cluster_lower_limit and cluster_qmax_lower_limit
+ *  - correct_edge_clusters mirrors the charge of an edge pad into the
+ *    virtual pad beyond it for the pad moments
+ *  - tag_deconvoluted_clusters sets the split flags, tag_border_clusters
+ *    sets both flags for clusters touching a branch border pad
+ *
+ * Clusters are written row by row in increasing pad order, which differs
+ * from the order of the hardware.
+ **/
+
+/** config word fields, see fcf_mapping::readMappingFile() **/
+#define FCF_CW_PAD(cw) ((cw)&0xff)
+#define FCF_CW_ROW(cw) (((cw) >> 8) & 0x3f)
+#define FCF_CW_BORDER (1 << 14)
+#define FCF_CW_ACTIVE (1 << 15)
+#define FCF_CW_GAIN(cw) (((cw) >> 16) & 0x1fff)
+#define FCF_CW_EDGE (1 << 29)
+
+struct fcfEmulatorStats_t {
+  uint64_t events;
+  uint64_t channels;
+  uint64_t sequences;
+  uint64_t clusters;
+  uint64_t decodeErrors;
+};
+
+class fcf_emulator {
+public:
+  fcf_emulator(fcf_mapping *mapping, fcfConfig_t cfg);
+  ~fcf_emulator();
+
+  /**
+   * process one raw event of nWords words, out is resized to the output
+   * event. Returns 0 or -1 with errno set to EBADMSG if the RCU trailer is
+   * invalid. Corrupt channels are skipped and counted as decode errors.
+   **/
+  int processEvent(const uint32_t *event, uint32_t nWords,
+                   std::vector<uint32_t> *out);
+
+  fcfEmulatorStats_t getStats() { return m_stats; }
+
+private:
+  struct sequence_t {
+    uint8_t row;
+    uint8_t pad;
+    uint8_t flags;
+    uint8_t edge;
+    uint8_t border;
+    uint16_t peakTime;
+    uint32_t q;
+    uint32_t qmax;
+    uint64_t qt;
+    uint64_t qt2;
+  };
+
+  struct cluster_t {
+    uint32_t q;
+    uint32_t qmax;
+    // pad moments include the virtual pads of correct_edge_clusters
+    uint64_t qpNorm;
+    int64_t qp;
+    uint64_t qp2;
+    uint64_t qt;
+    uint64_t qt2;
+    uint16_t firstPeakTime;
+    uint16_t lastPeakTime;
+    uint32_t lastQmax;
+    uint32_t nPads;
+    uint8_t lastPad;
+    uint8_t row;
+    uint8_t flags;
+    bool border;
+    bool falling;
+    bool continued;
+  };
+
+  void processChannel(uint32_t configWord, const uint16_t *data,
+                      uint32_t nWords10);
+  void addSequence(uint32_t configWord, const uint16_t *samples, int hi,
+                   int lo, uint32_t time0, uint8_t flags);
+  void mergeSequences();
+  void closeOpenClusters();
+  void openCluster(const sequence_t *seq, uint8_t flags, cluster_t *cl);
+  void addPad(cluster_t *cl, const sequence_t *seq);
+  void closeCluster(const cluster_t *cl);
+
+  uint32_t m_config_words[gkConfigWordCnt];
+  fcfConfig_t m_cfg;
+  fcfEmulatorStats_t m_stats;
+
+  // scratch buffers, reused for all events
+  std::vector<uint16_t> m_samples;
+  std::vector<sequence_t> m_sequences;
+  std::vector<uint64_t> m_order;
+  std::vector<cluster_t> m_open;
+  std::vector<cluster_t> m_next;
+  std::vector<uint32_t> *m_out;
+};
+
+#endif // FCF_EMULATOR_HH
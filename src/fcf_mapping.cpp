@@ -19,17 +19,27 @@
  **/
 
 #include "fcf_mapping.hh"
+#include "digest.hh"
 #include <algorithm> // for std::sort()
+#include <ctype.h>
 #include <errno.h>
-#include <fstream>
+#include <fcntl.h>
+#include <librorc.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <vector>
 
-static const unsigned gkPatchStartRow[] = {0, 30, 63, 90, 117, 139};
+static const unsigned gkPatchStartRow[gkPatchCnt] = {0, 30, 63, 90, 117, 139};
 
 fcf_mapping::fcf_mapping(unsigned patchNr) {
   memset(fConfigWords, 0, gkConfigWordCnt * sizeof(uint32_t));
   fPatchNr = patchNr;
+  memset(&fError, 0, sizeof(fError));
 }
 
 fcf_mapping::~fcf_mapping(){};
@@ -38,105 +48,128 @@ uint32_t fcf_mapping::operator[](unsigned ndx) {
   return (ndx < gkConfigWordCnt) ? fConfigWords[ndx] : 0xffffffff;
 }
 
-std::vector<std::string> splitString(std::string &s, char token) {
-  std::vector<std::string> ret;
-  typedef std::string::size_type string_size;
-  string_size i = 0;
-  // invariant: we have processed characters [original value of i, i)
-  while (i != s.size()) {
-    // ignore leading blanks
-    // invariant: characters in range [original i, current i) are all spaces
-    while (i != s.size() && isspace(s[i]))
-      ++i;
-    // find end of next word
-    string_size j = i;
-    // invariant: none of the characters in range [original j, current j)is a
-    // space
-    while (j != s.size() && !isblank(s[j]))
-      j++;
-    // if we found some nonwhitespace characters
-    if (i != j) {
-      // copy from s starting at i and taking j - i chars
-      ret.push_back(s.substr(i, j - i));
-      i = j;
-    }
+static inline bool isSeparator(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline const char *skipSeparators(const char *pos, const char *end) {
+  while (pos < end && isSeparator(*pos)) {
+    pos++;
   }
-  return ret;
+  return pos;
 }
 
-int fcf_mapping::readMappingFile(const char *filename, uint32_t rcuVersion) {
-  if (!filename) {
-    errno = EINVAL;
-    return -1;
+/**
+ * parse the number token at pos like strtoul() with base 0. Returns the end
+ * of the token or NULL if it is empty or contains invalid digits.
+ **/
+static const char *parseNumber(const char *pos, const char *end,
+                               unsigned long *value) {
+  unsigned long base = 10;
+  if (pos < end && *pos == '0') {
+    base = 8;
+    if (end - pos > 2 && (pos[1] | 0x20) == 'x' && isxdigit(pos[2])) {
+      base = 16;
+      pos += 2;
+    }
   }
-  std::ifstream infile(filename);
-  if (infile.bad() or infile.fail()) {
-    errno = EBADF;
-    return -1;
+  const char *start = pos;
+  unsigned long v = 0;
+  while (pos < end && !isSeparator(*pos)) {
+    char c = *pos | 0x20;
+    unsigned long digit;
+    if (*pos >= '0' && *pos <= '9') {
+      digit = *pos - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return NULL;
+    }
+    if (digit >= base) {
+      return NULL;
+    }
+    v = v * base + digit;
+    pos++;
+  }
+  if (pos == start) {
+    return NULL;
+  }
+  *value = v;
+  return pos;
+}
+
+static int mappingError(fcfMappingError_t *error, unsigned long line,
+                        unsigned long column, const char *reason) {
+  if (error) {
+    error->line = line;
+    error->column = column;
+    error->reason = reason;
   }
-  const unsigned bufSize = 4096;
-  char buf[bufSize];
-  std::string line;
+  errno = EINVAL;
+  return -1;
+}
+
+int fcf_mapping::parseMappingFile(const char *data, size_t size,
+                                  uint32_t rcuVersion, fcf_mapping **byPatch,
+                                  fcfMappingError_t *error) {
+  std::vector<uint32_t> rowBranchPadHw[gkPatchCnt];
+  const char *end = data + size;
+  const char *lineStart = data;
   unsigned long lineCnt = 0;
-  std::vector<uint32_t> rowBranchPadHw;
-  while (infile.good()) {
-    line = "";
-    unsigned count = 0;
-    do {
-      infile.getline(buf, bufSize);
-      count = infile.gcount();
-      if (count > 0)
-        line += buf;
-    } while (count == bufSize - 1 && infile.fail() && !infile.eof() &&
-             !infile.bad());    // fail bit set if function stops extracing because
-                                // buffer size limit is reached...
+  while (lineStart < end) {
     ++lineCnt;
-    if (line.length() <= 0) {
-      continue;
+    const char *lineEnd =
+        (const char *)memchr(lineStart, '\n', end - lineStart);
+    if (!lineEnd) {
+      lineEnd = end;
     }
-    char lineStr[1024];
-    snprintf(lineStr, 1024, "%lu", lineCnt);
-    std::vector<std::string> tokens;
-    tokens = splitString(line, '\t');
-    char *cpErr = NULL;
-    if (tokens.size() == 0) {
+    const char *pos = skipSeparators(lineStart, lineEnd);
+    if (pos == lineEnd) {
+      lineStart = lineEnd + 1;
       continue;
     }
-    if (tokens.size() < 2) {
-      errno = EINVAL;
-      return -1;
-    }
+
     // first word is number of this row
-    unsigned long rowNr = strtoul(tokens[0].c_str(), &cpErr, 0);
-    if (*cpErr != '\0') {
-      errno = EINVAL;
-      return -1;
+    unsigned long rowNr;
+    const char *tokenEnd = parseNumber(pos, lineEnd, &rowNr);
+    if (!tokenEnd) {
+      return mappingError(error, lineCnt, pos - lineStart + 1,
+                          "invalid row number");
     }
-    rowNr -= gkPatchStartRow[fPatchNr];
 
     // second word is number of pads in this row
-    unsigned long padCnt = strtoul(tokens[1].c_str(), &cpErr, 0);
-    if (*cpErr != '\0') {
-      errno = EINVAL;
-      return -1;
-    }
-    if (padCnt + 2 != tokens.size()) {
-      errno = EINVAL;
-      return -1;
+    pos = skipSeparators(tokenEnd, lineEnd);
+    unsigned long padCnt;
+    tokenEnd = parseNumber(pos, lineEnd, &padCnt);
+    if (!tokenEnd) {
+      return mappingError(error, lineCnt, pos - lineStart + 1,
+                          (pos == lineEnd) ? "missing pad count"
+                                           : "invalid pad count");
     }
 
-    for (unsigned pad = 0; pad < padCnt; ++pad) {
-      char padStr[1024];
-      snprintf(padStr, 1024, "%ud", pad);
-      unsigned long hwAddress = strtoul(tokens[pad + 2].c_str(), &cpErr, 0);
-      if (*cpErr != '\0') {
-        errno = EINVAL;
-        return -1;
+    // followed by the hardware addresses of all pads
+    for (unsigned long pad = 0;; ++pad) {
+      pos = skipSeparators(tokenEnd, lineEnd);
+      if (pad == padCnt) {
+        if (pos != lineEnd) {
+          return mappingError(error, lineCnt, pos - lineStart + 1,
+                              "more hardware addresses than pads");
+        }
+        break;
+      }
+      unsigned long hwAddress;
+      tokenEnd = parseNumber(pos, lineEnd, &hwAddress);
+      if (!tokenEnd) {
+        return mappingError(error, lineCnt, pos - lineStart + 1,
+                            (pos == lineEnd)
+                                ? "fewer hardware addresses than pads"
+                                : "invalid hardware address");
       }
       unsigned long patchNr = (hwAddress & ~0xFFF) >> 12;
-      if (patchNr != fPatchNr) {
+      if (patchNr >= gkPatchCnt || !byPatch[patchNr]) {
         continue;
       }
+      unsigned long patchRow = rowNr - gkPatchStartRow[patchNr];
 
       // Currently all channels are always active
       bool active = true;
@@ -149,40 +182,250 @@ int fcf_mapping::readMappingFile(const char *filename, uint32_t rcuVersion) {
       bool isEdgePad = (pad == 0) || (pad == (padCnt - 1));
 
       uint32_t configWord =
-          (gainCalib << 16) | ((rowNr & 0x3F) << 8) | (pad & 0xFF);
+          (gainCalib << 16) | ((patchRow & 0x3F) << 8) | (pad & 0xFF);
       if (active) {
         configWord |= (1 << 15);
       }
       if (isEdgePad) {
         configWord |= (1 << 29);
       }
-      fConfigWords[hwAddress & 0xFFF] = configWord;
+      byPatch[patchNr]->fConfigWords[hwAddress & 0xFFF] = configWord;
       uint32_t branch = (hwAddress >> 11) & 1;
       if (rcuVersion == 2) {
         branch = 0;
       }
 
-      rowBranchPadHw.push_back((rowNr << 25) | (branch << 24) | (pad << 16) |
-                               (hwAddress & 0xfff));
+      rowBranchPadHw[patchNr].push_back((patchRow << 25) | (branch << 24) |
+                                        (pad << 16) | (hwAddress & 0xfff));
     } // pad loop
-  } // while(infile.good())
+    lineStart = lineEnd + 1;
+  } // line loop
 
   // mark pads at borders of A/B branches
-  std::sort(rowBranchPadHw.begin(), rowBranchPadHw.end());
-  int rowBranchPadLast = -2;
-  for (unsigned int i = 0; i < rowBranchPadHw.size(); i++) {
-    int rowBranchPad = rowBranchPadHw[i] >> 16;
-    if (rowBranchPad != rowBranchPadLast + 1) {
-      fConfigWords[rowBranchPadHw[i] & 0xFFF] |= (1 << 14);
-      if (i > 0) {
-        fConfigWords[rowBranchPadHw[i - 1] & 0xFFF] |= (1 << 14);
+  for (unsigned patchNr = 0; patchNr < gkPatchCnt; patchNr++) {
+    if (!byPatch[patchNr]) {
+      continue;
+    }
+    uint32_t *configWords = byPatch[patchNr]->fConfigWords;
+    std::vector<uint32_t> &hw = rowBranchPadHw[patchNr];
+    std::sort(hw.begin(), hw.end());
+    int rowBranchPadLast = -2;
+    for (unsigned int i = 0; i < hw.size(); i++) {
+      int rowBranchPad = hw[i] >> 16;
+      if (rowBranchPad != rowBranchPadLast + 1) {
+        configWords[hw[i] & 0xFFF] |= (1 << 14);
+        if (i > 0) {
+          configWords[hw[i - 1] & 0xFFF] |= (1 << 14);
+        }
       }
+      rowBranchPadLast = rowBranchPad;
+    }
+    if (hw.size()) {
+      configWords[hw[hw.size() - 1] & 0xFFF] |= (1 << 14);
+    }
+  }
+  return 0;
+}
+
+int fcf_mapping::readMappingFiles(const char *filename, uint32_t rcuVersion,
+                                  fcf_mapping **maps, unsigned nMaps,
+                                  fcfMappingError_t *error) {
+  if (error) {
+    memset(error, 0, sizeof(*error));
+  }
+  fcf_mapping *byPatch[gkPatchCnt] = {NULL};
+  for (unsigned i = 0; i < nMaps; i++) {
+    unsigned patchNr = maps[i]->fPatchNr;
+    if (patchNr >= gkPatchCnt || byPatch[patchNr]) {
+      return mappingError(error, 0, 0, "invalid or duplicate patch");
+    }
+    byPatch[patchNr] = maps[i];
+  }
+  if (!filename) {
+    return mappingError(error, 0, 0, "no file name");
+  }
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (error) {
+      error->reason = "cannot open file";
     }
-    rowBranchPadLast = rowBranchPad;
+    errno = EBADF;
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
   }
-  if (rowBranchPadHw.size()) {
-    int lastHwAddr = rowBranchPadHw[rowBranchPadHw.size() - 1] & 0xFFF;
-    fConfigWords[lastHwAddr] |= (1 << 14);
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    if (error) {
+      error->reason = "cannot map file";
+    }
+    errno = EBADF;
+    return -1;
   }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  int result = parseMappingFile((const char *)data, st.st_size, rcuVersion,
+                                byPatch, error);
+  int err = errno;
+  munmap(data, st.st_size);
+  errno = err;
+  return result;
+}
+
+int fcf_mapping::readMappingFile(const char *filename, uint32_t rcuVersion) {
+  fcf_mapping *self = this;
+  return readMappingFiles(filename, rcuVersion, &self, 1, &fError);
+}
+
+/**
+ * digest64() and size of a file, read through a private mapping.
+ * Returns 0 or -1 with errno set.
+ **/
+static int hashFile(const char *filename, uint64_t *hash, uint64_t *size) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  *size = st.st_size;
+  if (*size == 0) {
+    close(fd);
+    *hash = digest64(NULL, 0);
+    return 0;
+  }
+  void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  *hash = digest64(data, *size);
+  munmap(data, *size);
   return 0;
 }
+
+int fcf_mapping::readCacheFile(const char *cacheFile, uint64_t sourceHash,
+                               uint64_t sourceSize, uint32_t rcuVersion) {
+  const size_t imageSize =
+      sizeof(fcfMappingCacheHeader_t) + sizeof(fConfigWords);
+  int fd = open(cacheFile, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size != imageSize) {
+    close(fd);
+    errno = EBADMSG;
+    return -1;
+  }
+  void *image = mmap(NULL, imageSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    return -1;
+  }
+  const fcfMappingCacheHeader_t *hdr = (const fcfMappingCacheHeader_t *)image;
+  const uint32_t *words = (const uint32_t *)(hdr + 1);
+  int result = 0;
+  if (hdr->magic != FCF_MAPPING_CACHE_MAGIC ||
+      hdr->version != FCF_MAPPING_CACHE_VERSION || hdr->patch != fPatchNr ||
+      hdr->rcuVersion != rcuVersion || hdr->sourceHash != sourceHash ||
+      hdr->sourceSize != sourceSize ||
+      hdr->wordsHash != digest64(words, sizeof(fConfigWords))) {
+    errno = EBADMSG;
+    result = -1;
+  } else {
+    memcpy(fConfigWords, words, sizeof(fConfigWords));
+  }
+  munmap(image, imageSize);
+  return result;
+}
+
+int fcf_mapping::writeCacheFile(const char *cacheFile, uint64_t sourceHash,
+                                uint64_t sourceSize, uint32_t rcuVersion) {
+  fcfMappingCacheHeader_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = FCF_MAPPING_CACHE_MAGIC;
+  hdr.version = FCF_MAPPING_CACHE_VERSION;
+  hdr.patch = fPatchNr;
+  hdr.rcuVersion = rcuVersion;
+  hdr.sourceHash = sourceHash;
+  hdr.sourceSize = sourceSize;
+  hdr.wordsHash = digest64(fConfigWords, sizeof(fConfigWords));
+
+  // write to a temporary file and rename it, so concurrent readers never
+  // see a partial image. The name is unique per thread, as channels sharing
+  // a mapping may be configured in parallel within one process.
+  char tmpFile[PATH_MAX];
+  snprintf(tmpFile, sizeof(tmpFile), "%s.%d.%ld.tmp", cacheFile, getpid(),
+           (long)syscall(SYS_gettid));
+  int fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      write(fd, fConfigWords, sizeof(fConfigWords)) != sizeof(fConfigWords)) {
+    int err = errno;
+    close(fd);
+    unlink(tmpFile);
+    errno = err;
+    return -1;
+  }
+  if (close(fd) < 0 || rename(tmpFile, cacheFile) < 0) {
+    int err = errno;
+    unlink(tmpFile);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+int fcf_mapping::readMappingFileCached(const char *filename,
+                                       uint32_t rcuVersion,
+                                       const char *cacheDir) {
+  if (!filename || !cacheDir) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&fError, 0, sizeof(fError));
+  uint64_t sourceHash, sourceSize;
+  if (hashFile(filename, &sourceHash, &sourceSize) < 0) {
+    fError.reason = "cannot open file";
+    errno = EBADF;
+    return -1;
+  }
+  char cacheFile[PATH_MAX];
+  snprintf(cacheFile, sizeof(cacheFile),
+           "%s/fcf_mapping_%016llx_p%u_rcu%u.bin", cacheDir,
+           (unsigned long long)sourceHash, fPatchNr, rcuVersion);
+  if (readCacheFile(cacheFile, sourceHash, sourceSize, rcuVersion) == 0) {
+    return 0;
+  }
+  if (readMappingFile(filename, rcuVersion) < 0) {
+    return -1;
+  }
+  writeCacheFile(cacheFile, sourceHash, sourceSize, rcuVersion);
+  return 0;
+}
+
+uint32_t writeMappingRam(librorc::fastclusterfinder *fcf, fcf_mapping *map,
+                         bool onlyChanged) {
+  uint32_t written = 0;
+  for (uint32_t i = 0; i < gkConfigWordCnt; i++) {
+    uint32_t word = (*map)[i];
+    if (onlyChanged && fcf->readMappingRamEntry(i) == word) {
+      continue;
+    }
+    fcf->writeMappingRamEntry(i, word);
+    written++;
+  }
+  return written;
+}
@@ -19,20 +19,85 @@
 #ifndef FCF_MAPPING_HH
 #define FCF_MAPPING_HH
 
+#include <stddef.h>
 #include <stdint.h>
 
+namespace librorc {
+class fastclusterfinder;
+}
+
 const unsigned gkConfigWordCnt = 4096;
+const unsigned gkPatchCnt = 6;
+
+/** location of the first error in a mapping file, line and column from 1 **/
+struct fcfMappingError_t {
+  unsigned long line; // 0 if the file could not be read
+  unsigned long column;
+  const char *reason;
+};
+
+/**
+ * binary image of a parsed mapping as written by readMappingFileCached(),
+ * followed by the gkConfigWordCnt config words in host byte order
+ **/
+#define FCF_MAPPING_CACHE_MAGIC 0x4d464346 // "FCFM"
+#define FCF_MAPPING_CACHE_VERSION 1
+
+struct fcfMappingCacheHeader_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t patch;
+  uint32_t rcuVersion;
+  uint64_t sourceHash; // digest64() of the mapping file
+  uint64_t sourceSize;
+  uint64_t wordsHash; // digest64() of the config words
+};
 
 class fcf_mapping {
 public:
   fcf_mapping(unsigned patchNr);
   ~fcf_mapping();
   int readMappingFile(const char *filename, uint32_t rcuVersion = 1);
+  /**
+   * fill the config words of nMaps mappings of different patches in a
+   * single pass over the file. Returns 0 or -1 with errno set, error
+   * receives the position of a syntax error.
+   **/
+  static int readMappingFiles(const char *filename, uint32_t rcuVersion,
+                              fcf_mapping **maps, unsigned nMaps,
+                              fcfMappingError_t *error = NULL);
+  /**
+   * like readMappingFile(), but take the config words from a binary image
+   * in cacheDir if one exists for the same file content, patch and RCU
+   * version. Otherwise the file is parsed and the image is written for the
+   * next run. Failing to write the image is not an error.
+   **/
+  int readMappingFileCached(const char *filename, uint32_t rcuVersion,
+                            const char *cacheDir);
   uint32_t operator[](unsigned ndx);
+  /** error of the last readMappingFile() **/
+  fcfMappingError_t parseError() { return fError; }
 
 private:
+  static int parseMappingFile(const char *data, size_t size,
+                              uint32_t rcuVersion, fcf_mapping **byPatch,
+                              fcfMappingError_t *error);
+  int readCacheFile(const char *cacheFile, uint64_t sourceHash,
+                    uint64_t sourceSize, uint32_t rcuVersion);
+  int writeCacheFile(const char *cacheFile, uint64_t sourceHash,
+                     uint64_t sourceSize, uint32_t rcuVersion);
+
   uint32_t fConfigWords[gkConfigWordCnt];
   unsigned fPatchNr;
+  fcfMappingError_t fError;
 };
 
+/**
+ * program the mapping RAM of fcf. With onlyChanged, each entry is read back
+ * first and only differing entries are written. Returns the number of
+ * entries written.
+ **/
+uint32_t writeMappingRam(librorc::fastclusterfinder *fcf, fcf_mapping *map,
+                         bool onlyChanged = false);
+
 #endif // FCF_MAPPING_HH
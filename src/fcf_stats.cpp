@@ -0,0 +1,90 @@
+/**
+ *  fcf_stats.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "fcf_stats.hh"
+
+/** stdio buffer of the trace file, keeps writes out of the event loop **/
+#define FCF_STATS_TRACE_BUFFER (1 << 20)
+
+fcf_stats::fcf_stats(uint32_t channel, uint32_t interval,
+                     const char *traceFile) {
+  m_channel = channel;
+  m_interval = interval ? interval : 1;
+  m_trace = NULL;
+  m_trace_errors = 0;
+  if (traceFile) {
+    m_trace = fopen(traceFile, "wb");
+    if (!m_trace) {
+      throw FCF_STATS_CONSTRUCTOR_FAILED;
+    }
+    setvbuf(m_trace, NULL, _IOFBF, FCF_STATS_TRACE_BUFFER);
+    fcfStatsTraceHeader_t hdr;
+    hdr.magic = FCF_STATS_TRACE_MAGIC;
+    hdr.version = FCF_STATS_TRACE_VERSION;
+    hdr.channel = m_channel;
+    hdr.interval = m_interval;
+    if (fwrite(&hdr, sizeof(hdr), 1, m_trace) != 1) {
+      m_trace_errors++;
+    }
+  }
+}
+
+fcf_stats::~fcf_stats() {
+  if (m_trace) {
+    fclose(m_trace);
+  }
+}
+
+void fcf_stats::record(const fcfStatsSample_t *sample) {
+  for (uint32_t i = 0; i < FCF_STAT_COUNT; i++) {
+    m_hist[i].add(sample->value[i]);
+  }
+  if (m_trace && fwrite(sample, sizeof(*sample), 1, m_trace) != 1) {
+    m_trace_errors++;
+  }
+}
+
+const char *fcf_stats::statName(uint32_t stat) {
+  switch (stat) {
+  case FCF_STAT_PROC_TIME:
+    return "procTimeCC";
+  case FCF_STAT_INPUT_IDLE_TIME:
+    return "inputIdleTimeCC";
+  case FCF_STAT_XOFF_TIME:
+    return "xoffTimeCC";
+  case FCF_STAT_MERGER_IDLE:
+    return "mergerIdle[0.01%]";
+  case FCF_STAT_MERGER_FIFO_MAX:
+    return "fifoMergerMax";
+  case FCF_STAT_DIVIDER_FIFO_MAX:
+    return "fifoDividerMax";
+  default:
+    return "unknown";
+  }
+}
+
+void fcf_stats::print(const char *label) {
+  printf("# %s: %lu samples, every %u events\n", label,
+         m_hist[0].count(), m_interval);
+  for (uint32_t i = 0; i < FCF_STAT_COUNT; i++) {
+    log_histogram *h = &m_hist[i];
+    printf("#   %-18s mean %10.1f  p50 %10u  p90 %10u  p99 %10u  max %10u\n",
+           statName(i), h->mean(), h->percentile(0.5), h->percentile(0.9),
+           h->percentile(0.99), h->max());
+  }
+}
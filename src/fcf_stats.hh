@@ -0,0 +1,86 @@
+/**
+ *  fcf_stats.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_STATS_HH
+#define FCF_STATS_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include "log_histogram.hh"
+
+#define FCF_STATS_CONSTRUCTOR_FAILED 1
+
+/** FCF counters kept per sampled event **/
+enum fcfStat_t {
+  FCF_STAT_PROC_TIME,
+  FCF_STAT_INPUT_IDLE_TIME,
+  FCF_STAT_XOFF_TIME,
+  FCF_STAT_MERGER_IDLE, // in 1/100 percent
+  FCF_STAT_MERGER_FIFO_MAX,
+  FCF_STAT_DIVIDER_FIFO_MAX,
+  FCF_STAT_COUNT
+};
+
+/**
+ * Binary trace: one fcfStatsTraceHeader_t followed by an fcfStatsSample_t
+ * per sampled event, in host byte order.
+ **/
+#define FCF_STATS_TRACE_MAGIC 0x53464346 // "FCFS"
+#define FCF_STATS_TRACE_VERSION 1
+
+struct fcfStatsTraceHeader_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t channel;
+  uint32_t interval;
+};
+
+struct fcfStatsSample_t {
+  uint64_t event; // index of the event in the channel
+  uint64_t timestamp_us;
+  uint32_t value[FCF_STAT_COUNT];
+};
+
+/**
+ * Histograms of the FCF counters of every interval-th event of a channel,
+ * optionally also written to a binary trace file. record() is called by
+ * the channel thread only, the histograms may be read from any thread.
+ **/
+class fcf_stats {
+public:
+  fcf_stats(uint32_t channel, uint32_t interval, const char *traceFile = NULL);
+  ~fcf_stats();
+
+  void record(const fcfStatsSample_t *sample);
+  uint32_t interval() { return m_interval; }
+  uint64_t traceErrors() { return m_trace_errors; }
+  log_histogram *histogram(uint32_t stat) { return &m_hist[stat]; }
+
+  /** print count, mean, p50, p90, p99 and max of each counter **/
+  void print(const char *label);
+  static const char *statName(uint32_t stat);
+
+private:
+  uint32_t m_channel;
+  uint32_t m_interval;
+  FILE *m_trace;
+  uint64_t m_trace_errors;
+  log_histogram m_hist[FCF_STAT_COUNT];
+};
+
+#endif // FCF_STATS_HH
@@ -16,13 +16,15 @@
  *  along with this program. If not, see <http://www.gnu.org/licenses/>.
  **/
 
-#include <sstream>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include "file_writer.hh"
 
+/** sleep time of the idle I/O thread **/
+#define FW_IDLE_USLEEP 100
+
 /****************** Helpers *******************/
 // Source: 'Patrick', https://stackoverflow.com/a/12904145
 int mkpath(std::string s, mode_t mode) {
@@ -53,6 +55,19 @@ file_writer::file_writer(std::string basedir, uint32_t device, uint32_t channel,
   m_device = device;
   m_channel = channel;
   m_dump_size_limit = (8 << 20); // 8MB
+  m_capture = NULL;
+  m_policy = FW_POLICY_BLOCK;
+  m_async = false;
+  m_stop = false;
+  m_head = 0;
+  m_tail = 0;
+  m_events_queued = 0;
+  m_bytes_queued = 0;
+  m_events_dropped = 0;
+  m_bytes_dropped = 0;
+  m_events_written = 0;
+  m_bytes_written = 0;
+  m_write_errors = 0;
   struct stat dirstat;
   int ret = stat(basedir.c_str(), &dirstat);
   if (ret < 0 && errno == ENOENT) {
@@ -65,9 +80,17 @@ file_writer::file_writer(std::string basedir, uint32_t device, uint32_t channel,
   }
 }
 
-file_writer::~file_writer(){};
+file_writer::~file_writer() {
+  stopAsync();
+  for (size_t i = 0; i < m_queue.size(); i++) {
+    free(m_queue[i].data);
+  }
+  if (m_capture) {
+    delete m_capture;
+  }
+}
 
-int write_to_file(const char *filename, void *event, ssize_t size) {
+int write_to_file(const char *filename, const void *event, ssize_t size) {
   int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
   if (fd < 0) {
     return -1;
@@ -80,13 +103,116 @@ int write_to_file(const char *filename, void *event, ssize_t size) {
   return 0;
 }
 
+int file_writer::useCaptureFormat(uint64_t segmentSizeLimit,
+                                  dioEngine_t engine) {
+  if (m_capture || m_async) {
+    errno = EINVAL;
+    return -1;
+  }
+  char basename[4096];
+  snprintf(basename, sizeof(basename), "%s/dev%u_ch%u", m_basedir.c_str(),
+           m_device, m_channel);
+  try {
+    m_capture = new capture_writer(basename, m_device, m_channel,
+                                   segmentSizeLimit, engine);
+  }
+  catch (int e) {
+    return -1;
+  }
+  return 0;
+}
+
+int file_writer::startAsync(uint32_t queueDepth, fileWriterPolicy_t policy) {
+  if (m_async || queueDepth == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  m_queue.resize(queueDepth);
+  for (size_t i = 0; i < m_queue.size(); i++) {
+    m_queue[i].size = 0;
+    m_queue[i].capacity = 0;
+    m_queue[i].data = NULL;
+  }
+  m_policy = policy;
+  m_stop = false;
+  m_async = true;
+  m_io_thread = std::thread(&file_writer::io_thread, this);
+  return 0;
+}
+
 int file_writer::dump(librorc::EventDescriptor *report, const uint32_t *event) {
   if ((m_eventlimit > 0) && (m_eventcount > m_eventlimit)) {
     m_eventcount++;
     return 0;
   }
-  std::string filebase = create_file_name();
+  ssize_t event_size = dump_size(report);
+
+  if (!m_async) {
+    int ret = write_event(report, event, event_size, m_eventcount);
+    m_eventcount++;
+    return ret;
+  }
+
+  uint64_t head = m_head.load(std::memory_order_relaxed);
+  while (head - m_tail.load(std::memory_order_acquire) >= m_queue.size()) {
+    if (m_policy == FW_POLICY_DROP) {
+      m_events_dropped.fetch_add(1, std::memory_order_relaxed);
+      m_bytes_dropped.fetch_add(event_size, std::memory_order_relaxed);
+      m_eventcount++;
+      return 0;
+    }
+    std::this_thread::yield();
+  }
+
+  queueEntry_t *entry = &m_queue[head % m_queue.size()];
+  if (entry->capacity < event_size) {
+    // slot buffers only ever grow, so steady state needs no allocation
+    char *data = (char *)realloc(entry->data, event_size);
+    if (!data) {
+      m_events_dropped.fetch_add(1, std::memory_order_relaxed);
+      m_bytes_dropped.fetch_add(event_size, std::memory_order_relaxed);
+      m_eventcount++;
+      return -1;
+    }
+    entry->data = data;
+    entry->capacity = event_size;
+  }
+  memcpy(&entry->report, report, sizeof(librorc::EventDescriptor));
+  memcpy(entry->data, event, event_size);
+  entry->size = event_size;
+  entry->eventnumber = m_eventcount;
+  m_head.store(head + 1, std::memory_order_release);
 
+  m_events_queued.fetch_add(1, std::memory_order_relaxed);
+  m_bytes_queued.fetch_add(event_size, std::memory_order_relaxed);
+  m_eventcount++;
+  return 0;
+}
+
+void file_writer::stopAsync() {
+  if (!m_async) {
+    return;
+  }
+  // the I/O thread drains the queue before it returns
+  m_stop = true;
+  m_io_thread.join();
+  m_async = false;
+}
+
+struct fileWriterStats_t file_writer::getStats() {
+  struct fileWriterStats_t stats;
+  stats.eventsQueued = m_events_queued.load(std::memory_order_relaxed);
+  stats.bytesQueued = m_bytes_queued.load(std::memory_order_relaxed);
+  stats.eventsDropped = m_events_dropped.load(std::memory_order_relaxed);
+  stats.bytesDropped = m_bytes_dropped.load(std::memory_order_relaxed);
+  stats.eventsWritten = m_events_written.load(std::memory_order_relaxed);
+  stats.bytesWritten = m_bytes_written.load(std::memory_order_relaxed);
+  stats.writeErrors = m_write_errors.load(std::memory_order_relaxed);
+  return stats;
+}
+
+/****************** Private *******************/
+ssize_t file_writer::dump_size(librorc::EventDescriptor *report) {
   uint32_t rep_size = (report->reported_event_size & 0x3fffffff) << 2;
   uint32_t calc_size = (report->calc_event_size & 0x3fffffff) << 2;
   ssize_t event_size = calc_size;
@@ -98,25 +224,65 @@ int file_writer::dump(librorc::EventDescriptor *report, const uint32_t *event) {
               << m_dump_size_limit << " bytes." << std::endl;
     event_size = m_dump_size_limit;
   }
+  return event_size;
+}
+
+int file_writer::write_event(librorc::EventDescriptor *report,
+                             const void *event, ssize_t size,
+                             uint64_t eventnumber) {
+  if (m_capture) {
+    if (m_capture->writeEvent(report, event, size, eventnumber) != 0) {
+      m_write_errors.fetch_add(1, std::memory_order_relaxed);
+      return -1;
+    }
+    m_events_written.fetch_add(1, std::memory_order_relaxed);
+    m_bytes_written.fetch_add(size, std::memory_order_relaxed);
+    return 0;
+  }
+
+  std::string filebase = create_file_name(eventnumber);
   std::string filename = filebase + ".ddl";
-  if (write_to_file(filename.c_str(), (void *)event, event_size) < 0) {
+  if (write_to_file(filename.c_str(), event, size) < 0) {
+    m_write_errors.fetch_add(1, std::memory_order_relaxed);
     return -1;
   }
   filename = filebase + ".report";
-  if (write_to_file(filename.c_str(), (void *)report, sizeof(report)) ) {
+  if (write_to_file(filename.c_str(), report,
+                    sizeof(librorc::EventDescriptor)) < 0) {
+    m_write_errors.fetch_add(1, std::memory_order_relaxed);
     return -1;
   }
-
-  m_eventcount++;
+  m_events_written.fetch_add(1, std::memory_order_relaxed);
+  m_bytes_written.fetch_add(size + sizeof(librorc::EventDescriptor),
+                            std::memory_order_relaxed);
   return 0;
 }
 
+void file_writer::io_thread() {
+  uint64_t tail = m_tail.load(std::memory_order_relaxed);
+  while (true) {
+    if (tail == m_head.load(std::memory_order_acquire)) {
+      if (m_stop) {
+        // check once more: the last entries may have been queued right
+        // before the stop request
+        if (tail == m_head.load(std::memory_order_acquire)) {
+          break;
+        }
+        continue;
+      }
+      usleep(FW_IDLE_USLEEP);
+      continue;
+    }
+    queueEntry_t *entry = &m_queue[tail % m_queue.size()];
+    write_event(&entry->report, entry->data, entry->size, entry->eventnumber);
+    tail++;
+    m_tail.store(tail, std::memory_order_release);
+  }
+}
 
-
-/****************** Private *******************/
-std::string file_writer::create_file_name() {
-  std::stringstream ss;
-  ss << m_basedir << "/"
-     << "dev" << m_device << "_ch" << m_channel << "_" << m_eventcount;
-  return ss.str();
+std::string file_writer::create_file_name(uint64_t eventnumber) {
+  char filebase[4096];
+  snprintf(filebase, sizeof(filebase), "%s/dev%u_ch%u_%lu", m_basedir.c_str(),
+           m_device, m_channel, eventnumber);
+  return std::string(filebase);
 }
@@ -19,11 +19,29 @@
 #ifndef FILE_WRITER_HH
 #define FILE_WRITER_HH
 
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 #include <librorc.h>
+#include "capture_file.hh"
+#include "thread_utils.hh"
 
 #define FILE_WRITER_CONSTRUCTOR_FAILED 1
 
+/** what dump() does if the queue of the asynchronous writer is full **/
+enum fileWriterPolicy_t { FW_POLICY_BLOCK, FW_POLICY_DROP };
+
+struct fileWriterStats_t {
+  uint64_t eventsQueued;
+  uint64_t bytesQueued;
+  uint64_t eventsDropped;
+  uint64_t bytesDropped;
+  uint64_t eventsWritten;
+  uint64_t bytesWritten;
+  uint64_t writeErrors;
+};
+
 class file_writer {
 public:
   file_writer(std::string basedir, uint32_t device, uint32_t channel,
@@ -34,15 +52,69 @@ public:
   void setDumpSizeLimit(ssize_t limit) { m_dump_size_limit = limit; }
   ssize_t getDumpSizeLimit() { return m_dump_size_limit; }
 
+  /**
+   * Hand events over to a dedicated I/O thread through a bounded
+   * single-producer/single-consumer queue of queueDepth entries. dump()
+   * then only copies the event into the queue. Must be called before the
+   * first call to dump().
+   **/
+  int startAsync(uint32_t queueDepth,
+                 fileWriterPolicy_t policy = FW_POLICY_BLOCK);
+  /**
+   * Append all events to capture segments <basedir>/dev<N>_ch<M>_<seg>.crc
+   * instead of writing a .ddl and a .report file per event. Must be called
+   * before the first call to dump().
+   **/
+  int useCaptureFormat(uint64_t segmentSizeLimit,
+                       dioEngine_t engine = DIO_ENGINE_BUFFERED);
+
+  /** write out all queued events and stop the I/O thread **/
+  void stopAsync();
+  struct fileWriterStats_t getStats();
+
 private:
-  std::string create_file_name();
-  
+  struct queueEntry_t {
+    librorc::EventDescriptor report;
+    uint64_t eventnumber;
+    ssize_t size;
+    ssize_t capacity;
+    char *data;
+  };
+
+  std::string create_file_name(uint64_t eventnumber);
+  ssize_t dump_size(librorc::EventDescriptor *report);
+  int write_event(librorc::EventDescriptor *report, const void *event,
+                  ssize_t size, uint64_t eventnumber);
+  void io_thread();
+
   std::string m_basedir;
   uint64_t m_eventcount;
   uint64_t m_eventlimit;
   uint32_t m_device;
   uint32_t m_channel;
   ssize_t m_dump_size_limit;
+  capture_writer *m_capture;
+
+  // asynchronous mode
+  std::vector<queueEntry_t> m_queue;
+  fileWriterPolicy_t m_policy;
+  std::thread m_io_thread;
+  bool m_async;
+  std::atomic<bool> m_stop;
+  // producer and consumer index are kept on separate cache lines
+  char m_pad0[CACHELINE_SIZE];
+  std::atomic<uint64_t> m_head; // written by dump()
+  char m_pad1[CACHELINE_SIZE];
+  std::atomic<uint64_t> m_tail; // written by the I/O thread
+  char m_pad2[CACHELINE_SIZE];
+
+  std::atomic<uint64_t> m_events_queued;
+  std::atomic<uint64_t> m_bytes_queued;
+  std::atomic<uint64_t> m_events_dropped;
+  std::atomic<uint64_t> m_bytes_dropped;
+  std::atomic<uint64_t> m_events_written;
+  std::atomic<uint64_t> m_bytes_written;
+  std::atomic<uint64_t> m_write_errors;
 };
 
 #endif // FILE_WRITER_HH
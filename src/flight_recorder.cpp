@@ -0,0 +1,198 @@
+/**
+ *  flight_recorder.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "flight_recorder.hh"
+#include "capture_file.hh"
+
+flight_recorder::flight_recorder(std::string basedir, uint32_t device,
+                                 uint32_t channel, uint32_t contextEvents,
+                                 uint32_t maxEventSize, uint32_t maxDumps) {
+  m_basedir = basedir;
+  m_device = device;
+  m_channel = channel;
+  m_context = contextEvents;
+  m_slot_size = (maxEventSize + 7) & ~7;
+  m_max_dumps = maxDumps;
+  m_dumps = 0;
+  m_eventcount = 0;
+  m_armed = false;
+  m_post_remaining = 0;
+  m_stop = false;
+  m_io_busy = false;
+  m_triggers = 0;
+  m_dumps_written = 0;
+  m_dumps_dropped = 0;
+  m_events_truncated = 0;
+  m_write_errors = 0;
+
+  uint32_t nSlots = 2 * contextEvents + 1;
+  for (int i = 0; i < 2; i++) {
+    m_arena[i].data = (uint8_t *)malloc((uint64_t)nSlots * m_slot_size);
+    m_arena[i].slots.resize(nSlots);
+    m_arena[i].head = 0;
+    m_arena[i].fill = 0;
+  }
+  if (m_slot_size == 0 || !m_arena[0].data || !m_arena[1].data) {
+    free(m_arena[0].data);
+    free(m_arena[1].data);
+    throw FR_CONSTRUCTOR_FAILED;
+  }
+  // touch the arenas now instead of taking page faults in record()
+  memset(m_arena[0].data, 0, (uint64_t)nSlots * m_slot_size);
+  memset(m_arena[1].data, 0, (uint64_t)nSlots * m_slot_size);
+  m_active = &m_arena[0];
+  m_pending = &m_arena[1];
+  m_io_thread = std::thread(&flight_recorder::io_thread, this);
+}
+
+flight_recorder::~flight_recorder() {
+  flush();
+  m_stop = true;
+  m_io_thread.join();
+  free(m_arena[0].data);
+  free(m_arena[1].data);
+}
+
+void flight_recorder::record(librorc::EventDescriptor *report,
+                             const uint32_t *event, uint32_t checkResult) {
+  arena_t *arena = m_active;
+  slot_t *slot = &arena->slots[arena->head];
+  uint64_t size = (uint64_t)(report->calc_event_size & 0x3fffffff) << 2;
+  if (size > m_slot_size) {
+    size = m_slot_size;
+    m_events_truncated.fetch_add(1, std::memory_order_relaxed);
+  }
+  memcpy(arena->data + (uint64_t)arena->head * m_slot_size, event, size);
+  slot->report = *report;
+  slot->eventnumber = m_eventcount;
+  slot->size = size;
+  arena->head = (arena->head + 1) % arena->slots.size();
+  if (arena->fill < arena->slots.size()) {
+    arena->fill++;
+  }
+
+  if (checkResult) {
+    m_triggers.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (m_armed) {
+    // errors within the trailing context are part of the same window
+    arena->trigger_mask |= checkResult;
+    if (--m_post_remaining == 0) {
+      hand_over();
+    }
+  } else if (checkResult && (m_max_dumps == 0 || m_dumps < m_max_dumps)) {
+    arena->trigger_event = m_eventcount;
+    arena->trigger_mask = checkResult;
+    m_armed = true;
+    m_post_remaining = m_context;
+    if (m_context == 0) {
+      hand_over();
+    }
+  }
+  m_eventcount++;
+}
+
+void flight_recorder::flush() {
+  if (m_armed) {
+    while (m_io_busy.load(std::memory_order_acquire)) {
+      usleep(FR_IDLE_USLEEP);
+    }
+    hand_over();
+  }
+  while (m_io_busy.load(std::memory_order_acquire)) {
+    usleep(FR_IDLE_USLEEP);
+  }
+}
+
+struct flightRecorderStats_t flight_recorder::getStats() {
+  struct flightRecorderStats_t stats;
+  stats.triggers = m_triggers.load(std::memory_order_relaxed);
+  stats.dumpsWritten = m_dumps_written.load(std::memory_order_relaxed);
+  stats.dumpsDropped = m_dumps_dropped.load(std::memory_order_relaxed);
+  stats.eventsTruncated = m_events_truncated.load(std::memory_order_relaxed);
+  stats.writeErrors = m_write_errors.load(std::memory_order_relaxed);
+  return stats;
+}
+
+/****************** Private *******************/
+void flight_recorder::hand_over() {
+  m_armed = false;
+  if (m_io_busy.load(std::memory_order_acquire)) {
+    // previous window still being written, never block the readout
+    m_dumps_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  arena_t *next = m_pending;
+  m_pending = m_active;
+  m_active = next;
+  m_active->head = 0;
+  m_active->fill = 0;
+  m_pending->dump_index = m_dumps++;
+  m_io_busy.store(true, std::memory_order_release);
+}
+
+int flight_recorder::write_arena(arena_t *arena) {
+  char name[256];
+  snprintf(name, sizeof(name), "/dev%u_ch%u_err%04u_evt%lu_mask0x%x",
+           m_device, m_channel, arena->dump_index, arena->trigger_event,
+           arena->trigger_mask);
+  capture_writer *writer = NULL;
+  try {
+    writer = new capture_writer(m_basedir + name, m_device, m_channel,
+                                UINT64_MAX);
+  }
+  catch (int e) {
+    return -1;
+  }
+  int ret = 0;
+  uint32_t nSlots = arena->slots.size();
+  uint32_t idx = (arena->head + nSlots - arena->fill) % nSlots;
+  for (uint32_t i = 0; i < arena->fill && ret == 0; i++) {
+    slot_t *slot = &arena->slots[idx];
+    ret = writer->writeEvent(&slot->report,
+                             arena->data + (uint64_t)idx * m_slot_size,
+                             slot->size, slot->eventnumber);
+    idx = (idx + 1) % nSlots;
+  }
+  if (writer->close() != 0) {
+    ret = -1;
+  }
+  delete writer;
+  return ret;
+}
+
+void flight_recorder::io_thread() {
+  while (true) {
+    if (m_io_busy.load(std::memory_order_acquire)) {
+      if (write_arena(m_pending) == 0) {
+        m_dumps_written.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        m_write_errors.fetch_add(1, std::memory_order_relaxed);
+      }
+      m_io_busy.store(false, std::memory_order_release);
+    } else if (m_stop.load()) {
+      break;
+    } else {
+      usleep(FR_IDLE_USLEEP);
+    }
+  }
+}
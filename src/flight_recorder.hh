@@ -0,0 +1,115 @@
+/**
+ *  flight_recorder.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FLIGHT_RECORDER_HH
+#define FLIGHT_RECORDER_HH
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <librorc.h>
+
+#define FR_DEFAULT_MAX_EVENT_SIZE (256 << 10)
+#define FR_IDLE_USLEEP 1000
+
+#define FR_CONSTRUCTOR_FAILED 1
+
+struct flightRecorderStats_t {
+  uint64_t triggers;
+  uint64_t dumpsWritten;
+  uint64_t dumpsDropped;
+  uint64_t eventsTruncated;
+  uint64_t writeErrors;
+};
+
+/**
+ * Keeps copies of the most recent events in a preallocated ring of
+ * 2 * contextEvents + 1 fixed-size slots. Once record() sees a non-zero
+ * check result, contextEvents more events are recorded and the whole
+ * window is handed to an I/O thread by swapping it with a second arena,
+ * so no allocation or disk I/O happens in the readout path. Windows are
+ * written as capture files (see capture_file.hh) named
+ * <basedir>/dev<N>_ch<M>_err<K>_evt<E>_mask<X>_0000.crc, where E is the
+ * recorder's sequence number of the faulting event and X its check
+ * result. Events larger than maxEventSize are truncated.
+ **/
+class flight_recorder {
+public:
+  flight_recorder(std::string basedir, uint32_t device, uint32_t channel,
+                  uint32_t contextEvents,
+                  uint32_t maxEventSize = FR_DEFAULT_MAX_EVENT_SIZE,
+                  uint32_t maxDumps = 0);
+  ~flight_recorder();
+
+  void record(librorc::EventDescriptor *report, const uint32_t *event,
+              uint32_t checkResult);
+  /**
+   * write out a window still waiting for its trailing context and wait
+   * until the I/O thread is idle. Must not run concurrently to record().
+   **/
+  void flush();
+  struct flightRecorderStats_t getStats();
+
+private:
+  struct slot_t {
+    librorc::EventDescriptor report;
+    uint64_t eventnumber;
+    uint64_t size;
+  };
+  struct arena_t {
+    uint8_t *data;
+    std::vector<slot_t> slots;
+    uint32_t head;
+    uint32_t fill;
+    uint64_t trigger_event;
+    uint32_t trigger_mask;
+    uint32_t dump_index;
+  };
+
+  void hand_over();
+  int write_arena(arena_t *arena);
+  void io_thread();
+
+  std::string m_basedir;
+  uint32_t m_device;
+  uint32_t m_channel;
+  uint32_t m_context;
+  uint32_t m_slot_size;
+  uint32_t m_max_dumps;
+  uint32_t m_dumps;
+  uint64_t m_eventcount;
+  bool m_armed;
+  uint32_t m_post_remaining;
+
+  arena_t m_arena[2];
+  arena_t *m_active;  // owned by record()
+  arena_t *m_pending; // owned by the I/O thread while m_io_busy is set
+  std::thread m_io_thread;
+  std::atomic<bool> m_stop;
+  std::atomic<bool> m_io_busy;
+
+  std::atomic<uint64_t> m_triggers;
+  std::atomic<uint64_t> m_dumps_written;
+  std::atomic<uint64_t> m_dumps_dropped;
+  std::atomic<uint64_t> m_events_truncated;
+  std::atomic<uint64_t> m_write_errors;
+};
+
+#endif // FLIGHT_RECORDER_HH
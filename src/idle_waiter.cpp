@@ -0,0 +1,92 @@
+/**
+ *  idle_waiter.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "idle_waiter.hh"
+
+static inline uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+idle_waiter::idle_waiter(uint32_t minSpinUs, uint32_t maxSpinUs) {
+  m_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epfd < 0) {
+    throw IDLE_WAITER_CONSTRUCTOR_FAILED;
+  }
+  m_min_spin_us = minSpinUs;
+  m_max_spin_us = (maxSpinUs > minSpinUs) ? maxSpinUs : minSpinUs;
+  m_spin_us = m_min_spin_us;
+  m_idle = false;
+  m_idle_since_us = 0;
+  m_sleeps = 0;
+}
+
+idle_waiter::~idle_waiter() { close(m_epfd); }
+
+int idle_waiter::addFd(int fd) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int idle_waiter::wait(int timeoutMs) {
+  struct epoll_event ev[IDLE_WAITER_MAX_EVENTS];
+  int n;
+  do {
+    n = epoll_wait(m_epfd, ev, IDLE_WAITER_MAX_EVENTS, timeoutMs);
+  } while (n < 0 && errno == EINTR && timeoutMs < 0);
+  return n;
+}
+
+bool idle_waiter::pass(bool idle) {
+  if (!idle) {
+    m_idle = false;
+    return false;
+  }
+  uint64_t now = monotonic_us();
+  if (!m_idle) {
+    m_idle = true;
+    m_idle_since_us = now;
+    return false;
+  }
+  if (now - m_idle_since_us < m_spin_us) {
+    return false;
+  }
+
+  wait(-1);
+  m_sleeps++;
+  m_idle = false;
+  uint64_t slept = monotonic_us() - now;
+  if (slept < m_max_spin_us) {
+    // a longer spin would have caught this wake-up without sleeping
+    uint32_t spin = 2 * slept;
+    if (spin > m_spin_us) {
+      m_spin_us = (spin < m_max_spin_us) ? spin : m_max_spin_us;
+    }
+  } else {
+    m_spin_us = (m_spin_us / 2 > m_min_spin_us) ? m_spin_us / 2
+                                                : m_min_spin_us;
+  }
+  return true;
+}
@@ -0,0 +1,64 @@
+/**
+ *  idle_waiter.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef IDLE_WAITER_HH
+#define IDLE_WAITER_HH
+
+#include <stdint.h>
+
+#define IDLE_WAITER_CONSTRUCTOR_FAILED 1
+
+/** file descriptors returned by a single epoll_wait() call **/
+#define IDLE_WAITER_MAX_EVENTS 8
+
+/**
+ * Decides when a polling loop may sleep. pass() is called once per loop
+ * iteration. After the loop has been idle for the spin window, the thread
+ * blocks in epoll_wait() until one of the registered file descriptors
+ * becomes readable. The spin window adapts between minSpinUs and
+ * maxSpinUs: a sleep shorter than maxSpinUs widens it to twice the sleep
+ * time, so regular short gaps are bridged by spinning, and a longer sleep
+ * halves it.
+ * Not thread safe, use one instance per thread.
+ **/
+class idle_waiter {
+public:
+  idle_waiter(uint32_t minSpinUs, uint32_t maxSpinUs);
+  ~idle_waiter();
+
+  /** wake up when fd becomes readable. Returns 0 or -1 with errno set. **/
+  int addFd(int fd);
+  /** account one loop pass, may block if idle. Returns true if it slept. **/
+  bool pass(bool idle);
+  /** block until a file descriptor is readable or timeoutMs expired **/
+  int wait(int timeoutMs);
+
+  uint32_t spinUs() { return m_spin_us; }
+  uint64_t sleeps() { return m_sleeps; }
+
+private:
+  int m_epfd;
+  uint32_t m_min_spin_us;
+  uint32_t m_max_spin_us;
+  uint32_t m_spin_us;
+  bool m_idle;
+  uint64_t m_idle_since_us;
+  uint64_t m_sleeps;
+};
+
+#endif // IDLE_WAITER_HH
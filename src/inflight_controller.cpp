@@ -0,0 +1,152 @@
+/**
+ *  inflight_controller.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <time.h>
+#include "inflight_controller.hh"
+
+static inline uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+inflight_controller::inflight_controller(uint32_t minDepth, uint32_t maxDepth,
+                                         uint32_t targetLatencyUs,
+                                         inflightClock_t clockUs) {
+  m_min_depth = (minDepth > 0) ? minDepth : 1;
+  m_max_depth = (maxDepth > m_min_depth) ? maxDepth : m_min_depth;
+  m_target_latency_us = targetLatencyUs;
+  m_clock_us = clockUs ? clockUs : monotonic_us;
+  m_depth = m_min_depth;
+  m_latency_us = 0;
+  m_adjustments = 0;
+  m_limited = false;
+  m_window_start_us = m_clock_us();
+  m_window_events = 0;
+  m_window_latency_us = 0;
+  m_last_xoff_cc = 0;
+  m_xoff_valid = false;
+  m_base_latency_us = 0;
+  m_epoch_min_us = -1;
+  m_prev_epoch_min_us = -1;
+  m_base_windows = 0;
+  m_probe = false;
+  m_probe_drain = 0;
+  m_probe_saved_depth = m_min_depth;
+}
+
+bool inflight_controller::mayEnqueue(uint64_t inFlight) {
+  if (inFlight < m_depth) {
+    return true;
+  }
+  m_limited = true;
+  return false;
+}
+
+void inflight_controller::enqueued() { m_enqueue_us.push_back(m_clock_us()); }
+
+bool inflight_controller::completed() {
+  uint64_t now = m_clock_us();
+  uint64_t enqueuedUs = now;
+  if (!m_enqueue_us.empty()) {
+    enqueuedUs = m_enqueue_us.front();
+    m_enqueue_us.pop_front();
+  }
+  if (m_probe_drain) {
+    // enqueued before the probe started, latency is still loaded
+    m_probe_drain--;
+    return false;
+  }
+  m_window_latency_us += now - enqueuedUs;
+  m_window_events++;
+  uint32_t windowSize = 2 * m_depth;
+  if (m_probe) {
+    windowSize = INFLIGHT_PROBE_EVENTS;
+  } else if (windowSize < INFLIGHT_WINDOW_MIN_EVENTS) {
+    windowSize = INFLIGHT_WINDOW_MIN_EVENTS;
+  }
+  return m_window_events >= windowSize;
+}
+
+void inflight_controller::adjust(uint64_t xoffTotalCC) {
+  uint64_t now = m_clock_us();
+  uint64_t windowUs = now - m_window_start_us;
+  double latency = (double)m_window_latency_us / m_window_events;
+  double rate = windowUs ? (double)m_window_events / windowUs : 0; // per us
+  bool xoff = m_xoff_valid && xoffTotalCC > m_last_xoff_cc;
+  m_latency_us = (uint32_t)latency;
+
+  if (m_epoch_min_us < 0 || latency < m_epoch_min_us) {
+    m_epoch_min_us = latency;
+  }
+  m_base_latency_us = m_epoch_min_us;
+  if (m_prev_epoch_min_us >= 0 && m_prev_epoch_min_us < m_base_latency_us) {
+    m_base_latency_us = m_prev_epoch_min_us;
+  }
+
+  double depth = m_depth;
+  if (m_probe) {
+    // the probe window only measured the base latency, continue with the
+    // depth from before the probe
+    m_probe = false;
+    m_depth = m_probe_saved_depth;
+    depth = m_depth;
+  } else if (m_target_latency_us && latency > m_target_latency_us) {
+    // Little's law, at most halving per window
+    depth = m_depth * (double)m_target_latency_us / latency;
+    if (depth < 0.5 * m_depth) {
+      depth = 0.5 * m_depth;
+    }
+  } else {
+    double queued = m_depth - rate * m_base_latency_us;
+    if (queued < INFLIGHT_QUEUED_LOW && !xoff && m_limited) {
+      depth = m_depth + 1;
+    } else if (queued > INFLIGHT_QUEUED_HIGH) {
+      depth = m_depth - 1;
+    }
+  }
+  uint32_t newDepth = (uint32_t)(depth + 0.5);
+  if (newDepth < m_min_depth) {
+    newDepth = m_min_depth;
+  } else if (newDepth > m_max_depth) {
+    newDepth = m_max_depth;
+  }
+  if (newDepth != m_depth) {
+    m_depth = newDepth;
+    m_adjustments++;
+  }
+
+  if (++m_base_windows >= INFLIGHT_BASE_WINDOWS) {
+    // new epoch, starting with a probe at the minimum depth. Events still
+    // in flight are not counted in the probe window.
+    m_base_windows = 0;
+    m_prev_epoch_min_us = m_epoch_min_us;
+    m_epoch_min_us = -1;
+    m_probe = true;
+    m_probe_drain = m_enqueue_us.size();
+    m_probe_saved_depth = m_depth;
+    m_depth = m_min_depth;
+  }
+
+  m_last_xoff_cc = xoffTotalCC;
+  m_xoff_valid = true;
+  m_limited = false;
+  m_window_start_us = now;
+  m_window_events = 0;
+  m_window_latency_us = 0;
+}
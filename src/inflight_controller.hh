@@ -0,0 +1,120 @@
+/**
+ *  inflight_controller.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INFLIGHT_CONTROLLER_HH
+#define INFLIGHT_CONTROLLER_HH
+
+#include <stdint.h>
+#include <deque>
+
+/** completions per adjustment window, at least twice the depth **/
+#define INFLIGHT_WINDOW_MIN_EVENTS 16
+/** windows after which the base latency is measured again **/
+#define INFLIGHT_BASE_WINDOWS 32
+/** completions at the minimum depth to measure the base latency **/
+#define INFLIGHT_PROBE_EVENTS 4
+/**
+ * throughput goal: events waiting in front of the bottleneck, estimated
+ * from the base latency, are kept between these bounds
+ **/
+#define INFLIGHT_QUEUED_LOW 1.0
+#define INFLIGHT_QUEUED_HIGH 3.0
+
+/**
+ * Chooses the number of events in flight on a channel from the completion
+ * latency and the FCF xoff time. Latencies are measured from enqueued() to
+ * completed(), events complete in order.
+ *
+ * The throughput is maximized with the least queueing. The lowest window
+ * latency is taken as the latency of an unloaded chain, depth - rate *
+ * baseLatency then estimates the events waiting in front of the
+ * bottleneck. The depth grows while fewer than INFLIGHT_QUEUED_LOW events
+ * wait and shrinks above INFLIGHT_QUEUED_HIGH. It does not grow while the
+ * FCF stalls its input (xoff), more events would only wait in the chain,
+ * or while the input did not fill the allowed depth.
+ *
+ * Every INFLIGHT_BASE_WINDOWS windows the chain is drained to the minimum
+ * depth for INFLIGHT_PROBE_EVENTS completions, so each epoch contains an
+ * unloaded window. The base latency is the minimum over the current and
+ * the previous epoch: it follows a slower chain within two epochs, but is
+ * never taken from a single loaded window.
+ *
+ * A target latency caps this: above it, the depth is scaled down by
+ * Little's law to the depth that meets the target at the measured rate,
+ * at most halving per window.
+ *
+ * Not thread safe, use one instance per channel thread.
+ **/
+/** time source in microseconds, monotonic **/
+typedef uint64_t (*inflightClock_t)();
+
+class inflight_controller {
+public:
+  /** clockUs defaults to CLOCK_MONOTONIC **/
+  inflight_controller(uint32_t minDepth, uint32_t maxDepth,
+                      uint32_t targetLatencyUs = 0,
+                      inflightClock_t clockUs = 0);
+
+  /** true if another event may be enqueued with inFlight events pending **/
+  bool mayEnqueue(uint64_t inFlight);
+  void enqueued();
+  /**
+   * account the completion of the oldest event in flight. Returns true at
+   * the end of a window, adjust() has to be called then.
+   **/
+  bool completed();
+  /** adjust the depth, xoffTotalCC is the accumulated FCF xoff time **/
+  void adjust(uint64_t xoffTotalCC);
+
+  uint32_t depth() { return m_depth; }
+  /** mean completion latency of the last window **/
+  uint32_t latencyUs() { return m_latency_us; }
+  uint64_t adjustments() { return m_adjustments; }
+
+private:
+  uint32_t m_min_depth;
+  uint32_t m_max_depth;
+  uint32_t m_target_latency_us;
+  inflightClock_t m_clock_us;
+  uint32_t m_depth;
+  uint32_t m_latency_us;
+  uint64_t m_adjustments;
+
+  std::deque<uint64_t> m_enqueue_us;
+  bool m_limited;
+
+  // current window
+  uint64_t m_window_start_us;
+  uint32_t m_window_events;
+  uint64_t m_window_latency_us;
+  uint64_t m_last_xoff_cc;
+  bool m_xoff_valid;
+
+  // base latency: minimum window latency of this and the previous epoch
+  double m_base_latency_us;
+  double m_epoch_min_us;
+  double m_prev_epoch_min_us;
+  uint32_t m_base_windows;
+
+  // base latency probe at the minimum depth
+  bool m_probe;
+  uint32_t m_probe_drain;
+  uint32_t m_probe_saved_depth;
+};
+
+#endif // INFLIGHT_CONTROLLER_HH
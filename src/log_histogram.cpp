@@ -0,0 +1,94 @@
+/**
+ *  log_histogram.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "log_histogram.hh"
+
+log_histogram::log_histogram() { clear(); }
+
+void log_histogram::clear() {
+  for (uint32_t i = 0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    m_buckets[i].store(0, std::memory_order_relaxed);
+  }
+  m_sum.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+void log_histogram::merge(const log_histogram &other) {
+  for (uint32_t i = 0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    uint64_t n = other.m_buckets[i].load(std::memory_order_relaxed);
+    if (n) {
+      m_buckets[i].store(m_buckets[i].load(std::memory_order_relaxed) + n,
+                         std::memory_order_relaxed);
+    }
+  }
+  m_sum.store(sum() + other.sum(), std::memory_order_relaxed);
+  if (other.max() > max()) {
+    m_max.store(other.max(), std::memory_order_relaxed);
+  }
+}
+
+uint64_t log_histogram::count() const {
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    n += m_buckets[i].load(std::memory_order_relaxed);
+  }
+  return n;
+}
+
+double log_histogram::mean() const {
+  uint64_t n = count();
+  return n ? (double)sum() / n : 0.0;
+}
+
+uint32_t log_histogram::bucketUpperBound(uint32_t index) {
+  if (index < (1 << LOG_HISTOGRAM_SUB_BITS)) {
+    return index;
+  }
+  uint32_t shift = (index >> LOG_HISTOGRAM_SUB_BITS) - 1;
+  uint64_t mantissa = (index & ((1 << LOG_HISTOGRAM_SUB_BITS) - 1)) |
+                      (1 << LOG_HISTOGRAM_SUB_BITS);
+  return ((mantissa + 1) << shift) - 1;
+}
+
+uint32_t log_histogram::percentile(double p) const {
+  // work on one copy so the result is consistent with itself
+  uint64_t buckets[LOG_HISTOGRAM_BUCKETS];
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    n += buckets[i];
+  }
+  if (n == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(p * n);
+  if (rank >= n) {
+    rank = n - 1;
+  }
+  uint64_t seen = 0;
+  uint32_t i = 0;
+  for (; i < LOG_HISTOGRAM_BUCKETS - 1; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      break;
+    }
+  }
+  uint32_t upper = bucketUpperBound(i);
+  uint32_t maxValue = max();
+  return (upper < maxValue) ? upper : maxValue;
+}
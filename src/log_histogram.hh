@@ -0,0 +1,84 @@
+/**
+ *  log_histogram.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef LOG_HISTOGRAM_HH
+#define LOG_HISTOGRAM_HH
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * values below 2^LOG_HISTOGRAM_SUB_BITS get a bucket each, every power of
+ * two above is split into 2^LOG_HISTOGRAM_SUB_BITS buckets, which limits
+ * the relative error of a percentile to 1/16
+ **/
+#define LOG_HISTOGRAM_SUB_BITS 4
+#define LOG_HISTOGRAM_BUCKETS                                                  \
+  ((32 - LOG_HISTOGRAM_SUB_BITS + 1) << LOG_HISTOGRAM_SUB_BITS)
+
+/**
+ * Log-bucketed histogram of 32 bit values. add() is wait-free for a
+ * single writer thread, any number of threads may read concurrently. A
+ * reader sees each bucket consistently but not necessarily all buckets
+ * from the same point in time.
+ **/
+class log_histogram {
+public:
+  log_histogram();
+
+  /** only one thread may call add(), merge() and clear() **/
+  void add(uint32_t value) {
+    uint32_t i = bucketIndex(value);
+    m_buckets[i].store(m_buckets[i].load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+    if (value > m_max.load(std::memory_order_relaxed)) {
+      m_max.store(value, std::memory_order_relaxed);
+    }
+  }
+  void merge(const log_histogram &other);
+  void clear();
+
+  uint64_t count() const;
+  uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+  uint32_t max() const { return m_max.load(std::memory_order_relaxed); }
+  double mean() const;
+  /**
+   * upper bound of the bucket holding the fraction p of all values, at
+   * most max(). Returns 0 for an empty histogram.
+   **/
+  uint32_t percentile(double p) const;
+
+  static uint32_t bucketIndex(uint32_t value) {
+    if (value < (1 << LOG_HISTOGRAM_SUB_BITS)) {
+      return value;
+    }
+    uint32_t shift = 31 - __builtin_clz(value) - LOG_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << LOG_HISTOGRAM_SUB_BITS) +
+           ((value >> shift) & ((1 << LOG_HISTOGRAM_SUB_BITS) - 1));
+  }
+  static uint32_t bucketUpperBound(uint32_t index);
+
+private:
+  std::atomic<uint64_t> m_buckets[LOG_HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> m_sum;
+  std::atomic<uint32_t> m_max;
+};
+
+#endif // LOG_HISTOGRAM_HH
@@ -0,0 +1,99 @@
+/**
+ *  reference_set.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string>
+#include <algorithm>
+#include "reference_set.hh"
+#include "digest.hh"
+
+reference_set::~reference_set() {
+  for (size_t i = 0; i < m_refList.size(); i++) {
+    if (m_refList[i].map) {
+      munmap((void *)m_refList[i].map, m_refList[i].size);
+    }
+  }
+}
+
+int reference_set::addFile(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat refstat;
+  if (fstat(fd, &refstat) == -1) {
+    close(fd);
+    return -1;
+  }
+  struct refFileEntry entry;
+  entry.map = NULL;
+  entry.size = refstat.st_size;
+  // mmap() rejects a zero length, an empty file stays an empty reference
+  if (entry.size) {
+    // prefault the reference so the first compare does not take page faults
+    void *map = mmap(0, entry.size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                     fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    madvise(map, entry.size, MADV_WILLNEED);
+    entry.map = (const uint32_t *)map;
+  }
+  close(fd);
+  entry.digest = digest64(entry.map, entry.size);
+  m_refIndex.insert(std::make_pair(entry.digest, m_refList.size()));
+  m_refList.push_back(entry);
+  return 0;
+}
+
+int reference_set::addPath(const char *path) {
+  struct stat pathstat;
+  if (stat(path, &pathstat) == -1) {
+    return -1;
+  }
+  if (!S_ISDIR(pathstat.st_mode)) {
+    return addFile(path);
+  }
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return -1;
+  }
+  std::vector<std::string> files;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string filename = std::string(path) + "/" + entry->d_name;
+    if (stat(filename.c_str(), &pathstat) == 0 && S_ISREG(pathstat.st_mode)) {
+      files.push_back(filename);
+    }
+  }
+  closedir(dir);
+  // keep a defined order for the round-robin mode
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size(); i++) {
+    if (addFile(files[i].c_str()) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ *  reference_set.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef REFERENCE_SET_HH
+#define REFERENCE_SET_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+struct refFileEntry {
+  /** NULL for an empty reference file **/
+  const uint32_t *map;
+  size_t size;
+  uint64_t digest;
+};
+
+/**
+ * reference events for EC_CHK_FILE, mapped read-only and indexed by their
+ * digest. The set is filled once and can then be shared by the event
+ * checkers of all channels.
+ **/
+class reference_set {
+public:
+  typedef std::unordered_multimap<uint64_t, size_t>::const_iterator
+      indexIter_t;
+
+  reference_set() {}
+  ~reference_set();
+
+  int addFile(const char *filename);
+  /** add a reference file or all regular files of a directory **/
+  int addPath(const char *path);
+
+  size_t size() const { return m_refList.size(); }
+  bool empty() const { return m_refList.empty(); }
+  const refFileEntry &entry(size_t index) const { return m_refList[index]; }
+
+  /** all references with the given digest **/
+  std::pair<indexIter_t, indexIter_t> find(uint64_t digest) const {
+    return m_refIndex.equal_range(digest);
+  }
+
+private:
+  reference_set(const reference_set &);
+  reference_set &operator=(const reference_set &);
+
+  std::vector<refFileEntry> m_refList;
+  /** reference digest -> index in m_refList **/
+  std::unordered_multimap<uint64_t, size_t> m_refIndex;
+};
+
+#endif // REFERENCE_SET_HH
@@ -0,0 +1,94 @@
+/**
+ *  ring_allocator.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include "ring_allocator.hh"
+
+ring_allocator::ring_allocator(uint64_t size, ringMode_t mode) {
+  m_size = size;
+  m_mode = mode;
+  m_head = 0;
+  m_used = 0;
+  m_high_water = 0;
+  m_padding_total = 0;
+  m_reserved.offset = 0;
+  m_reserved.size = 0;
+  m_reserved_padding = 0;
+}
+
+int ring_allocator::reserve(uint64_t size, ringSegment_t seg[2],
+                            uint32_t *nSegments) {
+  if (size > m_size || size == 0) {
+    return EFBIG;
+  }
+  uint64_t free = m_size - m_used;
+  uint64_t toEnd = m_size - m_head;
+  uint64_t padding = 0;
+  if (size > toEnd && m_mode == RING_PAD) {
+    padding = toEnd;
+  }
+  if (size + padding > free) {
+    return EAGAIN;
+  }
+
+  if (padding) {
+    seg[0].offset = 0;
+    seg[0].size = size;
+    *nSegments = 1;
+  } else if (size > toEnd) {
+    seg[0].offset = m_head;
+    seg[0].size = toEnd;
+    seg[1].offset = 0;
+    seg[1].size = size - toEnd;
+    *nSegments = 2;
+  } else {
+    seg[0].offset = m_head;
+    seg[0].size = size;
+    *nSegments = 1;
+  }
+  m_reserved.offset = seg[0].offset;
+  m_reserved.size = size + padding;
+  m_reserved_padding = padding;
+  return 0;
+}
+
+void ring_allocator::commit() {
+  m_allocs.push_back(m_reserved);
+  m_used += m_reserved.size;
+  m_padding_total += m_reserved_padding;
+  m_head = (m_head + m_reserved.size) % m_size;
+  if (m_used > m_high_water) {
+    m_high_water = m_used;
+  }
+  m_reserved.size = 0;
+  m_reserved_padding = 0;
+}
+
+int64_t ring_allocator::release() {
+  if (m_allocs.empty()) {
+    return -1;
+  }
+  alloc_t oldest = m_allocs.front();
+  m_allocs.pop_front();
+  m_used -= oldest.size;
+  if (m_used == 0) {
+    // start over at the beginning to avoid needless wraps
+    m_head = 0;
+  }
+  return oldest.offset;
+}
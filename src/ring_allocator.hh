@@ -0,0 +1,90 @@
+/**
+ *  ring_allocator.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef RING_ALLOCATOR_HH
+#define RING_ALLOCATOR_HH
+
+#include <stdint.h>
+#include <deque>
+
+/**
+ * RING_SPLIT: an allocation crossing the end of the buffer is returned as
+ *             two segments
+ * RING_PAD:   the space up to the end of the buffer is skipped and the
+ *             allocation starts at offset 0. The skipped bytes stay in use
+ *             until the allocation is released.
+ **/
+enum ringMode_t { RING_SPLIT, RING_PAD };
+
+struct ringSegment_t {
+  uint64_t offset;
+  uint64_t size;
+};
+
+/**
+ * Allocates variable sized regions of a ring buffer in FIFO order.
+ * Allocations are released in the order they were made. Not thread-safe.
+ **/
+class ring_allocator {
+public:
+  ring_allocator(uint64_t size, ringMode_t mode = RING_SPLIT);
+
+  /**
+   * find space for size bytes without allocating it. Fills seg with one
+   * or two segments and returns 0, EAGAIN if there is not enough free space
+   * right now or EFBIG if size exceeds the buffer.
+   **/
+  int reserve(uint64_t size, ringSegment_t seg[2], uint32_t *nSegments);
+  /** allocate the space found by the last successful reserve() **/
+  void commit();
+  /**
+   * release the oldest allocation. Returns the offset of its first
+   * segment or -1 if nothing is allocated.
+   **/
+  int64_t release();
+
+  uint64_t size() { return m_size; }
+  uint64_t used() { return m_used; }
+  uint64_t allocations() { return m_allocs.size(); }
+  /** maximum of used() since construction or resetHighWater() **/
+  uint64_t highWater() { return m_high_water; }
+  void resetHighWater() { m_high_water = m_used; }
+  /** total number of bytes skipped in RING_PAD mode **/
+  uint64_t paddingBytes() { return m_padding_total; }
+  ringMode_t mode() { return m_mode; }
+
+private:
+  struct alloc_t {
+    uint64_t offset;
+    uint64_t size; // including padding
+  };
+
+  uint64_t m_size;
+  ringMode_t m_mode;
+  uint64_t m_head;
+  uint64_t m_used;
+  uint64_t m_high_water;
+  uint64_t m_padding_total;
+  std::deque<alloc_t> m_allocs;
+
+  // result of the last reserve()
+  alloc_t m_reserved;
+  uint64_t m_reserved_padding;
+};
+
+#endif // RING_ALLOCATOR_HH
@@ -0,0 +1,132 @@
+/**
+ *  thread_utils.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <atomic>
+#include <set>
+#include "thread_utils.hh"
+
+static int parseId(const char *pos, char **end, uint32_t *id) {
+  errno = 0;
+  unsigned long value = strtoul(pos, end, 0);
+  if (*end == pos || *pos == '-' || errno != 0 || value > UINT32_MAX) {
+    return -1;
+  }
+  *id = value;
+  return 0;
+}
+
+int parseIdList(const char *str, std::vector<uint32_t> &list) {
+  list.clear();
+  if (!str || *str == '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+  std::set<uint32_t> seen;
+  const char *pos = str;
+  while (*pos != '\0') {
+    char *end = NULL;
+    uint32_t first, last;
+    if (parseId(pos, &end, &first) != 0) {
+      list.clear();
+      errno = EINVAL;
+      return -1;
+    }
+    last = first;
+    pos = end;
+    if (*pos == '-') {
+      pos++;
+      if (parseId(pos, &end, &last) != 0 || last < first) {
+        list.clear();
+        errno = EINVAL;
+        return -1;
+      }
+      pos = end;
+    }
+    // checked before expanding, so the loop below cannot run unbounded
+    if (last - first >= ID_LIST_MAX_ENTRIES - list.size()) {
+      list.clear();
+      errno = EINVAL;
+      return -1;
+    }
+    for (uint64_t id = first; id <= last; id++) {
+      if (!seen.insert(id).second) {
+        list.clear();
+        errno = EINVAL;
+        return -1;
+      }
+      list.push_back(id);
+    }
+    if (*pos == ',') {
+      pos++;
+      if (*pos == '\0') {
+        list.clear();
+        errno = EINVAL;
+        return -1;
+      }
+    } else if (*pos != '\0') {
+      list.clear();
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int pinThreadToCpu(std::thread &thread, uint32_t cpu) {
+  if (cpu >= CPU_SETSIZE) {
+    return EINVAL;
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t),
+                                &cpuset);
+}
+
+static void parallelForWorker(std::atomic<uint32_t> *next, uint32_t n,
+                              void (*fn)(uint32_t, void *), void *arg) {
+  uint32_t index;
+  while ((index = next->fetch_add(1)) < n) {
+    fn(index, arg);
+  }
+}
+
+void parallelFor(uint32_t n, uint32_t nThreads,
+                 void (*fn)(uint32_t index, void *arg), void *arg) {
+  if (nThreads > n) {
+    nThreads = n;
+  }
+  if (nThreads <= 1) {
+    for (uint32_t i = 0; i < n; i++) {
+      fn(i, arg);
+    }
+    return;
+  }
+  std::atomic<uint32_t> next(0);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < nThreads; t++) {
+    threads.push_back(std::thread(parallelForWorker, &next, n, fn, arg));
+  }
+  for (uint32_t t = 0; t < nThreads; t++) {
+    threads[t].join();
+  }
+}
@@ -0,0 +1,55 @@
+/**
+ *  thread_utils.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef THREAD_UTILS_HH
+#define THREAD_UTILS_HH
+
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/** size used to pad per-thread data to avoid false sharing **/
+#define CACHELINE_SIZE 64
+
+/** upper limit for the number of IDs in a list **/
+#define ID_LIST_MAX_ENTRIES 4096
+
+/**
+ * parse a list of IDs like "0-11" or "0,2,4-6" into a vector. IDs must fit
+ * into 32 bit and may appear only once, the list may hold at most
+ * ID_LIST_MAX_ENTRIES IDs. Returns 0 on success or -1 with errno set to
+ * EINVAL and an empty list.
+ **/
+int parseIdList(const char *str, std::vector<uint32_t> &list);
+
+/**
+ * pin a thread to a single CPU. Returns 0 on success or an error number,
+ * EINVAL if cpu is not below CPU_SETSIZE.
+ **/
+int pinThreadToCpu(std::thread &thread, uint32_t cpu);
+
+/**
+ * call fn(index, arg) for each index in [0, n) on up to nThreads threads.
+ * Each thread takes the next index once its previous call returned. Returns
+ * after all calls returned. With nThreads <= 1, the calls are made in order
+ * by the calling thread.
+ **/
+void parallelFor(uint32_t n, uint32_t nThreads,
+                 void (*fn)(uint32_t index, void *arg), void *arg);
+
+#endif // THREAD_UTILS_HH
@@ -0,0 +1,267 @@
+/**
+ *  word_compare.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "word_compare.hh"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define WC_X86 1
+#endif
+
+/****************** scalar *******************/
+static int64_t findLinearMismatchScalar(const uint32_t *data, size_t nWords,
+                                        uint32_t start, uint32_t step,
+                                        size_t first) {
+  uint32_t expected = start + first * step;
+  for (size_t i = first; i < nWords; i++) {
+    if (data[i] != expected) {
+      return i;
+    }
+    expected += step;
+  }
+  return -1;
+}
+
+// first has to be >= 1
+static int64_t findPrbsMismatchScalar(const uint32_t *data, size_t nWords,
+                                      size_t first) {
+  for (size_t i = first; i < nWords; i++) {
+    if (data[i] != prbsNext(data[i - 1])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void compareWordsScalar(const uint32_t *a, const uint32_t *b,
+                               size_t nWords, size_t first,
+                               wordMismatch_t *result) {
+  for (size_t i = first; i < nWords; i++) {
+    if (a[i] != b[i]) {
+      if (result->first < 0) {
+        result->first = i;
+      }
+      result->last = i;
+      result->count++;
+    }
+  }
+}
+
+/** account for a vector of differing words, bit n set for word base + n **/
+static inline void addMismatchMask(uint32_t mask, size_t base,
+                                   wordMismatch_t *result) {
+  if (result->first < 0) {
+    result->first = base + __builtin_ctz(mask);
+  }
+  result->last = base + 31 - __builtin_clz(mask);
+  result->count += __builtin_popcount(mask);
+}
+
+#ifdef WC_X86
+/****************** SSE2 *******************/
+static int64_t findLinearMismatchSse2(const uint32_t *data, size_t nWords,
+                                      uint32_t start, uint32_t step) {
+  __m128i expected =
+      _mm_setr_epi32(start, start + step, start + 2 * step, start + 3 * step);
+  const __m128i inc = _mm_set1_epi32(4 * step);
+  size_t i = 0;
+  for (; i + 4 <= nWords; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(data + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(d, expected)) != 0xffff) {
+      return findLinearMismatchScalar(data, i + 4, start, step, i);
+    }
+    expected = _mm_add_epi32(expected, inc);
+  }
+  return findLinearMismatchScalar(data, nWords, start, step, i);
+}
+
+static int64_t findPrbsMismatchSse2(const uint32_t *data, size_t nWords) {
+  const __m128i poly = _mm_set1_epi32(PRBS_POLY);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 1;
+  for (; i + 4 <= nWords; i += 4) {
+    __m128i prev = _mm_loadu_si128((const __m128i *)(data + i - 1));
+    __m128i cur = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i fb = _mm_sub_epi32(zero, _mm_and_si128(prev, one));
+    __m128i next =
+        _mm_xor_si128(_mm_srli_epi32(prev, 1), _mm_and_si128(fb, poly));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(cur, next)) != 0xffff) {
+      return findPrbsMismatchScalar(data, i + 4, i);
+    }
+  }
+  return findPrbsMismatchScalar(data, nWords, i);
+}
+
+static void compareWordsSse2(const uint32_t *a, const uint32_t *b,
+                             size_t nWords, wordMismatch_t *result) {
+  size_t i = 0;
+  for (; i + 4 <= nWords; i += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    uint32_t equal =
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+    if (equal != 0xf) {
+      addMismatchMask(~equal & 0xf, i, result);
+    }
+  }
+  compareWordsScalar(a, b, nWords, i, result);
+}
+
+/****************** AVX2 *******************/
+__attribute__((target("avx2"))) static int64_t
+findLinearMismatchAvx2(const uint32_t *data, size_t nWords, uint32_t start,
+                       uint32_t step) {
+  __m256i expected = _mm256_setr_epi32(
+      start, start + step, start + 2 * step, start + 3 * step,
+      start + 4 * step, start + 5 * step, start + 6 * step, start + 7 * step);
+  const __m256i inc = _mm256_set1_epi32(8 * step);
+  size_t i = 0;
+  for (; i + 8 <= nWords; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(data + i));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(d, expected)) != -1) {
+      return findLinearMismatchScalar(data, i + 8, start, step, i);
+    }
+    expected = _mm256_add_epi32(expected, inc);
+  }
+  return findLinearMismatchScalar(data, nWords, start, step, i);
+}
+
+__attribute__((target("avx2"))) static int64_t
+findPrbsMismatchAvx2(const uint32_t *data, size_t nWords) {
+  const __m256i poly = _mm256_set1_epi32(PRBS_POLY);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 1;
+  for (; i + 8 <= nWords; i += 8) {
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(data + i - 1));
+    __m256i cur = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i fb = _mm256_sub_epi32(zero, _mm256_and_si256(prev, one));
+    __m256i next = _mm256_xor_si256(_mm256_srli_epi32(prev, 1),
+                                    _mm256_and_si256(fb, poly));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(cur, next)) != -1) {
+      return findPrbsMismatchScalar(data, i + 8, i);
+    }
+  }
+  return findPrbsMismatchScalar(data, nWords, i);
+}
+
+__attribute__((target("avx2"))) static void
+compareWordsAvx2(const uint32_t *a, const uint32_t *b, size_t nWords,
+                 wordMismatch_t *result) {
+  size_t i = 0;
+  for (; i + 8 <= nWords; i += 8) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    uint32_t equal =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb)));
+    if (equal != 0xff) {
+      addMismatchMask(~equal & 0xff, i, result);
+    }
+  }
+  compareWordsScalar(a, b, nWords, i, result);
+}
+
+static bool cpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static wcImpl_t bestImpl() {
+#ifdef WC_X86
+  return cpuHasAvx2() ? WC_IMPL_AVX2 : WC_IMPL_SSE2;
+#else
+  return WC_IMPL_SCALAR;
+#endif
+}
+
+// resolved once at load time, before any checker thread runs
+static wcImpl_t activeImpl = bestImpl();
+
+/****************** dispatch *******************/
+int wordCompareSelect(wcImpl_t impl) {
+  switch (impl) {
+  case WC_IMPL_AUTO:
+    impl = bestImpl();
+    break;
+  case WC_IMPL_SCALAR:
+    break;
+#ifdef WC_X86
+  case WC_IMPL_SSE2:
+    break;
+  case WC_IMPL_AVX2:
+    if (!cpuHasAvx2()) {
+      return -1;
+    }
+    break;
+#endif
+  default:
+    return -1;
+  }
+  activeImpl = impl;
+  return 0;
+}
+
+int64_t findLinearMismatch(const uint32_t *data, size_t nWords, uint32_t start,
+                           uint32_t step) {
+  switch (activeImpl) {
+#ifdef WC_X86
+  case WC_IMPL_AVX2:
+    return findLinearMismatchAvx2(data, nWords, start, step);
+  case WC_IMPL_SSE2:
+    return findLinearMismatchSse2(data, nWords, start, step);
+#endif
+  default:
+    return findLinearMismatchScalar(data, nWords, start, step, 0);
+  }
+}
+
+int64_t findPrbsMismatch(const uint32_t *data, size_t nWords) {
+  switch (activeImpl) {
+#ifdef WC_X86
+  case WC_IMPL_AVX2:
+    return findPrbsMismatchAvx2(data, nWords);
+  case WC_IMPL_SSE2:
+    return findPrbsMismatchSse2(data, nWords);
+#endif
+  default:
+    return findPrbsMismatchScalar(data, nWords, 1);
+  }
+}
+
+uint64_t compareWords(const uint32_t *a, const uint32_t *b, size_t nWords,
+                      wordMismatch_t *result) {
+  result->first = -1;
+  result->last = -1;
+  result->count = 0;
+  switch (activeImpl) {
+#ifdef WC_X86
+  case WC_IMPL_AVX2:
+    compareWordsAvx2(a, b, nWords, result);
+    break;
+  case WC_IMPL_SSE2:
+    compareWordsSse2(a, b, nWords, result);
+    break;
+#endif
+  default:
+    compareWordsScalar(a, b, nWords, 0, result);
+    break;
+  }
+  return result->count;
+}
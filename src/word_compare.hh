@@ -0,0 +1,78 @@
+/**
+ *  word_compare.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef WORD_COMPARE_HH
+#define WORD_COMPARE_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Vectorized checks on 32 bit word buffers. AVX2 is used if the CPU
+ * supports it, SSE2 otherwise and a scalar loop on other architectures.
+ **/
+
+/** implementations, the fastest one the CPU supports is used by default **/
+enum wcImpl_t { WC_IMPL_AUTO, WC_IMPL_SCALAR, WC_IMPL_SSE2, WC_IMPL_AVX2 };
+
+/**
+ * use impl for all following checks, e.g. to test the fallbacks on an AVX2
+ * machine. Not thread safe, call it before any check runs. Returns 0 or -1
+ * if impl is not available on this CPU or architecture.
+ **/
+int wordCompareSelect(wcImpl_t impl);
+
+/** feedback polynomial of the PRBS pattern: x^32 + x^22 + x^2 + x + 1 **/
+#define PRBS_POLY 0x80200003
+
+/** one PRBS step: Galois LFSR, shifting right **/
+inline uint32_t prbsNext(uint32_t word) {
+  return (word >> 1) ^ ((0 - (word & 1)) & PRBS_POLY);
+}
+
+/**
+ * check data[i] == start + i * step for all i < nWords. step 0 checks for a
+ * constant pattern, 1 for incrementing and 0xffffffff for decrementing.
+ * Returns the index of the first mismatching word or -1.
+ **/
+int64_t findLinearMismatch(const uint32_t *data, size_t nWords, uint32_t start,
+                           uint32_t step);
+
+/**
+ * check data[i] == prbsNext(data[i - 1]) for 0 < i < nWords. The check
+ * synchronizes on the first word and does not need to know the seed.
+ * Returns the index of the first mismatching word or -1.
+ **/
+int64_t findPrbsMismatch(const uint32_t *data, size_t nWords);
+
+/** location of the differences found by compareWords() **/
+struct wordMismatch_t {
+  int64_t first;
+  int64_t last;
+  uint64_t count;
+};
+
+/**
+ * compare nWords words of a and b. Fills result with the indices of the
+ * first and last differing word (-1 if there are none) and the number of
+ * differing words. Returns the number of differing words.
+ **/
+uint64_t compareWords(const uint32_t *a, const uint32_t *b, size_t nWords,
+                      wordMismatch_t *result);
+
+#endif // WORD_COMPARE_HH
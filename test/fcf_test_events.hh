@@ -0,0 +1,87 @@
+/**
+ *  fcf_test_events.hh
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FCF_TEST_EVENTS_HH
+#define FCF_TEST_EVENTS_HH
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "fcf_cluster_decoder.hh"
+
+/** FCF output cluster as encoded by the hardware **/
+struct testCluster_t {
+  uint32_t row;
+  uint32_t flags;
+  uint32_t qmax;   // fixed point, FCF_CHARGE_FRAC_BITS fractional bits
+  uint32_t charge; // fixed point, FCF_CHARGE_FRAC_BITS fractional bits
+  float pad;
+  float time;
+  float pad2;
+  float time2;
+};
+
+inline testCluster_t testCluster(uint32_t row, float pad, float time,
+                                 uint32_t charge = 100) {
+  testCluster_t c;
+  c.row = row;
+  c.flags = 0;
+  c.qmax = (charge / 4) << FCF_CHARGE_FRAC_BITS;
+  c.charge = charge << FCF_CHARGE_FRAC_BITS;
+  c.pad = pad;
+  c.time = time;
+  c.pad2 = pad * pad + 0.25f;
+  c.time2 = time * time + 0.5f;
+  return c;
+}
+
+inline void appendCluster(std::vector<uint32_t> &event,
+                          const testCluster_t &c) {
+  uint32_t w[FCF_CLUSTER_DW];
+  w[0] = (FCF_CLUSTER_MARKER << 30) | (c.row << 24) | (c.qmax & 0xffffff);
+  w[1] = (c.flags << 30) | (c.charge & 0x3fffffff);
+  memcpy(&w[2], &c.pad, sizeof(float));
+  memcpy(&w[3], &c.time, sizeof(float));
+  memcpy(&w[4], &c.pad2, sizeof(float));
+  memcpy(&w[5], &c.time2, sizeof(float));
+  event.insert(event.end(), w, w + FCF_CLUSTER_DW);
+}
+
+/** header, clusters and an RCU trailer of trailerWords words **/
+inline std::vector<uint32_t>
+makeFcfEvent(const std::vector<testCluster_t> &clusters,
+             uint32_t trailerWords = FCF_TRAILER_DW, uint32_t rcuId = 0x5a,
+             uint32_t formatVersion = 2) {
+  std::vector<uint32_t> event;
+  event.push_back(0xffffffff);
+  for (uint32_t i = 1; i < FCF_HEADER_DW; i++) {
+    event.push_back(0x1000 + i);
+  }
+  for (size_t i = 0; i < clusters.size(); i++) {
+    appendCluster(event, clusters[i]);
+  }
+  event.push_back(0x1234);
+  for (uint32_t i = 1; i + 1 < trailerWords; i++) {
+    event.push_back((0x2u << 30) | (i << 26) | i);
+  }
+  event.push_back((0x3u << 30) | (formatVersion << 24) | (rcuId << 7) |
+                  trailerWords);
+  return event;
+}
+
+#endif // FCF_TEST_EVENTS_HH
@@ -0,0 +1,65 @@
+/**
+ *  test_digest.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include "digest.hh"
+#include "test_common.hh"
+
+/** results of the xxHash64 reference implementation **/
+static void testReferenceVectors() {
+  uint8_t seq[101];
+  for (size_t i = 0; i < sizeof(seq); i++) {
+    seq[i] = i;
+  }
+  const char *fox = "The quick brown fox jumps over the lazy dog";
+
+  CHECK(digest64("", 0) == 0xef46db3751d8e999ULL);
+  CHECK(digest64(NULL, 0) == 0xef46db3751d8e999ULL);
+  CHECK(digest64("", 0, 1) == 0xd5afba1336a3be4bULL);
+  CHECK(digest64("a", 1) == 0xd24ec4f1a98c6e5bULL);
+  CHECK(digest64("abc", 3) == 0x44bc2cf5ad770999ULL);
+  CHECK(digest64("abc", 3, 0x9e3779b1) == 0x1318df30094a85fdULL);
+  CHECK(digest64(fox, strlen(fox)) == 0x0b242d361fda71bcULL);
+  CHECK(digest64(seq, sizeof(seq)) == 0xe99038495f85381eULL);
+  CHECK(digest64(seq, sizeof(seq), 0x9e3779b1) == 0xa1c6d4174c37136dULL);
+}
+
+/** the result must not depend on the alignment of the buffer **/
+static void testUnaligned() {
+  uint8_t buf[128 + 8];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = i * 7;
+  }
+  uint8_t ref[128];
+  for (size_t offset = 1; offset < 8; offset++) {
+    memcpy(ref, buf + offset, sizeof(ref));
+    for (size_t size = 0; size <= sizeof(ref); size++) {
+      CHECK(digest64(buf + offset, size) == digest64(ref, size));
+    }
+  }
+}
+
+int main() {
+  testReferenceVectors();
+  testUnaligned();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
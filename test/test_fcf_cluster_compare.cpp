@@ -0,0 +1,172 @@
+/**
+ *  test_fcf_cluster_compare.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include "fcf_cluster_compare.hh"
+#include "fcf_test_events.hh"
+#include "test_common.hh"
+
+static std::vector<testCluster_t> someClusters(uint32_t n) {
+  std::vector<testCluster_t> clusters;
+  for (uint32_t i = 0; i < n; i++) {
+    // several clusters per row and pad to exercise the merge window
+    clusters.push_back(
+        testCluster(i % 7, 10.0f + (i % 3), 50.0f + 3 * i, 40 + i));
+  }
+  return clusters;
+}
+
+static bool upperLess(uint64_t a, uint64_t b) { return (a >> 32) < (b >> 32); }
+
+static void testRadixSort() {
+  srand(3);
+  for (size_t n = 0; n < 3000; n += 299) {
+    std::vector<uint64_t> keys(n), tmp(n), expected;
+    for (size_t i = 0; i < n; i++) {
+      // few distinct upper digits in some runs to hit the skipped passes
+      uint32_t upper = (n % 2) ? rand() : (rand() & 0x7ff);
+      keys[i] = ((uint64_t)upper << 32) | i;
+    }
+    expected = keys;
+    std::stable_sort(expected.begin(), expected.end(), upperLess);
+    radixSortKeys(keys.data(), tmp.data(), n);
+    CHECK(keys == expected);
+  }
+}
+
+static void testOrderInsensitive() {
+  std::vector<testCluster_t> ref = someClusters(40);
+  std::vector<testCluster_t> out = ref;
+  std::mt19937 rng(4);
+  std::shuffle(out.begin(), out.end(), rng);
+  std::vector<uint32_t> refEv = makeFcfEvent(ref);
+  std::vector<uint32_t> outEv = makeFcfEvent(out);
+
+  fcf_cluster_compare cmp;
+  fcfCompareResult_t res;
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 0);
+  CHECK(res.nOutput == 40 && res.nReference == 40 && res.matched == 40);
+  CHECK(res.differing == 0 && res.missing == 0 && res.extra == 0);
+  CHECK(!res.headerDiffers);
+
+  // the buffers are reused for a larger event
+  ref = someClusters(100);
+  out = ref;
+  std::reverse(out.begin(), out.end());
+  refEv = makeFcfEvent(ref);
+  outEv = makeFcfEvent(out);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 0);
+  CHECK(res.matched == 100);
+}
+
+static void testDifferences() {
+  std::vector<testCluster_t> ref = someClusters(20);
+  std::vector<uint32_t> refEv = makeFcfEvent(ref);
+  fcf_cluster_compare cmp;
+  fcfCompareResult_t res;
+
+  // one charge differs, one cluster is lost, one is added
+  std::vector<testCluster_t> out = ref;
+  out[3].charge += 1 << FCF_CHARGE_FRAC_BITS;
+  out.erase(out.begin() + 7);
+  out.push_back(testCluster(63, 100.0f, 900.0f));
+  std::vector<uint32_t> outEv = makeFcfEvent(out);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 1);
+  CHECK(res.matched == 18 && res.differing == 1 && res.missing == 1 &&
+        res.extra == 1);
+  CHECK(!res.headerDiffers);
+
+  // within the charge tolerance
+  fcfTolerance_t tol = fcfExactTolerance;
+  tol.charge = 1;
+  cmp.setTolerance(tol);
+  out = ref;
+  out[3].charge += 1 << FCF_CHARGE_FRAC_BITS;
+  outEv = makeFcfEvent(out);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 0);
+  CHECK(res.matched == 20);
+
+  // flags always have to match
+  out = ref;
+  out[5].flags = FCF_FLAG_SPLIT_TIME;
+  outEv = makeFcfEvent(out);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 1);
+  CHECK(res.differing == 1);
+
+  // a shifted position is a different cluster unless within tolerance
+  cmp.setTolerance(fcfExactTolerance);
+  out = ref;
+  out[2].pad += 0.5f;
+  out[2].pad2 = out[2].pad * out[2].pad + 0.25f;
+  outEv = makeFcfEvent(out);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 1);
+  CHECK(res.missing == 1 && res.extra == 1);
+  tol = fcfExactTolerance;
+  tol.pad = 0.5f;
+  tol.sigma = 0.01f;
+  cmp.setTolerance(tol);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 0);
+  CHECK(res.matched == 20);
+}
+
+static void testHeaderAndErrors() {
+  std::vector<testCluster_t> ref = someClusters(5);
+  std::vector<uint32_t> refEv = makeFcfEvent(ref);
+  fcf_cluster_compare cmp;
+  fcfCompareResult_t res;
+
+  std::vector<uint32_t> outEv = makeFcfEvent(ref);
+  outEv[2] ^= 1;
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 1);
+  CHECK(res.headerDiffers && res.matched == 5);
+
+  outEv = makeFcfEvent(ref, FCF_TRAILER_DW, 0x11);
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == 1);
+  CHECK(res.headerDiffers);
+
+  outEv = makeFcfEvent(ref);
+  outEv.back() = 0;
+  errno = 0;
+  CHECK(cmp.compare(outEv.data(), outEv.size(), refEv.data(), refEv.size(),
+                    &res) == -1 &&
+        errno == EBADMSG);
+}
+
+int main() {
+  testRadixSort();
+  testOrderInsensitive();
+  testDifferences();
+  testHeaderAndErrors();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
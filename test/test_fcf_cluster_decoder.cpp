@@ -0,0 +1,150 @@
+/**
+ *  test_fcf_cluster_decoder.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include "fcf_cluster_decoder.hh"
+#include "fcf_test_events.hh"
+#include "test_common.hh"
+
+static std::vector<testCluster_t> someClusters(uint32_t n) {
+  std::vector<testCluster_t> clusters;
+  for (uint32_t i = 0; i < n; i++) {
+    testCluster_t c = testCluster(i % 64, 1.5f + i, 100.25f + 2 * i, 50 + i);
+    c.flags = i & 0x3;
+    clusters.push_back(c);
+  }
+  return clusters;
+}
+
+static void testParseTrailer() {
+  std::vector<uint32_t> ev = makeFcfEvent(someClusters(3));
+  fcfTrailer_t trl;
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), &trl) == 3);
+  CHECK(trl.payloadWords == 0x1234 && trl.trailerWords == FCF_TRAILER_DW &&
+        trl.rcuId == 0x5a && trl.formatVersion == 2);
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), NULL) == 3);
+
+  // no clusters, shortest trailer
+  ev = makeFcfEvent(someClusters(0), 2);
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), &trl) == 0);
+  CHECK(trl.trailerWords == 2);
+
+  // too short for header and trailer
+  errno = 0;
+  CHECK(fcfParseTrailer(ev.data(), FCF_HEADER_DW + 1, NULL) == -1 &&
+        errno == EBADMSG);
+
+  // bad marker in the last word
+  ev = makeFcfEvent(someClusters(2));
+  ev.back() &= 0x3fffffff;
+  errno = 0;
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), NULL) == -1 && errno == EBADMSG);
+
+  // bad marker in a middle trailer word
+  ev = makeFcfEvent(someClusters(2));
+  ev[ev.size() - 3] = 0;
+  errno = 0;
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), NULL) == -1 && errno == EBADMSG);
+
+  // trailer larger than the event
+  ev = makeFcfEvent(someClusters(0), 2);
+  ev.back() = (ev.back() & ~0x7fu) | 0x7f;
+  errno = 0;
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), NULL) == -1 && errno == EBADMSG);
+
+  // incomplete cluster
+  ev = makeFcfEvent(someClusters(2));
+  ev.erase(ev.begin() + FCF_HEADER_DW);
+  errno = 0;
+  CHECK(fcfParseTrailer(ev.data(), ev.size(), NULL) == -1 && errno == EBADMSG);
+}
+
+static void testDecode() {
+  // covers the vector loop and the scalar tail
+  for (uint32_t n = 0; n < 12; n++) {
+    std::vector<testCluster_t> in = someClusters(n);
+    std::vector<uint32_t> ev = makeFcfEvent(in);
+    fcf_cluster_buffer buffer(16);
+    fcfClusters_t *c = buffer.clusters();
+    fcfTrailer_t trl;
+    CHECK(fcfDecodeClusters(ev.data(), ev.size(), c, &trl) == n);
+    CHECK(c->count == n && trl.rcuId == 0x5a);
+    for (uint32_t i = 0; i < n && i < c->count; i++) {
+      CHECK(c->row[i] == in[i].row);
+      CHECK(c->flags[i] == in[i].flags);
+      CHECK(c->qmax[i] == in[i].qmax >> FCF_CHARGE_FRAC_BITS);
+      CHECK(c->charge[i] == in[i].charge >> FCF_CHARGE_FRAC_BITS);
+      CHECK(c->pad[i] == in[i].pad);
+      CHECK(c->time[i] == in[i].time);
+      CHECK(c->sigmaPad2[i] == in[i].pad2 - in[i].pad * in[i].pad);
+      CHECK(c->sigmaTime2[i] == in[i].time2 - in[i].time * in[i].time);
+    }
+  }
+}
+
+static void testDecodeErrors() {
+  fcf_cluster_buffer buffer(8);
+  fcfClusters_t *c = buffer.clusters();
+
+  // bad cluster marker inside a vector block and in the scalar tail
+  uint32_t bad[] = { 1, 5, 8 };
+  for (int i = 0; i < 3; i++) {
+    std::vector<uint32_t> ev = makeFcfEvent(someClusters(9));
+    ev[FCF_HEADER_DW + bad[i] * FCF_CLUSTER_DW] &= 0x3fffffff;
+    fcf_cluster_buffer big(16);
+    errno = 0;
+    CHECK(fcfDecodeClusters(ev.data(), ev.size(), big.clusters()) == -1 &&
+          errno == EBADMSG);
+    CHECK(big.clusters()->count == bad[i]);
+  }
+
+  // more clusters than capacity
+  std::vector<uint32_t> ev = makeFcfEvent(someClusters(9));
+  errno = 0;
+  CHECK(fcfDecodeClusters(ev.data(), ev.size(), c) == -1 && errno == ENOSPC);
+  CHECK(c->count == 0);
+
+  // invalid trailer
+  ev = makeFcfEvent(someClusters(2));
+  ev.back() = 0;
+  errno = 0;
+  CHECK(fcfDecodeClusters(ev.data(), ev.size(), c) == -1 && errno == EBADMSG);
+}
+
+static void testBufferAlignment() {
+  fcf_cluster_buffer buffer(13);
+  fcfClusters_t *c = buffer.clusters();
+  CHECK(c->capacity == 13 && c->count == 0);
+  const void *arrays[] = { c->row,  c->flags, c->charge,    c->qmax,
+                           c->pad,  c->time,  c->sigmaPad2, c->sigmaTime2 };
+  for (int i = 0; i < 8; i++) {
+    CHECK(((uintptr_t)arrays[i] & 63) == 0);
+  }
+}
+
+int main() {
+  testParseTrailer();
+  testDecode();
+  testDecodeErrors();
+  testBufferAlignment();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
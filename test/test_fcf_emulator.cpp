@@ -0,0 +1,303 @@
+/**
+ *  test_fcf_emulator.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "fcf_emulator.hh"
+#include "fcf_cluster_decoder.hh"
+#include "fcf_mapping.hh"
+#include "fcf_test_events.hh"
+#include "test_common.hh"
+
+/** rows 0 and 1 of patch 0 with four pads each, 0x100 is not mapped **/
+#define HW_ROW0_PAD(pad) (0x000 + (pad))
+#define HW_ROW1_PAD(pad) (0x004 + (pad))
+#define HW_INACTIVE 0x100
+
+static fcf_mapping mapping(0);
+
+/** a bunch with samples in increasing time, starting at firstTime **/
+static void appendBunch(std::vector<uint16_t> &w10, uint32_t firstTime,
+                        const std::vector<uint16_t> &samples) {
+  uint32_t n = samples.size();
+  w10.push_back(n + 2);
+  w10.push_back(firstTime + n - 1);
+  // ALTRO order: decreasing time
+  for (uint32_t k = 0; k < n; k++) {
+    w10.push_back(samples[n - 1 - k]);
+  }
+}
+
+/** channel header and the 10 bit words packed three per payload word **/
+static void appendChannel(std::vector<uint32_t> &payload, uint32_t hwAddr,
+                          const std::vector<uint16_t> &w10) {
+  uint32_t n10 = w10.size();
+  payload.push_back((0x1u << 30) | (n10 << 16) | hwAddr);
+  for (uint32_t i = 0; i < n10; i += 3) {
+    uint32_t w = (uint32_t)w10[i] << 20;
+    if (i + 1 < n10) {
+      w |= (uint32_t)w10[i + 1] << 10;
+    }
+    if (i + 2 < n10) {
+      w |= w10[i + 2];
+    }
+    payload.push_back(w);
+  }
+}
+
+static void appendSingleBunchChannel(std::vector<uint32_t> &payload,
+                                     uint32_t hwAddr, uint32_t firstTime,
+                                     const std::vector<uint16_t> &samples) {
+  std::vector<uint16_t> w10;
+  appendBunch(w10, firstTime, samples);
+  appendChannel(payload, hwAddr, w10);
+}
+
+/** raw DDL event: the FCF header, the RCU payload and an RCU trailer **/
+static std::vector<uint32_t> makeRawEvent(
+    const std::vector<uint32_t> &payload) {
+  std::vector<uint32_t> event = makeFcfEvent(std::vector<testCluster_t>());
+  event.insert(event.begin() + FCF_HEADER_DW, payload.begin(), payload.end());
+  return event;
+}
+
+/** expected cluster from per-pad sample lists, all with gain 1.0 **/
+struct expected_t {
+  uint32_t row;
+  uint32_t flags;
+  uint32_t q;
+  uint32_t qmax;
+  double qp, qp2, qt, qt2;
+};
+
+static void addPad(expected_t *e, uint32_t pad, uint32_t firstTime,
+                   const std::vector<uint16_t> &samples) {
+  for (size_t k = 0; k < samples.size(); k++) {
+    double t = firstTime + k;
+    e->q += samples[k];
+    e->qmax = (samples[k] > e->qmax) ? samples[k] : e->qmax;
+    e->qp += samples[k] * (double)pad;
+    e->qp2 += samples[k] * (double)pad * pad;
+    e->qt += samples[k] * t;
+    e->qt2 += samples[k] * t * t;
+  }
+}
+
+static expected_t expected(uint32_t row, uint32_t flags = 0) {
+  expected_t e = { row, flags, 0, 0, 0, 0, 0, 0 };
+  return e;
+}
+
+static bool near(float value, double expected) {
+  return fabs(value - expected) <= 1e-3 * (1 + fabs(expected));
+}
+
+static void checkCluster(const fcfClusters_t *c, uint32_t i,
+                         const expected_t &e) {
+  CHECK(i < c->count);
+  if (i >= c->count) {
+    return;
+  }
+  double pad = e.qp / e.q;
+  double time = e.qt / e.q;
+  CHECK(c->row[i] == e.row);
+  CHECK(c->flags[i] == e.flags);
+  // the decoder drops the fractional bits, gain 1.0 keeps them zero
+  CHECK(c->charge[i] == e.q);
+  CHECK(c->qmax[i] == e.qmax);
+  CHECK(near(c->pad[i], pad));
+  CHECK(near(c->time[i], time));
+  CHECK(near(c->sigmaPad2[i], e.qp2 / e.q - pad * pad));
+  CHECK(near(c->sigmaTime2[i], e.qt2 / e.q - time * time));
+}
+
+/**
+ * run the emulator on the payload and decode its output. Header and
+ * trailer are passed through unchanged.
+ **/
+static int64_t emulate(fcfConfig_t cfg, const std::vector<uint32_t> &payload,
+                       fcf_cluster_buffer *buffer,
+                       fcfEmulatorStats_t *stats = NULL) {
+  fcf_emulator emu(&mapping, cfg);
+  std::vector<uint32_t> in = makeRawEvent(payload);
+  std::vector<uint32_t> out;
+  CHECK(emu.processEvent(in.data(), in.size(), &out) == 0);
+  CHECK(out.size() >= FCF_HEADER_DW + FCF_TRAILER_DW);
+  if (out.size() < FCF_HEADER_DW + FCF_TRAILER_DW) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < FCF_HEADER_DW; i++) {
+    CHECK(out[i] == in[i]);
+  }
+  for (uint32_t i = 1; i <= FCF_TRAILER_DW; i++) {
+    CHECK(out[out.size() - i] == in[in.size() - i]);
+  }
+  fcfTrailer_t trailer;
+  int64_t n = fcfDecodeClusters(out.data(), out.size(), buffer->clusters(),
+                                &trailer);
+  CHECK(n >= 0);
+  CHECK(trailer.trailerWords == FCF_TRAILER_DW);
+  CHECK(trailer.rcuId == 0x5a);
+  CHECK(trailer.formatVersion == 2);
+  CHECK(out.size() ==
+        FCF_HEADER_DW + (size_t)n * FCF_CLUSTER_DW + FCF_TRAILER_DW);
+  if (stats) {
+    *stats = emu.getStats();
+  }
+  return n;
+}
+
+static std::vector<uint16_t> samples(uint16_t a, uint16_t b, uint16_t c,
+                                     uint16_t d, uint16_t e) {
+  uint16_t s[] = { a, b, c, d, e };
+  return std::vector<uint16_t>(s, s + 5);
+}
+
+static void testSingleBunch() {
+  fcf_cluster_buffer buffer(16);
+  std::vector<uint32_t> payload;
+  std::vector<uint16_t> s = samples(2, 5, 9, 5, 2);
+  appendSingleBunchChannel(payload, HW_ROW1_PAD(2), 10, s);
+  fcfEmulatorStats_t stats;
+  CHECK(emulate(fcfDefaultConfig, payload, &buffer, &stats) == 1);
+  expected_t e = expected(1);
+  addPad(&e, 2, 10, s);
+  checkCluster(buffer.clusters(), 0, e);
+  CHECK(stats.events == 1);
+  CHECK(stats.channels == 1);
+  CHECK(stats.sequences == 1);
+  CHECK(stats.clusters == 1);
+  CHECK(stats.decodeErrors == 0);
+}
+
+static void testTwoPadCluster() {
+  fcf_cluster_buffer buffer(16);
+  std::vector<uint32_t> payload;
+  std::vector<uint16_t> s1 = samples(2, 5, 9, 5, 2);
+  std::vector<uint16_t> s2 = samples(1, 3, 6, 3, 1);
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(1), 10, s1);
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(2), 10, s2);
+  CHECK(emulate(fcfDefaultConfig, payload, &buffer) == 1);
+  expected_t e = expected(0);
+  addPad(&e, 1, 10, s1);
+  addPad(&e, 2, 10, s2);
+  checkCluster(buffer.clusters(), 0, e);
+
+  // the peaks are further apart than merger_distance: two clusters
+  payload.clear();
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(1), 10, s1);
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(2), 20, s2);
+  CHECK(emulate(fcfDefaultConfig, payload, &buffer) == 2);
+  expected_t e1 = expected(0), e2 = expected(0);
+  addPad(&e1, 1, 10, s1);
+  addPad(&e2, 2, 20, s2);
+  checkCluster(buffer.clusters(), 0, e1);
+  checkCluster(buffer.clusters(), 1, e2);
+
+  // single pad suppression drops both of them
+  fcfConfig_t cfg = fcfDefaultConfig;
+  cfg.single_pad_suppression = 1;
+  CHECK(emulate(cfg, payload, &buffer) == 0);
+}
+
+static void testSplitAtMinimum() {
+  fcf_cluster_buffer buffer(16);
+  std::vector<uint32_t> payload;
+  std::vector<uint16_t> s = samples(4, 20, 6, 15, 5);
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(0), 10, s);
+  fcfConfig_t cfg = fcfDefaultConfig;
+  cfg.tag_deconvoluted_clusters = 1;
+  CHECK(emulate(cfg, payload, &buffer) == 2);
+  // the minimum at time 12 stays with the earlier sequence
+  expected_t e1 = expected(0, FCF_FLAG_SPLIT_TIME);
+  expected_t e2 = expected(0, FCF_FLAG_SPLIT_TIME);
+  addPad(&e1, 0, 10, std::vector<uint16_t>(s.begin(), s.begin() + 3));
+  addPad(&e2, 0, 13, std::vector<uint16_t>(s.begin() + 3, s.end()));
+  checkCluster(buffer.clusters(), 0, e1);
+  checkCluster(buffer.clusters(), 1, e2);
+
+  // a minimum within the noise suppression does not split
+  cfg.noise_suppression_minimum = 14;
+  CHECK(emulate(cfg, payload, &buffer) == 1);
+  expected_t e = expected(0);
+  addPad(&e, 0, 10, s);
+  checkCluster(buffer.clusters(), 0, e);
+}
+
+static void testInactiveChannel() {
+  fcf_cluster_buffer buffer(16);
+  std::vector<uint32_t> payload;
+  std::vector<uint16_t> s = samples(2, 5, 9, 5, 2);
+  appendSingleBunchChannel(payload, HW_INACTIVE, 10, s);
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(3), 30, s);
+  fcfEmulatorStats_t stats;
+  CHECK(emulate(fcfDefaultConfig, payload, &buffer, &stats) == 1);
+  expected_t e = expected(0);
+  addPad(&e, 3, 30, s);
+  checkCluster(buffer.clusters(), 0, e);
+  CHECK(stats.channels == 1);
+  CHECK(stats.decodeErrors == 0);
+}
+
+static void testBadTrailer() {
+  std::vector<uint32_t> payload;
+  appendSingleBunchChannel(payload, HW_ROW0_PAD(0), 10,
+                           samples(2, 5, 9, 5, 2));
+  std::vector<uint32_t> in = makeRawEvent(payload);
+  in.back() &= 0x3fffffff;
+  fcf_emulator emu(&mapping, fcfDefaultConfig);
+  std::vector<uint32_t> out;
+  errno = 0;
+  CHECK(emu.processEvent(in.data(), in.size(), &out) == -1);
+  CHECK(errno == EBADMSG);
+}
+
+int main() {
+  char tmpl[] = "/tmp/test_fcf_emulator.XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string file = std::string(tmpl) + "/map.txt";
+  FILE *fp = fopen(file.c_str(), "w");
+  CHECK(fp != NULL);
+  if (fp) {
+    fputs("0 4 0x000 0x001 0x002 0x003\n"
+          "1 4 0x004 0x005 0x006 0x007\n",
+          fp);
+    fclose(fp);
+  }
+  CHECK(mapping.readMappingFile(file.c_str(), 2) == 0);
+  unlink(file.c_str());
+  rmdir(tmpl);
+
+  testSingleBunch();
+  testTwoPadCluster();
+  testSplitAtMinimum();
+  testInactiveChannel();
+  testBadTrailer();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
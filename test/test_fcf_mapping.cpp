@@ -0,0 +1,145 @@
+/**
+ *  test_fcf_mapping.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "fcf_mapping.hh"
+#include "test_common.hh"
+
+static std::string tmpDir;
+
+static std::string writeMapping(const char *name, const char *content) {
+  std::string path = tmpDir + "/" + name;
+  FILE *fp = fopen(path.c_str(), "w");
+  CHECK(fp != NULL);
+  if (fp) {
+    fputs(content, fp);
+    fclose(fp);
+  }
+  return path;
+}
+
+/**
+ * config word: gain [28:16], active [15], branch border [14], patch row
+ * [13:8], pad [7:0], edge pad [29]
+ **/
+static uint32_t word(uint32_t row, uint32_t pad, bool edge, bool border) {
+  return (1 << 28) | (1 << 15) | (border << 14) | (row << 8) | pad |
+         (edge << 29);
+}
+
+static void testParse() {
+  // branch A: 0x000, 0x001, branch B: 0x800, row 1 on 0x002, row 30 is
+  // the first row of patch 1. Blank lines, tabs and CRLF are accepted.
+  std::string file = writeMapping("map.txt", "0 3 0x000 0x001 0x800\n"
+                                             "\n"
+                                             "1\t1  2\r\n"
+                                             "  30 2 0x1000 4097\n");
+  fcf_mapping p0(0), p1(1);
+  CHECK(p0.readMappingFile(file.c_str(), 1) == 0);
+  CHECK(p0[0x000] == word(0, 0, true, true));
+  CHECK(p0[0x001] == word(0, 1, false, true));
+  CHECK(p0[0x800] == word(0, 2, true, true));
+  CHECK(p0[0x002] == word(1, 0, true, true));
+  CHECK(p0[0x003] == 0);
+  CHECK(p0[gkConfigWordCnt] == 0xffffffff);
+
+  // RCU2 has no branch border within the row
+  CHECK(p0.readMappingFile(file.c_str(), 2) == 0);
+  CHECK(p0[0x001] == word(0, 1, false, false));
+
+  // several patches in one pass give the same words
+  fcf_mapping *maps[] = { &p1, &p0 };
+  fcf_mapping single(1);
+  CHECK(single.readMappingFile(file.c_str(), 1) == 0);
+  CHECK(fcf_mapping::readMappingFiles(file.c_str(), 1, maps, 2) == 0);
+  for (unsigned i = 0; i < gkConfigWordCnt; i++) {
+    CHECK(p1[i] == single[i]);
+  }
+  CHECK(p1[0] == word(0, 0, true, true));
+  CHECK(p1[1] == word(0, 1, true, true));
+
+  fcf_mapping dup(1);
+  fcf_mapping *dups[] = { &p1, &dup };
+  errno = 0;
+  CHECK(fcf_mapping::readMappingFiles(file.c_str(), 1, dups, 2) == -1 &&
+        errno == EINVAL);
+
+  // an empty file leaves all words cleared
+  fcf_mapping empty(0);
+  CHECK(empty.readMappingFile(writeMapping("empty.txt", "").c_str()) == 0);
+  CHECK(empty[0] == 0);
+
+  unlink(file.c_str());
+  unlink((tmpDir + "/empty.txt").c_str());
+}
+
+/** the reported position points to the first bad token **/
+static void checkError(const char *content, unsigned long line,
+                       unsigned long column, const char *reason) {
+  std::string file = writeMapping("bad.txt", content);
+  fcf_mapping map(0);
+  errno = 0;
+  CHECK(map.readMappingFile(file.c_str()) == -1 && errno == EINVAL);
+  fcfMappingError_t error = map.parseError();
+  CHECK(error.line == line && error.column == column);
+  CHECK(error.reason && strcmp(error.reason, reason) == 0);
+  if (error.line != line || error.column != column) {
+    fprintf(stderr, "  \"%s\": got %lu:%lu\n", content, error.line,
+            error.column);
+  }
+  unlink(file.c_str());
+}
+
+static void testErrors() {
+  checkError("0 1 0\n  5a 1 0x0\n", 2, 3, "invalid row number");
+  checkError("0", 1, 2, "missing pad count");
+  checkError("0 x 0", 1, 3, "invalid pad count");
+  checkError("0 2 0x0", 1, 8, "fewer hardware addresses than pads");
+  checkError("0 1 0x0 0x1", 1, 9, "more hardware addresses than pads");
+  checkError("0 1 0xg", 1, 5, "invalid hardware address");
+  checkError("0 1 09", 1, 5, "invalid hardware address");
+  checkError("0 1 1\n0 1 2\n\n0 2 3 4 5\n", 4, 9,
+             "more hardware addresses than pads");
+
+  fcf_mapping map(0);
+  errno = 0;
+  CHECK(map.readMappingFile("/nonexistent/mapping.txt") == -1 &&
+        errno == EBADF);
+  CHECK(map.parseError().line == 0);
+}
+
+int main() {
+  char tmpl[] = "/tmp/test_fcf_mapping.XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  tmpDir = tmpl;
+  testParse();
+  testErrors();
+  rmdir(tmpl);
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+/**
+ *  test_inflight_controller.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <deque>
+#include "inflight_controller.hh"
+#include "test_common.hh"
+
+static uint64_t simNowUs = 0;
+static uint64_t simClock() { return simNowUs; }
+
+/**
+ * an in-order chain with a fixed delay behind a bottleneck stage, the
+ * input always has events available
+ **/
+struct simChain_t {
+  uint64_t delayUs;
+  uint64_t serviceUs;
+  uint64_t bottleneckFreeUs;
+  std::deque<uint64_t> doneUs;
+};
+
+struct simResult_t {
+  uint32_t maxDepth;
+  uint64_t depthSum;
+  uint64_t latencySum;
+  uint64_t windows;
+  uint64_t events;
+  uint64_t timeUs;
+};
+
+/**
+ * run nEvents completions through the chain. Statistics are taken after
+ * skipWindows adjustments, probe windows at depth 1 are left out.
+ **/
+static simResult_t simulate(inflight_controller *ctl, simChain_t *chain,
+                            uint64_t nEvents, uint64_t skipWindows) {
+  simResult_t r = {0, 0, 0, 0, 0, 0};
+  uint64_t adjusted = 0, startUs = simNowUs;
+  for (uint64_t i = 0; i < nEvents; i++) {
+    while (ctl->mayEnqueue(chain->doneUs.size())) {
+      ctl->enqueued();
+      uint64_t start = (chain->bottleneckFreeUs > simNowUs)
+                           ? chain->bottleneckFreeUs
+                           : simNowUs;
+      chain->bottleneckFreeUs = start + chain->serviceUs;
+      chain->doneUs.push_back(chain->bottleneckFreeUs + chain->delayUs);
+    }
+    simNowUs = chain->doneUs.front();
+    chain->doneUs.pop_front();
+    if (adjusted >= skipWindows) {
+      r.events++;
+    }
+    if (ctl->completed()) {
+      ctl->adjust(0);
+      if (++adjusted == skipWindows) {
+        startUs = simNowUs;
+      }
+      if (adjusted > skipWindows && ctl->depth() > 1) {
+        if (ctl->depth() > r.maxDepth) {
+          r.maxDepth = ctl->depth();
+        }
+        r.depthSum += ctl->depth();
+        r.latencySum += ctl->latencyUs();
+        r.windows++;
+      }
+    }
+  }
+  r.timeUs = simNowUs - startUs;
+  return r;
+}
+
+/**
+ * 200us delay and a 50us bottleneck: the bottleneck is saturated from
+ * depth 5 on, at 250us latency. The depth settles just above that knee
+ * instead of growing to the maximum.
+ **/
+static void testConvergesToKnee() {
+  simNowUs = 0;
+  simChain_t chain = {200, 50, 0, std::deque<uint64_t>()};
+  inflight_controller ctl(1, 64, 0, simClock);
+  simResult_t r = simulate(&ctl, &chain, 200000, 500);
+  CHECK(r.windows > 1000);
+  CHECK(r.maxDepth >= 5);
+  CHECK(r.maxDepth <= 9);
+  double meanDepth = (double)r.depthSum / r.windows;
+  CHECK(meanDepth >= 5.0 && meanDepth <= 8.0);
+  CHECK(r.latencySum / r.windows <= 450);
+  // at least 90% of the bottleneck rate, including the probes
+  CHECK(r.events * 50 >= r.timeUs * 9 / 10);
+}
+
+/** a slower chain raises the base latency and the depth follows **/
+static void testFollowsSlowerChain() {
+  simNowUs = 0;
+  simChain_t chain = {200, 50, 0, std::deque<uint64_t>()};
+  inflight_controller ctl(1, 64, 0, simClock);
+  simulate(&ctl, &chain, 100000, 0);
+  // knee at depth 15 now
+  chain.delayUs = 700;
+  simResult_t r = simulate(&ctl, &chain, 200000, 500);
+  CHECK(r.windows > 0);
+  CHECK(r.maxDepth >= 15);
+  CHECK(r.maxDepth <= 19);
+  CHECK(r.events * 50 >= r.timeUs * 9 / 10);
+}
+
+int main() {
+  testConvergesToKnee();
+  testFollowsSlowerChain();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+/**
+ *  test_log_histogram.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <thread>
+#include "log_histogram.hh"
+#include "test_common.hh"
+
+/** each value lies in its bucket, buckets are ordered and tight **/
+static void checkBucket(uint32_t value) {
+  uint32_t i = log_histogram::bucketIndex(value);
+  CHECK(i < LOG_HISTOGRAM_BUCKETS);
+  uint32_t upper = log_histogram::bucketUpperBound(i);
+  CHECK(upper >= value);
+  CHECK(i == 0 || log_histogram::bucketUpperBound(i - 1) < value);
+  // relative bucket width of at most 1/16
+  CHECK((uint64_t)(upper - value) << LOG_HISTOGRAM_SUB_BITS <= value ||
+        value < (1 << LOG_HISTOGRAM_SUB_BITS));
+}
+
+static void testBuckets() {
+  for (uint32_t v = 0; v < 100000; v++) {
+    checkBucket(v);
+  }
+  for (uint32_t bit = 16; bit < 32; bit++) {
+    uint32_t p = 1u << bit;
+    checkBucket(p - 1);
+    checkBucket(p);
+    checkBucket(p + 1);
+  }
+  checkBucket(0xffffffff);
+  CHECK(log_histogram::bucketIndex(0xffffffff) == LOG_HISTOGRAM_BUCKETS - 1);
+  CHECK(log_histogram::bucketUpperBound(LOG_HISTOGRAM_BUCKETS - 1) ==
+        0xffffffff);
+  uint32_t last = 0;
+  for (uint32_t i = 1; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    uint32_t upper = log_histogram::bucketUpperBound(i);
+    CHECK(upper > last);
+    CHECK(log_histogram::bucketIndex(upper) == i);
+    last = upper;
+  }
+}
+
+static void testStatistics() {
+  log_histogram h;
+  CHECK(h.count() == 0 && h.sum() == 0 && h.max() == 0);
+  CHECK(h.mean() == 0.0 && h.percentile(0.5) == 0);
+
+  for (uint32_t v = 1; v <= 1000; v++) {
+    h.add(v);
+  }
+  CHECK(h.count() == 1000 && h.sum() == 500500 && h.max() == 1000);
+  CHECK(h.mean() == 500.5);
+  // percentiles are bucket upper bounds, at most 1/16 above the exact value
+  uint32_t p50 = h.percentile(0.5);
+  CHECK(p50 >= 500 && p50 <= 500 + 500 / 16);
+  uint32_t p99 = h.percentile(0.99);
+  CHECK(p99 >= 990 && p99 <= 1000);
+  CHECK(h.percentile(0.0) == 1);
+  CHECK(h.percentile(1.0) == 1000);
+
+  // a single value is reported exactly
+  log_histogram one;
+  one.add(123456);
+  CHECK(one.percentile(0.5) == 123456 && one.percentile(1.0) == 123456);
+
+  log_histogram other;
+  other.add(5000);
+  other.add(0);
+  h.merge(other);
+  CHECK(h.count() == 1002 && h.sum() == 505500 && h.max() == 5000);
+  CHECK(h.percentile(1.0) == 5000);
+  CHECK(h.percentile(0.0) == 0);
+
+  h.clear();
+  CHECK(h.count() == 0 && h.sum() == 0 && h.max() == 0);
+}
+
+/** a concurrent reader never sees more values than were added **/
+static void testConcurrentReader() {
+  log_histogram h;
+  const uint32_t n = 200000;
+  std::atomic<bool> stop(false);
+  std::atomic<bool> ok(true);
+  std::thread reader([&] {
+    uint64_t last = 0;
+    while (!stop) {
+      uint64_t count = h.count();
+      if (count < last || count > n || h.percentile(0.5) > n) {
+        ok = false;
+      }
+      last = count;
+    }
+  });
+  for (uint32_t v = 0; v < n; v++) {
+    h.add(v);
+  }
+  stop = true;
+  reader.join();
+  CHECK(ok);
+  CHECK(h.count() == n);
+}
+
+int main() {
+  testBuckets();
+  testStatistics();
+  testConcurrentReader();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
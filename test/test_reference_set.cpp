@@ -0,0 +1,105 @@
+/**
+ *  test_reference_set.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "reference_set.hh"
+#include "digest.hh"
+#include "test_common.hh"
+
+static std::string writeFile(const std::string &dir, const char *name,
+                             const uint32_t *data, size_t nWords) {
+  std::string path = dir + "/" + name;
+  FILE *fp = fopen(path.c_str(), "w");
+  CHECK(fp != NULL);
+  if (fp) {
+    // fwrite() must not be passed a NULL buffer, even for zero words
+    CHECK(nWords == 0 || fwrite(data, sizeof(uint32_t), nWords, fp) == nWords);
+    fclose(fp);
+  }
+  return path;
+}
+
+static void testDirectory() {
+  char tmpl[] = "/tmp/test_reference_set.XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  CHECK(dir != NULL);
+  if (!dir) {
+    return;
+  }
+  uint32_t c[] = { 0xffffffff, 3, 4, 5 };
+  uint32_t b[] = { 0xffffffff, 1, 2 };
+  // written out of order, the set sorts by name
+  std::string pc = writeFile(dir, "c", c, 4);
+  std::string pb = writeFile(dir, "b", b, 3);
+  std::string pa = writeFile(dir, "a", NULL, 0);
+
+  reference_set refs;
+  CHECK(refs.empty());
+  CHECK(refs.addPath(dir) == 0);
+  CHECK(refs.size() == 3);
+  if (refs.size() == 3) {
+    // an empty file is kept as an empty reference
+    CHECK(refs.entry(0).map == NULL && refs.entry(0).size == 0);
+    CHECK(refs.entry(0).digest == digest64(NULL, 0));
+    CHECK(refs.entry(1).size == sizeof(b) &&
+          memcmp(refs.entry(1).map, b, sizeof(b)) == 0);
+    CHECK(refs.entry(2).size == sizeof(c) &&
+          memcmp(refs.entry(2).map, c, sizeof(c)) == 0);
+  }
+
+  std::pair<reference_set::indexIter_t, reference_set::indexIter_t> range =
+      refs.find(digest64(c, sizeof(c)));
+  CHECK(range.first != range.second && range.first->second == 2);
+  range = refs.find(digest64(c, sizeof(c) - 4));
+  CHECK(range.first == range.second);
+
+  // single files are appended
+  CHECK(refs.addPath(pb.c_str()) == 0);
+  CHECK(refs.size() == 4);
+  range = refs.find(digest64(b, sizeof(b)));
+  size_t matches = 0;
+  for (; range.first != range.second; ++range.first) {
+    matches++;
+  }
+  CHECK(matches == 2);
+
+  unlink(pa.c_str());
+  unlink(pb.c_str());
+  unlink(pc.c_str());
+  rmdir(dir);
+}
+
+static void testMissing() {
+  reference_set refs;
+  CHECK(refs.addPath("/nonexistent/reference") == -1);
+  CHECK(refs.addFile("/nonexistent/reference") == -1);
+  CHECK(refs.empty());
+}
+
+int main() {
+  testDirectory();
+  testMissing();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/**
+ *  test_ring_allocator.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+#include "ring_allocator.hh"
+#include "test_common.hh"
+
+static void testSplit() {
+  ring_allocator ring(100, RING_SPLIT);
+  ringSegment_t seg[2];
+  uint32_t n;
+  CHECK(ring.reserve(0, seg, &n) == EFBIG);
+  CHECK(ring.reserve(101, seg, &n) == EFBIG);
+
+  CHECK(ring.reserve(60, seg, &n) == 0 && n == 1 && seg[0].offset == 0 &&
+        seg[0].size == 60);
+  ring.commit();
+  CHECK(ring.reserve(30, seg, &n) == 0 && n == 1 && seg[0].offset == 60);
+  ring.commit();
+  CHECK(ring.used() == 90 && ring.allocations() == 2);
+  CHECK(ring.reserve(20, seg, &n) == EAGAIN);
+
+  CHECK(ring.release() == 0);
+  // crosses the end of the buffer
+  CHECK(ring.reserve(20, seg, &n) == 0 && n == 2 && seg[0].offset == 90 &&
+        seg[0].size == 10 && seg[1].offset == 0 && seg[1].size == 10);
+  ring.commit();
+  CHECK(ring.used() == 50 && ring.highWater() == 90);
+  CHECK(ring.paddingBytes() == 0);
+
+  CHECK(ring.release() == 60);
+  CHECK(ring.release() == 90);
+  CHECK(ring.release() == -1);
+  CHECK(ring.used() == 0);
+  // an empty ring starts over at offset 0
+  CHECK(ring.reserve(100, seg, &n) == 0 && n == 1 && seg[0].offset == 0);
+}
+
+static void testPad() {
+  ring_allocator ring(100, RING_PAD);
+  ringSegment_t seg[2];
+  uint32_t n;
+  CHECK(ring.reserve(70, seg, &n) == 0);
+  ring.commit();
+  CHECK(ring.reserve(20, seg, &n) == 0 && seg[0].offset == 70);
+  ring.commit();
+  CHECK(ring.release() == 0);
+
+  // 10 bytes up to the end plus 20 bytes would fit, but not contiguously
+  CHECK(ring.reserve(20, seg, &n) == 0 && n == 1 && seg[0].offset == 0 &&
+        seg[0].size == 20);
+  ring.commit();
+  CHECK(ring.used() == 50 && ring.paddingBytes() == 10);
+
+  // the padding is released together with its allocation
+  CHECK(ring.release() == 70);
+  CHECK(ring.used() == 30);
+  CHECK(ring.reserve(70, seg, &n) == 0 && seg[0].offset == 20);
+  ring.commit();
+  CHECK(ring.reserve(1, seg, &n) == EAGAIN);
+  ring.resetHighWater();
+  CHECK(ring.highWater() == 100);
+}
+
+/**
+ * random allocations and releases against a byte map of the buffer: no byte
+ * may ever belong to two allocations and all bytes are free at the end.
+ **/
+static void testRandom(ringMode_t mode) {
+  const uint64_t size = 257;
+  ring_allocator ring(size, mode);
+  std::vector<int> owner(size, -1);
+  std::deque<std::vector<ringSegment_t> > live;
+  std::deque<int> ids;
+  srand(1);
+  int nextId = 0;
+  uint64_t liveBytes = 0;
+  std::deque<uint64_t> liveSizes;
+  for (int iter = 0; iter < 100000; iter++) {
+    if (rand() % 2 && !live.empty()) {
+      std::vector<ringSegment_t> &segs = live.front();
+      CHECK(ring.release() == (int64_t)segs[0].offset);
+      for (size_t s = 0; s < segs.size(); s++) {
+        for (uint64_t b = 0; b < segs[s].size; b++) {
+          CHECK(owner[segs[s].offset + b] == ids.front());
+          owner[segs[s].offset + b] = -1;
+        }
+      }
+      liveBytes -= liveSizes.front();
+      live.pop_front();
+      ids.pop_front();
+      liveSizes.pop_front();
+      continue;
+    }
+    uint64_t request = 1 + rand() % 64;
+    ringSegment_t seg[2];
+    uint32_t n;
+    int ret = ring.reserve(request, seg, &n);
+    if (ret == EAGAIN) {
+      // only allowed if there really is no space left
+      CHECK(ring.used() + request > size || mode == RING_PAD);
+      continue;
+    }
+    CHECK(ret == 0);
+    if (ret != 0) {
+      return;
+    }
+    ring.commit();
+    std::vector<ringSegment_t> segs(seg, seg + n);
+    uint64_t total = 0;
+    for (uint32_t s = 0; s < n; s++) {
+      CHECK(seg[s].offset + seg[s].size <= size);
+      for (uint64_t b = 0; b < seg[s].size; b++) {
+        CHECK(owner[seg[s].offset + b] == -1);
+        owner[seg[s].offset + b] = nextId;
+      }
+      total += seg[s].size;
+    }
+    CHECK(total == request);
+    CHECK(mode == RING_SPLIT || n == 1);
+    live.push_back(segs);
+    ids.push_back(nextId++);
+    liveBytes += request;
+    liveSizes.push_back(request);
+    CHECK(ring.used() >= liveBytes);
+    CHECK(mode == RING_PAD || ring.used() == liveBytes);
+  }
+  while (ring.release() >= 0) {
+  }
+  CHECK(ring.used() == 0);
+}
+
+int main() {
+  testSplit();
+  testPad();
+  testRandom(RING_SPLIT);
+  testRandom(RING_PAD);
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
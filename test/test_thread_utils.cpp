@@ -0,0 +1,113 @@
+/**
+ *  test_thread_utils.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <atomic>
+#include "thread_utils.hh"
+#include "test_common.hh"
+
+static bool parses(const char *str, std::vector<uint32_t> &list) {
+  return parseIdList(str, list) == 0;
+}
+
+static bool rejects(const char *str) {
+  std::vector<uint32_t> list;
+  errno = 0;
+  return parseIdList(str, list) == -1 && errno == EINVAL && list.empty();
+}
+
+static void testParseIdList() {
+  std::vector<uint32_t> list;
+  CHECK(parses("3", list) && list.size() == 1 && list[0] == 3);
+  CHECK(parses("0-3", list) && list.size() == 4 && list[0] == 0 &&
+        list[3] == 3);
+  CHECK(parses("0,2,4-6", list) && list.size() == 5 && list[1] == 2 &&
+        list[2] == 4 && list[4] == 6);
+  CHECK(parses("0x10", list) && list.size() == 1 && list[0] == 16);
+  CHECK(parses("4294967295", list) && list.size() == 1 &&
+        list[0] == 4294967295u);
+  CHECK(parses("4294967294-4294967295", list) && list.size() == 2);
+
+  // malformed
+  CHECK(rejects(NULL));
+  CHECK(rejects(""));
+  CHECK(rejects("a"));
+  CHECK(rejects("1,"));
+  CHECK(rejects(",1"));
+  CHECK(rejects("1-"));
+  CHECK(rejects("-1"));
+  CHECK(rejects("1--2"));
+  CHECK(rejects("3-1"));
+  CHECK(rejects("1;2"));
+
+  // duplicates
+  CHECK(rejects("0,0"));
+  CHECK(rejects("0-3,2"));
+  CHECK(rejects("0-3,1-2"));
+
+  // values beyond 32 bit
+  CHECK(rejects("4294967296"));
+  CHECK(rejects("0-4294967296"));
+  CHECK(rejects("18446744073709551615"));
+  CHECK(rejects("18446744073709551614-18446744073709551615"));
+
+  // oversized ranges
+  CHECK(parses("0-4095", list) && list.size() == ID_LIST_MAX_ENTRIES);
+  CHECK(rejects("0-4096"));
+  CHECK(rejects("0-4294967295"));
+  CHECK(rejects("0-4094,5000,6000"));
+}
+
+static void testPinThreadToCpu() {
+  std::thread t([] {});
+  CHECK(pinThreadToCpu(t, CPU_SETSIZE) == EINVAL);
+  CHECK(pinThreadToCpu(t, 0xffffffff) == EINVAL);
+  t.join();
+}
+
+static void countIndex(uint32_t index, void *arg) {
+  std::atomic<uint32_t> *counts = (std::atomic<uint32_t> *)arg;
+  counts[index]++;
+}
+
+static void testParallelFor() {
+  std::atomic<uint32_t> counts[64];
+  for (uint32_t n = 0; n <= 64; n += 16) {
+    for (uint32_t threads = 0; threads <= 8; threads += 4) {
+      for (uint32_t i = 0; i < 64; i++) {
+        counts[i] = 0;
+      }
+      parallelFor(n, threads, countIndex, counts);
+      for (uint32_t i = 0; i < 64; i++) {
+        CHECK(counts[i] == (i < n ? 1u : 0u));
+      }
+    }
+  }
+}
+
+int main() {
+  testParseIdList();
+  testPinThreadToCpu();
+  testParallelFor();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/**
+ *  test_word_compare.cpp
+ *  Copyright (C) 2016 Heiko Engel <hengel@cern.ch>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <vector>
+#include "word_compare.hh"
+#include "test_common.hh"
+
+/** none of them is a multiple of 4 or 8 **/
+static const size_t lengths[] = { 1, 3, 5, 7, 13, 21, 37, 103 };
+static const size_t nLengths = sizeof(lengths) / sizeof(lengths[0]);
+
+/**
+ * words to corrupt for nWords: the first one, one inside the first vector,
+ * one in the scalar tail behind the last full AVX2 vector and the last one
+ **/
+static std::vector<size_t> mismatchPositions(size_t nWords) {
+  std::vector<size_t> pos;
+  pos.push_back(0);
+  if (nWords > 5) {
+    pos.push_back(5);
+  }
+  if (nWords > 8 && (nWords & ~7) < nWords - 1) {
+    pos.push_back(nWords & ~7);
+  }
+  if (nWords - 1 > pos.back()) {
+    pos.push_back(nWords - 1);
+  }
+  return pos;
+}
+
+static void checkLinear(uint32_t start, uint32_t step) {
+  for (size_t l = 0; l < nLengths; l++) {
+    size_t n = lengths[l];
+    std::vector<uint32_t> data(n);
+    for (size_t i = 0; i < n; i++) {
+      data[i] = start + i * step;
+    }
+    CHECK(findLinearMismatch(data.data(), n, start, step) == -1);
+    std::vector<size_t> pos = mismatchPositions(n);
+    for (size_t p = 0; p < pos.size(); p++) {
+      data[pos[p]] ^= 0x100;
+      CHECK(findLinearMismatch(data.data(), n, start, step) ==
+            (int64_t)pos[p]);
+      data[pos[p]] ^= 0x100;
+    }
+  }
+}
+
+static void checkPrbs() {
+  for (size_t l = 0; l < nLengths; l++) {
+    size_t n = lengths[l];
+    std::vector<uint32_t> data(n);
+    data[0] = 0x12345678;
+    for (size_t i = 1; i < n; i++) {
+      data[i] = prbsNext(data[i - 1]);
+    }
+    CHECK(findPrbsMismatch(data.data(), n) == -1);
+    std::vector<size_t> pos = mismatchPositions(n);
+    for (size_t p = 0; p < pos.size(); p++) {
+      data[pos[p]] ^= 0x100;
+      // the check synchronizes on word 0, a wrong word 0 shows up at 1
+      int64_t expected = pos[p] ? pos[p] : 1;
+      if (expected >= (int64_t)n) {
+        expected = -1;
+      }
+      CHECK(findPrbsMismatch(data.data(), n) == expected);
+      data[pos[p]] ^= 0x100;
+    }
+  }
+}
+
+static void checkCompare() {
+  for (size_t l = 0; l < nLengths; l++) {
+    size_t n = lengths[l];
+    std::vector<uint32_t> a(n), b(n);
+    for (size_t i = 0; i < n; i++) {
+      a[i] = b[i] = i * 0x9e3779b9;
+    }
+    wordMismatch_t result;
+    CHECK(compareWords(a.data(), b.data(), n, &result) == 0);
+    CHECK(result.first == -1 && result.last == -1 && result.count == 0);
+    std::vector<size_t> pos = mismatchPositions(n);
+    for (size_t p = 0; p < pos.size(); p++) {
+      // each position alone
+      b[pos[p]] ^= 1;
+      CHECK(compareWords(a.data(), b.data(), n, &result) == 1);
+      CHECK(result.first == (int64_t)pos[p]);
+      CHECK(result.last == (int64_t)pos[p]);
+      b[pos[p]] ^= 1;
+    }
+    // all positions together
+    for (size_t p = 0; p < pos.size(); p++) {
+      b[pos[p]] ^= 1;
+    }
+    CHECK(compareWords(a.data(), b.data(), n, &result) == pos.size());
+    CHECK(result.count == pos.size());
+    CHECK(result.first == (int64_t)pos.front());
+    CHECK(result.last == (int64_t)pos.back());
+  }
+}
+
+static void checkAll() {
+  checkLinear(0, 1);
+  checkLinear(0xfffffffe, 1);
+  checkLinear(100, 0xffffffff);
+  checkLinear(0, 0);
+  checkLinear(0xdeadbeef, 0);
+  checkPrbs();
+  checkCompare();
+}
+
+int main() {
+  // the scalar and SSE2 paths are the fallbacks on AVX2 machines
+  CHECK(wordCompareSelect(WC_IMPL_SCALAR) == 0);
+  checkAll();
+#if defined(__x86_64__)
+  CHECK(wordCompareSelect(WC_IMPL_SSE2) == 0);
+  checkAll();
+#endif
+  if (wordCompareSelect(WC_IMPL_AVX2) == 0) {
+    checkAll();
+  } else {
+    printf("AVX2 not available, skipped\n");
+  }
+  CHECK(wordCompareSelect(WC_IMPL_AUTO) == 0);
+  checkAll();
+  if (testFailures) {
+    fprintf(stderr, "%d checks failed\n", testFailures);
+  }
+  return testFailures ? 1 : 0;
+}